@@ -334,6 +334,9 @@ bool convert_codec(DataFormat lhs, amf_wstring &rhs) {
   case H265:
     rhs = AMFVideoDecoderHW_H265_HEVC;
     break;
+  case AV1:
+    rhs = AMFVideoDecoderHW_AV1;
+    break;
   default:
     LOG_ERROR("unsupported codec: " + std::to_string(lhs));
     return false;
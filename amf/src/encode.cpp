@@ -69,8 +69,9 @@ private:
   amf::AMF_SURFACE_FORMAT AMFSurfaceFormat_ = amf::AMF_SURFACE_BGRA;
   std::pair<int32_t, int32_t> resolution_;
   amf_wstring codec_;
-  // const
   AMF_COLOR_BIT_DEPTH_ENUM eDepth_ = AMF_COLOR_BIT_DEPTH_8;
+  DynamicRange range_ = DYNAMIC_RANGE_SDR;
+  // const
   int query_timeout_ = 500;
   int32_t bitRateIn_;
   int32_t frameRate_;
@@ -78,6 +79,8 @@ private:
   bool enable4K_ = false;
   bool full_range_ = false;
   bool bt709_ = false;
+  bool force_idr_ = false;
+  ComPtr<ID3D11Texture2D> padded_ = nullptr;
 
   // Buffers
   std::vector<uint8_t> packetDataBuffer_;
@@ -85,7 +88,8 @@ private:
 public:
   AMFEncoder(void *handle, amf::AMF_MEMORY_TYPE memoryType, amf_wstring codec,
              DataFormat dataFormat, int32_t width, int32_t height,
-             int32_t bitrate, int32_t framerate, int32_t gop) {
+             int32_t bitrate, int32_t framerate, int32_t gop,
+             DynamicRange range) {
     handle_ = handle;
     dataFormat_ = dataFormat;
     AMFMemoryType_ = memoryType;
@@ -95,6 +99,11 @@ public:
     frameRate_ = framerate;
     gop_ = gop;
     enable4K_ = width > 1920 && height > 1080;
+    range_ = range;
+    if (range != DYNAMIC_RANGE_SDR) {
+      eDepth_ = AMF_COLOR_BIT_DEPTH_10;
+      AMFSurfaceFormat_ = amf::AMF_SURFACE_R10G10B10A2;
+    }
   }
 
   AMF_RESULT encode(void *tex, EncodeCallback callback, void *obj) {
@@ -105,6 +114,13 @@ public:
 
     switch (AMFMemoryType_) {
     case amf::AMF_MEMORY_DX11:
+      // odd sized frames are coded one column or row larger
+      tex = PadTexture((ID3D11Texture2D *)tex, resolution_.first,
+                       resolution_.second, padded_);
+      if (!tex) {
+        LOG_ERROR("PadTexture failed");
+        return AMF_FAIL;
+      }
       // https://github.com/GPUOpen-LibrariesAndSDKs/AMF/issues/280
       // AMF will not copy the surface during the CreateSurfaceFromDX11Native
       // call
@@ -121,6 +137,11 @@ public:
       return AMF_NOT_IMPLEMENTED;
       break;
     }
+    if (force_idr_) {
+      res = ForceKeyframe(surface);
+      AMF_CHECK_RETURN(res, "ForceKeyframe failed");
+      force_idr_ = false;
+    }
     res = AMFEncoder_->SubmitInput(surface);
     AMF_CHECK_RETURN(res, "SubmitInput failed");
 
@@ -184,6 +205,8 @@ public:
     return encode(native, nullptr, nullptr);
   }
 
+  void request_keyframe() { force_idr_ = true; }
+
   AMF_RESULT initialize() {
     AMF_RESULT res;
 
@@ -226,6 +249,63 @@ public:
   }
 
 private:
+  // the surface is coded as an IDR carrying the parameter sets
+  AMF_RESULT ForceKeyframe(amf::AMFSurfacePtr &surface) {
+    AMF_RESULT res = AMF_NOT_SUPPORTED;
+    switch (dataFormat_) {
+    case H264:
+      surface->SetProperty(AMF_VIDEO_ENCODER_INSERT_SPS, true);
+      surface->SetProperty(AMF_VIDEO_ENCODER_INSERT_PPS, true);
+      res = surface->SetProperty(AMF_VIDEO_ENCODER_FORCE_PICTURE_TYPE,
+                                 AMF_VIDEO_ENCODER_PICTURE_TYPE_IDR);
+      break;
+    case H265:
+      surface->SetProperty(AMF_VIDEO_ENCODER_HEVC_INSERT_HEADER, true);
+      res = surface->SetProperty(AMF_VIDEO_ENCODER_HEVC_FORCE_PICTURE_TYPE,
+                                 AMF_VIDEO_ENCODER_HEVC_PICTURE_TYPE_IDR);
+      break;
+    case AV1:
+      surface->SetProperty(AMF_VIDEO_ENCODER_AV1_FORCE_INSERT_SEQUENCE_HEADER,
+                           true);
+      res = surface->SetProperty(AMF_VIDEO_ENCODER_AV1_FORCE_FRAME_TYPE,
+                                 AMF_VIDEO_ENCODER_AV1_FORCE_FRAME_TYPE_KEY);
+      break;
+    }
+    return res;
+  }
+
+  bool hdr() const {
+    return range_ == DYNAMIC_RANGE_HDR_PQ || range_ == DYNAMIC_RANGE_HDR_HLG;
+  }
+
+  amf_int64 ColorProfile() const {
+    if (hdr())
+      return full_range_ ? AMF_VIDEO_CONVERTER_COLOR_PROFILE_FULL_2020
+                         : AMF_VIDEO_CONVERTER_COLOR_PROFILE_2020;
+    return bt709_ ? (full_range_ ? AMF_VIDEO_CONVERTER_COLOR_PROFILE_FULL_709
+                                 : AMF_VIDEO_CONVERTER_COLOR_PROFILE_709)
+                  : (full_range_ ? AMF_VIDEO_CONVERTER_COLOR_PROFILE_FULL_601
+                                 : AMF_VIDEO_CONVERTER_COLOR_PROFILE_601);
+  }
+
+  amf_int64 TransferCharacteristic() const {
+    switch (range_) {
+    case DYNAMIC_RANGE_HDR_PQ:
+      return AMF_COLOR_TRANSFER_CHARACTERISTIC_SMPTE2084;
+    case DYNAMIC_RANGE_HDR_HLG:
+      return AMF_COLOR_TRANSFER_CHARACTERISTIC_ARIB_STD_B67;
+    default:
+      return bt709_ ? AMF_COLOR_TRANSFER_CHARACTERISTIC_BT709
+                    : AMF_COLOR_TRANSFER_CHARACTERISTIC_SMPTE170M;
+    }
+  }
+
+  amf_int64 ColorPrimaries() const {
+    if (hdr())
+      return AMF_COLOR_PRIMARIES_BT2020;
+    return bt709_ ? AMF_COLOR_PRIMARIES_BT709 : AMF_COLOR_PRIMARIES_SMPTE170M;
+  }
+
   AMF_RESULT SetParams(const amf_wstring &codecStr) {
     AMF_RESULT res;
     if (codecStr == amf_wstring(AMFVideoEncoderVCE_AVC)) {
@@ -273,23 +353,17 @@ private:
                                      full_range_);
       AMF_CHECK_RETURN(res, "SetProperty AMF_VIDEO_ENCODER_FULL_RANGE_COLOR");
       res = AMFEncoder_->SetProperty<amf_int64>(
-          AMF_VIDEO_ENCODER_OUTPUT_COLOR_PROFILE,
-          bt709_ ? (full_range_ ? AMF_VIDEO_CONVERTER_COLOR_PROFILE_FULL_709
-                                : AMF_VIDEO_CONVERTER_COLOR_PROFILE_709)
-                 : (full_range_ ? AMF_VIDEO_CONVERTER_COLOR_PROFILE_FULL_601
-                                : AMF_VIDEO_CONVERTER_COLOR_PROFILE_601));
+          AMF_VIDEO_ENCODER_OUTPUT_COLOR_PROFILE, ColorProfile());
       AMF_CHECK_RETURN(res,
                        "SetProperty AMF_VIDEO_ENCODER_OUTPUT_COLOR_PROFILE");
       // https://github.com/obsproject/obs-studio/blob/e27b013d4754e0e81119ab237ffedce8fcebcbbf/plugins/obs-ffmpeg/texture-amf.cpp#L924
       res = AMFEncoder_->SetProperty<amf_int64>(
           AMF_VIDEO_ENCODER_OUTPUT_TRANSFER_CHARACTERISTIC,
-          bt709_ ? AMF_COLOR_TRANSFER_CHARACTERISTIC_BT709
-                 : AMF_COLOR_TRANSFER_CHARACTERISTIC_SMPTE170M);
+          TransferCharacteristic());
       AMF_CHECK_RETURN(
           res, "SetProperty AMF_VIDEO_ENCODER_OUTPUT_TRANSFER_CHARACTERISTIC");
       res = AMFEncoder_->SetProperty<amf_int64>(
-          AMF_VIDEO_ENCODER_OUTPUT_COLOR_PRIMARIES,
-          bt709_ ? AMF_COLOR_PRIMARIES_BT709 : AMF_COLOR_PRIMARIES_SMPTE170M);
+          AMF_VIDEO_ENCODER_OUTPUT_COLOR_PRIMARIES, ColorPrimaries());
       AMF_CHECK_RETURN(res,
                        "SetProperty AMF_VIDEO_ENCODER_OUTPUT_COLOR_PRIMARIES");
 
@@ -342,6 +416,12 @@ private:
                                      eDepth_);
       AMF_CHECK_RETURN(
           res, "SetProperty AMF_VIDEO_ENCODER_HEVC_COLOR_BIT_DEPTH failed");
+      if (eDepth_ == AMF_COLOR_BIT_DEPTH_10) {
+        res = AMFEncoder_->SetProperty(AMF_VIDEO_ENCODER_HEVC_PROFILE,
+                                       AMF_VIDEO_ENCODER_HEVC_PROFILE_MAIN_10);
+        AMF_CHECK_RETURN(res,
+                         "SetProperty AMF_VIDEO_ENCODER_HEVC_PROFILE failed");
+      }
 
       res = AMFEncoder_->SetProperty(
           AMF_VIDEO_ENCODER_HEVC_RATE_CONTROL_METHOD,
@@ -367,24 +447,18 @@ private:
       AMF_CHECK_RETURN(
           res, "SetProperty AMF_VIDEO_ENCODER_HEVC_NOMINAL_RANGE failed");
       res = AMFEncoder_->SetProperty<amf_int64>(
-          AMF_VIDEO_ENCODER_HEVC_OUTPUT_COLOR_PROFILE,
-          bt709_ ? (full_range_ ? AMF_VIDEO_CONVERTER_COLOR_PROFILE_FULL_709
-                                : AMF_VIDEO_CONVERTER_COLOR_PROFILE_709)
-                 : (full_range_ ? AMF_VIDEO_CONVERTER_COLOR_PROFILE_FULL_601
-                                : AMF_VIDEO_CONVERTER_COLOR_PROFILE_601));
+          AMF_VIDEO_ENCODER_HEVC_OUTPUT_COLOR_PROFILE, ColorProfile());
       AMF_CHECK_RETURN(
           res,
           "SetProperty AMF_VIDEO_ENCODER_HEVC_OUTPUT_COLOR_PROFILE failed");
       res = AMFEncoder_->SetProperty<amf_int64>(
           AMF_VIDEO_ENCODER_HEVC_OUTPUT_TRANSFER_CHARACTERISTIC,
-          bt709_ ? AMF_COLOR_TRANSFER_CHARACTERISTIC_BT709
-                 : AMF_COLOR_TRANSFER_CHARACTERISTIC_SMPTE170M);
+          TransferCharacteristic());
       AMF_CHECK_RETURN(
           res, "SetProperty "
                "AMF_VIDEO_ENCODER_HEVC_OUTPUT_TRANSFER_CHARACTERISTIC failed");
       res = AMFEncoder_->SetProperty<amf_int64>(
-          AMF_VIDEO_ENCODER_HEVC_OUTPUT_COLOR_PRIMARIES,
-          bt709_ ? AMF_COLOR_PRIMARIES_BT709 : AMF_COLOR_PRIMARIES_SMPTE170M);
+          AMF_VIDEO_ENCODER_HEVC_OUTPUT_COLOR_PRIMARIES, ColorPrimaries());
       AMF_CHECK_RETURN(
           res,
           "SetProperty AMF_VIDEO_ENCODER_HEVC_OUTPUT_COLOR_PRIMARIES failed");
@@ -410,6 +484,92 @@ private:
                                      gop_); // todo
       AMF_CHECK_RETURN(res,
                        "SetProperty AMF_VIDEO_ENCODER_HEVC_GOP_SIZE failed");
+    } else if (codecStr == amf_wstring(AMFVideoEncoder_AV1)) {
+      // ------------- Encoder params usage---------------
+      res = AMFEncoder_->SetProperty(AMF_VIDEO_ENCODER_AV1_USAGE,
+                                     AMF_VIDEO_ENCODER_AV1_USAGE_LOW_LATENCY);
+      AMF_CHECK_RETURN(res, "SetProperty AMF_VIDEO_ENCODER_AV1_USAGE failed");
+
+      // ------------- Encoder params static---------------
+      res = AMFEncoder_->SetProperty(
+          AMF_VIDEO_ENCODER_AV1_FRAMESIZE,
+          ::AMFConstructSize(resolution_.first, resolution_.second));
+      AMF_CHECK_RETURN(res,
+                       "SetProperty AMF_VIDEO_ENCODER_AV1_FRAMESIZE failed");
+
+      // without this 1080p is coded as 1088 and cropped by the decoder
+      res = AMFEncoder_->SetProperty(
+          AMF_VIDEO_ENCODER_AV1_ALIGNMENT_MODE,
+          AMF_VIDEO_ENCODER_AV1_ALIGNMENT_MODE_NO_RESTRICTIONS);
+      AMF_CHECK_RETURN(
+          res, "SetProperty AMF_VIDEO_ENCODER_AV1_ALIGNMENT_MODE failed");
+
+      res = AMFEncoder_->SetProperty(
+          AMF_VIDEO_ENCODER_AV1_ENCODING_LATENCY_MODE,
+          AMF_VIDEO_ENCODER_AV1_ENCODING_LATENCY_MODE_LOWEST_LATENCY);
+      AMF_CHECK_RETURN(
+          res, "SetProperty AMF_VIDEO_ENCODER_AV1_ENCODING_LATENCY_MODE failed");
+
+      res = AMFEncoder_->SetProperty(
+          AMF_VIDEO_ENCODER_AV1_QUALITY_PRESET,
+          AMF_VIDEO_ENCODER_AV1_QUALITY_PRESET_QUALITY);
+      AMF_CHECK_RETURN(res,
+                       "SetProperty AMF_VIDEO_ENCODER_AV1_QUALITY_PRESET failed");
+
+      res = AMFEncoder_->SetProperty(AMF_VIDEO_ENCODER_AV1_COLOR_BIT_DEPTH,
+                                     eDepth_);
+      AMF_CHECK_RETURN(
+          res, "SetProperty AMF_VIDEO_ENCODER_AV1_COLOR_BIT_DEPTH failed");
+
+      res = AMFEncoder_->SetProperty(
+          AMF_VIDEO_ENCODER_AV1_RATE_CONTROL_METHOD,
+          AMF_VIDEO_ENCODER_AV1_RATE_CONTROL_METHOD_CBR);
+      AMF_CHECK_RETURN(
+          res, "SetProperty AMF_VIDEO_ENCODER_AV1_RATE_CONTROL_METHOD failed");
+
+      // the sequence header must precede every key frame for late joiners
+      res = AMFEncoder_->SetProperty(
+          AMF_VIDEO_ENCODER_AV1_HEADER_INSERTION_MODE,
+          AMF_VIDEO_ENCODER_AV1_HEADER_INSERTION_MODE_KEY_FRAME_ALIGNED);
+      AMF_CHECK_RETURN(
+          res, "SetProperty AMF_VIDEO_ENCODER_AV1_HEADER_INSERTION_MODE failed");
+
+      // color
+      res = AMFEncoder_->SetProperty<amf_int64>(
+          AMF_VIDEO_ENCODER_AV1_OUTPUT_COLOR_PROFILE, ColorProfile());
+      AMF_CHECK_RETURN(
+          res, "SetProperty AMF_VIDEO_ENCODER_AV1_OUTPUT_COLOR_PROFILE failed");
+      res = AMFEncoder_->SetProperty<amf_int64>(
+          AMF_VIDEO_ENCODER_AV1_OUTPUT_TRANSFER_CHARACTERISTIC,
+          TransferCharacteristic());
+      AMF_CHECK_RETURN(
+          res, "SetProperty "
+               "AMF_VIDEO_ENCODER_AV1_OUTPUT_TRANSFER_CHARACTERISTIC failed");
+      res = AMFEncoder_->SetProperty<amf_int64>(
+          AMF_VIDEO_ENCODER_AV1_OUTPUT_COLOR_PRIMARIES, ColorPrimaries());
+      AMF_CHECK_RETURN(
+          res,
+          "SetProperty AMF_VIDEO_ENCODER_AV1_OUTPUT_COLOR_PRIMARIES failed");
+
+      // ------------- Encoder params dynamic ---------------
+      res = AMFEncoder_->SetProperty(AMF_VIDEO_ENCODER_AV1_QUERY_TIMEOUT,
+                                     query_timeout_); // ms
+      AMF_CHECK_RETURN(res,
+                       "SetProperty AMF_VIDEO_ENCODER_AV1_QUERY_TIMEOUT failed");
+
+      res = AMFEncoder_->SetProperty(AMF_VIDEO_ENCODER_AV1_TARGET_BITRATE,
+                                     bitRateIn_);
+      AMF_CHECK_RETURN(
+          res, "SetProperty AMF_VIDEO_ENCODER_AV1_TARGET_BITRATE failed");
+
+      res = AMFEncoder_->SetProperty(AMF_VIDEO_ENCODER_AV1_FRAMERATE,
+                                     ::AMFConstructRate(frameRate_, 1));
+      AMF_CHECK_RETURN(res,
+                       "SetProperty AMF_VIDEO_ENCODER_AV1_FRAMERATE failed");
+
+      res = AMFEncoder_->SetProperty(AMF_VIDEO_ENCODER_AV1_GOP_SIZE, gop_);
+      AMF_CHECK_RETURN(res,
+                       "SetProperty AMF_VIDEO_ENCODER_AV1_GOP_SIZE failed");
     } else {
       return AMF_FAIL;
     }
@@ -428,6 +588,12 @@ private:
       packet->keyframe =
           AMF_VIDEO_ENCODER_HEVC_OUTPUT_DATA_TYPE_IDR == pktType ||
           AMF_VIDEO_ENCODER_HEVC_OUTPUT_DATA_TYPE_I == pktType;
+    } else if (AMFVideoEncoder_AV1 == codec_) {
+      uint64_t frameType;
+      pData->GetProperty(AMF_VIDEO_ENCODER_AV1_OUTPUT_FRAME_TYPE, &frameType);
+      packet->keyframe =
+          AMF_VIDEO_ENCODER_AV1_OUTPUT_FRAME_TYPE_KEY == frameType ||
+          AMF_VIDEO_ENCODER_AV1_OUTPUT_FRAME_TYPE_INTRA_ONLY == frameType;
     }
   }
 };
@@ -440,6 +606,9 @@ bool convert_codec(DataFormat lhs, amf_wstring &rhs) {
   case H265:
     rhs = AMFVideoEncoder_HEVC;
     break;
+  case AV1:
+    rhs = AMFVideoEncoder_AV1;
+    break;
   default:
     LOG_ERROR("unsupported codec: " + std::to_string((int)lhs));
     return false;
@@ -468,9 +637,18 @@ int amf_destroy_encoder(void *encoder) {
 
 void *amf_new_encoder(void *handle, int64_t luid, API api,
                       DataFormat dataFormat, int32_t width, int32_t height,
-                      int32_t kbs, int32_t framerate, int32_t gop) {
+                      int32_t kbs, int32_t framerate, int32_t gop,
+                      ChromaFormat chroma, DynamicRange range) {
   AMFEncoder *enc = NULL;
   try {
+    if (chroma != CHROMA_420) {
+      LOG_TRACE("AMF encoders only take 4:2:0");
+      return NULL;
+    }
+    if (range != DYNAMIC_RANGE_SDR && dataFormat == H264) {
+      LOG_TRACE("AMF H264 encoder is 8-bit only");
+      return NULL;
+    }
     amf_wstring codecStr;
     if (!convert_codec(dataFormat, codecStr)) {
       return NULL;
@@ -480,7 +658,7 @@ void *amf_new_encoder(void *handle, int64_t luid, API api,
       return NULL;
     }
     enc = new AMFEncoder(handle, memoryType, codecStr, dataFormat, width,
-                         height, kbs * 1000, framerate, gop);
+                         height, kbs * 1000, framerate, gop, range);
     if (enc) {
       if (AMF_OK == enc->initialize()) {
         return enc;
@@ -522,7 +700,7 @@ int amf_driver_support() {
 int amf_test_encode(void *outDescs, int32_t maxDescNum, int32_t *outDescNum,
                     API api, DataFormat dataFormat, int32_t width,
                     int32_t height, int32_t kbs, int32_t framerate,
-                    int32_t gop) {
+                    int32_t gop, ChromaFormat chroma, DynamicRange range) {
   try {
     AdapterDesc *descs = (AdapterDesc *)outDescs;
     Adapters adapters;
@@ -532,7 +710,7 @@ int amf_test_encode(void *outDescs, int32_t maxDescNum, int32_t *outDescNum,
     for (auto &adapter : adapters.adapters_) {
       AMFEncoder *e = (AMFEncoder *)amf_new_encoder(
           (void *)adapter.get()->device_.Get(), LUID(adapter.get()->desc1_),
-          api, dataFormat, width, height, kbs, framerate, gop);
+          api, dataFormat, width, height, kbs, framerate, gop, chroma, range);
       if (!e)
         continue;
       if (e->test() == AMF_OK) {
@@ -567,6 +745,10 @@ int amf_set_bitrate(void *encoder, int32_t kbs) {
       res = enc->AMFEncoder_->SetProperty(AMF_VIDEO_ENCODER_HEVC_TARGET_BITRATE,
                                           kbs * 1000);
       break;
+    case AV1:
+      res = enc->AMFEncoder_->SetProperty(AMF_VIDEO_ENCODER_AV1_TARGET_BITRATE,
+                                          kbs * 1000);
+      break;
     }
     return res == AMF_OK ? 0 : -1;
   } catch (const std::exception &e) {
@@ -589,6 +771,10 @@ int amf_set_framerate(void *encoder, int32_t framerate) {
       res =
           enc->AMFEncoder_->SetProperty(AMF_VIDEO_ENCODER_HEVC_FRAMERATE, rate);
       break;
+    case AV1:
+      res =
+          enc->AMFEncoder_->SetProperty(AMF_VIDEO_ENCODER_AV1_FRAMERATE, rate);
+      break;
     }
     return res == AMF_OK ? 0 : -1;
   } catch (const std::exception &e) {
@@ -598,4 +784,10 @@ int amf_set_framerate(void *encoder, int32_t framerate) {
   return -1;
 }
 
+int amf_request_keyframe(void *encoder) {
+  AMFEncoder *enc = (AMFEncoder *)encoder;
+  enc->request_keyframe();
+  return 0;
+}
+
 } // extern "C"
\ No newline at end of file
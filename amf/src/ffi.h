@@ -8,7 +8,8 @@ int amf_driver_support();
 
 void *amf_new_encoder(void *handle, int64_t luid, int32_t api,
                       int32_t data_format, int32_t width, int32_t height,
-                      int32_t bitrate, int32_t framerate, int32_t gop);
+                      int32_t bitrate, int32_t framerate, int32_t gop,
+                      int32_t chroma, int32_t range);
 
 int amf_encode(void *encoder, void *texture, EncodeCallback callback,
                void *obj);
@@ -26,7 +27,7 @@ int amf_destroy_decoder(void *decoder);
 int amf_test_encode(void *outDescs, int32_t maxDescNum, int32_t *outDescNum,
                     int32_t api, int32_t dataFormat, int32_t width,
                     int32_t height, int32_t kbs, int32_t framerate,
-                    int32_t gop);
+                    int32_t gop, int32_t chroma, int32_t range);
 
 int amf_test_decode(void *outDescs, int32_t maxDescNum, int32_t *outDescNum,
                     int32_t api, int32_t dataFormat, bool outputSharedHandle,
@@ -36,4 +37,6 @@ int amf_set_bitrate(void *encoder, int32_t kbs);
 
 int amf_set_framerate(void *encoder, int32_t framerate);
 
+int amf_request_keyframe(void *encoder);
+
 #endif // AMF_FFI_H
\ No newline at end of file
@@ -18,6 +18,7 @@ pub fn encode_calls() -> EncodeCalls {
         test: amf_test_encode,
         set_bitrate: amf_set_bitrate,
         set_framerate: amf_set_framerate,
+        request_keyframe: amf_request_keyframe,
     }
 }
 
@@ -40,7 +41,7 @@ pub fn possible_support_encoders() -> Vec<InnerEncodeContext> {
     devices.append(&mut vec![API_DX11]);
     #[cfg(target_os = "linux")]
     devices.append(&mut vec![API_OPENCL, API_VULKAN]);
-    let codecs = vec![H264, H265];
+    let codecs = vec![H264, H265, AV1];
 
     let mut v = vec![];
     for device in devices.iter() {
@@ -64,7 +65,7 @@ pub fn possible_support_decoders() -> Vec<InnerDecodeContext> {
     #[cfg(target_os = "linux")]
     devices.append(&mut vec![OPENCL, VULKAN]);
     // https://github.com/GPUOpen-LibrariesAndSDKs/AMF/issues/432#issuecomment-1873141122
-    let codecs = vec![H264];
+    let codecs = vec![H264, AV1];
 
     let mut v = vec![];
     for device in devices.iter() {
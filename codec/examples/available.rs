@@ -13,6 +13,8 @@ fn main() {
         framerate: 30,
         gop: MAX_GOP as _,
         device: None,
+        chroma: Default::default(),
+        range: Default::default(),
     });
     encoders.iter().map(|e| println!("{:?}", e)).count();
     println!("decoders:");
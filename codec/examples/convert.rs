@@ -0,0 +1,384 @@
+use gpucodec::convert::{ColorSpace, RgbFormat, RgbToYuv, Simd, YuvPlanes, YuvSource, YuvToRgb};
+use gpucodec::denoise::{DenoiseParams, TemporalDenoiser};
+use gpucodec::hash::TileHashes;
+use gpucodec::idle::{FrameAction, IdleDetector, IdlePolicy};
+use gpucodec::quality::{Frame, QualityMeter};
+use gpucodec::scale::{ScaleFilter, Scaler};
+use gpucodec::synth::{Scenario, ScreenContent};
+use gpucodec::{dirty::FrameDiffer, incremental::IncrementalNv12};
+use std::time::{Duration, Instant};
+
+fn main() {
+    let simds = [Simd::None, Simd::Sse41, Simd::Avx2, Simd::Neon];
+    for (width, height) in [(1920, 1080), (2560, 1440), (3840, 2160), (7680, 4320)] {
+        let src = ScreenContent::new(Scenario::Video, width, height, 30)
+            .frame(0)
+            .to_vec();
+        let mut y = vec![0u8; width * height];
+        let mut uv = vec![0u8; width * height / 2];
+        for simd in simds {
+            for threads in [1, 0] {
+                let c = RgbToYuv::new(RgbFormat::Bgra, ColorSpace::default())
+                    .with_simd(simd)
+                    .with_threads(threads);
+                if c.simd() != simd {
+                    continue;
+                }
+                let n = 10;
+                let start = Instant::now();
+                for _ in 0..n {
+                    let dst = YuvPlanes::Nv12 {
+                        y: &mut y,
+                        y_stride: width,
+                        uv: &mut uv,
+                        uv_stride: width,
+                    };
+                    c.convert(&src, width * 4, width, height, dst).unwrap();
+                }
+                println!(
+                    "BGRA->NV12 {}x{} {:?} threads {}: {:?}",
+                    width,
+                    height,
+                    simd,
+                    threads,
+                    start.elapsed() / n
+                );
+                let c = YuvToRgb::new(RgbFormat::Bgra, ColorSpace::default())
+                    .with_simd(simd)
+                    .with_threads(threads);
+                let mut dst = vec![0u8; width * height * 4];
+                let start = Instant::now();
+                for _ in 0..n {
+                    let src = YuvSource::Nv12 {
+                        y: &y,
+                        y_stride: width,
+                        uv: &uv,
+                        uv_stride: width,
+                    };
+                    c.convert(src, width, height, &mut dst, width * 4).unwrap();
+                }
+                println!(
+                    "NV12->BGRA {}x{} {:?} threads {}: {:?}",
+                    width,
+                    height,
+                    simd,
+                    threads,
+                    start.elapsed() / n
+                );
+            }
+        }
+    }
+    incremental();
+    incremental_ratios();
+    scale();
+    quality();
+    idle();
+    denoise();
+}
+
+/// Frame differencing and incremental conversion of 4K sequences of each
+/// screen content scenario.
+fn incremental() {
+    let (width, height) = (3840, 2160);
+    for scenario in Scenario::ALL {
+        let frames = ScreenContent::new(scenario, width, height, 30).frames(0, 31);
+        let mut differ = FrameDiffer::new(1);
+        differ.diff(&frames[0], width, height, width * 4).unwrap();
+        let converter = RgbToYuv::new(RgbFormat::Bgra, ColorSpace::default());
+        let mut nv12 = IncrementalNv12::new(converter, 2);
+        nv12.update(&frames[0], width * 4, width, height, None)
+            .unwrap();
+        let (mut diff_time, mut update_time) = (Duration::ZERO, Duration::ZERO);
+        let (mut dirty, mut tiles) = (0, 0);
+        for frame in &frames[1..] {
+            let start = Instant::now();
+            let map = differ.diff(frame, width, height, width * 4).unwrap();
+            diff_time += start.elapsed();
+            dirty += map.dirty_count();
+            tiles += map.columns * map.rows;
+            let start = Instant::now();
+            nv12.update(frame, width * 4, width, height, Some(map))
+                .unwrap();
+            update_time += start.elapsed();
+        }
+        let n = frames.len() as u32 - 1;
+        println!(
+            "incremental BGRA->NV12 {}x{} {:?} {}% dirty: diff {:?}, convert {:?}",
+            width,
+            height,
+            scenario,
+            dirty * 100 / tiles,
+            diff_time / n,
+            update_time / n
+        );
+    }
+}
+
+/// Incremental conversion of a 4K frame where 1%, 10% and all of the tiles
+/// change, fixed shares next to those of the scenarios.
+fn incremental_ratios() {
+    let (width, height) = (3840, 2160);
+    let frame = ScreenContent::new(Scenario::Gaming, width, height, 30)
+        .frame(0)
+        .to_vec();
+    for percent in [1, 10, 100] {
+        let mut changed = frame.clone();
+        let (columns, rows) = ((width + 63) / 64, (height + 63) / 64);
+        let tiles = columns * rows;
+        let n = tiles * percent / 100;
+        for k in 0..n {
+            let t = k * tiles / n;
+            changed[(t / columns * 64 * width + t % columns * 64) * 4] ^= 1;
+        }
+        let mut differ = FrameDiffer::new(1);
+        differ.diff(&frame, width, height, width * 4).unwrap();
+        let dirty = differ
+            .diff(&changed, width, height, width * 4)
+            .unwrap()
+            .clone();
+        let converter = RgbToYuv::new(RgbFormat::Bgra, ColorSpace::default());
+        let mut nv12 = IncrementalNv12::new(converter, 2);
+        nv12.update(&frame, width * 4, width, height, None).unwrap();
+        nv12.update(&frame, width * 4, width, height, None).unwrap();
+        let n = 10;
+        let start = Instant::now();
+        for i in 0..n {
+            let src = if i % 2 == 0 { &changed } else { &frame };
+            nv12.update(src, width * 4, width, height, Some(&dirty))
+                .unwrap();
+        }
+        println!(
+            "incremental BGRA->NV12 {}x{} {}% dirty: {:?}",
+            width,
+            height,
+            percent,
+            start.elapsed() / n
+        );
+    }
+}
+
+/// 4K to 1080p BGRA resizing with each filter.
+fn scale() {
+    let (width, height) = (3840, 2160);
+    let src = ScreenContent::new(Scenario::Video, width, height, 30)
+        .frame(0)
+        .to_vec();
+    let mut dst = vec![0u8; 1920 * 1080 * 4];
+    for filter in [
+        ScaleFilter::Bilinear,
+        ScaleFilter::Area,
+        ScaleFilter::Lanczos3,
+    ] {
+        let scaler = Scaler::new(filter);
+        let n = 10;
+        let start = Instant::now();
+        for _ in 0..n {
+            scaler
+                .scale(
+                    &src,
+                    width * 4,
+                    width,
+                    height,
+                    4,
+                    &mut dst,
+                    1920 * 4,
+                    1920,
+                    1080,
+                )
+                .unwrap();
+        }
+        println!(
+            "scale BGRA {}x{} -> 1920x1080 {:?}: {:?}",
+            width,
+            height,
+            filter,
+            start.elapsed() / n
+        );
+    }
+}
+
+/// Quality of a BGRA->NV12->BGRA round trip of a 4K frame, and how long
+/// measuring it takes.
+fn quality() {
+    let (width, height) = (3840, 2160);
+    let src = ScreenContent::new(Scenario::Video, width, height, 30)
+        .frame(0)
+        .to_vec();
+    let mut y = vec![0u8; width * height];
+    let mut uv = vec![0u8; width * height / 2];
+    let mut dst = vec![0u8; width * height * 4];
+    let dst_planes = YuvPlanes::Nv12 {
+        y: &mut y,
+        y_stride: width,
+        uv: &mut uv,
+        uv_stride: width,
+    };
+    RgbToYuv::new(RgbFormat::Bgra, ColorSpace::default())
+        .convert(&src, width * 4, width, height, dst_planes)
+        .unwrap();
+    let yuv = YuvSource::Nv12 {
+        y: &y,
+        y_stride: width,
+        uv: &uv,
+        uv_stride: width,
+    };
+    YuvToRgb::new(RgbFormat::Bgra, ColorSpace::default())
+        .convert(yuv, width, height, &mut dst, width * 4)
+        .unwrap();
+    let reference = Frame::Bgra {
+        data: &src,
+        stride: width * 4,
+    };
+    let distorted = Frame::Bgra {
+        data: &dst,
+        stride: width * 4,
+    };
+    for subsample in [1, 4] {
+        let meter = QualityMeter::new().with_subsample(subsample);
+        let n = 10;
+        let start = Instant::now();
+        let mut q = Default::default();
+        for _ in 0..n {
+            q = meter.measure(reference, distorted, width, height).unwrap();
+        }
+        println!(
+            "quality BGRA {}x{} {:?} subsample {}: {:?}, PSNR {:.2} SSIM B/G/R {:.4}/{:.4}/{:.4}",
+            width,
+            height,
+            meter.simd(),
+            subsample,
+            start.elapsed() / n,
+            q.psnr(),
+            q.planes[0].ssim,
+            q.planes[1].ssim,
+            q.planes[2].ssim
+        );
+    }
+}
+
+/// CRC32C tile hashing of 4K frames, and unchanged frame detection on a
+/// static and a changing sequence.
+fn idle() {
+    let (width, height) = (3840, 2160);
+    let frame = ScreenContent::new(Scenario::Video, width, height, 30)
+        .frame(0)
+        .to_vec();
+    let mut hashes = TileHashes::default();
+    let n = 30;
+    let start = Instant::now();
+    for _ in 0..n {
+        hashes.compute(&frame, width, height, 4, width * 4).unwrap();
+    }
+    let elapsed = start.elapsed() / n;
+    println!(
+        "tile hash BGRA {}x{}: {:?}, {:.1} GB/s",
+        width,
+        height,
+        elapsed,
+        (width * height * 4) as f64 / elapsed.as_secs_f64() / 1e9
+    );
+    for scenario in [Scenario::IdleCaret, Scenario::Video] {
+        let frames = ScreenContent::new(scenario, width, height, 30).frames(0, 31);
+        let mut detector = IdleDetector::new(IdlePolicy::default());
+        let mut unchanged = 0;
+        let start = Instant::now();
+        for frame in frames.iter() {
+            if detector.check(frame, width, height, width * 4) != FrameAction::Encode {
+                unchanged += 1;
+            }
+        }
+        println!(
+            "idle detection BGRA {}x{} {:?}: {:?}, {} of {} frames unchanged",
+            width,
+            height,
+            scenario,
+            start.elapsed() / frames.len() as u32,
+            unchanged,
+            frames.len()
+        );
+    }
+}
+
+/// Temporal denoising of 1080p NV12 sequences with added noise of sigma 3,
+/// quality of the noisy and the denoised frames against the clean ones.
+fn denoise() {
+    let (width, height) = (1920, 1080);
+    let (cw, ch) = (width / 2, height / 2);
+    let converter = RgbToYuv::new(RgbFormat::Bgra, ColorSpace::default());
+    let meter = QualityMeter::new();
+    fn frame<'a>(y: &'a [u8], uv: &'a [u8], stride: usize) -> Frame<'a> {
+        Frame::Yuv(YuvSource::Nv12 {
+            y,
+            y_stride: stride,
+            uv,
+            uv_stride: stride,
+        })
+    }
+    let mut seed = 1u32;
+    let mut noise = move |v: &mut u8| {
+        // the sum of four uniform bytes, close to normal
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        let s: i32 = seed.to_le_bytes().iter().map(|&b| b as i32 - 128).sum();
+        *v = (*v as i32 + s * 3 / 148).clamp(0, 255) as u8;
+    };
+    for scenario in [Scenario::IdleCaret, Scenario::Video] {
+        let frames = ScreenContent::new(scenario, width, height, 30).frames(0, 30);
+        let mut denoiser = TemporalDenoiser::new(DenoiseParams::default());
+        let (mut clean_y, mut clean_uv) = (vec![0u8; width * height], vec![0u8; 2 * cw * ch]);
+        let (mut before, mut after) = ([0.0; 2], [0.0; 2]);
+        let mut time = Duration::ZERO;
+        for bgra in frames.iter() {
+            let dst = YuvPlanes::Nv12 {
+                y: &mut clean_y,
+                y_stride: width,
+                uv: &mut clean_uv,
+                uv_stride: width,
+            };
+            converter
+                .convert(bgra, width * 4, width, height, dst)
+                .unwrap();
+            let (mut y, mut uv) = (clean_y.clone(), clean_uv.clone());
+            y.iter_mut().chain(uv.iter_mut()).for_each(&mut noise);
+            let q = meter
+                .measure(
+                    frame(&clean_y, &clean_uv, width),
+                    frame(&y, &uv, width),
+                    width,
+                    height,
+                )
+                .unwrap();
+            before[0] += q.psnr();
+            before[1] += q.planes[0].ssim;
+            let start = Instant::now();
+            denoiser
+                .denoise_nv12(&mut y, width, &mut uv, width, width, height)
+                .unwrap();
+            time += start.elapsed();
+            let q = meter
+                .measure(
+                    frame(&clean_y, &clean_uv, width),
+                    frame(&y, &uv, width),
+                    width,
+                    height,
+                )
+                .unwrap();
+            after[0] += q.psnr();
+            after[1] += q.planes[0].ssim;
+        }
+        let n = frames.len() as f64;
+        println!(
+            "denoise NV12 {}x{} {:?} {:?}: {:?}, PSNR {:.2} -> {:.2}, SSIM Y {:.4} -> {:.4}",
+            width,
+            height,
+            scenario,
+            denoiser.simd(),
+            time / frames.len() as u32,
+            before[0] / n,
+            after[0] / n,
+            before[1] / n,
+            after[1] / n
+        );
+    }
+}
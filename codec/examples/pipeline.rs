@@ -36,6 +36,8 @@ fn main() {
                 kbitrate: 5000,
                 framerate: 30,
                 gop: MAX_GOP as _,
+                chroma: Default::default(),
+                range: Default::default(),
             },
         };
         let de_ctx = DecodeContext {
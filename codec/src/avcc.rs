@@ -0,0 +1,490 @@
+//! Conversion between Annex-B and the length-prefixed layout used by MP4
+//! (`avcC`/`hvcC`), plus the decoder configuration records themselves.
+
+use crate::{
+    nal::{self, NalUnit},
+    params,
+};
+use gpu_common::DataFormat::{self, *};
+
+/// Converts `data` to 4-byte length-prefixed NAL units in place, dropping
+/// padding between units. The buffer only grows when it held 3-byte start
+/// codes. Returns false if no start code was found.
+pub fn annexb_to_length_prefixed(data: &mut Vec<u8>) -> bool {
+    let units: Vec<NalUnit> = nal::nal_units(data).collect();
+    if units.is_empty() {
+        return false;
+    }
+    let total: usize = units.iter().map(|n| 4 + n.len()).sum();
+    if total > data.len() {
+        data.resize(total, 0);
+    }
+    // units moving towards the front are moved front to back, the others
+    // back to front, so no unit overwrites one that has not moved yet
+    let mut dest = 0;
+    for n in units.iter() {
+        if dest + 4 <= n.header {
+            move_unit(data, n, dest);
+        }
+        dest += 4 + n.len();
+    }
+    for n in units.iter().rev() {
+        dest -= 4 + n.len();
+        if dest + 4 > n.header {
+            move_unit(data, n, dest);
+        }
+    }
+    data.truncate(total);
+    true
+}
+
+fn move_unit(data: &mut [u8], n: &NalUnit, dest: usize) {
+    if dest + 4 != n.header {
+        data.copy_within(n.header..n.end, dest + 4);
+    }
+    data[dest..dest + 4].copy_from_slice(&(n.len() as u32).to_be_bytes());
+}
+
+fn read_length(data: &[u8], pos: usize, length_size: usize) -> Option<usize> {
+    let bytes = data.get(pos..pos + length_size)?;
+    Some(bytes.iter().fold(0usize, |v, &b| (v << 8) | b as usize))
+}
+
+/// Splits a length-prefixed buffer into NAL payloads. Returns `None` if a
+/// length runs past the end of the buffer.
+pub fn length_prefixed_units(data: &[u8], length_size: usize) -> Option<Vec<&[u8]>> {
+    let mut units = vec![];
+    let mut pos = 0;
+    while pos < data.len() {
+        let len = read_length(data, pos, length_size)?;
+        pos += length_size;
+        units.push(data.get(pos..pos + len)?);
+        pos += len;
+    }
+    Some(units)
+}
+
+/// Whether every length of a length-prefixed buffer stays inside it.
+fn lengths_valid(data: &[u8], length_size: usize) -> bool {
+    let mut pos = 0;
+    while pos < data.len() {
+        match read_length(data, pos, length_size) {
+            Some(len) if len <= data.len() - pos - length_size => pos += length_size + len,
+            _ => return false,
+        }
+    }
+    true
+}
+
+/// Converts length-prefixed NAL units to Annex-B. With 4-byte lengths this
+/// is done in place, smaller length fields make the buffer grow. On failure
+/// the buffer is left untouched.
+pub fn length_prefixed_to_annexb(data: &mut Vec<u8>, length_size: usize) -> bool {
+    if !(1..=4).contains(&length_size) {
+        return false;
+    }
+    if length_size == 4 {
+        // all lengths are checked first, they are overwritten while walking
+        if !lengths_valid(data, 4) {
+            return false;
+        }
+        let mut pos = 0;
+        while pos < data.len() {
+            let len = read_length(data, pos, 4).unwrap_or_default();
+            data[pos..pos + 4].copy_from_slice(&[0, 0, 0, 1]);
+            pos += 4 + len;
+        }
+        return true;
+    }
+    let mut out = Vec::with_capacity(data.len() + data.len() / 64 + 16);
+    if !append_annexb(data, length_size, &mut out) {
+        return false;
+    }
+    *data = out;
+    true
+}
+
+/// Appends the Annex-B form of a length-prefixed buffer to `out`.
+pub fn append_annexb(data: &[u8], length_size: usize, out: &mut Vec<u8>) -> bool {
+    let units = match length_prefixed_units(data, length_size) {
+        Some(units) => units,
+        None => return false,
+    };
+    for u in units {
+        out.extend_from_slice(&[0, 0, 0, 1]);
+        out.extend_from_slice(u);
+    }
+    true
+}
+
+/// A parsed `avcC`/`hvcC` record.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct CodecConfig {
+    pub length_size: usize,
+    /// Parameter set NAL units in decoding order, headers included.
+    pub parameter_sets: Vec<Vec<u8>>,
+}
+
+impl CodecConfig {
+    /// The parameter sets as an Annex-B buffer to prepend to the first
+    /// packet sent to a decoder.
+    pub fn to_annexb(&self) -> Vec<u8> {
+        let mut out = vec![];
+        for ps in self.parameter_sets.iter() {
+            out.extend_from_slice(&[0, 0, 0, 1]);
+            out.extend_from_slice(ps);
+        }
+        out
+    }
+}
+
+/// Collects the parameter sets of an Annex-B packet, keyed by NAL type.
+fn parameter_sets<'a>(format: DataFormat, data: &'a [u8]) -> Vec<(u8, &'a [u8])> {
+    let mut sets: Vec<(u8, &[u8])> = vec![];
+    for n in nal::nal_units(data) {
+        let p = n.payload(data);
+        if p.is_empty() {
+            continue;
+        }
+        let t = nal::nal_type(format, p[0]);
+        let wanted = match format {
+            H264 => t == nal::H264_NAL_SPS || t == nal::H264_NAL_PPS,
+            H265 => (nal::HEVC_NAL_VPS..=nal::HEVC_NAL_PPS).contains(&t),
+            _ => false,
+        };
+        if wanted && !sets.iter().any(|&(_, s)| s == p) {
+            sets.push((t, p));
+        }
+    }
+    sets
+}
+
+fn push_u16_prefixed(out: &mut Vec<u8>, nal: &[u8]) {
+    out.extend_from_slice(&(nal.len() as u16).to_be_bytes());
+    out.extend_from_slice(nal);
+}
+
+/// Builds the `avcC`/`hvcC` payload from the parameter sets found in an
+/// Annex-B packet, normally the first keyframe. Length fields are 4 bytes.
+pub fn codec_config_record(format: DataFormat, annexb: &[u8]) -> Option<Vec<u8>> {
+    let sets = parameter_sets(format, annexb);
+    match format {
+        H264 => avcc_record(&sets),
+        H265 => hvcc_record(&sets),
+        _ => None,
+    }
+}
+
+fn avcc_record(sets: &[(u8, &[u8])]) -> Option<Vec<u8>> {
+    let sps: Vec<&[u8]> = sets
+        .iter()
+        .filter(|s| s.0 == nal::H264_NAL_SPS)
+        .map(|s| s.1)
+        .collect();
+    let pps: Vec<&[u8]> = sets
+        .iter()
+        .filter(|s| s.0 == nal::H264_NAL_PPS)
+        .map(|s| s.1)
+        .collect();
+    let info = params::parse_h264_sps(sps.first()?)?;
+    if pps.is_empty() {
+        return None;
+    }
+    let mut out = vec![
+        1,
+        info.profile_idc,
+        info.constraint_flags,
+        info.level_idc,
+        0xFC | 3,
+        0xE0 | sps.len() as u8,
+    ];
+    for s in sps.iter() {
+        push_u16_prefixed(&mut out, s);
+    }
+    out.push(pps.len() as u8);
+    for p in pps.iter() {
+        push_u16_prefixed(&mut out, p);
+    }
+    if params::has_chroma_info(info.profile_idc) {
+        out.push(0xFC | info.chroma_format_idc as u8);
+        out.push(0xF8 | (info.bit_depth_luma - 8) as u8);
+        out.push(0xF8 | (info.bit_depth_chroma - 8) as u8);
+        out.push(0);
+    }
+    Some(out)
+}
+
+fn hvcc_record(sets: &[(u8, &[u8])]) -> Option<Vec<u8>> {
+    let sps = sets.iter().find(|s| s.0 == nal::HEVC_NAL_SPS)?.1;
+    let info = params::parse_hevc_sps(sps)?;
+    let ptl = &info.ptl;
+    let mut out = Vec::with_capacity(64);
+    out.push(1);
+    out.push((ptl.profile_space << 6) | ((ptl.tier as u8) << 5) | ptl.profile_idc);
+    out.extend_from_slice(&ptl.compatibility_flags.to_be_bytes());
+    out.extend_from_slice(&ptl.constraint_flags.to_be_bytes()[2..]);
+    out.push(ptl.level_idc);
+    out.extend_from_slice(&[0xF0, 0x00]); // min_spatial_segmentation_idc
+    out.push(0xFC); // parallelismType
+    out.push(0xFC | info.chroma_format_idc as u8);
+    out.push(0xF8 | (info.bit_depth_luma - 8) as u8);
+    out.push(0xF8 | (info.bit_depth_chroma - 8) as u8);
+    out.extend_from_slice(&[0, 0]); // avgFrameRate
+    out.push(
+        ((info.max_sub_layers as u8 & 0x07) << 3) | ((info.temporal_id_nesting as u8) << 2) | 3,
+    );
+    let types = [nal::HEVC_NAL_VPS, nal::HEVC_NAL_SPS, nal::HEVC_NAL_PPS];
+    let arrays: Vec<(u8, Vec<&[u8]>)> = types
+        .iter()
+        .map(|&t| (t, sets.iter().filter(|s| s.0 == t).map(|s| s.1).collect()))
+        .collect();
+    if arrays.iter().any(|(_, v)| v.is_empty()) {
+        return None;
+    }
+    out.push(arrays.len() as u8);
+    for (t, units) in arrays.iter() {
+        out.push(0x80 | t); // array_completeness
+        out.extend_from_slice(&(units.len() as u16).to_be_bytes());
+        for u in units.iter() {
+            push_u16_prefixed(&mut out, u);
+        }
+    }
+    Some(out)
+}
+
+/// Parses an `avcC`/`hvcC` payload.
+pub fn parse_codec_config_record(format: DataFormat, record: &[u8]) -> Option<CodecConfig> {
+    let mut cfg = CodecConfig::default();
+    let mut pos;
+    let take = |pos: &mut usize| -> Option<Vec<u8>> {
+        let len = read_length(record, *pos, 2)?;
+        let nal = record.get(*pos + 2..*pos + 2 + len)?.to_vec();
+        *pos += 2 + len;
+        Some(nal)
+    };
+    match format {
+        H264 => {
+            if *record.first()? != 1 {
+                return None;
+            }
+            cfg.length_size = (*record.get(4)? & 0x03) as usize + 1;
+            pos = 5;
+            let num_sps = *record.get(pos)? & 0x1F;
+            pos += 1;
+            for _ in 0..num_sps {
+                cfg.parameter_sets.push(take(&mut pos)?);
+            }
+            let num_pps = *record.get(pos)?;
+            pos += 1;
+            for _ in 0..num_pps {
+                cfg.parameter_sets.push(take(&mut pos)?);
+            }
+        }
+        H265 => {
+            if *record.first()? != 1 {
+                return None;
+            }
+            cfg.length_size = (*record.get(21)? & 0x03) as usize + 1;
+            let num_arrays = *record.get(22)?;
+            pos = 23;
+            for _ in 0..num_arrays {
+                pos += 1;
+                let count = read_length(record, pos, 2)?;
+                pos += 2;
+                for _ in 0..count {
+                    cfg.parameter_sets.push(take(&mut pos)?);
+                }
+            }
+        }
+        _ => return None,
+    }
+    Some(cfg)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{bits::BitWriter, gpu_video_codec_get_bin_file};
+    use std::slice::from_raw_parts;
+
+    const UNITS: [&[u8]; 4] = [
+        &[0x67, 0x42, 0xC0, 0x1E],
+        &[0x68, 0xCE, 0x3C, 0x80],
+        &[0x06, 0x05, 0x00, 0x00, 0x03, 0x01, 0x80],
+        &[0x65, 0x88, 0x84, 0x00, 0x21, 0xFF],
+    ];
+
+    fn clip(format: DataFormat) -> Vec<u8> {
+        unsafe {
+            let (mut p, mut len) = (std::ptr::null_mut(), 0);
+            gpu_video_codec_get_bin_file(format as _, &mut p, &mut len);
+            from_raw_parts(p, len as usize).to_vec()
+        }
+    }
+
+    fn payloads(annexb: &[u8]) -> Vec<&[u8]> {
+        nal::nal_units(annexb).map(|n| n.payload(annexb)).collect()
+    }
+
+    fn length_prefixed(units: &[&[u8]], length_size: usize) -> Vec<u8> {
+        let mut out = vec![];
+        for u in units {
+            out.extend_from_slice(&u.len().to_be_bytes()[8 - length_size..]);
+            out.extend_from_slice(u);
+        }
+        out
+    }
+
+    #[test]
+    fn annexb_round_trip() {
+        // 3- and 4-byte start codes, zero padding after a unit
+        for starts in [[4, 4, 4, 4], [3, 3, 3, 3], [4, 3, 4, 3], [3, 4, 3, 4]] {
+            let mut data = vec![];
+            for (u, n) in UNITS.iter().zip(starts) {
+                data.extend_from_slice(&[0, 0, 0, 1][4 - n..]);
+                data.extend_from_slice(u);
+            }
+            data.extend_from_slice(&[0, 0]);
+            assert!(annexb_to_length_prefixed(&mut data));
+            assert_eq!(data, length_prefixed(&UNITS, 4), "{:?}", starts);
+            assert!(length_prefixed_to_annexb(&mut data, 4));
+            assert_eq!(payloads(&data), UNITS);
+        }
+        let mut data = vec![1, 2, 3];
+        assert!(!annexb_to_length_prefixed(&mut data));
+        assert_eq!(data, [1, 2, 3]);
+    }
+
+    #[test]
+    fn length_sizes_round_trip() {
+        for length_size in [1, 2, 4] {
+            let data = length_prefixed(&UNITS, length_size);
+            assert_eq!(length_prefixed_units(&data, length_size).unwrap(), UNITS);
+            let mut annexb = data.clone();
+            assert!(length_prefixed_to_annexb(&mut annexb, length_size));
+            assert_eq!(payloads(&annexb), UNITS);
+            let mut appended = vec![9];
+            assert!(append_annexb(&data, length_size, &mut appended));
+            assert_eq!(appended[1..], annexb[..]);
+        }
+        let mut data = vec![];
+        assert!(length_prefixed_to_annexb(&mut data, 4));
+        assert!(data.is_empty());
+    }
+
+    #[test]
+    fn truncated_rejected_unchanged() {
+        for length_size in [1, 2, 4] {
+            let full = length_prefixed(&UNITS, length_size);
+            // the last length runs past the end, or is cut itself
+            for cut in [1, UNITS[3].len() + length_size - 1] {
+                let mut data = full[..full.len() - cut].to_vec();
+                let before = data.clone();
+                assert!(!length_prefixed_to_annexb(&mut data, length_size));
+                assert_eq!(data, before, "length size {} cut {}", length_size, cut);
+                assert_eq!(length_prefixed_units(&data, length_size), None);
+                let mut out = vec![];
+                assert!(!append_annexb(&data, length_size, &mut out));
+            }
+        }
+        for length_size in [0, 5] {
+            let mut data = length_prefixed(&UNITS, 4);
+            assert!(!length_prefixed_to_annexb(&mut data, length_size));
+            assert_eq!(data, length_prefixed(&UNITS, 4));
+        }
+    }
+
+    #[test]
+    fn record_round_trip_on_clips() {
+        for (format, types) in [(H264, 2), (H265, 3)] {
+            let clip = clip(format);
+            let record = codec_config_record(format, &clip).unwrap();
+            let cfg = parse_codec_config_record(format, &record).unwrap();
+            assert_eq!(cfg.length_size, 4);
+            let expected: Vec<Vec<u8>> = parameter_sets(format, &clip)
+                .into_iter()
+                .map(|(_, p)| p.to_vec())
+                .collect();
+            assert_eq!(expected.len(), types, "{:?}", format);
+            assert_eq!(cfg.parameter_sets, expected);
+            assert_eq!(payloads(&cfg.to_annexb()), expected);
+            assert_eq!(
+                parse_codec_config_record(format, &record[..record.len() - 1]),
+                None
+            );
+        }
+        assert_eq!(codec_config_record(H264, &[0, 0, 1, 0x65, 0x88]), None);
+    }
+
+    /// An SPS of `profile_idc`, 4:4:4 at `bit_depth` where the profile
+    /// signals it.
+    fn h264_sps(profile_idc: u8, bit_depth: u32) -> Vec<u8> {
+        let mut w = BitWriter::new();
+        w.u(8, 0x67);
+        w.u(8, profile_idc as u32);
+        w.u(8, 0);
+        w.u(8, 40);
+        w.ue(0);
+        if params::has_chroma_info(profile_idc) {
+            w.ue(3);
+            w.flag(false);
+            w.ue(bit_depth - 8);
+            w.ue(bit_depth - 8);
+            w.flag(false);
+            w.flag(false);
+        }
+        w.ue(0);
+        w.ue(0);
+        w.ue(0);
+        w.ue(1);
+        w.flag(false);
+        w.ue(6);
+        w.ue(3);
+        w.flag(true);
+        w.flag(true);
+        w.flag(false);
+        w.flag(false);
+        w.trailing_bits();
+        w.into_bytes()
+    }
+
+    #[test]
+    fn avcc_high_profile_extension() {
+        for (profile_idc, extended) in [
+            (66, false),
+            (77, false),
+            (88, false),
+            (100, true),
+            (110, true),
+            (122, true),
+            (244, true),
+            (44, true),
+            (83, true),
+            (86, true),
+            (118, true),
+            (128, true),
+            (138, true),
+            (139, true),
+            (134, true),
+            (135, true),
+        ] {
+            let sps = h264_sps(profile_idc, 10);
+            let pps = UNITS[1];
+            let mut annexb = vec![];
+            for u in [&sps[..], pps] {
+                annexb.extend_from_slice(&[0, 0, 0, 1]);
+                annexb.extend_from_slice(u);
+            }
+            let record = codec_config_record(H264, &annexb).unwrap();
+            assert_eq!(record[1], profile_idc);
+            let base = 6 + 2 + sps.len() + 1 + 2 + pps.len();
+            if extended {
+                assert_eq!(record[base..], [0xFF, 0xFA, 0xFA, 0], "{}", profile_idc);
+            } else {
+                assert_eq!(record.len(), base, "{}", profile_idc);
+            }
+            let cfg = parse_codec_config_record(H264, &record).unwrap();
+            assert_eq!(cfg.parameter_sets, [sps, pps.to_vec()]);
+        }
+    }
+}
@@ -0,0 +1,230 @@
+/// MSB-first reader over an escaped NAL payload. Emulation prevention bytes
+/// are dropped on the fly, so callers see the RBSP.
+pub struct BitReader<'a> {
+    data: &'a [u8],
+    unescape: bool,
+    pos: usize,
+    zeros: u32,
+    cache: u64,
+    bits: u32,
+    consumed: usize,
+}
+
+impl<'a> BitReader<'a> {
+    pub fn new(data: &'a [u8]) -> Self {
+        Self {
+            data,
+            unescape: true,
+            pos: 0,
+            zeros: 0,
+            cache: 0,
+            bits: 0,
+            consumed: 0,
+        }
+    }
+
+    /// A reader for syntax without emulation prevention, such as AV1 OBUs.
+    pub fn new_raw(data: &'a [u8]) -> Self {
+        Self {
+            unescape: false,
+            ..Self::new(data)
+        }
+    }
+
+    fn next_byte(&mut self) -> Option<u8> {
+        loop {
+            let b = *self.data.get(self.pos)?;
+            self.pos += 1;
+            if self.unescape && self.zeros >= 2 && b == 3 {
+                self.zeros = 0;
+                continue;
+            }
+            self.zeros = if b == 0 { self.zeros + 1 } else { 0 };
+            return Some(b);
+        }
+    }
+
+    fn refill(&mut self) {
+        while self.bits <= 56 {
+            match self.next_byte() {
+                Some(b) => {
+                    self.cache |= (b as u64) << (56 - self.bits);
+                    self.bits += 8;
+                }
+                None => break,
+            }
+        }
+    }
+
+    /// Reads `n` (<= 32) bits.
+    pub fn u(&mut self, n: u32) -> Option<u32> {
+        if n == 0 {
+            return Some(0);
+        }
+        if self.bits < n {
+            self.refill();
+            if self.bits < n {
+                return None;
+            }
+        }
+        let v = (self.cache >> (64 - n)) as u32;
+        self.cache <<= n;
+        self.bits -= n;
+        self.consumed += n as usize;
+        Some(v)
+    }
+
+    pub fn flag(&mut self) -> Option<bool> {
+        self.u(1).map(|v| v != 0)
+    }
+
+    pub fn skip(&mut self, mut n: u32) -> Option<()> {
+        while n > 32 {
+            self.u(32)?;
+            n -= 32;
+        }
+        self.u(n).map(|_| ())
+    }
+
+    pub fn ue(&mut self) -> Option<u32> {
+        if self.bits < 32 {
+            self.refill();
+        }
+        let zeros = self.cache.leading_zeros();
+        if zeros > 31 || zeros >= self.bits {
+            return None;
+        }
+        self.u(zeros)?;
+        let v = self.u(zeros + 1)?;
+        Some(v - 1)
+    }
+
+    pub fn se(&mut self) -> Option<i32> {
+        let k = self.ue()? as i64;
+        Some(if k & 1 == 1 {
+            ((k + 1) / 2) as i32
+        } else {
+            (-(k / 2)) as i32
+        })
+    }
+
+    pub fn bits_read(&self) -> usize {
+        self.consumed
+    }
+
+    pub fn byte_aligned(&self) -> bool {
+        self.consumed % 8 == 0
+    }
+
+    /// more_rbsp_data() of the spec: whether anything but the stop bit and
+    /// trailing zeros is left.
+    pub fn more_rbsp_data(&self) -> bool {
+        let mut rbsp_len = 0;
+        let mut last = 0;
+        let mut last_bits = 0;
+        let mut zeros = 0;
+        for &b in self.data {
+            if zeros >= 2 && b == 3 {
+                zeros = 0;
+                continue;
+            }
+            zeros = if b == 0 { zeros + 1 } else { 0 };
+            rbsp_len += 1;
+            if b != 0 {
+                last = rbsp_len;
+                last_bits = b.trailing_zeros() as usize;
+            }
+        }
+        if last == 0 {
+            return false;
+        }
+        let stop = last * 8 - last_bits - 1;
+        self.consumed < stop
+    }
+}
+
+/// MSB-first writer producing an RBSP. Emulation prevention is added when
+/// the RBSP is wrapped into a NAL unit, see `nal::escape`.
+#[derive(Default)]
+pub struct BitWriter {
+    data: Vec<u8>,
+    cache: u8,
+    bits: u32,
+}
+
+impl BitWriter {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Writes the `n` (<= 32) low bits of `v`.
+    pub fn u(&mut self, n: u32, v: u32) {
+        for i in (0..n).rev() {
+            self.cache = (self.cache << 1) | ((v >> i) & 1) as u8;
+            self.bits += 1;
+            if self.bits == 8 {
+                self.data.push(self.cache);
+                self.cache = 0;
+                self.bits = 0;
+            }
+        }
+    }
+
+    pub fn flag(&mut self, v: bool) {
+        self.u(1, v as u32);
+    }
+
+    pub fn ue(&mut self, v: u32) {
+        let v = v as u64 + 1;
+        let len = 64 - v.leading_zeros();
+        self.u(len - 1, 0);
+        if len > 32 {
+            self.u(1, 1);
+            self.u(32, v as u32);
+        } else {
+            self.u(len, v as u32);
+        }
+    }
+
+    pub fn se(&mut self, v: i32) {
+        let k = if v > 0 {
+            2 * v as i64 - 1
+        } else {
+            -2 * v as i64
+        };
+        self.ue(k as u32);
+    }
+
+    pub fn byte_aligned(&self) -> bool {
+        self.bits == 0
+    }
+
+    /// rbsp_trailing_bits(): a stop bit and zeros up to the byte boundary.
+    pub fn trailing_bits(&mut self) {
+        self.u(1, 1);
+        while !self.byte_aligned() {
+            self.u(1, 0);
+        }
+    }
+
+    pub fn into_bytes(mut self) -> Vec<u8> {
+        if self.bits > 0 {
+            self.data.push(self.cache << (8 - self.bits));
+        }
+        self.data
+    }
+}
+
+/// Overwrites `n` (<= 32) bits at bit offset `pos` of an RBSP with the low
+/// bits of `v`.
+pub fn put_bits_at(data: &mut [u8], pos: usize, n: u32, v: u32) -> Option<()> {
+    if (pos + n as usize + 7) / 8 > data.len() {
+        return None;
+    }
+    for i in 0..n as usize {
+        let bit = (v >> (n as usize - 1 - i)) & 1;
+        let (byte, shift) = ((pos + i) / 8, 7 - (pos + i) % 8);
+        data[byte] = (data[byte] & !(1 << shift)) | ((bit as u8) << shift);
+    }
+    Some(())
+}
@@ -0,0 +1,461 @@
+//! Fan-out of one encoded stream to many subscribers. Each packet is
+//! published once as a reference-counted buffer, so a subscriber costs a
+//! pointer copy per packet and no byte copies.
+//!
+//! Subscribers have bounded queues. One that falls behind loses its queue
+//! and the stream up to the next keyframe, or is disconnected, without
+//! holding back the publisher or the others.
+
+use crate::{encode::EncodeFrame, keyframe::KeyframeRequester, parser::FrameInfo};
+use std::{
+    collections::VecDeque,
+    sync::{Arc, Condvar, Mutex},
+    time::{Duration, Instant},
+};
+
+pub struct BroadcastPacket {
+    pub data: Vec<u8>,
+    /// Whether decoding can start here, see `EncodeFrame::is_random_access`.
+    pub key: bool,
+    pub info: FrameInfo,
+    /// Position in the stream, counting every packet published.
+    pub sequence: u64,
+    pub published: Instant,
+}
+
+pub type Packet = Arc<BroadcastPacket>;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum LagPolicy {
+    /// Drop the queue and the packets up to the next keyframe.
+    SkipToKeyframe,
+    /// Close the subscription.
+    Disconnect,
+}
+
+#[derive(Debug, Clone)]
+pub struct SubscribeOptions {
+    /// Packets queued before the subscriber counts as behind.
+    pub capacity: usize,
+    pub policy: LagPolicy,
+    /// Whether delivery starts at a keyframe. False for receivers that
+    /// already have the stream up to now, e.g. from `Encoder::late_join`.
+    pub wait_for_keyframe: bool,
+    /// Asked for a keyframe whenever the subscriber waits for one.
+    pub keyframes: Option<KeyframeRequester>,
+}
+
+impl Default for SubscribeOptions {
+    fn default() -> Self {
+        Self {
+            capacity: 60,
+            policy: LagPolicy::SkipToKeyframe,
+            wait_for_keyframe: true,
+            keyframes: None,
+        }
+    }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub struct SubscriberStats {
+    pub delivered: u64,
+    /// Packets dropped, queued or skipped while waiting for a keyframe.
+    pub dropped: u64,
+    /// Times the subscriber fell behind.
+    pub lagged: u64,
+    pub queued: usize,
+    pub max_queued: usize,
+    /// Age of the oldest queued packet.
+    pub lag: Duration,
+}
+
+struct Queue {
+    packets: VecDeque<Packet>,
+    waiting: bool,
+    closed: bool,
+    stats: SubscriberStats,
+}
+
+struct Slot {
+    queue: Mutex<Queue>,
+    ready: Condvar,
+    options: SubscribeOptions,
+}
+
+impl Slot {
+    fn push(&self, packet: &Packet) {
+        let mut q = self.queue.lock().unwrap();
+        if q.closed {
+            return;
+        }
+        if q.waiting && !packet.key {
+            q.stats.dropped += 1;
+            return;
+        }
+        q.waiting = false;
+        if q.packets.len() >= self.options.capacity {
+            q.stats.lagged += 1;
+            q.stats.dropped += q.packets.len() as u64;
+            q.packets.clear();
+            match self.options.policy {
+                LagPolicy::SkipToKeyframe if packet.key => {}
+                LagPolicy::SkipToKeyframe => {
+                    q.stats.dropped += 1;
+                    q.waiting = true;
+                    if let Some(k) = self.options.keyframes.as_ref() {
+                        k.request();
+                    }
+                    return;
+                }
+                LagPolicy::Disconnect => {
+                    q.stats.dropped += 1;
+                    q.closed = true;
+                    self.ready.notify_all();
+                    return;
+                }
+            }
+        }
+        q.packets.push_back(packet.clone());
+        q.stats.max_queued = q.stats.max_queued.max(q.packets.len());
+        self.ready.notify_one();
+    }
+
+    fn close(&self) {
+        self.queue.lock().unwrap().closed = true;
+        self.ready.notify_all();
+    }
+}
+
+#[derive(Default)]
+struct State {
+    slots: Vec<Arc<Slot>>,
+    sequence: u64,
+}
+
+impl State {
+    /// Forgets dropped subscribers, the slots only the broadcaster holds.
+    fn prune(&mut self) {
+        self.slots.retain(|s| Arc::strong_count(s) > 1);
+    }
+}
+
+/// Publishing side, shareable between threads.
+#[derive(Default)]
+pub struct Broadcaster {
+    state: Mutex<State>,
+}
+
+impl Broadcaster {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    pub fn subscribe(&self, options: SubscribeOptions) -> Subscriber {
+        if options.wait_for_keyframe {
+            if let Some(k) = options.keyframes.as_ref() {
+                k.request();
+            }
+        }
+        let slot = Arc::new(Slot {
+            queue: Mutex::new(Queue {
+                packets: VecDeque::with_capacity(options.capacity),
+                waiting: options.wait_for_keyframe,
+                closed: false,
+                stats: SubscriberStats::default(),
+            }),
+            ready: Condvar::new(),
+            options,
+        });
+        self.state.lock().unwrap().slots.push(slot.clone());
+        Subscriber { slot }
+    }
+
+    /// Live subscribers.
+    pub fn subscribers(&self) -> usize {
+        let mut state = self.state.lock().unwrap();
+        state.prune();
+        state.slots.len()
+    }
+
+    /// Publishes a packet, taking its buffer without copying.
+    pub fn publish(&self, frame: EncodeFrame) -> Packet {
+        let key = frame.is_random_access();
+        let mut state = self.state.lock().unwrap();
+        let packet = Arc::new(BroadcastPacket {
+            data: frame.data,
+            key,
+            info: frame.info,
+            sequence: state.sequence,
+            published: Instant::now(),
+        });
+        state.sequence += 1;
+        state.prune();
+        for slot in state.slots.iter() {
+            slot.push(&packet);
+        }
+        packet
+    }
+
+    /// Publishes the packets returned by `Encoder::encode`, leaving the
+    /// vector empty.
+    pub fn publish_all(&self, frames: &mut Vec<EncodeFrame>) {
+        for frame in frames.drain(..) {
+            self.publish(frame);
+        }
+    }
+}
+
+impl Drop for Broadcaster {
+    fn drop(&mut self) {
+        for slot in self.state.lock().unwrap().slots.iter() {
+            slot.close();
+        }
+    }
+}
+
+pub struct Subscriber {
+    slot: Arc<Slot>,
+}
+
+impl Subscriber {
+    fn pop(q: &mut Queue) -> Option<Packet> {
+        let packet = q.packets.pop_front()?;
+        q.stats.delivered += 1;
+        Some(packet)
+    }
+
+    pub fn try_recv(&self) -> Option<Packet> {
+        Self::pop(&mut self.slot.queue.lock().unwrap())
+    }
+
+    /// Waits for the next packet, `None` once the subscription is closed.
+    pub fn recv(&self) -> Option<Packet> {
+        let mut q = self.slot.queue.lock().unwrap();
+        loop {
+            if let Some(packet) = Self::pop(&mut q) {
+                return Some(packet);
+            }
+            if q.closed {
+                return None;
+            }
+            q = self.slot.ready.wait(q).unwrap();
+        }
+    }
+
+    pub fn recv_timeout(&self, timeout: Duration) -> Option<Packet> {
+        let deadline = Instant::now() + timeout;
+        let mut q = self.slot.queue.lock().unwrap();
+        loop {
+            if let Some(packet) = Self::pop(&mut q) {
+                return Some(packet);
+            }
+            let now = Instant::now();
+            if q.closed || now >= deadline {
+                return None;
+            }
+            q = self.slot.ready.wait_timeout(q, deadline - now).unwrap().0;
+        }
+    }
+
+    /// Whether the broadcaster is gone or the subscriber was disconnected.
+    /// Packets queued before can still be received.
+    pub fn is_closed(&self) -> bool {
+        self.slot.queue.lock().unwrap().closed
+    }
+
+    /// Whether packets are dropped until the next keyframe.
+    pub fn is_waiting(&self) -> bool {
+        self.slot.queue.lock().unwrap().waiting
+    }
+
+    pub fn stats(&self) -> SubscriberStats {
+        let q = self.slot.queue.lock().unwrap();
+        let mut stats = q.stats;
+        stats.queued = q.packets.len();
+        stats.lag = q
+            .packets
+            .front()
+            .map_or(Duration::ZERO, |p| p.published.elapsed());
+        stats
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{encode::Encoder, keyframe::KeyframeCoalescer};
+    use gpu_common::{
+        DataFormat::H264, DynamicContext, EncodeContext, EncodeDriver::CPU, FeatureContext,
+        API::API_DX11,
+    };
+    use std::{ptr::null_mut, thread};
+
+    fn encoder() -> Encoder {
+        let mut e = Encoder::new(EncodeContext {
+            f: FeatureContext {
+                driver: CPU,
+                luid: 0,
+                api: API_DX11,
+                data_format: H264,
+            },
+            d: DynamicContext {
+                device: None,
+                width: 128,
+                height: 64,
+                kbitrate: 1000,
+                framerate: 30,
+                gop: i32::MAX,
+                chroma: Default::default(),
+                range: Default::default(),
+            },
+        })
+        .unwrap();
+        e.set_keyframe_window(Duration::ZERO);
+        e
+    }
+
+    /// Publishes a packet of each kind in `pattern`: `I` an IDR, `P` a P
+    /// picture and `K` a P picture the backend flagged as key.
+    fn publish(b: &Broadcaster, e: &mut Encoder, pattern: &str) {
+        for c in pattern.chars() {
+            if c == 'I' {
+                e.request_keyframe();
+            }
+            let mut frame = e.encode(null_mut()).unwrap().pop().unwrap();
+            assert_eq!(frame.is_random_access(), c == 'I');
+            if c == 'K' {
+                frame.key = 1;
+            }
+            b.publish(frame);
+        }
+    }
+
+    /// Sequence numbers and keyframe flags of the queued packets.
+    fn received(s: &Subscriber) -> Vec<(u64, bool)> {
+        std::iter::from_fn(|| s.try_recv())
+            .map(|p| (p.sequence, p.key))
+            .collect()
+    }
+
+    fn options(capacity: usize, policy: LagPolicy) -> SubscribeOptions {
+        SubscribeOptions {
+            capacity,
+            policy,
+            ..Default::default()
+        }
+    }
+
+    #[test]
+    fn new_subscriber_waits_for_keyframe() {
+        let b = Broadcaster::new();
+        let mut e = encoder();
+        let keyframes = KeyframeCoalescer::default();
+        let waiting = b.subscribe(SubscribeOptions {
+            keyframes: Some(keyframes.requester()),
+            ..Default::default()
+        });
+        let joined = b.subscribe(SubscribeOptions {
+            wait_for_keyframe: false,
+            ..Default::default()
+        });
+        assert!(waiting.is_waiting() && !joined.is_waiting());
+        publish(&b, &mut e, "IPKIP");
+        // the first packet of a new encoder is an IDR anyway
+        assert_eq!(received(&joined).len(), 5);
+        assert_eq!(
+            received(&waiting),
+            [(0, true), (1, false), (2, false), (3, true), (4, false)]
+        );
+
+        let late = b.subscribe(SubscribeOptions {
+            keyframes: Some(keyframes.requester()),
+            ..Default::default()
+        });
+        publish(&b, &mut e, "PKPIP");
+        assert_eq!(received(&late), [(8, true), (9, false)]);
+        assert_eq!(late.stats().dropped, 3);
+        assert_eq!(received(&joined).len(), 5);
+        let mut keyframes = keyframes;
+        keyframes.pending();
+        assert_eq!(keyframes.stats().requests, 2);
+    }
+
+    #[test]
+    fn skip_to_keyframe_resumes_at_random_access_point() {
+        let b = Broadcaster::new();
+        let mut e = encoder();
+        let mut keyframes = KeyframeCoalescer::default();
+        let slow = b.subscribe(SubscribeOptions {
+            keyframes: Some(keyframes.requester()),
+            ..options(3, LagPolicy::SkipToKeyframe)
+        });
+        let fast = b.subscribe(options(100, LagPolicy::SkipToKeyframe));
+        publish(&b, &mut e, "IPP");
+        assert_eq!(received(&fast).len(), 3);
+        keyframes.pending();
+        assert_eq!(keyframes.stats().requests, 1);
+
+        // the fourth packet finds the queue full
+        publish(&b, &mut e, "PKPKPIP");
+        assert!(!slow.is_waiting());
+        assert_eq!(received(&slow), [(8, true), (9, false)]);
+        assert_eq!(received(&fast).len(), 7);
+        keyframes.pending();
+        assert_eq!(keyframes.stats().requests, 2);
+        let stats = slow.stats();
+        assert_eq!((stats.delivered, stats.dropped, stats.lagged), (2, 8, 1));
+        assert_eq!(stats.max_queued, 3);
+
+        // a keyframe finding the queue full is kept
+        publish(&b, &mut e, "PPPI");
+        assert!(!slow.is_waiting());
+        assert_eq!(received(&slow), [(13, true)]);
+        let stats = slow.stats();
+        assert_eq!((stats.dropped, stats.lagged), (11, 2));
+        keyframes.pending();
+        assert_eq!(keyframes.stats().requests, 2);
+    }
+
+    #[test]
+    fn disconnect_when_behind() {
+        let b = Broadcaster::new();
+        let mut e = encoder();
+        let slow = b.subscribe(options(2, LagPolicy::Disconnect));
+        let fast = b.subscribe(options(100, LagPolicy::Disconnect));
+        publish(&b, &mut e, "IP");
+        assert!(!slow.is_closed());
+        publish(&b, &mut e, "PI");
+        assert!(slow.is_closed());
+        assert!(slow.recv().is_none());
+        let stats = slow.stats();
+        assert_eq!((stats.delivered, stats.dropped, stats.lagged), (0, 3, 1));
+        assert_eq!(received(&fast).len(), 4);
+        assert!(!fast.is_closed());
+
+        drop(slow);
+        assert_eq!(b.subscribers(), 1);
+        drop(b);
+        assert!(fast.is_closed());
+        assert!(fast.recv().is_none());
+    }
+
+    #[test]
+    fn lag_stats() {
+        let b = Broadcaster::new();
+        let mut e = encoder();
+        let s = b.subscribe(options(10, LagPolicy::SkipToKeyframe));
+        assert_eq!(s.stats(), SubscriberStats::default());
+        publish(&b, &mut e, "IPP");
+        thread::sleep(Duration::from_millis(20));
+        let stats = s.stats();
+        assert_eq!((stats.queued, stats.max_queued), (3, 3));
+        assert!(stats.lag >= Duration::from_millis(20));
+        s.recv().unwrap();
+        s.recv_timeout(Duration::ZERO).unwrap();
+        let stats = s.stats();
+        assert_eq!((stats.delivered, stats.queued, stats.max_queued), (2, 1, 3));
+        s.recv().unwrap();
+        assert_eq!(s.stats().lag, Duration::ZERO);
+        assert!(s.recv_timeout(Duration::from_millis(10)).is_none());
+    }
+}
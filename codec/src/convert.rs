@@ -0,0 +1,1474 @@
+//! CPU colour conversion between packed RGB and 8-bit YUV 4:2:0 or 4:4:4,
+//! with the BT.601/709 and full/studio range choices of
+//! `NativeDevice::ToNV12`.
+//!
+//! Every SIMD path computes exactly what the scalar one does: 14-bit fixed
+//! point coefficients, chroma from the sum of each 2x2 block. The way back
+//! follows `nv_pixel_shader_601` and its linear sampler, chroma being
+//! interpolated with weights 9, 3, 3 and 1.
+
+use std::{ops::Range, thread};
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub struct ColorSpace {
+    pub bt709: bool,
+    pub full_range: bool,
+}
+
+/// Byte order of 4-byte pixels, alpha last.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum RgbFormat {
+    Bgra,
+    Rgba,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Simd {
+    None,
+    Sse41,
+    Avx2,
+    Neon,
+}
+
+impl Simd {
+    /// The widest instruction set the CPU supports.
+    pub fn detect() -> Simd {
+        #[cfg(target_arch = "x86_64")]
+        {
+            if is_x86_feature_detected!("avx2") {
+                return Simd::Avx2;
+            }
+            if is_x86_feature_detected!("sse4.1") {
+                return Simd::Sse41;
+            }
+        }
+        #[cfg(target_arch = "aarch64")]
+        if std::arch::is_aarch64_feature_detected!("neon") {
+            return Simd::Neon;
+        }
+        Simd::None
+    }
+
+    pub(crate) fn supported(self) -> bool {
+        match self {
+            Simd::None => true,
+            #[cfg(target_arch = "x86_64")]
+            Simd::Sse41 => is_x86_feature_detected!("sse4.1"),
+            #[cfg(target_arch = "x86_64")]
+            Simd::Avx2 => is_x86_feature_detected!("avx2"),
+            #[cfg(target_arch = "aarch64")]
+            Simd::Neon => std::arch::is_aarch64_feature_detected!("neon"),
+            #[allow(unreachable_patterns)]
+            _ => false,
+        }
+    }
+}
+
+/// Destination of `RgbToYuv::convert`, chroma planes of
+/// `(width + 1) / 2` x `(height + 1) / 2` samples.
+pub enum YuvPlanes<'a> {
+    Nv12 {
+        y: &'a mut [u8],
+        y_stride: usize,
+        uv: &'a mut [u8],
+        uv_stride: usize,
+    },
+    I420 {
+        y: &'a mut [u8],
+        y_stride: usize,
+        u: &'a mut [u8],
+        u_stride: usize,
+        v: &'a mut [u8],
+        v_stride: usize,
+    },
+}
+
+/// Destination of `RgbToYuv::convert_444`, three planes of `width` x
+/// `height` samples with rows `stride` bytes apart.
+pub struct Yuv444Planes<'a> {
+    pub y: &'a mut [u8],
+    pub u: &'a mut [u8],
+    pub v: &'a mut [u8],
+    pub stride: usize,
+}
+
+const Y_SHIFT: u32 = 14;
+const UV_SHIFT: u32 = 16;
+
+/// Coefficients in pixel byte order, the fourth (alpha) being 0.
+#[derive(Debug, Clone, Copy)]
+struct Coefs {
+    y: [i16; 4],
+    u: [i16; 4],
+    v: [i16; 4],
+    y_bias: i32,
+    uv_bias: i32,
+}
+
+impl Coefs {
+    fn new(format: RgbFormat, color: ColorSpace) -> Self {
+        let (kr, kb) = if color.bt709 {
+            (0.2126, 0.0722)
+        } else {
+            (0.299, 0.114)
+        };
+        let (y_range, uv_range, y_offset) = if color.full_range {
+            (255.0, 255.0, 0)
+        } else {
+            (219.0, 224.0, 16)
+        };
+        let one = (1 << Y_SHIFT) as f64;
+        let q = |x: f64| (x * one).round() as i16;
+        // rounded so that white is exact and greys have neutral chroma
+        let y_total = q(y_range / 255.0);
+        let (yr, yb) = (q(kr * y_range / 255.0), q(kb * y_range / 255.0));
+        let c = uv_range / 255.0;
+        let (ur, ub) = (q(-kr / (2.0 * (1.0 - kb)) * c), q(0.5 * c));
+        let (vr, vb) = (q(0.5 * c), q(-kb / (2.0 * (1.0 - kr)) * c));
+        let order = |r: i16, g: i16, b: i16| match format {
+            RgbFormat::Bgra => [b, g, r, 0],
+            RgbFormat::Rgba => [r, g, b, 0],
+        };
+        Self {
+            y: order(yr, y_total - yr - yb, yb),
+            u: order(ur, -ur - ub, ub),
+            v: order(vr, -vr - vb, vb),
+            y_bias: (y_offset << Y_SHIFT) + (1 << (Y_SHIFT - 1)),
+            uv_bias: (128 << UV_SHIFT) + (1 << (UV_SHIFT - 1)),
+        }
+    }
+}
+
+fn clamp(x: i32) -> u8 {
+    x.clamp(0, 255) as u8
+}
+
+fn dot(c: &[i16; 4], p: [i32; 3]) -> i32 {
+    c[0] as i32 * p[0] + c[1] as i32 * p[1] + c[2] as i32 * p[2]
+}
+
+enum ChromaRow<'a> {
+    Nv12(&'a mut [u8]),
+    I420(&'a mut [u8], &'a mut [u8]),
+}
+
+impl ChromaRow<'_> {
+    fn put(&mut self, i: usize, u: u8, v: u8) {
+        match self {
+            ChromaRow::Nv12(uv) => {
+                uv[2 * i] = u;
+                uv[2 * i + 1] = v;
+            }
+            ChromaRow::I420(us, vs) => {
+                us[i] = u;
+                vs[i] = v;
+            }
+        }
+    }
+}
+
+fn luma_scalar(c: &Coefs, src: &[u8], dst: &mut [u8], from: usize) {
+    for (p, y) in src.chunks_exact(4).zip(dst.iter_mut()).skip(from) {
+        let s = dot(&c.y, [p[0] as i32, p[1] as i32, p[2] as i32]);
+        *y = clamp((s + c.y_bias) >> Y_SHIFT);
+    }
+}
+
+/// Chroma of the 2x2 blocks from `from` on; an odd last column or a single
+/// last row is repeated.
+fn chroma_scalar(c: &Coefs, s0: &[u8], s1: &[u8], width: usize, out: &mut ChromaRow, from: usize) {
+    for i in from..(width + 1) / 2 {
+        let x0 = 8 * i;
+        let x1 = if 2 * i + 1 < width { x0 + 4 } else { x0 };
+        let mut sum = [0i32; 3];
+        for (k, s) in sum.iter_mut().enumerate() {
+            *s = s0[x0 + k] as i32 + s0[x1 + k] as i32 + s1[x0 + k] as i32 + s1[x1 + k] as i32;
+        }
+        let u = clamp((dot(&c.u, sum) + c.uv_bias) >> UV_SHIFT);
+        let v = clamp((dot(&c.v, sum) + c.uv_bias) >> UV_SHIFT);
+        out.put(i, u, v);
+    }
+}
+
+/// Source of `YuvToRgb::convert`, chroma planes as in `YuvPlanes`.
+#[derive(Clone, Copy)]
+pub enum YuvSource<'a> {
+    Nv12 {
+        y: &'a [u8],
+        y_stride: usize,
+        uv: &'a [u8],
+        uv_stride: usize,
+    },
+    I420 {
+        y: &'a [u8],
+        y_stride: usize,
+        u: &'a [u8],
+        u_stride: usize,
+        v: &'a [u8],
+        v_stride: usize,
+    },
+}
+
+/// Source of `YuvToRgb::convert_444`, planes as in `Yuv444Planes`.
+#[derive(Clone, Copy)]
+pub struct Yuv444Source<'a> {
+    pub y: &'a [u8],
+    pub u: &'a [u8],
+    pub v: &'a [u8],
+    pub stride: usize,
+}
+
+/// Chroma reaches the conversion with 4 more fraction bits than luma, its
+/// coefficients have 4 bits less.
+const CHROMA_BITS: u32 = 4;
+const CHROMA_ZERO: i16 = 128 << CHROMA_BITS;
+
+#[derive(Debug, Clone, Copy)]
+struct InvCoefs {
+    y_offset: i16,
+    y: i16,
+    rv: i16,
+    gu: i16,
+    gv: i16,
+    bu: i16,
+    bgra: bool,
+}
+
+impl InvCoefs {
+    fn new(format: RgbFormat, color: ColorSpace) -> Self {
+        let (kr, kb): (f64, f64) = if color.bt709 {
+            (0.2126, 0.0722)
+        } else {
+            (0.299, 0.114)
+        };
+        let kg = 1.0 - kr - kb;
+        let (y_scale, c, y_offset) = if color.full_range {
+            (1.0, 1.0, 0)
+        } else {
+            (255.0 / 219.0, 255.0 / 224.0, 16)
+        };
+        let q = |x: f64| (x * (1 << (Y_SHIFT - CHROMA_BITS)) as f64).round() as i16;
+        Self {
+            y_offset,
+            y: (y_scale * (1 << Y_SHIFT) as f64).round() as i16,
+            rv: q(2.0 * (1.0 - kr) * c),
+            gu: q(-2.0 * (1.0 - kb) * kb / kg * c),
+            gv: q(-2.0 * (1.0 - kr) * kr / kg * c),
+            bu: q(2.0 * (1.0 - kb) * c),
+            bgra: format == RgbFormat::Bgra,
+        }
+    }
+}
+
+/// Chroma of picture row `row` interpolated vertically, interleaved U and V
+/// times 4, with one more pair repeating each end.
+fn chroma_vertical(src: &YuvSource, cw: usize, ch: usize, row: usize, out: &mut [i16]) {
+    let k = row / 2;
+    let far = if row % 2 == 0 {
+        k.saturating_sub(1)
+    } else {
+        (k + 1).min(ch - 1)
+    };
+    let mix = |near: u8, far: u8| 3 * near as i16 + far as i16;
+    match *src {
+        YuvSource::Nv12 { uv, uv_stride, .. } => {
+            let a = &uv[k * uv_stride..][..2 * cw];
+            let b = &uv[far * uv_stride..][..2 * cw];
+            for ((o, &a), &b) in out[2..2 + 2 * cw].iter_mut().zip(a).zip(b) {
+                *o = mix(a, b);
+            }
+        }
+        YuvSource::I420 {
+            u,
+            u_stride,
+            v,
+            v_stride,
+            ..
+        } => {
+            let (ua, ub) = (&u[k * u_stride..][..cw], &u[far * u_stride..][..cw]);
+            let (va, vb) = (&v[k * v_stride..][..cw], &v[far * v_stride..][..cw]);
+            for (i, o) in out[2..2 + 2 * cw].chunks_exact_mut(2).enumerate() {
+                o[0] = mix(ua[i], ub[i]);
+                o[1] = mix(va[i], vb[i]);
+            }
+        }
+    }
+    out.copy_within(2..4, 0);
+    out.copy_within(2 * cw..2 * cw + 2, 2 * cw + 2);
+}
+
+/// One pixel from luma and chroma with `CHROMA_BITS` fraction bits,
+/// centred on 0.
+fn rgb_pixel(c: &InvCoefs, l: u8, u: i32, v: i32, p: &mut [u8]) {
+    let base = c.y as i32 * (l as i32 - c.y_offset as i32) + (1 << (Y_SHIFT - 1));
+    let r = clamp((base + c.rv as i32 * v) >> Y_SHIFT);
+    let g = clamp((base + c.gu as i32 * u + c.gv as i32 * v) >> Y_SHIFT);
+    let b = clamp((base + c.bu as i32 * u) >> Y_SHIFT);
+    let (first, third) = if c.bgra { (b, r) } else { (r, b) };
+    p.copy_from_slice(&[first, g, third, 255]);
+}
+
+fn rgb_scalar(c: &InvCoefs, y: &[u8], vert: &[i16], dst: &mut [u8], from: usize) {
+    for (x, (&l, p)) in y.iter().zip(dst.chunks_exact_mut(4)).enumerate().skip(from) {
+        // pairs are offset by one in `vert`
+        let near = x / 2 + 1;
+        let far = if x % 2 == 0 { near - 1 } else { near + 1 };
+        let u = 3 * vert[2 * near] as i32 + vert[2 * far] as i32 - CHROMA_ZERO as i32;
+        let v = 3 * vert[2 * near + 1] as i32 + vert[2 * far + 1] as i32 - CHROMA_ZERO as i32;
+        rgb_pixel(c, l, u, v, p);
+    }
+}
+
+fn rgb444_scalar(c: &InvCoefs, y: &[u8], u: &[u8], v: &[u8], dst: &mut [u8]) {
+    let zero = CHROMA_ZERO as i32;
+    for (((&l, &u), &v), p) in y.iter().zip(u).zip(v).zip(dst.chunks_exact_mut(4)) {
+        rgb_pixel(
+            c,
+            l,
+            ((u as i32) << CHROMA_BITS) - zero,
+            ((v as i32) << CHROMA_BITS) - zero,
+            p,
+        );
+    }
+}
+
+#[cfg(target_arch = "x86_64")]
+mod x86 {
+    use super::{ChromaRow, Coefs, InvCoefs, CHROMA_ZERO, UV_SHIFT, Y_SHIFT};
+    use std::arch::x86_64::*;
+
+    unsafe fn coef128(c: &[i16; 4]) -> __m128i {
+        _mm_setr_epi16(c[0], c[1], c[2], 0, c[0], c[1], c[2], 0)
+    }
+
+    /// 4 luma values from 4 pixels, as i32.
+    #[inline]
+    #[target_feature(enable = "sse4.1")]
+    unsafe fn luma4(p: __m128i, coef: __m128i, bias: __m128i) -> __m128i {
+        let zero = _mm_setzero_si128();
+        let lo = _mm_madd_epi16(_mm_unpacklo_epi8(p, zero), coef);
+        let hi = _mm_madd_epi16(_mm_unpackhi_epi8(p, zero), coef);
+        _mm_srai_epi32::<{ Y_SHIFT as i32 }>(_mm_add_epi32(_mm_hadd_epi32(lo, hi), bias))
+    }
+
+    #[target_feature(enable = "sse4.1")]
+    pub unsafe fn luma_sse41(c: &Coefs, src: &[u8], dst: &mut [u8]) -> usize {
+        let (coef, bias) = (coef128(&c.y), _mm_set1_epi32(c.y_bias));
+        let n = dst.len() / 16 * 16;
+        let (s, d) = (
+            src.as_ptr() as *const __m128i,
+            dst.as_mut_ptr() as *mut __m128i,
+        );
+        for i in 0..n / 16 {
+            let y0 = luma4(_mm_loadu_si128(s.add(4 * i)), coef, bias);
+            let y1 = luma4(_mm_loadu_si128(s.add(4 * i + 1)), coef, bias);
+            let y2 = luma4(_mm_loadu_si128(s.add(4 * i + 2)), coef, bias);
+            let y3 = luma4(_mm_loadu_si128(s.add(4 * i + 3)), coef, bias);
+            let y = _mm_packus_epi16(_mm_packs_epi32(y0, y1), _mm_packs_epi32(y2, y3));
+            _mm_storeu_si128(d.add(i), y);
+        }
+        n
+    }
+
+    /// 2x2 sums of 4 pixels from each of two rows, 2 blocks as i16.
+    #[inline]
+    #[target_feature(enable = "sse4.1")]
+    unsafe fn block_sums(a: __m128i, b: __m128i) -> __m128i {
+        let zero = _mm_setzero_si128();
+        let lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+        let hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+        _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi))
+    }
+
+    /// Stores 8 chroma pairs given as i32.
+    #[inline]
+    #[target_feature(enable = "sse4.1")]
+    unsafe fn store_chroma(
+        u: (__m128i, __m128i),
+        v: (__m128i, __m128i),
+        out: &mut ChromaRow,
+        i: usize,
+    ) {
+        let u = _mm_packs_epi32(u.0, u.1);
+        let v = _mm_packs_epi32(v.0, v.1);
+        match out {
+            ChromaRow::Nv12(uv) => {
+                let uv0 = _mm_unpacklo_epi16(u, v);
+                let uv1 = _mm_unpackhi_epi16(u, v);
+                let p = uv.as_mut_ptr().add(2 * i) as *mut __m128i;
+                _mm_storeu_si128(p, _mm_packus_epi16(uv0, uv1));
+            }
+            ChromaRow::I420(us, vs) => {
+                let b = _mm_packus_epi16(u, v);
+                _mm_storel_epi64(us.as_mut_ptr().add(i) as *mut __m128i, b);
+                _mm_storel_epi64(
+                    vs.as_mut_ptr().add(i) as *mut __m128i,
+                    _mm_srli_si128::<8>(b),
+                );
+            }
+        }
+    }
+
+    /// 4 chroma values from 8 pixels of each row, as i32.
+    #[inline]
+    #[target_feature(enable = "sse4.1")]
+    unsafe fn chroma4(
+        s0: *const __m128i,
+        s1: *const __m128i,
+        coef: __m128i,
+        bias: __m128i,
+    ) -> __m128i {
+        let a = block_sums(_mm_loadu_si128(s0), _mm_loadu_si128(s1));
+        let b = block_sums(_mm_loadu_si128(s0.add(1)), _mm_loadu_si128(s1.add(1)));
+        let x = _mm_hadd_epi32(_mm_madd_epi16(a, coef), _mm_madd_epi16(b, coef));
+        _mm_srai_epi32::<{ UV_SHIFT as i32 }>(_mm_add_epi32(x, bias))
+    }
+
+    #[target_feature(enable = "sse4.1")]
+    pub unsafe fn chroma_sse41(
+        c: &Coefs,
+        s0: &[u8],
+        s1: &[u8],
+        width: usize,
+        out: &mut ChromaRow,
+    ) -> usize {
+        let (cu, cv, bias) = (coef128(&c.u), coef128(&c.v), _mm_set1_epi32(c.uv_bias));
+        let n = width / 16 * 8;
+        let (p0, p1) = (s0.as_ptr() as *const __m128i, s1.as_ptr() as *const __m128i);
+        for i in (0..n).step_by(8) {
+            let (a0, a1) = (p0.add(i / 2), p1.add(i / 2));
+            let (b0, b1) = (p0.add(i / 2 + 2), p1.add(i / 2 + 2));
+            let u = (chroma4(a0, a1, cu, bias), chroma4(b0, b1, cu, bias));
+            let v = (chroma4(a0, a1, cv, bias), chroma4(b0, b1, cv, bias));
+            store_chroma(u, v, out, i);
+        }
+        n
+    }
+
+    unsafe fn coef256(c: &[i16; 4]) -> __m256i {
+        _mm256_broadcastsi128_si256(coef128(c))
+    }
+
+    /// 8 luma values from 8 pixels, as i32 in order.
+    #[inline]
+    #[target_feature(enable = "avx2")]
+    unsafe fn luma8(p: __m256i, coef: __m256i, bias: __m256i) -> __m256i {
+        let zero = _mm256_setzero_si256();
+        let lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(p, zero), coef);
+        let hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(p, zero), coef);
+        _mm256_srai_epi32::<{ Y_SHIFT as i32 }>(_mm256_add_epi32(_mm256_hadd_epi32(lo, hi), bias))
+    }
+
+    #[target_feature(enable = "avx2")]
+    pub unsafe fn luma_avx2(c: &Coefs, src: &[u8], dst: &mut [u8]) -> usize {
+        let (coef, bias) = (coef256(&c.y), _mm256_set1_epi32(c.y_bias));
+        let order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+        let n = dst.len() / 32 * 32;
+        let (s, d) = (
+            src.as_ptr() as *const __m256i,
+            dst.as_mut_ptr() as *mut __m256i,
+        );
+        for i in 0..n / 32 {
+            let y0 = luma8(_mm256_loadu_si256(s.add(4 * i)), coef, bias);
+            let y1 = luma8(_mm256_loadu_si256(s.add(4 * i + 1)), coef, bias);
+            let y2 = luma8(_mm256_loadu_si256(s.add(4 * i + 2)), coef, bias);
+            let y3 = luma8(_mm256_loadu_si256(s.add(4 * i + 3)), coef, bias);
+            let y = _mm256_packus_epi16(_mm256_packs_epi32(y0, y1), _mm256_packs_epi32(y2, y3));
+            _mm256_storeu_si256(d.add(i), _mm256_permutevar8x32_epi32(y, order));
+        }
+        n
+    }
+
+    #[inline]
+    #[target_feature(enable = "avx2")]
+    unsafe fn block_sums256(a: __m256i, b: __m256i) -> __m256i {
+        let zero = _mm256_setzero_si256();
+        let lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+        let hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+        _mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), _mm256_unpackhi_epi64(lo, hi))
+    }
+
+    /// 8 chroma values from 16 pixels of each row, as i32 in order.
+    #[inline]
+    #[target_feature(enable = "avx2")]
+    unsafe fn chroma8(
+        s0: *const __m256i,
+        s1: *const __m256i,
+        coef: __m256i,
+        bias: __m256i,
+    ) -> __m256i {
+        let a = block_sums256(_mm256_loadu_si256(s0), _mm256_loadu_si256(s1));
+        let b = block_sums256(_mm256_loadu_si256(s0.add(1)), _mm256_loadu_si256(s1.add(1)));
+        let x = _mm256_hadd_epi32(_mm256_madd_epi16(a, coef), _mm256_madd_epi16(b, coef));
+        let x = _mm256_srai_epi32::<{ UV_SHIFT as i32 }>(_mm256_add_epi32(x, bias));
+        _mm256_permutevar8x32_epi32(x, _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7))
+    }
+
+    #[target_feature(enable = "avx2")]
+    pub unsafe fn chroma_avx2(
+        c: &Coefs,
+        s0: &[u8],
+        s1: &[u8],
+        width: usize,
+        out: &mut ChromaRow,
+    ) -> usize {
+        let (cu, cv, bias) = (coef256(&c.u), coef256(&c.v), _mm256_set1_epi32(c.uv_bias));
+        let n = width / 16 * 8;
+        let (p0, p1) = (s0.as_ptr() as *const __m256i, s1.as_ptr() as *const __m256i);
+        for i in (0..n).step_by(8) {
+            let (a0, a1) = (p0.add(i / 4), p1.add(i / 4));
+            let u = chroma8(a0, a1, cu, bias);
+            let v = chroma8(a0, a1, cv, bias);
+            let u = (_mm256_castsi256_si128(u), _mm256_extracti128_si256::<1>(u));
+            let v = (_mm256_castsi256_si128(v), _mm256_extracti128_si256::<1>(v));
+            store_chroma(u, v, out, i);
+        }
+        n
+    }
+
+    fn pair(a: i16, b: i16) -> i32 {
+        a as u16 as i32 | (b as i32) << 16
+    }
+
+    /// Per-pixel (U, V) pairs for 8 pixels from 4 chroma pairs at `p`.
+    #[inline]
+    #[target_feature(enable = "sse4.1")]
+    unsafe fn chroma_pairs(p: *const i16) -> (__m128i, __m128i) {
+        let near = _mm_loadu_si128(p as *const __m128i);
+        let left = _mm_loadu_si128(p.sub(2) as *const __m128i);
+        let right = _mm_loadu_si128(p.add(2) as *const __m128i);
+        let near = _mm_sub_epi16(
+            _mm_mullo_epi16(near, _mm_set1_epi16(3)),
+            _mm_set1_epi16(CHROMA_ZERO),
+        );
+        let even = _mm_add_epi16(near, left);
+        let odd = _mm_add_epi16(near, right);
+        (_mm_unpacklo_epi32(even, odd), _mm_unpackhi_epi32(even, odd))
+    }
+
+    /// R, G and B of 4 pixels as i32.
+    #[inline]
+    #[target_feature(enable = "sse4.1")]
+    unsafe fn rgb4(c: &InvCoefs, y: __m128i, uv: __m128i) -> (__m128i, __m128i, __m128i) {
+        let base = _mm_madd_epi16(y, _mm_set1_epi32(pair(c.y, 1 << (Y_SHIFT - 1))));
+        let r = _mm_madd_epi16(uv, _mm_set1_epi32(pair(0, c.rv)));
+        let g = _mm_madd_epi16(uv, _mm_set1_epi32(pair(c.gu, c.gv)));
+        let b = _mm_madd_epi16(uv, _mm_set1_epi32(pair(c.bu, 0)));
+        (
+            _mm_srai_epi32::<{ Y_SHIFT as i32 }>(_mm_add_epi32(base, r)),
+            _mm_srai_epi32::<{ Y_SHIFT as i32 }>(_mm_add_epi32(base, g)),
+            _mm_srai_epi32::<{ Y_SHIFT as i32 }>(_mm_add_epi32(base, b)),
+        )
+    }
+
+    /// Interleaves 8 pixels of R, G and B given as i16 into 2 vectors of 4
+    /// pixels.
+    #[inline]
+    #[target_feature(enable = "sse4.1")]
+    unsafe fn interleave(bgra: bool, r: __m128i, g: __m128i, b: __m128i) -> (__m128i, __m128i) {
+        let (first, third) = if bgra { (b, r) } else { (r, b) };
+        let t0 = _mm_packus_epi16(first, third);
+        let t1 = _mm_packus_epi16(g, _mm_set1_epi16(255));
+        let lo = _mm_unpacklo_epi8(t0, t1);
+        let hi = _mm_unpackhi_epi8(t0, t1);
+        (_mm_unpacklo_epi16(lo, hi), _mm_unpackhi_epi16(lo, hi))
+    }
+
+    #[target_feature(enable = "sse4.1")]
+    pub unsafe fn rgb_sse41(c: &InvCoefs, y: &[u8], vert: &[i16], dst: &mut [u8]) -> usize {
+        let n = y.len() / 8 * 8;
+        let (offset, one) = (_mm_set1_epi16(c.y_offset), _mm_set1_epi16(1));
+        let d = dst.as_mut_ptr() as *mut __m128i;
+        for x in (0..n).step_by(8) {
+            let (uv0, uv1) = chroma_pairs(vert.as_ptr().add(x + 2));
+            let l = _mm_loadl_epi64(y.as_ptr().add(x) as *const __m128i);
+            let l = _mm_sub_epi16(_mm_cvtepu8_epi16(l), offset);
+            let (r0, g0, b0) = rgb4(c, _mm_unpacklo_epi16(l, one), uv0);
+            let (r1, g1, b1) = rgb4(c, _mm_unpackhi_epi16(l, one), uv1);
+            let (p0, p1) = interleave(
+                c.bgra,
+                _mm_packs_epi32(r0, r1),
+                _mm_packs_epi32(g0, g1),
+                _mm_packs_epi32(b0, b1),
+            );
+            _mm_storeu_si128(d.add(x / 4), p0);
+            _mm_storeu_si128(d.add(x / 4 + 1), p1);
+        }
+        n
+    }
+
+    #[target_feature(enable = "avx2")]
+    pub unsafe fn rgb_avx2(c: &InvCoefs, y: &[u8], vert: &[i16], dst: &mut [u8]) -> usize {
+        let n = y.len() / 16 * 16;
+        let offset = _mm256_set1_epi16(c.y_offset);
+        let one = _mm256_set1_epi16(1);
+        let three = _mm256_set1_epi16(3);
+        let zero = _mm256_set1_epi16(CHROMA_ZERO);
+        let c_base = _mm256_set1_epi32(pair(c.y, 1 << (Y_SHIFT - 1)));
+        let c_r = _mm256_set1_epi32(pair(0, c.rv));
+        let c_g = _mm256_set1_epi32(pair(c.gu, c.gv));
+        let c_b = _mm256_set1_epi32(pair(c.bu, 0));
+        let alpha = _mm256_set1_epi16(255);
+        let d = dst.as_mut_ptr() as *mut __m256i;
+        for x in (0..n).step_by(16) {
+            let p = vert.as_ptr().add(x + 2);
+            let near = _mm256_loadu_si256(p as *const __m256i);
+            let left = _mm256_loadu_si256(p.sub(2) as *const __m256i);
+            let right = _mm256_loadu_si256(p.add(2) as *const __m256i);
+            let near = _mm256_sub_epi16(_mm256_mullo_epi16(near, three), zero);
+            let even = _mm256_add_epi16(near, left);
+            let odd = _mm256_add_epi16(near, right);
+            // pixels 0-3 and 8-11, 4-7 and 12-15
+            let uv0 = _mm256_unpacklo_epi32(even, odd);
+            let uv1 = _mm256_unpackhi_epi32(even, odd);
+            let l = _mm_loadu_si128(y.as_ptr().add(x) as *const __m128i);
+            let l = _mm256_sub_epi16(_mm256_cvtepu8_epi16(l), offset);
+            let base0 = _mm256_madd_epi16(_mm256_unpacklo_epi16(l, one), c_base);
+            let base1 = _mm256_madd_epi16(_mm256_unpackhi_epi16(l, one), c_base);
+            let channel = |k: __m256i| {
+                let a = _mm256_add_epi32(base0, _mm256_madd_epi16(uv0, k));
+                let b = _mm256_add_epi32(base1, _mm256_madd_epi16(uv1, k));
+                _mm256_packs_epi32(
+                    _mm256_srai_epi32::<{ Y_SHIFT as i32 }>(a),
+                    _mm256_srai_epi32::<{ Y_SHIFT as i32 }>(b),
+                )
+            };
+            let (r, g, b) = (channel(c_r), channel(c_g), channel(c_b));
+            let (first, third) = if c.bgra { (b, r) } else { (r, b) };
+            let t0 = _mm256_packus_epi16(first, third);
+            let t1 = _mm256_packus_epi16(g, alpha);
+            let lo = _mm256_unpacklo_epi8(t0, t1);
+            let hi = _mm256_unpackhi_epi8(t0, t1);
+            let p0 = _mm256_unpacklo_epi16(lo, hi);
+            let p1 = _mm256_unpackhi_epi16(lo, hi);
+            _mm256_storeu_si256(d.add(x / 8), _mm256_permute2x128_si256::<0x20>(p0, p1));
+            _mm256_storeu_si256(d.add(x / 8 + 1), _mm256_permute2x128_si256::<0x31>(p0, p1));
+        }
+        n
+    }
+}
+
+#[cfg(target_arch = "aarch64")]
+mod arm {
+    use super::{ChromaRow, Coefs, InvCoefs, CHROMA_ZERO, UV_SHIFT, Y_SHIFT};
+    use std::arch::aarch64::*;
+
+    #[inline(always)]
+    unsafe fn dot(c: &[i16; 4], p: [int16x8_t; 3], bias: int32x4_t) -> (int32x4_t, int32x4_t) {
+        let mut lo = vmlal_n_s16(bias, vget_low_s16(p[0]), c[0]);
+        let mut hi = vmlal_high_n_s16(bias, p[0], c[0]);
+        for k in 1..3 {
+            lo = vmlal_n_s16(lo, vget_low_s16(p[k]), c[k]);
+            hi = vmlal_high_n_s16(hi, p[k], c[k]);
+        }
+        (lo, hi)
+    }
+
+    #[target_feature(enable = "neon")]
+    pub unsafe fn luma_neon(c: &Coefs, src: &[u8], dst: &mut [u8]) -> usize {
+        let bias = vdupq_n_s32(c.y_bias);
+        let n = dst.len() / 8 * 8;
+        for i in (0..n).step_by(8) {
+            let p = vld4_u8(src.as_ptr().add(4 * i));
+            let w = |x: uint8x8_t| vreinterpretq_s16_u16(vmovl_u8(x));
+            let (lo, hi) = dot(&c.y, [w(p.0), w(p.1), w(p.2)], bias);
+            let y = vcombine_u16(
+                vqmovun_s32(vshrq_n_s32::<{ Y_SHIFT as i32 }>(lo)),
+                vqmovun_s32(vshrq_n_s32::<{ Y_SHIFT as i32 }>(hi)),
+            );
+            vst1_u8(dst.as_mut_ptr().add(i), vqmovn_u16(y));
+        }
+        n
+    }
+
+    #[target_feature(enable = "neon")]
+    pub unsafe fn chroma_neon(
+        c: &Coefs,
+        s0: &[u8],
+        s1: &[u8],
+        width: usize,
+        out: &mut ChromaRow,
+    ) -> usize {
+        let bias = vdupq_n_s32(c.uv_bias);
+        let n = width / 16 * 8;
+        for i in (0..n).step_by(8) {
+            let a = vld4q_u8(s0.as_ptr().add(8 * i));
+            let b = vld4q_u8(s1.as_ptr().add(8 * i));
+            let sum =
+                |x: uint8x16_t, y: uint8x16_t| vreinterpretq_s16_u16(vpadalq_u8(vpaddlq_u8(x), y));
+            let p = [sum(a.0, b.0), sum(a.1, b.1), sum(a.2, b.2)];
+            let narrow = |(lo, hi): (int32x4_t, int32x4_t)| {
+                vqmovn_u16(vcombine_u16(
+                    vqmovun_s32(vshrq_n_s32::<{ UV_SHIFT as i32 }>(lo)),
+                    vqmovun_s32(vshrq_n_s32::<{ UV_SHIFT as i32 }>(hi)),
+                ))
+            };
+            let u = narrow(dot(&c.u, p, bias));
+            let v = narrow(dot(&c.v, p, bias));
+            match out {
+                ChromaRow::Nv12(uv) => vst2_u8(uv.as_mut_ptr().add(2 * i), uint8x8x2_t(u, v)),
+                ChromaRow::I420(us, vs) => {
+                    vst1_u8(us.as_mut_ptr().add(i), u);
+                    vst1_u8(vs.as_mut_ptr().add(i), v);
+                }
+            }
+        }
+        n
+    }
+
+    /// R, G and B of 8 pixels.
+    #[inline(always)]
+    unsafe fn rgb8(c: &InvCoefs, y: int16x8_t, u: int16x8_t, v: int16x8_t) -> [uint8x8_t; 3] {
+        let half = |lo: bool, x: int16x8_t| {
+            if lo {
+                vget_low_s16(x)
+            } else {
+                vget_high_s16(x)
+            }
+        };
+        let channel = |ku: i16, kv: i16| {
+            let mut out = [vdupq_n_s32(0); 2];
+            for (i, o) in out.iter_mut().enumerate() {
+                let lo = i == 0;
+                let base = vmlal_n_s16(vdupq_n_s32(1 << (Y_SHIFT - 1)), half(lo, y), c.y);
+                let t = vmlal_n_s16(vmlal_n_s16(base, half(lo, u), ku), half(lo, v), kv);
+                *o = vshrq_n_s32::<{ Y_SHIFT as i32 }>(t);
+            }
+            vqmovn_u16(vcombine_u16(vqmovun_s32(out[0]), vqmovun_s32(out[1])))
+        };
+        [channel(0, c.rv), channel(c.gu, c.gv), channel(c.bu, 0)]
+    }
+
+    #[target_feature(enable = "neon")]
+    pub unsafe fn rgb_neon(c: &InvCoefs, y: &[u8], vert: &[i16], dst: &mut [u8]) -> usize {
+        let n = y.len() / 16 * 16;
+        let zero = vdupq_n_s16(CHROMA_ZERO);
+        let offset = vdupq_n_s16(c.y_offset);
+        for x in (0..n).step_by(16) {
+            let p = vert.as_ptr().add(x + 2);
+            let (near, left, right) = (vld2q_s16(p), vld2q_s16(p.sub(2)), vld2q_s16(p.add(2)));
+            let interp = |near: int16x8_t, left: int16x8_t, right: int16x8_t| {
+                let near = vsubq_s16(vmulq_n_s16(near, 3), zero);
+                vzipq_s16(vaddq_s16(near, left), vaddq_s16(near, right))
+            };
+            let u = interp(near.0, left.0, right.0);
+            let v = interp(near.1, left.1, right.1);
+            let l = vld1q_u8(y.as_ptr().add(x));
+            let y0 = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(l))), offset);
+            let y1 = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(l))), offset);
+            for (k, (y, u, v)) in [(y0, u.0, v.0), (y1, u.1, v.1)].into_iter().enumerate() {
+                let [r, g, b] = rgb8(c, y, u, v);
+                let (first, third) = if c.bgra { (b, r) } else { (r, b) };
+                let px = uint8x8x4_t(first, g, third, vdup_n_u8(255));
+                vst4_u8(dst.as_mut_ptr().add(4 * (x + 8 * k)), px);
+            }
+        }
+        n
+    }
+}
+
+/// Converts packed RGB frames to NV12 or I420.
+#[derive(Debug, Clone, Copy)]
+pub struct RgbToYuv {
+    coefs: Coefs,
+    simd: Simd,
+    threads: usize,
+}
+
+impl RgbToYuv {
+    pub fn new(format: RgbFormat, color: ColorSpace) -> Self {
+        Self {
+            coefs: Coefs::new(format, color),
+            simd: Simd::detect(),
+            threads: 0,
+        }
+    }
+
+    /// Uses `simd` instead of the detected instruction set, if supported.
+    pub fn with_simd(mut self, simd: Simd) -> Self {
+        if simd.supported() {
+            self.simd = simd;
+        }
+        self
+    }
+
+    /// Converts in `threads` bands of rows, 0 picks the number of CPUs for
+    /// frames above 4K and 1 below.
+    pub fn with_threads(mut self, threads: usize) -> Self {
+        self.threads = threads;
+        self
+    }
+
+    pub fn simd(&self) -> Simd {
+        self.simd
+    }
+
+    pub(crate) fn threads(&self) -> usize {
+        self.threads
+    }
+
+    /// Converts `width` x `height` pixels, rows `stride` bytes apart.
+    pub fn convert(
+        &self,
+        src: &[u8],
+        stride: usize,
+        width: usize,
+        height: usize,
+        dst: YuvPlanes,
+    ) -> Result<(), ()> {
+        let (cw, ch) = ((width + 1) / 2, (height + 1) / 2);
+        let fits = |len: usize, stride: usize, rows: usize, row: usize| {
+            stride >= row && len >= stride * (rows - 1) + row
+        };
+        if width == 0 || height == 0 || !fits(src.len(), stride, height, 4 * width) {
+            return Err(());
+        }
+        let ok = match &dst {
+            YuvPlanes::Nv12 {
+                y,
+                y_stride,
+                uv,
+                uv_stride,
+            } => fits(y.len(), *y_stride, height, width) && fits(uv.len(), *uv_stride, ch, 2 * cw),
+            YuvPlanes::I420 {
+                y,
+                y_stride,
+                u,
+                u_stride,
+                v,
+                v_stride,
+            } => {
+                fits(y.len(), *y_stride, height, width)
+                    && fits(u.len(), *u_stride, ch, cw)
+                    && fits(v.len(), *v_stride, ch, cw)
+            }
+        };
+        if !ok {
+            return Err(());
+        }
+        let threads = band_threads(self.threads, width, height);
+        // bands of whole chroma rows
+        let band = (ch + threads - 1) / threads;
+        let job = |first: usize, y: &mut [u8], y_stride: usize, mut chroma: BandChroma| {
+            let rows = band.min(ch - first);
+            self.band(
+                src,
+                stride,
+                height,
+                first,
+                rows,
+                0..width,
+                y,
+                y_stride,
+                &mut chroma,
+            );
+        };
+        match dst {
+            YuvPlanes::Nv12 {
+                y,
+                y_stride,
+                uv,
+                uv_stride,
+            } => {
+                let bands = y
+                    .chunks_mut(2 * band * y_stride)
+                    .zip(uv.chunks_mut(band * uv_stride))
+                    .enumerate()
+                    .map(|(i, (y, uv))| (i * band, y, BandChroma::Nv12(uv, uv_stride)));
+                run_bands(threads, bands, |(first, y, c)| job(first, y, y_stride, c));
+            }
+            YuvPlanes::I420 {
+                y,
+                y_stride,
+                u,
+                u_stride,
+                v,
+                v_stride,
+            } => {
+                let bands = y
+                    .chunks_mut(2 * band * y_stride)
+                    .zip(u.chunks_mut(band * u_stride))
+                    .zip(v.chunks_mut(band * v_stride))
+                    .enumerate()
+                    .map(|(i, ((y, u), v))| {
+                        (i * band, y, BandChroma::I420(u, u_stride, v, v_stride))
+                    });
+                run_bands(threads, bands, |(first, y, c)| job(first, y, y_stride, c));
+            }
+        }
+        Ok(())
+    }
+
+    /// Converts to full resolution chroma, each sample being what a 2x2
+    /// block of that pixel gets from `convert`.
+    pub fn convert_444(
+        &self,
+        src: &[u8],
+        stride: usize,
+        width: usize,
+        height: usize,
+        dst: Yuv444Planes,
+    ) -> Result<(), ()> {
+        let fits = |len: usize, stride: usize, rows: usize, row: usize| {
+            stride >= row && len >= stride * (rows - 1) + row
+        };
+        let s = dst.stride;
+        if width == 0
+            || height == 0
+            || !fits(src.len(), stride, height, 4 * width)
+            || [dst.y.len(), dst.u.len(), dst.v.len()]
+                .iter()
+                .any(|&len| !fits(len, s, height, width))
+        {
+            return Err(());
+        }
+        // a single pixel's chroma is a luma-like dot product, with the 2
+        // bits of the 2x2 sum folded into the bias
+        let bias = (128 << Y_SHIFT) + (1 << (Y_SHIFT - 1));
+        let u_coefs = Coefs {
+            y: self.coefs.u,
+            y_bias: bias,
+            ..self.coefs
+        };
+        let v_coefs = Coefs {
+            y: self.coefs.v,
+            y_bias: bias,
+            ..self.coefs
+        };
+        let threads = band_threads(self.threads, width, height);
+        let band = (height + threads - 1) / threads;
+        let bands = dst
+            .y
+            .chunks_mut(band * s)
+            .zip(dst.u.chunks_mut(band * s))
+            .zip(dst.v.chunks_mut(band * s))
+            .enumerate();
+        run_bands(threads, bands, |(i, ((y, u), v))| {
+            for r in 0..band.min(height - i * band) {
+                let row = &src[(i * band + r) * stride..][..4 * width];
+                self.luma(&self.coefs, row, &mut y[r * s..][..width]);
+                self.luma(&u_coefs, row, &mut u[r * s..][..width]);
+                self.luma(&v_coefs, row, &mut v[r * s..][..width]);
+            }
+        });
+        Ok(())
+    }
+
+    /// Converts chroma rows `first..first + rows` between pixel columns
+    /// `columns`, starting at an even one; `y` and `chroma` begin at the
+    /// band. Blocks of 2x2 pixels are independent, so the pixels around
+    /// are not needed.
+    #[allow(clippy::too_many_arguments)]
+    pub(crate) fn band(
+        &self,
+        src: &[u8],
+        stride: usize,
+        height: usize,
+        first: usize,
+        rows: usize,
+        columns: Range<usize>,
+        y: &mut [u8],
+        y_stride: usize,
+        chroma: &mut BandChroma,
+    ) {
+        let (x0, width) = (columns.start, columns.len());
+        let cw = (width + 1) / 2;
+        for r in 0..rows {
+            let row = 2 * (first + r);
+            let s0 = &src[row * stride + 4 * x0..][..4 * width];
+            let two = row + 1 < height;
+            let s1 = if two {
+                &src[(row + 1) * stride + 4 * x0..][..4 * width]
+            } else {
+                s0
+            };
+            let mut out = match chroma {
+                BandChroma::Nv12(uv, stride) => {
+                    ChromaRow::Nv12(&mut uv[r * *stride + x0..][..2 * cw])
+                }
+                BandChroma::I420(u, us, v, vs) => ChromaRow::I420(
+                    &mut u[r * *us + x0 / 2..][..cw],
+                    &mut v[r * *vs + x0 / 2..][..cw],
+                ),
+            };
+            self.luma(&self.coefs, s0, &mut y[2 * r * y_stride + x0..][..width]);
+            if two {
+                self.luma(
+                    &self.coefs,
+                    s1,
+                    &mut y[(2 * r + 1) * y_stride + x0..][..width],
+                );
+            }
+            self.chroma(s0, s1, width, &mut out);
+        }
+    }
+
+    fn luma(&self, c: &Coefs, src: &[u8], dst: &mut [u8]) {
+        let done = unsafe {
+            match self.simd {
+                #[cfg(target_arch = "x86_64")]
+                Simd::Avx2 => x86::luma_avx2(c, src, dst),
+                #[cfg(target_arch = "x86_64")]
+                Simd::Sse41 => x86::luma_sse41(c, src, dst),
+                #[cfg(target_arch = "aarch64")]
+                Simd::Neon => arm::luma_neon(c, src, dst),
+                _ => 0,
+            }
+        };
+        luma_scalar(c, src, dst, done);
+    }
+
+    fn chroma(&self, s0: &[u8], s1: &[u8], width: usize, out: &mut ChromaRow) {
+        let c = &self.coefs;
+        let done = unsafe {
+            match self.simd {
+                #[cfg(target_arch = "x86_64")]
+                Simd::Avx2 => x86::chroma_avx2(c, s0, s1, width, out),
+                #[cfg(target_arch = "x86_64")]
+                Simd::Sse41 => x86::chroma_sse41(c, s0, s1, width, out),
+                #[cfg(target_arch = "aarch64")]
+                Simd::Neon => arm::chroma_neon(c, s0, s1, width, out),
+                _ => 0,
+            }
+        };
+        chroma_scalar(c, s0, s1, width, out, done);
+    }
+}
+
+/// Converts NV12 or I420 frames to packed RGB.
+#[derive(Debug, Clone, Copy)]
+pub struct YuvToRgb {
+    coefs: InvCoefs,
+    simd: Simd,
+    threads: usize,
+}
+
+impl YuvToRgb {
+    pub fn new(format: RgbFormat, color: ColorSpace) -> Self {
+        Self {
+            coefs: InvCoefs::new(format, color),
+            simd: Simd::detect(),
+            threads: 0,
+        }
+    }
+
+    /// As `RgbToYuv::with_simd`.
+    pub fn with_simd(mut self, simd: Simd) -> Self {
+        if simd.supported() {
+            self.simd = simd;
+        }
+        self
+    }
+
+    /// As `RgbToYuv::with_threads`.
+    pub fn with_threads(mut self, threads: usize) -> Self {
+        self.threads = threads;
+        self
+    }
+
+    pub fn simd(&self) -> Simd {
+        self.simd
+    }
+
+    /// Converts `width` x `height` pixels into `dst`, rows `dst_stride` bytes
+    /// apart, such as a mapped streaming texture.
+    pub fn convert(
+        &self,
+        src: YuvSource,
+        width: usize,
+        height: usize,
+        dst: &mut [u8],
+        dst_stride: usize,
+    ) -> Result<(), ()> {
+        let (cw, ch) = ((width + 1) / 2, (height + 1) / 2);
+        let fits = |len: usize, stride: usize, rows: usize, row: usize| {
+            stride >= row && len >= stride * (rows - 1) + row
+        };
+        if width == 0 || height == 0 || !fits(dst.len(), dst_stride, height, 4 * width) {
+            return Err(());
+        }
+        let (y, y_stride) = match src {
+            YuvSource::Nv12 {
+                y,
+                y_stride,
+                uv,
+                uv_stride,
+            } => {
+                if !fits(uv.len(), uv_stride, ch, 2 * cw) {
+                    return Err(());
+                }
+                (y, y_stride)
+            }
+            YuvSource::I420 {
+                y,
+                y_stride,
+                u,
+                u_stride,
+                v,
+                v_stride,
+            } => {
+                if !fits(u.len(), u_stride, ch, cw) || !fits(v.len(), v_stride, ch, cw) {
+                    return Err(());
+                }
+                (y, y_stride)
+            }
+        };
+        if !fits(y.len(), y_stride, height, width) {
+            return Err(());
+        }
+        let threads = band_threads(self.threads, width, height);
+        let band = (height + threads - 1) / threads;
+        let bands = dst.chunks_mut(band * dst_stride).enumerate();
+        run_bands(threads, bands, |(i, dst)| {
+            let mut vert = vec![0i16; 2 * cw + 4];
+            for r in 0..band.min(height - i * band) {
+                let row = i * band + r;
+                chroma_vertical(&src, cw, ch, row, &mut vert);
+                let y = &y[row * y_stride..][..width];
+                self.row(y, &vert, &mut dst[r * dst_stride..][..4 * width]);
+            }
+        });
+        Ok(())
+    }
+
+    /// Converts full resolution chroma, which needs no interpolation.
+    pub fn convert_444(
+        &self,
+        src: Yuv444Source,
+        width: usize,
+        height: usize,
+        dst: &mut [u8],
+        dst_stride: usize,
+    ) -> Result<(), ()> {
+        let fits = |len: usize, stride: usize, rows: usize, row: usize| {
+            stride >= row && len >= stride * (rows - 1) + row
+        };
+        let s = src.stride;
+        if width == 0
+            || height == 0
+            || !fits(dst.len(), dst_stride, height, 4 * width)
+            || [src.y.len(), src.u.len(), src.v.len()]
+                .iter()
+                .any(|&len| !fits(len, s, height, width))
+        {
+            return Err(());
+        }
+        let threads = band_threads(self.threads, width, height);
+        let band = (height + threads - 1) / threads;
+        let bands = dst.chunks_mut(band * dst_stride).enumerate();
+        run_bands(threads, bands, |(i, dst)| {
+            for r in 0..band.min(height - i * band) {
+                let at = (i * band + r) * s;
+                rgb444_scalar(
+                    &self.coefs,
+                    &src.y[at..][..width],
+                    &src.u[at..][..width],
+                    &src.v[at..][..width],
+                    &mut dst[r * dst_stride..][..4 * width],
+                );
+            }
+        });
+        Ok(())
+    }
+
+    fn row(&self, y: &[u8], vert: &[i16], dst: &mut [u8]) {
+        let c = &self.coefs;
+        let done = unsafe {
+            match self.simd {
+                #[cfg(target_arch = "x86_64")]
+                Simd::Avx2 => x86::rgb_avx2(c, y, vert, dst),
+                #[cfg(target_arch = "x86_64")]
+                Simd::Sse41 => x86::rgb_sse41(c, y, vert, dst),
+                #[cfg(target_arch = "aarch64")]
+                Simd::Neon => arm::rgb_neon(c, y, vert, dst),
+                _ => 0,
+            }
+        };
+        rgb_scalar(c, y, vert, dst, done);
+    }
+}
+
+pub(crate) enum BandChroma<'a> {
+    Nv12(&'a mut [u8], usize),
+    I420(&'a mut [u8], usize, &'a mut [u8], usize),
+}
+
+pub(crate) fn band_threads(threads: usize, width: usize, height: usize) -> usize {
+    let n = match threads {
+        0 if width * height > 3840 * 2160 => thread::available_parallelism().map_or(1, |n| n.get()),
+        0 => 1,
+        n => n,
+    };
+    n.clamp(1, (height + 1) / 2)
+}
+
+pub(crate) fn run_bands<T: Send>(
+    threads: usize,
+    bands: impl Iterator<Item = T>,
+    job: impl Fn(T) + Sync,
+) {
+    if threads <= 1 {
+        bands.for_each(job);
+    } else {
+        let job = &job;
+        thread::scope(|s| {
+            for b in bands {
+                s.spawn(move || job(b));
+            }
+        });
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const SIMDS: [Simd; 3] = [Simd::Sse41, Simd::Avx2, Simd::Neon];
+    /// Odd sizes, wide enough for the vector loops and their tails.
+    const SIZES: [(usize, usize); 4] = [(1, 1), (3, 5), (37, 9), (101, 33)];
+
+    fn color_spaces() -> impl Iterator<Item = ColorSpace> {
+        [false, true].into_iter().flat_map(|bt709| {
+            [false, true]
+                .into_iter()
+                .map(move |full_range| ColorSpace { bt709, full_range })
+        })
+    }
+
+    fn noise(len: usize, seed: u32) -> Vec<u8> {
+        let mut x = seed | 1;
+        (0..len)
+            .map(|_| {
+                x ^= x << 13;
+                x ^= x >> 17;
+                x ^= x << 5;
+                (x >> 24) as u8
+            })
+            .collect()
+    }
+
+    /// NV12 and I420 output of `c`, planes padded to catch stray writes.
+    fn to_yuv(c: &RgbToYuv, src: &[u8], width: usize, height: usize) -> [Vec<u8>; 3] {
+        let (cw, ch) = ((width + 1) / 2, (height + 1) / 2);
+        let (ys, cs) = (width + 3, cw + 5);
+        let mut y = vec![0xAA; ys * height];
+        let mut uv = vec![0xAA; 2 * cs * ch];
+        c.convert(
+            src,
+            width * 4 + 8,
+            width,
+            height,
+            YuvPlanes::Nv12 {
+                y: &mut y,
+                y_stride: ys,
+                uv: &mut uv,
+                uv_stride: 2 * cs,
+            },
+        )
+        .unwrap();
+        let mut i420 = vec![0xAA; ys * height + 2 * cs * ch];
+        let (iy, chroma) = i420.split_at_mut(ys * height);
+        let (u, v) = chroma.split_at_mut(cs * ch);
+        c.convert(
+            src,
+            width * 4 + 8,
+            width,
+            height,
+            YuvPlanes::I420 {
+                y: iy,
+                y_stride: ys,
+                u,
+                u_stride: cs,
+                v,
+                v_stride: cs,
+            },
+        )
+        .unwrap();
+        [y, uv, i420]
+    }
+
+    #[test]
+    fn rgb_to_yuv_simd_matches_scalar() {
+        for format in [RgbFormat::Bgra, RgbFormat::Rgba] {
+            for color in color_spaces() {
+                for (width, height) in SIZES {
+                    let src = noise((width * 4 + 8) * height, (width * height) as u32);
+                    let reference = RgbToYuv::new(format, color)
+                        .with_simd(Simd::None)
+                        .with_threads(1);
+                    assert_eq!(reference.simd(), Simd::None);
+                    let expected = to_yuv(&reference, &src, width, height);
+                    for simd in SIMDS.into_iter().filter(|s| s.supported()) {
+                        for threads in [1, 2, 3, 0] {
+                            let c = RgbToYuv::new(format, color)
+                                .with_simd(simd)
+                                .with_threads(threads);
+                            assert!(
+                                to_yuv(&c, &src, width, height) == expected,
+                                "{:?} {:?} {}x{} {:?} threads {}",
+                                format,
+                                color,
+                                width,
+                                height,
+                                simd,
+                                threads
+                            );
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    /// BGRA or RGBA output of `c` for NV12 and I420 input, rows padded.
+    fn to_rgb(c: &YuvToRgb, yuv: &[u8], width: usize, height: usize) -> [Vec<u8>; 2] {
+        let (cw, ch) = ((width + 1) / 2, (height + 1) / 2);
+        let (ys, cs) = (width + 3, cw + 5);
+        let (y, chroma) = yuv.split_at(ys * height);
+        let (u, v) = chroma.split_at(cs * ch);
+        let stride = width * 4 + 8;
+        let mut nv12 = vec![0xAA; stride * height];
+        let src = YuvSource::Nv12 {
+            y,
+            y_stride: ys,
+            uv: chroma,
+            uv_stride: 2 * cs,
+        };
+        c.convert(src, width, height, &mut nv12, stride).unwrap();
+        let mut i420 = vec![0xAA; stride * height];
+        let src = YuvSource::I420 {
+            y,
+            y_stride: ys,
+            u,
+            u_stride: cs,
+            v: &v[..cs * ch],
+            v_stride: cs,
+        };
+        c.convert(src, width, height, &mut i420, stride).unwrap();
+        [nv12, i420]
+    }
+
+    #[test]
+    fn yuv_to_rgb_simd_matches_scalar() {
+        for format in [RgbFormat::Bgra, RgbFormat::Rgba] {
+            for color in color_spaces() {
+                for (width, height) in SIZES {
+                    let (cw, ch) = ((width + 1) / 2, (height + 1) / 2);
+                    let len = (width + 3) * height + 2 * (cw + 5) * ch;
+                    let yuv = noise(len, (width * height) as u32);
+                    let reference = YuvToRgb::new(format, color)
+                        .with_simd(Simd::None)
+                        .with_threads(1);
+                    assert_eq!(reference.simd(), Simd::None);
+                    let expected = to_rgb(&reference, &yuv, width, height);
+                    for simd in SIMDS.into_iter().filter(|s| s.supported()) {
+                        for threads in [1, 2, 3, 0] {
+                            let c = YuvToRgb::new(format, color)
+                                .with_simd(simd)
+                                .with_threads(threads);
+                            assert!(
+                                to_rgb(&c, &yuv, width, height) == expected,
+                                "{:?} {:?} {}x{} {:?} threads {}",
+                                format,
+                                color,
+                                width,
+                                height,
+                                simd,
+                                threads
+                            );
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    /// 4:4:4 planes of `c`, rows padded to catch stray writes.
+    fn to_yuv444(c: &RgbToYuv, src: &[u8], width: usize, height: usize) -> [Vec<u8>; 3] {
+        let stride = width + 3;
+        let mut planes = [0, 1, 2].map(|_| vec![0xAA; stride * height]);
+        let [y, u, v] = &mut planes;
+        c.convert_444(
+            src,
+            width * 4 + 8,
+            width,
+            height,
+            Yuv444Planes { y, u, v, stride },
+        )
+        .unwrap();
+        planes
+    }
+
+    #[test]
+    fn rgb_to_yuv444_simd_matches_scalar() {
+        for format in [RgbFormat::Bgra, RgbFormat::Rgba] {
+            for color in color_spaces() {
+                for (width, height) in SIZES {
+                    let src = noise((width * 4 + 8) * height, (width * height) as u32);
+                    let reference = RgbToYuv::new(format, color)
+                        .with_simd(Simd::None)
+                        .with_threads(1);
+                    let expected = to_yuv444(&reference, &src, width, height);
+                    for simd in SIMDS.into_iter().filter(|s| s.supported()) {
+                        for threads in [1, 2, 3, 0] {
+                            let c = RgbToYuv::new(format, color)
+                                .with_simd(simd)
+                                .with_threads(threads);
+                            assert!(
+                                to_yuv444(&c, &src, width, height) == expected,
+                                "{:?} {:?} {}x{} {:?} threads {}",
+                                format,
+                                color,
+                                width,
+                                height,
+                                simd,
+                                threads
+                            );
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn yuv444_to_rgb_bands_match() {
+        for format in [RgbFormat::Bgra, RgbFormat::Rgba] {
+            for color in color_spaces() {
+                for (width, height) in SIZES {
+                    let stride = width + 3;
+                    let yuv = noise(3 * stride * height, (width * height) as u32);
+                    let (y, uv) = yuv.split_at(stride * height);
+                    let (u, v) = uv.split_at(stride * height);
+                    let src = Yuv444Source { y, u, v, stride };
+                    let rgb = |c: YuvToRgb| {
+                        let mut dst = vec![0xAA; (width * 4 + 8) * height];
+                        c.convert_444(src, width, height, &mut dst, width * 4 + 8)
+                            .unwrap();
+                        dst
+                    };
+                    let expected = rgb(YuvToRgb::new(format, color)
+                        .with_simd(Simd::None)
+                        .with_threads(1));
+                    for simd in [Simd::None].into_iter().chain(SIMDS) {
+                        for threads in [1, 2, 3, 0] {
+                            let c = YuvToRgb::new(format, color)
+                                .with_simd(simd)
+                                .with_threads(threads);
+                            assert!(
+                                rgb(c) == expected,
+                                "{:?} {:?} {}x{} {:?} threads {}",
+                                format,
+                                color,
+                                width,
+                                height,
+                                simd,
+                                threads
+                            );
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
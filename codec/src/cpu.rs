@@ -0,0 +1,423 @@
+//! A software stand-in for the GPU backends, so the wrapper logic can be
+//! exercised without a GPU. The decoder produces no pixels: it parses every
+//! packet and reports one frame per decodable access unit. The encoder
+//! ignores its input and codes a flat grey H.264 stream, IDR pictures of
+//! DC-predicted macroblocks and P pictures of skipped ones, following the
+//! GOP and keyframe requests like a hardware encoder.
+
+use crate::{
+    bits::BitWriter,
+    nal,
+    parser::{Parser, PictureType},
+};
+use gpu_common::{
+    inner::{DecodeCalls, EncodeCalls},
+    AdapterDesc, DataFormat,
+    DataFormat::*,
+    DecodeCallback, EncodeCallback,
+};
+use std::{
+    cell::Cell,
+    os::raw::{c_int, c_void},
+    ptr::null_mut,
+    slice::from_raw_parts,
+};
+
+thread_local! {
+    static DECODE_FAILURES: Cell<u32> = Cell::new(0);
+}
+
+/// Makes the next `count` pictures decoded by CPU decoders on the calling
+/// thread fail, for exercising error handling. A failed reference picture
+/// breaks the inter frames that follow until the next IDR.
+pub fn fail_decodes(count: u32) {
+    DECODE_FAILURES.with(|f| f.set(count));
+}
+
+pub fn decode_calls() -> DecodeCalls {
+    DecodeCalls {
+        new: cpu_new_decoder,
+        decode: cpu_decode,
+        destroy: cpu_destroy_decoder,
+        test: cpu_test_decode,
+    }
+}
+
+pub fn encode_calls() -> EncodeCalls {
+    EncodeCalls {
+        new: cpu_new_encoder,
+        encode: cpu_encode,
+        destroy: cpu_destroy_encoder,
+        test: cpu_test_encode,
+        set_bitrate: cpu_set_bitrate,
+        set_framerate: cpu_set_framerate,
+        request_keyframe: cpu_request_keyframe,
+    }
+}
+
+pub(crate) fn data_format(v: i32) -> Option<DataFormat> {
+    [H264, H265, VP8, VP9, AV1]
+        .iter()
+        .find(|&&f| f as i32 == v)
+        .copied()
+}
+
+struct CpuDecoder {
+    parser: Parser,
+    /// Whether a picture that inter frames can predict from was decoded
+    /// since the last error.
+    has_reference: bool,
+}
+
+impl CpuDecoder {
+    /// Fails like a hardware decoder would on a slice header that does not
+    /// parse, and on inter frames without a valid reference, or when told to
+    /// by `fail_decodes`.
+    fn decode(&mut self, data: &[u8]) -> Result<bool, c_int> {
+        let info = self.parser.parse(data);
+        if info.slices.count == 0 {
+            return Ok(false);
+        }
+        if info.qp.is_none() {
+            self.has_reference = false;
+            return Err(-1);
+        }
+        if DECODE_FAILURES.with(|f| f.replace(f.get().saturating_sub(1))) > 0 {
+            if info.reference {
+                self.has_reference = false;
+            }
+            return Err(-1);
+        }
+        match info.picture_type {
+            PictureType::Idr => self.has_reference = true,
+            PictureType::P | PictureType::B if !self.has_reference => return Err(-1),
+            _ => {}
+        }
+        Ok(true)
+    }
+}
+
+unsafe extern "C" fn cpu_new_decoder(
+    _device: *mut c_void,
+    _luid: i64,
+    _api: i32,
+    data_format: i32,
+    _output_shared_handle: bool,
+) -> *mut c_void {
+    match self::data_format(data_format) {
+        Some(f @ (H264 | H265 | AV1)) => Box::into_raw(Box::new(CpuDecoder {
+            parser: Parser::new(f),
+            has_reference: false,
+        })) as _,
+        _ => null_mut(),
+    }
+}
+
+unsafe extern "C" fn cpu_decode(
+    decoder: *mut c_void,
+    data: *mut u8,
+    length: i32,
+    callback: DecodeCallback,
+    obj: *mut c_void,
+) -> c_int {
+    if decoder.is_null() || data.is_null() || length <= 0 {
+        return -1;
+    }
+    let decoder = &mut *(decoder as *mut CpuDecoder);
+    match decoder.decode(from_raw_parts(data, length as usize)) {
+        Ok(true) => {
+            if let Some(callback) = callback {
+                callback(null_mut(), obj);
+            }
+            0
+        }
+        Ok(false) => 0,
+        Err(e) => e,
+    }
+}
+
+unsafe extern "C" fn cpu_destroy_decoder(decoder: *mut c_void) -> c_int {
+    if !decoder.is_null() {
+        let _ = Box::from_raw(decoder as *mut CpuDecoder);
+    }
+    0
+}
+
+unsafe extern "C" fn cpu_test_decode(
+    out_descs: *mut c_void,
+    max_desc_num: i32,
+    out_desc_num: *mut i32,
+    api: i32,
+    data_format: i32,
+    output_shared_handle: bool,
+    data: *mut u8,
+    length: i32,
+) -> c_int {
+    let decoder = cpu_new_decoder(null_mut(), 0, api, data_format, output_shared_handle);
+    if decoder.is_null() {
+        return -1;
+    }
+    let ret = cpu_decode(decoder, data, length, None, null_mut());
+    cpu_destroy_decoder(decoder);
+    if ret != 0 || max_desc_num < 1 {
+        return -1;
+    }
+    *(out_descs as *mut AdapterDesc) = AdapterDesc { luid: 0 };
+    *out_desc_num = 1;
+    0
+}
+
+/// `log2_max_frame_num_minus4` of the SPS.
+const LOG2_MAX_FRAME_NUM: u32 = 4;
+
+struct CpuEncoder {
+    width: u32,
+    height: u32,
+    gop: u32,
+    /// Frames since the last IDR.
+    frame: u32,
+    idr_pic_id: u32,
+    force_idr: bool,
+    buf: Vec<u8>,
+}
+
+/// Appends a NAL unit with the RBSP of `w` to `out`.
+fn put_nal(out: &mut Vec<u8>, header: u8, mut w: BitWriter) {
+    w.trailing_bits();
+    out.extend_from_slice(&[0, 0, 0, 1, header]);
+    nal::escape(&w.into_bytes(), out);
+}
+
+impl CpuEncoder {
+    fn width_in_mbs(&self) -> u32 {
+        (self.width + 15) / 16
+    }
+
+    fn height_in_mbs(&self) -> u32 {
+        (self.height + 15) / 16
+    }
+
+    /// Constrained baseline, CAVLC, one reference frame and picture order
+    /// following decoding order.
+    fn put_sps(&self, out: &mut Vec<u8>) {
+        let mut w = BitWriter::new();
+        w.u(8, 66); // profile_idc
+        w.u(8, 0xC0); // constraint_set0_flag, constraint_set1_flag
+        w.u(8, 51); // level_idc
+        w.ue(0); // seq_parameter_set_id
+        w.ue(LOG2_MAX_FRAME_NUM - 4);
+        w.ue(2); // pic_order_cnt_type
+        w.ue(1); // max_num_ref_frames
+        w.flag(false); // gaps_in_frame_num_value_allowed_flag
+        w.ue(self.width_in_mbs() - 1);
+        w.ue(self.height_in_mbs() - 1);
+        w.flag(true); // frame_mbs_only_flag
+        w.flag(true); // direct_8x8_inference_flag
+        let (crop_x, crop_y) = (
+            (self.width_in_mbs() * 16 - self.width) / 2,
+            (self.height_in_mbs() * 16 - self.height) / 2,
+        );
+        w.flag(crop_x > 0 || crop_y > 0);
+        if crop_x > 0 || crop_y > 0 {
+            w.ue(0);
+            w.ue(crop_x);
+            w.ue(0);
+            w.ue(crop_y);
+        }
+        w.flag(false); // vui_parameters_present_flag
+        put_nal(out, 0x60 | nal::H264_NAL_SPS, w);
+    }
+
+    fn put_pps(&self, out: &mut Vec<u8>) {
+        let mut w = BitWriter::new();
+        w.ue(0); // pic_parameter_set_id
+        w.ue(0); // seq_parameter_set_id
+        w.flag(false); // entropy_coding_mode_flag
+        w.flag(false); // bottom_field_pic_order_in_frame_present_flag
+        w.ue(0); // num_slice_groups_minus1
+        w.ue(0); // num_ref_idx_l0_default_active_minus1
+        w.ue(0); // num_ref_idx_l1_default_active_minus1
+        w.flag(false); // weighted_pred_flag
+        w.u(2, 0); // weighted_bipred_idc
+        w.se(0); // pic_init_qp_minus26
+        w.se(0); // pic_init_qs_minus26
+        w.se(0); // chroma_qp_index_offset
+        w.flag(true); // deblocking_filter_control_present_flag
+        w.flag(false); // constrained_intra_pred_flag
+        w.flag(false); // redundant_pic_cnt_present_flag
+        put_nal(out, 0x60 | nal::H264_NAL_PPS, w);
+    }
+
+    fn put_slice(&self, out: &mut Vec<u8>, idr: bool) {
+        let mbs = self.width_in_mbs() * self.height_in_mbs();
+        let mut w = BitWriter::new();
+        w.ue(0); // first_mb_in_slice
+        w.ue(if idr { 7 } else { 5 }); // slice_type, I or P for the whole picture
+        w.ue(0); // pic_parameter_set_id
+        w.u(LOG2_MAX_FRAME_NUM, self.frame % (1 << LOG2_MAX_FRAME_NUM));
+        if idr {
+            w.ue(self.idr_pic_id);
+            w.flag(false); // no_output_of_prior_pics_flag
+            w.flag(false); // long_term_reference_flag
+        } else {
+            w.flag(false); // num_ref_idx_active_override_flag
+            w.flag(false); // ref_pic_list_modification_flag_l0
+            w.flag(false); // adaptive_ref_pic_marking_mode_flag
+        }
+        w.se(0); // slice_qp_delta
+        w.ue(1); // disable_deblocking_filter_idc
+        if idr {
+            for _ in 0..mbs {
+                w.ue(3); // mb_type I_16x16_2_0_0, DC prediction, no AC
+                w.ue(0); // intra_chroma_pred_mode, DC
+                w.se(0); // mb_qp_delta
+                w.u(1, 1); // coeff_token of the empty luma DC block
+            }
+        } else {
+            w.ue(mbs); // mb_skip_run
+        }
+        let header = if idr {
+            0x60 | nal::H264_NAL_IDR
+        } else {
+            0x40 | nal::H264_NAL_SLICE
+        };
+        put_nal(out, header, w);
+    }
+
+    /// Codes the next picture into `buf`, returns whether it is an IDR.
+    fn encode(&mut self) -> bool {
+        let idr = self.force_idr || self.frame == 0 || (self.gop > 0 && self.frame >= self.gop);
+        if idr {
+            if self.frame > 0 {
+                self.idr_pic_id = (self.idr_pic_id + 1) % 65536;
+            }
+            self.frame = 0;
+            self.force_idr = false;
+        }
+        let mut out = std::mem::take(&mut self.buf);
+        out.clear();
+        if idr {
+            self.put_sps(&mut out);
+            self.put_pps(&mut out);
+        }
+        self.put_slice(&mut out, idr);
+        self.buf = out;
+        self.frame += 1;
+        idr
+    }
+}
+
+unsafe extern "C" fn cpu_new_encoder(
+    _hdl: *mut c_void,
+    _luid: i64,
+    _device_type: i32,
+    codec_id: i32,
+    width: i32,
+    height: i32,
+    _bitrate: i32,
+    _framerate: i32,
+    gop: i32,
+    _chroma: i32,
+    _range: i32,
+) -> *mut c_void {
+    if self::data_format(codec_id) != Some(H264) || width <= 0 || height <= 0 {
+        return null_mut();
+    }
+    Box::into_raw(Box::new(CpuEncoder {
+        width: width as u32,
+        height: height as u32,
+        gop: gop.max(0) as u32,
+        frame: 0,
+        idr_pic_id: 0,
+        force_idr: false,
+        buf: Vec::new(),
+    })) as _
+}
+
+unsafe extern "C" fn cpu_encode(
+    encoder: *mut c_void,
+    _tex: *mut c_void,
+    callback: EncodeCallback,
+    obj: *mut c_void,
+) -> c_int {
+    if encoder.is_null() {
+        return -1;
+    }
+    let encoder = &mut *(encoder as *mut CpuEncoder);
+    let key = encoder.encode();
+    if let Some(callback) = callback {
+        callback(encoder.buf.as_ptr(), encoder.buf.len() as _, key as _, obj);
+    }
+    0
+}
+
+unsafe extern "C" fn cpu_destroy_encoder(encoder: *mut c_void) -> c_int {
+    if !encoder.is_null() {
+        let _ = Box::from_raw(encoder as *mut CpuEncoder);
+    }
+    0
+}
+
+unsafe extern "C" fn cpu_test_encode(
+    out_descs: *mut c_void,
+    max_desc_num: i32,
+    out_desc_num: *mut i32,
+    api: i32,
+    data_format: i32,
+    width: i32,
+    height: i32,
+    kbs: i32,
+    framerate: i32,
+    gop: i32,
+    chroma: i32,
+    range: i32,
+) -> c_int {
+    let encoder = cpu_new_encoder(
+        null_mut(),
+        0,
+        api,
+        data_format,
+        width,
+        height,
+        kbs,
+        framerate,
+        gop,
+        chroma,
+        range,
+    );
+    if encoder.is_null() {
+        return -1;
+    }
+    let ret = cpu_encode(encoder, null_mut(), None, null_mut());
+    cpu_destroy_encoder(encoder);
+    if ret != 0 || max_desc_num < 1 {
+        return -1;
+    }
+    *(out_descs as *mut AdapterDesc) = AdapterDesc { luid: 0 };
+    *out_desc_num = 1;
+    0
+}
+
+unsafe extern "C" fn cpu_set_bitrate(encoder: *mut c_void, _kbs: i32) -> c_int {
+    if encoder.is_null() {
+        -1
+    } else {
+        0
+    }
+}
+
+unsafe extern "C" fn cpu_set_framerate(encoder: *mut c_void, _framerate: i32) -> c_int {
+    if encoder.is_null() {
+        -1
+    } else {
+        0
+    }
+}
+
+unsafe extern "C" fn cpu_request_keyframe(encoder: *mut c_void) -> c_int {
+    if encoder.is_null() {
+        return -1;
+    }
+    (*(encoder as *mut CpuEncoder)).force_idr = true;
+    0
+}
@@ -0,0 +1,138 @@
+//! Conformance cropping of H.264 and HEVC sequence parameter sets, so that
+//! pictures coded at a padded size show at their real one.
+
+use crate::{
+    bits::{BitReader, BitWriter},
+    filter::BitstreamFilter,
+    nal, params,
+};
+use gpu_common::DataFormat::{self, *};
+
+/// The smallest size of at least `width` x `height` a crop window in units
+/// of `units` pixels can show. 4:2:0 crops in 2-pixel units, so odd sizes
+/// keep one padding column or row.
+pub fn croppable_size(width: u32, height: u32, units: (u32, u32)) -> (u32, u32) {
+    let round = |v: u32, unit: u32| (v + unit - 1) / unit * unit;
+    (round(width, units.0), round(height, units.1))
+}
+
+/// Right and bottom offsets showing the top-left `width` x `height` of a
+/// `coded` picture, `None` if it is smaller.
+fn offsets(coded: (u32, u32), width: u32, height: u32, units: (u32, u32)) -> Option<[u32; 4]> {
+    let (w, h) = croppable_size(width, height, units);
+    if width == 0 || height == 0 || w > coded.0 || h > coded.1 {
+        return None;
+    }
+    Some([0, (coded.0 - w) / units.0, 0, (coded.1 - h) / units.1])
+}
+
+fn copy_bits(r: &mut BitReader, w: &mut BitWriter, mut n: usize) -> Option<()> {
+    while n > 0 {
+        let k = n.min(32) as u32;
+        w.u(k, r.u(k)?);
+        n -= k as usize;
+    }
+    Some(())
+}
+
+/// Replaces the bits `window` of the RBSP of `nal`, whose header is
+/// `header_len` bytes, with a crop flag and `crop` offsets.
+fn rewrite(
+    nal: &[u8],
+    header_len: usize,
+    window: (usize, usize),
+    crop: [u32; 4],
+) -> Option<Vec<u8>> {
+    let rbsp = nal::unescape(nal.get(header_len..)?);
+    // the stop bit ends the syntax, trailing bits are rewritten
+    let last = rbsp.iter().rposition(|&b| b != 0)?;
+    let stop = last * 8 + 7 - rbsp[last].trailing_zeros() as usize;
+    if window.1 > stop {
+        return None;
+    }
+    let mut r = BitReader::new_raw(&rbsp);
+    let mut w = BitWriter::new();
+    copy_bits(&mut r, &mut w, window.0)?;
+    let cropped = crop != [0; 4];
+    w.flag(cropped);
+    if cropped {
+        for c in crop {
+            w.ue(c);
+        }
+    }
+    r.skip((window.1 - window.0) as u32)?;
+    copy_bits(&mut r, &mut w, stop - window.1)?;
+    w.trailing_bits();
+    let mut out = nal[..header_len].to_vec();
+    nal::escape(&w.into_bytes(), &mut out);
+    Some(out)
+}
+
+/// Rewrites the crop window of an SPS NAL unit, header included, to show
+/// the top-left `width` x `height` pixels, rounded up by `croppable_size`.
+/// `None` if it already does, or the SPS cannot be parsed.
+pub fn crop_sps(format: DataFormat, nal: &[u8], width: u32, height: u32) -> Option<Vec<u8>> {
+    match format {
+        H264 => {
+            let sps = params::parse_h264_sps(nal)?;
+            let crop = offsets(sps.coded_size(), width, height, sps.crop_units())?;
+            if crop == sps.crop {
+                return None;
+            }
+            rewrite(nal, 1, sps.crop_bits, crop)
+        }
+        H265 => {
+            let sps = params::parse_hevc_sps(nal)?;
+            let crop = offsets((sps.width, sps.height), width, height, sps.crop_units())?;
+            if crop == sps.conf_win {
+                return None;
+            }
+            rewrite(nal, 2, sps.conf_win_bits, crop)
+        }
+        _ => None,
+    }
+}
+
+/// Keeps the crop window of every SPS at `width` x `height`, for backends
+/// that code a padded size without cropping it.
+pub struct SpsCrop {
+    pub width: u32,
+    pub height: u32,
+}
+
+impl BitstreamFilter for SpsCrop {
+    fn name(&self) -> &'static str {
+        "sps_crop"
+    }
+
+    fn filter(&mut self, format: DataFormat, data: &mut Vec<u8>) -> usize {
+        let sps_type = match format {
+            H264 => nal::H264_NAL_SPS,
+            H265 => nal::HEVC_NAL_SPS,
+            _ => return 0,
+        };
+        let mut out: Option<Vec<u8>> = None;
+        let mut copied = 0;
+        for n in nal::nal_units(data) {
+            let p = n.payload(data);
+            if p.is_empty() || nal::nal_type(format, p[0]) != sps_type {
+                continue;
+            }
+            if let Some(sps) = crop_sps(format, p, self.width, self.height) {
+                let o = out.get_or_insert_with(|| Vec::with_capacity(data.len() + 8));
+                o.extend_from_slice(&data[copied..n.header]);
+                o.extend_from_slice(&sps);
+                copied = n.end;
+            }
+        }
+        match out {
+            Some(mut o) => {
+                o.extend_from_slice(&data[copied..]);
+                let before = data.len();
+                *data = o;
+                before.saturating_sub(data.len())
+            }
+            None => 0,
+        }
+    }
+}
@@ -5540,6 +5540,45 @@ INCBIN_CONST INCBIN_ALIGN unsigned char gBinFile265Data[] = {
 };
 INCBIN_CONST INCBIN_ALIGN unsigned char *const gBinFile265End = gBinFile265Data + sizeof(gBinFile265Data);
 INCBIN_CONST unsigned int gBinFile265Size = sizeof(gBinFile265Data);
+/* INCBIN(BinFileAV1, "1920_1080.obu"); */
+INCBIN_CONST INCBIN_ALIGN unsigned char gBinFileAV1Data[] = {
+    0x12, 0x00, 0x0A, 0x0B, 0x00, 0x00, 0x00, 0x42, 0xAB, 0xBF, 0xC3, 0x70, 
+    0xAB, 0xE4, 0x01, 0x32, 0xFE, 0x02, 0x10, 0x00, 0x94, 0x00, 0x26, 0x99, 
+    0x24, 0x84, 0x1A, 0x64, 0x02, 0x36, 0x01, 0x5F, 0x00, 0xBF, 0x5A, 0xD9, 
+    0x25, 0xB6, 0xCA, 0x1D, 0xD7, 0x38, 0xD9, 0x02, 0xF7, 0x5B, 0x3B, 0xCE, 
+    0x6C, 0x4A, 0x3B, 0xCA, 0x10, 0x5E, 0x80, 0x84, 0x43, 0x6E, 0x9D, 0xDB, 
+    0x4F, 0x56, 0x5E, 0x24, 0x12, 0xFB, 0x61, 0x30, 0xC1, 0xFD, 0xDF, 0x77, 
+    0xC4, 0x69, 0x48, 0xC8, 0x8B, 0x24, 0xEA, 0x44, 0xA9, 0xE2, 0xDC, 0xA0, 
+    0x13, 0xA0, 0xB6, 0x90, 0x38, 0x2F, 0xCA, 0x4B, 0x51, 0xB0, 0x05, 0xDA, 
+    0x8A, 0x34, 0xC6, 0x59, 0x10, 0x18, 0xFD, 0x06, 0x7F, 0x75, 0x9F, 0xA3, 
+    0x3E, 0x56, 0xA3, 0x01, 0x1D, 0xE1, 0xB7, 0x69, 0xCD, 0x7D, 0xB7, 0xD5, 
+    0xFA, 0x62, 0xC3, 0xAF, 0x0F, 0x09, 0x62, 0x15, 0xAB, 0x54, 0xA4, 0x06, 
+    0xBC, 0x46, 0xEA, 0x77, 0xF0, 0x9B, 0x2C, 0x52, 0xAF, 0x0B, 0x39, 0x4B, 
+    0x5F, 0xC9, 0xA3, 0x3C, 0x4D, 0xBD, 0x22, 0x27, 0x6E, 0x38, 0xD7, 0x7B, 
+    0x19, 0xC5, 0x45, 0x05, 0xE3, 0x44, 0x0A, 0xDB, 0x85, 0x59, 0x31, 0x04, 
+    0x45, 0xFE, 0x4A, 0x61, 0x5E, 0x49, 0xEA, 0x32, 0xE3, 0x2D, 0x83, 0x0F, 
+    0xB9, 0x24, 0xC3, 0xEB, 0xA7, 0xB9, 0x06, 0x96, 0x02, 0x83, 0x82, 0xDB, 
+    0x83, 0xA2, 0x2E, 0x51, 0x14, 0x5D, 0x88, 0x00, 0xD7, 0x74, 0x34, 0xE2, 
+    0xD1, 0xCA, 0x1D, 0x92, 0x0C, 0xD4, 0x9D, 0xD1, 0x57, 0xFC, 0x1E, 0xB8, 
+    0x51, 0x46, 0x75, 0xC0, 0x8A, 0x5F, 0x3F, 0x0C, 0x34, 0x7B, 0x3A, 0x9D, 
+    0xB5, 0x0C, 0xB2, 0xBB, 0xFD, 0x66, 0xC0, 0xFC, 0x02, 0x7B, 0xF6, 0xD8, 
+    0xF7, 0xA7, 0x05, 0x31, 0xF5, 0xF8, 0xA1, 0x6F, 0x85, 0x42, 0x6A, 0x89, 
+    0x51, 0x9C, 0x84, 0xD4, 0x39, 0xB8, 0x9B, 0x0C, 0x22, 0xF8, 0x6E, 0x00, 
+    0x32, 0x8C, 0x17, 0x67, 0x8A, 0xD3, 0x53, 0x6E, 0x3D, 0xA0, 0x66, 0xED, 
+    0x5C, 0x73, 0xF1, 0xE7, 0x87, 0x5C, 0xA3, 0x98, 0xE8, 0x09, 0x11, 0xF2, 
+    0x44, 0xAE, 0x15, 0xA0, 0xBB, 0x76, 0x87, 0xE4, 0x2C, 0x9A, 0xF5, 0xAC, 
+    0xCE, 0xA2, 0xE7, 0x66, 0x96, 0xB7, 0x3D, 0x9B, 0xD8, 0xCE, 0xEC, 0x29, 
+    0x9A, 0x90, 0x83, 0xCE, 0x73, 0xF9, 0x67, 0x2B, 0x83, 0x44, 0x99, 0x52, 
+    0x64, 0x41, 0x6E, 0xA8, 0x71, 0x72, 0x20, 0x90, 0xD7, 0xC9, 0x0C, 0x75, 
+    0x83, 0x03, 0xB8, 0x29, 0x55, 0x77, 0xDC, 0x33, 0x55, 0x45, 0x4B, 0xE3, 
+    0x73, 0x22, 0x95, 0xAA, 0xF1, 0x5F, 0x7A, 0xD6, 0xCF, 0x90, 0x40, 0x00, 
+    0x12, 0x5D, 0x84, 0xA2, 0x16, 0x89, 0xB1, 0xEE, 0x72, 0x57, 0x3B, 0x0F, 
+    0x53, 0x39, 0xDD, 0x41, 0x7F, 0xA6, 0x4C, 0x48, 0x0C, 0xB2, 0xE8, 0xD4, 
+    0x94, 0x46, 0x0E, 0xA0, 0xF5, 0xB0, 0x9F, 0x62, 0xDA, 0x8A, 0xC8, 0xB7, 
+    0x63, 0x1C, 0x1B, 0x80
+};
+INCBIN_CONST INCBIN_ALIGN unsigned char *const gBinFileAV1End = gBinFileAV1Data + sizeof(gBinFileAV1Data);
+INCBIN_CONST unsigned int gBinFileAV1Size = sizeof(gBinFileAV1Data);
 
 #ifdef __cplusplus
 }
@@ -1,4 +1,7 @@
-use crate::gpu_video_codec_get_bin_file;
+use crate::{
+    avcc, cpu, gpu_video_codec_get_bin_file, obu,
+    parser::{FrameInfo, Parser},
+};
 use gpu_common::{inner::DecodeCalls, AdapterDesc, DataFormat::*, DecodeContext, DecodeDriver};
 use log::{error, trace};
 use std::{
@@ -7,13 +10,140 @@ use std::{
     slice::from_raw_parts,
     sync::{Arc, Mutex},
     thread,
+    time::{Duration, Instant},
 };
 use DecodeDriver::*;
 
+const DEFAULT_KEYFRAME_REQUEST_INTERVAL: Duration = Duration::from_millis(500);
+
+/// Converts length-prefixed input (MP4 samples) to the Annex-B the backends
+/// expect.
+struct LengthPrefixedInput {
+    length_size: usize,
+    parameter_sets: Vec<u8>,
+    parameter_sets_sent: bool,
+    buf: Vec<u8>,
+}
+
+/// When to drop input so a decoder that fell behind gets back to real time.
+/// Thresholds are in packets queued behind the one being decoded, use
+/// `usize::MAX` to disable a stage.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct CatchUpPolicy {
+    /// Non-reference pictures are dropped from this backlog on.
+    pub drop_non_reference: usize,
+    /// Everything up to the next keyframe is dropped from this backlog on.
+    pub skip_to_keyframe: usize,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DecodeEvent {
+    /// Decoding resumed at a keyframe after `dropped` packets were skipped
+    /// to catch up.
+    SkippedToKeyframe { dropped: u64 },
+    /// Input is discarded until the next keyframe, because reference
+    /// pictures are broken or to catch up. Repeated at most once per
+    /// keyframe request interval.
+    KeyframeNeeded,
+}
+
+struct CatchUp {
+    policy: CatchUpPolicy,
+    backlog: usize,
+    skipping: bool,
+    skipped: u64,
+}
+
+impl CatchUp {
+    /// Whether the packet described by `info` should reach the backend.
+    fn admit(&mut self, info: &FrameInfo, events: &mut Vec<DecodeEvent>) -> bool {
+        if info.slices.count == 0 {
+            return true;
+        }
+        if info.is_keyframe() {
+            if self.skipping {
+                self.skipping = false;
+                events.push(DecodeEvent::SkippedToKeyframe {
+                    dropped: self.skipped,
+                });
+                self.skipped = 0;
+            }
+            return true;
+        }
+        if self.backlog >= self.policy.skip_to_keyframe {
+            self.skipping = true;
+        }
+        if self.skipping {
+            self.skipped += 1;
+            return false;
+        }
+        !(!info.reference && self.backlog >= self.policy.drop_non_reference)
+    }
+}
+
+/// Keeps dependent pictures away from the backend after a reference
+/// picture failed to decode.
+struct Resync {
+    broken: bool,
+    interval: Duration,
+    last_request: Option<Instant>,
+}
+
+impl Resync {
+    fn request_keyframe(&mut self, events: &mut Vec<DecodeEvent>) {
+        let now = Instant::now();
+        if self
+            .last_request
+            .map_or(true, |t| now.duration_since(t) >= self.interval)
+        {
+            self.last_request = Some(now);
+            events.push(DecodeEvent::KeyframeNeeded);
+        }
+    }
+
+    /// Whether the packet described by `info` should reach the backend.
+    fn admit(&mut self, info: &FrameInfo, events: &mut Vec<DecodeEvent>) -> bool {
+        if info.slices.count == 0 {
+            return true;
+        }
+        if info.is_keyframe() {
+            self.broken = false;
+            self.last_request = None;
+            return true;
+        }
+        if !self.broken {
+            return true;
+        }
+        self.request_keyframe(events);
+        false
+    }
+
+    fn failed(&mut self, info: Option<&FrameInfo>, events: &mut Vec<DecodeEvent>) {
+        match info {
+            // a broken non-reference picture leaves the references intact
+            Some(info) if !info.reference && info.qp.is_some() => {}
+            Some(_) => {
+                self.broken = true;
+                self.request_keyframe(events);
+            }
+            // nothing to resync on without a parser
+            None => self.request_keyframe(events),
+        }
+    }
+}
+
 pub struct Decoder {
     calls: DecodeCalls,
     codec: *mut c_void,
     frames: *mut Vec<DecodeFrame>,
+    input: Option<LengthPrefixedInput>,
+    parser: Option<Parser>,
+    catch_up: Option<CatchUp>,
+    resync: Resync,
+    dropped: u64,
+    events: Vec<DecodeEvent>,
+    /// Cropped picture size of the last parsed slice.
+    dimensions: Option<(u32, u32)>,
     pub ctx: DecodeContext,
 }
 
@@ -26,6 +156,7 @@ impl Decoder {
             CUVID => nv::decode_calls(),
             AMF => amf::decode_calls(),
             VPL => vpl::decode_calls(),
+            CPU => cpu::decode_calls(),
         };
         unsafe {
             let codec = (calls.new)(
@@ -42,35 +173,167 @@ impl Decoder {
                 calls,
                 codec,
                 frames: Box::into_raw(Box::new(Vec::<DecodeFrame>::new())),
+                input: None,
+                parser: matches!(ctx.data_format, H264 | H265 | AV1)
+                    .then(|| Parser::new(ctx.data_format)),
+                catch_up: None,
+                resync: Resync {
+                    broken: false,
+                    interval: DEFAULT_KEYFRAME_REQUEST_INTERVAL,
+                    last_request: None,
+                },
+                dropped: 0,
+                events: vec![],
+                dimensions: None,
                 ctx,
             })
         }
     }
 
+    /// Switches input to length-prefixed packets described by an
+    /// `avcC`/`hvcC` record. Its parameter sets are sent with the next packet.
+    pub fn set_codec_config(&mut self, record: &[u8]) -> Result<(), ()> {
+        let cfg = avcc::parse_codec_config_record(self.ctx.data_format, record).ok_or(())?;
+        self.input = Some(LengthPrefixedInput {
+            length_size: cfg.length_size,
+            parameter_sets: cfg.to_annexb(),
+            parameter_sets_sent: false,
+            buf: vec![],
+        });
+        Ok(())
+    }
+
+    /// Enables dropping input when the backlog reported with `set_backlog`
+    /// grows. Only H.264, HEVC and AV1 are supported.
+    pub fn set_catch_up(&mut self, policy: Option<CatchUpPolicy>) -> Result<(), ()> {
+        let policy = match policy {
+            Some(policy) => policy,
+            None => {
+                self.catch_up = None;
+                return Ok(());
+            }
+        };
+        if self.parser.is_none() {
+            return Err(());
+        }
+        match self.catch_up.as_mut() {
+            Some(catch_up) => catch_up.policy = policy,
+            None => {
+                self.catch_up = Some(CatchUp {
+                    policy,
+                    backlog: 0,
+                    skipping: false,
+                    skipped: 0,
+                })
+            }
+        }
+        Ok(())
+    }
+
+    /// Minimum time between two `KeyframeNeeded` events while waiting for a
+    /// keyframe, after a decode error or to catch up.
+    pub fn set_keyframe_request_interval(&mut self, interval: Duration) {
+        self.resync.interval = interval;
+    }
+
+    /// Number of packets queued behind the next one passed to `decode`.
+    pub fn set_backlog(&mut self, queued: usize) {
+        if let Some(catch_up) = self.catch_up.as_mut() {
+            catch_up.backlog = queued;
+        }
+    }
+
+    /// Packets dropped so far, either to catch up or because the pictures
+    /// they depend on failed to decode.
+    pub fn dropped_packets(&self) -> u64 {
+        self.dropped
+    }
+
+    pub fn take_events(&mut self) -> Vec<DecodeEvent> {
+        std::mem::take(&mut self.events)
+    }
+
     pub fn decode(&mut self, packet: &[u8]) -> Result<&mut Vec<DecodeFrame>, i32> {
-        unsafe {
-            (&mut *self.frames).clear();
-            let ret = (self.calls.decode)(
+        let mut buf = vec![];
+        let packet = match self.input.as_mut() {
+            Some(input) => {
+                buf = std::mem::take(&mut input.buf);
+                buf.clear();
+                if !input.parameter_sets_sent {
+                    buf.extend_from_slice(&input.parameter_sets);
+                }
+                if !avcc::append_annexb(packet, input.length_size, &mut buf) {
+                    error!("invalid length-prefixed packet");
+                    input.buf = buf;
+                    return Err(-1);
+                }
+                input.parameter_sets_sent = true;
+                &buf[..]
+            }
+            None => packet,
+        };
+        unsafe { (&mut *self.frames).clear() };
+        let result = if self.ctx.data_format == AV1 {
+            // backends take one temporal unit at a time
+            obu::temporal_units(packet)
+                .into_iter()
+                .try_for_each(|unit| self.decode_unit(unit))
+        } else {
+            self.decode_unit(packet)
+        };
+        if let Some(input) = self.input.as_mut() {
+            input.buf = buf;
+        }
+        result.map(|_| unsafe { &mut *self.frames })
+    }
+
+    fn decode_unit(&mut self, unit: &[u8]) -> Result<(), i32> {
+        let info = self.parser.as_mut().map(|p| p.parse(unit));
+        if let Some(info) = info.as_ref() {
+            self.dimensions = info.dimensions.or(self.dimensions);
+            let mut admit = self.resync.admit(info, &mut self.events);
+            if let Some(catch_up) = self.catch_up.as_mut() {
+                admit = admit && catch_up.admit(info, &mut self.events);
+                // without asking, e.g. with an infinite GOP, no keyframe
+                // may ever come
+                if catch_up.skipping {
+                    self.resync.request_keyframe(&mut self.events);
+                }
+            }
+            if !admit {
+                self.dropped += 1;
+                return Ok(());
+            }
+        }
+        let first = unsafe { (&*self.frames).len() };
+        let ret = unsafe {
+            (self.calls.decode)(
                 self.codec,
-                packet.as_ptr() as _,
-                packet.len() as _,
+                unit.as_ptr() as _,
+                unit.len() as _,
                 Some(Self::callback),
                 self.frames as *mut _ as *mut c_void,
-            );
-
-            if ret != 0 {
-                error!("Error decode: {}", ret);
-                Err(ret)
-            } else {
-                Ok(&mut *self.frames)
+            )
+        };
+        if ret != 0 {
+            error!("Error decode: {}", ret);
+            self.resync.failed(info.as_ref(), &mut self.events);
+            Err(ret)
+        } else {
+            for frame in unsafe { &mut (&mut *self.frames)[first..] } {
+                frame.dimensions = self.dimensions;
             }
+            Ok(())
         }
     }
 
     unsafe extern "C" fn callback(texture: *mut c_void, obj: *const c_void) {
         let frames = &mut *(obj as *mut Vec<DecodeFrame>);
 
-        let frame = DecodeFrame { texture };
+        let frame = DecodeFrame {
+            texture,
+            dimensions: None,
+        };
         frames.push(frame);
     }
 }
@@ -87,6 +350,9 @@ impl Drop for Decoder {
 
 pub struct DecodeFrame {
     pub texture: *mut c_void,
+    /// Picture size after the stream's cropping, the top-left part of
+    /// `texture` to show. `None` when the stream is not parsed.
+    pub dimensions: Option<(u32, u32)>,
 }
 
 pub fn available(output_shared_handle: bool) -> Vec<DecodeContext> {
@@ -125,24 +391,32 @@ pub fn available(output_shared_handle: bool) -> Vec<DecodeContext> {
     let mut p_bin_265: *mut u8 = std::ptr::null_mut();
     let mut len_bin_265: c_int = 0;
     let buf265;
+    let mut p_bin_av1: *mut u8 = std::ptr::null_mut();
+    let mut len_bin_av1: c_int = 0;
+    let bufav1;
     unsafe {
         gpu_video_codec_get_bin_file(0, &mut p_bin_264 as _, &mut len_bin_264 as _);
         gpu_video_codec_get_bin_file(1, &mut p_bin_265 as _, &mut len_bin_265 as _);
+        gpu_video_codec_get_bin_file(AV1 as _, &mut p_bin_av1 as _, &mut len_bin_av1 as _);
         buf264 = from_raw_parts(p_bin_264, len_bin_264 as _);
         buf265 = from_raw_parts(p_bin_265, len_bin_265 as _);
+        bufav1 = from_raw_parts(p_bin_av1, len_bin_av1 as _);
     }
     let buf264 = Arc::new(buf264);
     let buf265 = Arc::new(buf265);
+    let bufav1 = Arc::new(bufav1);
     let mut handles = vec![];
     for input in inputs {
         let outputs = outputs.clone();
         let buf264 = buf264.clone();
         let buf265 = buf265.clone();
+        let bufav1 = bufav1.clone();
         let handle = thread::spawn(move || {
             let test = match input.driver {
                 CUVID => nv::decode_calls().test,
                 AMF => amf::decode_calls().test,
                 VPL => vpl::decode_calls().test,
+                CPU => cpu::decode_calls().test,
             };
             let mut descs: Vec<AdapterDesc> = vec![];
             descs.resize(crate::MAX_ADATER_NUM_ONE_VENDER, unsafe {
@@ -152,6 +426,7 @@ pub fn available(output_shared_handle: bool) -> Vec<DecodeContext> {
             let data = match input.data_format {
                 H264 => &buf264[..],
                 H265 => &buf265[..],
+                AV1 => &bufav1[..],
                 _ => return,
             };
             if 0 == unsafe {
@@ -183,3 +458,187 @@ pub fn available(output_shared_handle: bool) -> Vec<DecodeContext> {
     let x = outputs.lock().unwrap().clone();
     x
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{nal, skip::SkipFrames};
+    use gpu_common::{DataFormat, API::API_DX11};
+
+    fn decoder(format: DataFormat) -> Decoder {
+        Decoder::new(DecodeContext {
+            device: None,
+            driver: CPU,
+            luid: 0,
+            api: API_DX11,
+            data_format: format,
+            output_shared_handle: false,
+        })
+        .unwrap()
+    }
+
+    /// Packets of the embedded clip, its keyframe for every `I` of
+    /// `pattern` and skip pictures repeating it for `P`, non-reference ones
+    /// for `p`.
+    fn stream(format: DataFormat, pattern: &str) -> Vec<Vec<u8>> {
+        let clip = unsafe {
+            let (mut p, mut len) = (std::ptr::null_mut(), 0);
+            gpu_video_codec_get_bin_file(format as _, &mut p, &mut len);
+            from_raw_parts(p, len as usize).to_vec()
+        };
+        let mut parser = Parser::new(format);
+        let mut skip = SkipFrames::new(format);
+        pattern
+            .chars()
+            .map(|c| {
+                let mut data = clip.clone();
+                if c != 'I' {
+                    data = skip.next(&parser).unwrap();
+                    parser.parse(&data);
+                    if c == 'p' {
+                        // nal_ref_idc 0, or TRAIL_R to TRAIL_N
+                        data[4] &= if format == H264 { 0x9F } else { 0xFD };
+                    }
+                    return data;
+                }
+                parser.parse(&data);
+                skip.follow(&parser, &mut data);
+                data
+            })
+            .collect()
+    }
+
+    #[test]
+    fn catch_up_drops_and_skips_to_keyframe() {
+        for format in [H264, H265] {
+            let mut d = decoder(format);
+            d.set_keyframe_request_interval(Duration::from_secs(3600));
+            d.set_catch_up(Some(CatchUpPolicy {
+                drop_non_reference: 2,
+                skip_to_keyframe: 4,
+            }))
+            .unwrap();
+            let packets = stream(format, "IPpPpPpPpIPpIP");
+            let backlog = [0, 0, 0, 2, 2, 4, 0, 0, 0, 0, 0, 2, 5, 0];
+            let mut decoded = vec![];
+            let mut events = vec![];
+            for (p, &queued) in packets.iter().zip(backlog.iter()) {
+                d.set_backlog(queued);
+                decoded.push(d.decode(p).unwrap().len());
+                events.push(d.take_events());
+            }
+            assert_eq!(decoded, [1, 1, 1, 1, 0, 0, 0, 0, 0, 1, 1, 0, 1, 1]);
+            assert_eq!(d.dropped_packets(), 6);
+            // one request when skipping starts, until the keyframe
+            assert_eq!(events[5], [DecodeEvent::KeyframeNeeded]);
+            assert!(events[6..9].iter().all(|e| e.is_empty()));
+            assert_eq!(events[9], [DecodeEvent::SkippedToKeyframe { dropped: 4 }]);
+            // a keyframe is admitted under any backlog
+            assert!(events[10..].iter().all(|e| e.is_empty()));
+        }
+    }
+
+    #[test]
+    fn catch_up_requests_keyframe_again_after_interval() {
+        let mut d = decoder(H264);
+        d.set_keyframe_request_interval(Duration::ZERO);
+        d.set_catch_up(Some(CatchUpPolicy {
+            drop_non_reference: usize::MAX,
+            skip_to_keyframe: 1,
+        }))
+        .unwrap();
+        let packets = stream(H264, "IPPPI");
+        d.set_backlog(1);
+        let mut events = vec![];
+        for p in packets.iter() {
+            d.decode(p).unwrap();
+            events.extend(d.take_events());
+        }
+        assert_eq!(
+            events,
+            [
+                DecodeEvent::KeyframeNeeded,
+                DecodeEvent::KeyframeNeeded,
+                DecodeEvent::KeyframeNeeded,
+                DecodeEvent::SkippedToKeyframe { dropped: 3 },
+            ]
+        );
+    }
+
+    #[test]
+    fn resync_withholds_dependent_pictures() {
+        let mut d = decoder(H264);
+        d.set_keyframe_request_interval(Duration::from_secs(3600));
+        let packets = stream(H264, "IPPPPIP");
+        let mut decoded = vec![];
+        let mut events = vec![];
+        for (i, p) in packets.iter().enumerate() {
+            if i == 1 {
+                cpu::fail_decodes(1);
+            }
+            decoded.push(d.decode(p).map(|f| f.len()));
+            events.push(d.take_events());
+        }
+        // without resync the backend would fail on every P picture
+        assert_eq!(decoded, [Ok(1), Err(-1), Ok(0), Ok(0), Ok(0), Ok(1), Ok(1)]);
+        assert_eq!(d.dropped_packets(), 3);
+        assert_eq!(events[1], [DecodeEvent::KeyframeNeeded]);
+        assert!(events[2..].iter().all(|e| e.is_empty()));
+    }
+
+    #[test]
+    fn resync_ignores_broken_non_reference_pictures() {
+        let mut d = decoder(H265);
+        let packets = stream(H265, "IPpP");
+        let mut decoded = vec![];
+        for (i, p) in packets.iter().enumerate() {
+            if i == 2 {
+                cpu::fail_decodes(1);
+            }
+            decoded.push(d.decode(p).map(|f| f.len()));
+        }
+        assert_eq!(decoded, [Ok(1), Ok(1), Err(-1), Ok(1)]);
+        assert_eq!(d.dropped_packets(), 0);
+        assert!(d.take_events().is_empty());
+    }
+
+    #[test]
+    fn resync_rate_limits_keyframe_requests() {
+        let mut d = decoder(H264);
+        d.set_keyframe_request_interval(Duration::from_millis(100));
+        let packets = stream(H264, "IPPPPPI");
+        d.decode(&packets[0]).unwrap();
+        cpu::fail_decodes(1);
+        assert!(d.decode(&packets[1]).is_err());
+        d.decode(&packets[2]).unwrap();
+        d.decode(&packets[3]).unwrap();
+        assert_eq!(d.take_events(), [DecodeEvent::KeyframeNeeded]);
+        thread::sleep(Duration::from_millis(150));
+        d.decode(&packets[4]).unwrap();
+        d.decode(&packets[5]).unwrap();
+        assert_eq!(d.take_events(), [DecodeEvent::KeyframeNeeded]);
+        assert_eq!(d.decode(&packets[6]).unwrap().len(), 1);
+        assert!(d.take_events().is_empty());
+    }
+
+    #[test]
+    fn length_prefixed_input_sends_parameter_sets_once() {
+        let mut d = decoder(H264);
+        let clip = stream(H264, "I").remove(0);
+        let record = avcc::codec_config_record(H264, &clip).unwrap();
+        d.set_codec_config(&record).unwrap();
+        // the IDR alone, the parameter sets come from the record
+        let mut idr = vec![];
+        for n in nal::nal_units(&clip) {
+            let p = n.payload(&clip);
+            if nal::nal_type(H264, p[0]) == nal::H264_NAL_IDR {
+                idr.extend_from_slice(&(p.len() as u32).to_be_bytes());
+                idr.extend_from_slice(p);
+            }
+        }
+        assert!(!idr.is_empty());
+        assert_eq!(d.decode(&[0, 0, 0, 9, 0x65]).err(), Some(-1));
+        assert_eq!(d.decode(&idr).unwrap().len(), 1);
+        assert_eq!(d.decode(&idr).unwrap().len(), 1);
+    }
+}
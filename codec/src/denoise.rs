@@ -0,0 +1,426 @@
+//! Motion-adaptive temporal denoising of NV12 frames before encode.
+//!
+//! Each pixel is blended towards the previous output, the less the more it
+//! differs from it, so noise averages out over frames while moving edges
+//! are kept. The blend is further scaled per 32x32 tile by the tile's mean
+//! absolute difference from the previous output: tiles in motion are passed
+//! through, static noisy ones are smoothed the most. Being recursive the
+//! filter only keeps one reference frame, allocated once per size.
+
+use crate::convert::{band_threads, run_bands, Simd};
+
+const TILE: usize = 32;
+/// Blend weights are in units of 1/128.
+const ONE: i16 = 128;
+
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct DenoiseParams {
+    /// Largest blend towards the previous output, 0 to 1.
+    pub strength: f32,
+    /// Pixel differences from the previous output at or above this are
+    /// motion and kept.
+    pub threshold: u8,
+    /// Tiles whose mean absolute difference reaches this are kept whole.
+    pub tile_motion: u8,
+}
+
+impl Default for DenoiseParams {
+    /// Suited to webcam noise, sigma 2 to 4.
+    fn default() -> Self {
+        Self {
+            strength: 0.8,
+            threshold: 16,
+            tile_motion: 16,
+        }
+    }
+}
+
+fn blend_scalar(cur: &mut [u8], reference: &mut [u8], k: i16, slope: i16, from: usize) {
+    for (c, r) in cur.iter_mut().zip(reference.iter_mut()).skip(from) {
+        let d = *r as i32 - *c as i32;
+        let w = (k as i32 - d.abs() * slope as i32).max(0);
+        *c = (*c as i32 + ((d * w + 64) >> 7)) as u8;
+        *r = *c;
+    }
+}
+
+fn sad_scalar(a: &[u8], b: &[u8], from: usize) -> u32 {
+    a.iter()
+        .zip(b)
+        .skip(from)
+        .map(|(&x, &y)| x.abs_diff(y) as u32)
+        .sum()
+}
+
+#[cfg(target_arch = "x86_64")]
+mod x86 {
+    use std::arch::x86_64::*;
+
+    /// 8 blended pixels, as i16.
+    #[inline]
+    #[target_feature(enable = "sse4.1")]
+    unsafe fn blend8(c: __m128i, r: __m128i, k: __m128i, slope: __m128i) -> __m128i {
+        let d = _mm_sub_epi16(r, c);
+        let w = _mm_subs_epu16(k, _mm_mullo_epi16(_mm_abs_epi16(d), slope));
+        let t = _mm_add_epi16(_mm_mullo_epi16(d, w), _mm_set1_epi16(64));
+        _mm_add_epi16(c, _mm_srai_epi16::<7>(t))
+    }
+
+    #[target_feature(enable = "sse4.1")]
+    pub unsafe fn blend_sse41(cur: &mut [u8], reference: &mut [u8], k: i16, slope: i16) -> usize {
+        let n = cur.len().min(reference.len()) / 16 * 16;
+        let (kv, sv, zero) = (
+            _mm_set1_epi16(k),
+            _mm_set1_epi16(slope),
+            _mm_setzero_si128(),
+        );
+        for i in (0..n).step_by(16) {
+            let pc = cur.as_mut_ptr().add(i) as *mut __m128i;
+            let pr = reference.as_mut_ptr().add(i) as *mut __m128i;
+            let (c, r) = (_mm_loadu_si128(pc), _mm_loadu_si128(pr));
+            let lo = blend8(
+                _mm_unpacklo_epi8(c, zero),
+                _mm_unpacklo_epi8(r, zero),
+                kv,
+                sv,
+            );
+            let hi = blend8(
+                _mm_unpackhi_epi8(c, zero),
+                _mm_unpackhi_epi8(r, zero),
+                kv,
+                sv,
+            );
+            let out = _mm_packus_epi16(lo, hi);
+            _mm_storeu_si128(pc, out);
+            _mm_storeu_si128(pr, out);
+        }
+        n
+    }
+
+    #[target_feature(enable = "sse4.1")]
+    pub unsafe fn sad_sse41(a: &[u8], b: &[u8]) -> (u32, usize) {
+        let n = a.len().min(b.len()) / 16 * 16;
+        let mut acc = _mm_setzero_si128();
+        for i in (0..n).step_by(16) {
+            let x = _mm_loadu_si128(a.as_ptr().add(i) as *const __m128i);
+            let y = _mm_loadu_si128(b.as_ptr().add(i) as *const __m128i);
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(x, y));
+        }
+        let sum = _mm_extract_epi64::<0>(acc) + _mm_extract_epi64::<1>(acc);
+        (sum as u32, n)
+    }
+
+    #[inline]
+    #[target_feature(enable = "avx2")]
+    unsafe fn blend16(c: __m256i, r: __m256i, k: __m256i, slope: __m256i) -> __m256i {
+        let d = _mm256_sub_epi16(r, c);
+        let w = _mm256_subs_epu16(k, _mm256_mullo_epi16(_mm256_abs_epi16(d), slope));
+        let t = _mm256_add_epi16(_mm256_mullo_epi16(d, w), _mm256_set1_epi16(64));
+        _mm256_add_epi16(c, _mm256_srai_epi16::<7>(t))
+    }
+
+    #[target_feature(enable = "avx2")]
+    pub unsafe fn blend_avx2(cur: &mut [u8], reference: &mut [u8], k: i16, slope: i16) -> usize {
+        let n = cur.len().min(reference.len()) / 32 * 32;
+        let (kv, sv, zero) = (
+            _mm256_set1_epi16(k),
+            _mm256_set1_epi16(slope),
+            _mm256_setzero_si256(),
+        );
+        for i in (0..n).step_by(32) {
+            let pc = cur.as_mut_ptr().add(i) as *mut __m256i;
+            let pr = reference.as_mut_ptr().add(i) as *mut __m256i;
+            let (c, r) = (_mm256_loadu_si256(pc), _mm256_loadu_si256(pr));
+            // unpacking and packing within lanes keeps the order
+            let lo = blend16(
+                _mm256_unpacklo_epi8(c, zero),
+                _mm256_unpacklo_epi8(r, zero),
+                kv,
+                sv,
+            );
+            let hi = blend16(
+                _mm256_unpackhi_epi8(c, zero),
+                _mm256_unpackhi_epi8(r, zero),
+                kv,
+                sv,
+            );
+            let out = _mm256_packus_epi16(lo, hi);
+            _mm256_storeu_si256(pc, out);
+            _mm256_storeu_si256(pr, out);
+        }
+        n
+    }
+
+    #[target_feature(enable = "avx2")]
+    pub unsafe fn sad_avx2(a: &[u8], b: &[u8]) -> (u32, usize) {
+        let n = a.len().min(b.len()) / 32 * 32;
+        let mut acc = _mm256_setzero_si256();
+        for i in (0..n).step_by(32) {
+            let x = _mm256_loadu_si256(a.as_ptr().add(i) as *const __m256i);
+            let y = _mm256_loadu_si256(b.as_ptr().add(i) as *const __m256i);
+            acc = _mm256_add_epi64(acc, _mm256_sad_epu8(x, y));
+        }
+        let s = _mm_add_epi64(
+            _mm256_castsi256_si128(acc),
+            _mm256_extracti128_si256::<1>(acc),
+        );
+        let sum = _mm_extract_epi64::<0>(s) + _mm_extract_epi64::<1>(s);
+        (sum as u32, n)
+    }
+}
+
+#[cfg(target_arch = "aarch64")]
+mod arm {
+    use std::arch::aarch64::*;
+
+    #[inline(always)]
+    unsafe fn blend8(c: int16x8_t, r: int16x8_t, k: uint16x8_t, slope: int16x8_t) -> int16x8_t {
+        let d = vsubq_s16(r, c);
+        let x = vreinterpretq_u16_s16(vmulq_s16(vabsq_s16(d), slope));
+        let w = vreinterpretq_s16_u16(vqsubq_u16(k, x));
+        let t = vaddq_s16(vmulq_s16(d, w), vdupq_n_s16(64));
+        vaddq_s16(c, vshrq_n_s16::<7>(t))
+    }
+
+    #[target_feature(enable = "neon")]
+    pub unsafe fn blend_neon(cur: &mut [u8], reference: &mut [u8], k: i16, slope: i16) -> usize {
+        let n = cur.len().min(reference.len()) / 16 * 16;
+        let (kv, sv) = (vdupq_n_u16(k as u16), vdupq_n_s16(slope));
+        let w = |x: uint8x8_t| vreinterpretq_s16_u16(vmovl_u8(x));
+        for i in (0..n).step_by(16) {
+            let (pc, pr) = (cur.as_mut_ptr().add(i), reference.as_mut_ptr().add(i));
+            let (c, r) = (vld1q_u8(pc), vld1q_u8(pr));
+            let lo = blend8(w(vget_low_u8(c)), w(vget_low_u8(r)), kv, sv);
+            let hi = blend8(w(vget_high_u8(c)), w(vget_high_u8(r)), kv, sv);
+            let out = vcombine_u8(vqmovun_s16(lo), vqmovun_s16(hi));
+            vst1q_u8(pc, out);
+            vst1q_u8(pr, out);
+        }
+        n
+    }
+
+    #[target_feature(enable = "neon")]
+    pub unsafe fn sad_neon(a: &[u8], b: &[u8]) -> (u32, usize) {
+        let n = a.len().min(b.len()) / 16 * 16;
+        let mut acc = vdupq_n_u32(0);
+        for i in (0..n).step_by(16) {
+            let d = vabdq_u8(vld1q_u8(a.as_ptr().add(i)), vld1q_u8(b.as_ptr().add(i)));
+            acc = vpadalq_u16(acc, vpaddlq_u8(d));
+        }
+        (vaddvq_u32(acc), n)
+    }
+}
+
+/// Denoises NV12 frames in place against its own previous output.
+pub struct TemporalDenoiser {
+    params: DenoiseParams,
+    simd: Simd,
+    threads: usize,
+    width: usize,
+    height: usize,
+    reference_y: Vec<u8>,
+    reference_uv: Vec<u8>,
+    activity: Vec<u8>,
+}
+
+impl TemporalDenoiser {
+    pub fn new(params: DenoiseParams) -> Self {
+        Self {
+            params,
+            simd: Simd::detect(),
+            threads: 0,
+            width: 0,
+            height: 0,
+            reference_y: vec![],
+            reference_uv: vec![],
+            activity: vec![],
+        }
+    }
+
+    /// Uses `simd` instead of the detected instruction set, if supported.
+    pub fn with_simd(mut self, simd: Simd) -> Self {
+        if simd.supported() {
+            self.simd = simd;
+        }
+        self
+    }
+
+    /// Filters in `threads` bands of tile rows, 0 picks the number of CPUs
+    /// for frames above 4K and 1 below.
+    pub fn with_threads(mut self, threads: usize) -> Self {
+        self.threads = threads;
+        self
+    }
+
+    pub fn simd(&self) -> Simd {
+        self.simd
+    }
+
+    pub fn params(&self) -> &DenoiseParams {
+        &self.params
+    }
+
+    pub fn set_params(&mut self, params: DenoiseParams) {
+        self.params = params;
+    }
+
+    /// Forgets the previous output, after a scene cut or seek.
+    pub fn reset(&mut self) {
+        self.width = 0;
+        self.height = 0;
+    }
+
+    /// Mean absolute difference from the previous output of each 32x32 luma
+    /// tile of the last frame, in rows of `tile_columns`.
+    pub fn activity(&self) -> &[u8] {
+        &self.activity
+    }
+
+    pub fn tile_columns(&self) -> usize {
+        (self.width + TILE - 1) / TILE
+    }
+
+    /// Blend weight at a zero difference and its decrease per level of
+    /// difference, for a tile of mean absolute difference `activity`.
+    fn weights(&self, activity: u32) -> (i16, i16) {
+        let motion = self.params.tile_motion.max(1) as u32;
+        if activity >= motion {
+            return (0, 0);
+        }
+        let strength = self.params.strength.clamp(0.0, 1.0) * ONE as f32;
+        let k = (strength * (motion - activity) as f32 / motion as f32).round() as i16;
+        let threshold = self.params.threshold.max(1) as i16;
+        (k, (k + threshold - 1) / threshold)
+    }
+
+    fn blend(&self, cur: &mut [u8], reference: &mut [u8], k: i16, slope: i16) {
+        let done = unsafe {
+            match self.simd {
+                #[cfg(target_arch = "x86_64")]
+                Simd::Avx2 => x86::blend_avx2(cur, reference, k, slope),
+                #[cfg(target_arch = "x86_64")]
+                Simd::Sse41 => x86::blend_sse41(cur, reference, k, slope),
+                #[cfg(target_arch = "aarch64")]
+                Simd::Neon => arm::blend_neon(cur, reference, k, slope),
+                _ => 0,
+            }
+        };
+        blend_scalar(cur, reference, k, slope, done);
+    }
+
+    fn sad(&self, a: &[u8], b: &[u8]) -> u32 {
+        let (sum, done) = unsafe {
+            match self.simd {
+                #[cfg(target_arch = "x86_64")]
+                Simd::Avx2 => x86::sad_avx2(a, b),
+                #[cfg(target_arch = "x86_64")]
+                Simd::Sse41 => x86::sad_sse41(a, b),
+                #[cfg(target_arch = "aarch64")]
+                Simd::Neon => arm::sad_neon(a, b),
+                _ => (0, 0),
+            }
+        };
+        sum + sad_scalar(a, b, done)
+    }
+
+    /// Denoises a `width` x `height` NV12 frame in place. The first frame,
+    /// and any frame after a size change or `reset`, only becomes the
+    /// reference.
+    pub fn denoise_nv12(
+        &mut self,
+        y: &mut [u8],
+        y_stride: usize,
+        uv: &mut [u8],
+        uv_stride: usize,
+        width: usize,
+        height: usize,
+    ) -> Result<(), ()> {
+        let (uv_width, ch) = (2 * ((width + 1) / 2), (height + 1) / 2);
+        let fits = |len: usize, stride: usize, rows: usize, row: usize| {
+            stride >= row && len >= stride * (rows - 1) + row
+        };
+        if width == 0
+            || height == 0
+            || !fits(y.len(), y_stride, height, width)
+            || !fits(uv.len(), uv_stride, ch, uv_width)
+        {
+            self.reset();
+            return Err(());
+        }
+        let columns = (width + TILE - 1) / TILE;
+        let tile_rows = (height + TILE - 1) / TILE;
+        if self.width != width || self.height != height {
+            self.reference_y.resize(width * height, 0);
+            self.reference_uv.resize(uv_width * ch, 0);
+            for r in 0..height {
+                self.reference_y[r * width..][..width].copy_from_slice(&y[r * y_stride..][..width]);
+            }
+            for r in 0..ch {
+                self.reference_uv[r * uv_width..][..uv_width]
+                    .copy_from_slice(&uv[r * uv_stride..][..uv_width]);
+            }
+            self.activity.clear();
+            self.activity.resize(columns * tile_rows, 0);
+            self.width = width;
+            self.height = height;
+            return Ok(());
+        }
+        let threads = band_threads(self.threads, width, height).min(tile_rows);
+        let band = (tile_rows + threads - 1) / threads;
+        let mut reference_y = std::mem::take(&mut self.reference_y);
+        let mut reference_uv = std::mem::take(&mut self.reference_uv);
+        let mut activity = std::mem::take(&mut self.activity);
+        let bands = y
+            .chunks_mut(band * TILE * y_stride)
+            .zip(uv.chunks_mut(band * TILE / 2 * uv_stride))
+            .zip(reference_y.chunks_mut(band * TILE * width))
+            .zip(reference_uv.chunks_mut(band * TILE / 2 * uv_width))
+            .zip(activity.chunks_mut(band * columns))
+            .enumerate();
+        let this = &*self;
+        run_bands(threads, bands, |(i, ((((y, uv), ry), ruv), act))| {
+            let rows = (band * TILE).min(height - i * band * TILE);
+            let chroma_rows = (band * TILE / 2).min(ch - i * band * TILE / 2);
+            for t in 0..(rows + TILE - 1) / TILE {
+                let (r0, r1) = (t * TILE, (t * TILE + TILE).min(rows));
+                let (c0, c1) = (t * TILE / 2, (t * TILE / 2 + TILE / 2).min(chroma_rows));
+                for c in 0..columns {
+                    let (x0, x1) = (c * TILE, (c * TILE + TILE).min(width));
+                    let sad: u32 = (r0..r1)
+                        .map(|r| {
+                            this.sad(
+                                &y[r * y_stride + x0..][..x1 - x0],
+                                &ry[r * width + x0..][..x1 - x0],
+                            )
+                        })
+                        .sum();
+                    let mean = sad / ((r1 - r0) * (x1 - x0)) as u32;
+                    act[t * columns + c] = mean.min(255) as u8;
+                    let (k, slope) = this.weights(mean);
+                    for r in r0..r1 {
+                        this.blend(
+                            &mut y[r * y_stride + x0..][..x1 - x0],
+                            &mut ry[r * width + x0..][..x1 - x0],
+                            k,
+                            slope,
+                        );
+                    }
+                    // the same tile of interleaved chroma spans as many bytes
+                    let u1 = x1.min(uv_width).max(x0);
+                    for r in c0..c1 {
+                        this.blend(
+                            &mut uv[r * uv_stride + x0..][..u1 - x0],
+                            &mut ruv[r * uv_width + x0..][..u1 - x0],
+                            k,
+                            slope,
+                        );
+                    }
+                }
+            }
+        });
+        self.reference_y = reference_y;
+        self.reference_uv = reference_uv;
+        self.activity = activity;
+        Ok(())
+    }
+}
@@ -0,0 +1,344 @@
+//! Changed 64x64 tiles between consecutive BGRA frames.
+
+use crate::hash::TILE_SIZE;
+use std::{ops::Range, thread};
+
+const BPP: usize = 4;
+
+/// A rectangle of changed pixels.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct DirtyRect {
+    pub x: u32,
+    pub y: u32,
+    pub width: u32,
+    pub height: u32,
+}
+
+/// One bit per tile, tile rows padded to whole words.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct DirtyMap {
+    pub width: usize,
+    pub height: usize,
+    pub columns: usize,
+    pub rows: usize,
+    words_per_row: usize,
+    bits: Vec<u64>,
+}
+
+impl DirtyMap {
+    /// A map of `width` x `height` pixels with every tile dirty.
+    pub(crate) fn full(width: usize, height: usize) -> Self {
+        let mut map = Self::default();
+        map.reset(width, height);
+        map.set_all();
+        map
+    }
+
+    /// Whether `other` covers the same tiles.
+    pub(crate) fn same_grid(&self, other: &DirtyMap) -> bool {
+        self.width == other.width && self.height == other.height
+    }
+
+    /// Adds the dirty tiles of `other`, of the same grid.
+    pub(crate) fn merge(&mut self, other: &DirtyMap) {
+        for (a, b) in self.bits.iter_mut().zip(&other.bits) {
+            *a |= b;
+        }
+    }
+
+    pub(crate) fn clear(&mut self) {
+        self.bits.iter_mut().for_each(|w| *w = 0);
+    }
+
+    fn reset(&mut self, width: usize, height: usize) {
+        self.width = width;
+        self.height = height;
+        self.columns = (width + TILE_SIZE - 1) / TILE_SIZE;
+        self.rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+        self.words_per_row = (self.columns + 63) / 64;
+        self.bits.clear();
+        self.bits.resize(self.words_per_row * self.rows, 0);
+    }
+
+    pub(crate) fn set_all(&mut self) {
+        for (i, w) in self.bits.iter_mut().enumerate() {
+            let last = (i % self.words_per_row) + 1 == self.words_per_row;
+            let used = if last {
+                self.columns - (self.words_per_row - 1) * 64
+            } else {
+                64
+            };
+            *w = if used == 64 { !0 } else { (1 << used) - 1 };
+        }
+    }
+
+    pub fn is_dirty(&self, column: usize, row: usize) -> bool {
+        if column >= self.columns || row >= self.rows {
+            return false;
+        }
+        self.bits[row * self.words_per_row + column / 64] & (1 << (column % 64)) != 0
+    }
+
+    pub fn dirty_count(&self) -> usize {
+        self.bits.iter().map(|w| w.count_ones() as usize).sum()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.bits.iter().all(|&w| w == 0)
+    }
+
+    /// The bitmap, `words_per_row` words per tile row, bit `c % 64` of
+    /// word `c / 64` for column `c`.
+    pub fn words(&self) -> (&[u64], usize) {
+        (&self.bits, self.words_per_row)
+    }
+
+    /// Column ranges of consecutive dirty tiles in tile row `row`.
+    pub fn runs(&self, row: usize) -> impl Iterator<Item = Range<usize>> + '_ {
+        let mut column = 0;
+        std::iter::from_fn(move || {
+            while column < self.columns && !self.is_dirty(column, row) {
+                column += 1;
+            }
+            let start = column;
+            while column < self.columns && self.is_dirty(column, row) {
+                column += 1;
+            }
+            (start < column).then_some(start..column)
+        })
+    }
+
+    /// Pixel rectangles covering the changed tiles: runs of tiles in a row,
+    /// merged with the same run of the rows below.
+    pub fn rects(&self) -> Vec<DirtyRect> {
+        let mut rects: Vec<DirtyRect> = vec![];
+        // rects still open for merging, as (index, columns)
+        let mut open: Vec<(usize, Range<usize>)> = vec![];
+        for row in 0..self.rows {
+            let y = row * TILE_SIZE;
+            let height = TILE_SIZE.min(self.height - y) as u32;
+            let mut next_open = vec![];
+            for run in self.runs(row) {
+                match open.iter().find(|o| o.1 == run) {
+                    Some(&(i, _)) => {
+                        rects[i].height += height;
+                        next_open.push((i, run));
+                    }
+                    None => {
+                        let x = run.start * TILE_SIZE;
+                        rects.push(DirtyRect {
+                            x: x as u32,
+                            y: y as u32,
+                            width: ((run.end * TILE_SIZE).min(self.width) - x) as u32,
+                            height,
+                        });
+                        next_open.push((rects.len() - 1, run));
+                    }
+                }
+            }
+            open = next_open;
+        }
+        rects
+    }
+}
+
+#[cfg(target_arch = "x86_64")]
+#[target_feature(enable = "avx2")]
+unsafe fn differs_avx2(a: &[u8], b: &[u8]) -> bool {
+    use std::arch::x86_64::*;
+    let n = a.len().min(b.len());
+    let mut i = 0;
+    while i + 128 <= n {
+        let pa = a.as_ptr().add(i) as *const __m256i;
+        let pb = b.as_ptr().add(i) as *const __m256i;
+        let x0 = _mm256_xor_si256(_mm256_loadu_si256(pa), _mm256_loadu_si256(pb));
+        let x1 = _mm256_xor_si256(_mm256_loadu_si256(pa.add(1)), _mm256_loadu_si256(pb.add(1)));
+        let x2 = _mm256_xor_si256(_mm256_loadu_si256(pa.add(2)), _mm256_loadu_si256(pb.add(2)));
+        let x3 = _mm256_xor_si256(_mm256_loadu_si256(pa.add(3)), _mm256_loadu_si256(pb.add(3)));
+        let x = _mm256_or_si256(_mm256_or_si256(x0, x1), _mm256_or_si256(x2, x3));
+        if _mm256_testz_si256(x, x) == 0 {
+            return true;
+        }
+        i += 128;
+    }
+    differs_scalar(&a[i..n], &b[i..n])
+}
+
+fn differs_scalar(a: &[u8], b: &[u8]) -> bool {
+    let mut ca = a.chunks_exact(8);
+    let mut cb = b.chunks_exact(8);
+    for (x, y) in (&mut ca).zip(&mut cb) {
+        if u64::from_ne_bytes(x.try_into().unwrap()) != u64::from_ne_bytes(y.try_into().unwrap()) {
+            return true;
+        }
+    }
+    ca.remainder() != cb.remainder()
+}
+
+type DiffersFn = fn(&[u8], &[u8]) -> bool;
+
+fn differs_fn() -> DiffersFn {
+    static F: std::sync::OnceLock<DiffersFn> = std::sync::OnceLock::new();
+    *F.get_or_init(|| {
+        #[cfg(target_arch = "x86_64")]
+        if is_x86_feature_detected!("avx2") {
+            return |a, b| unsafe { differs_avx2(a, b) };
+        }
+        differs_scalar
+    })
+}
+
+/// Compares each BGRA frame with the previous one, keeping a packed copy of
+/// the latter. Only changed tiles are copied.
+#[derive(Default)]
+pub struct FrameDiffer {
+    previous: Vec<u8>,
+    map: DirtyMap,
+    threads: usize,
+}
+
+impl FrameDiffer {
+    /// `threads` row strips are compared in parallel, 0 picks the number of
+    /// CPUs for frames above 4K and 1 below.
+    pub fn new(threads: usize) -> Self {
+        Self {
+            threads,
+            ..Default::default()
+        }
+    }
+
+    /// The map of the last frame passed to `diff`, `None` if it failed.
+    pub fn map(&self) -> Option<&DirtyMap> {
+        (self.map.columns > 0).then_some(&self.map)
+    }
+
+    /// Marks the tiles that changed since the previous frame. The first
+    /// frame, and any frame after a size change, is all dirty.
+    pub fn diff(
+        &mut self,
+        data: &[u8],
+        width: usize,
+        height: usize,
+        stride: usize,
+    ) -> Result<&DirtyMap, ()> {
+        let row_bytes = width * BPP;
+        if width == 0
+            || height == 0
+            || stride < row_bytes
+            || data.len() < stride * (height - 1) + row_bytes
+        {
+            // the next frame is all dirty
+            self.map = DirtyMap::default();
+            return Err(());
+        }
+        let resized = self.map.width != width || self.map.height != height;
+        self.map.reset(width, height);
+        if resized || self.previous.len() != row_bytes * height {
+            self.previous.clear();
+            self.previous.reserve_exact(row_bytes * height);
+            for y in 0..height {
+                self.previous
+                    .extend_from_slice(&data[y * stride..y * stride + row_bytes]);
+            }
+            self.map.set_all();
+            return Ok(&self.map);
+        }
+        let threads = match self.threads {
+            0 if width * height > 3840 * 2160 => {
+                thread::available_parallelism().map_or(1, |n| n.get())
+            }
+            0 => 1,
+            n => n,
+        }
+        .min(self.map.rows);
+        let words = self.map.words_per_row;
+        let columns = self.map.columns;
+        let strip_rows = (self.map.rows + threads - 1) / threads;
+        let strips = self
+            .previous
+            .chunks_mut(row_bytes * TILE_SIZE * strip_rows)
+            .zip(self.map.bits.chunks_mut(words * strip_rows))
+            .enumerate();
+        if threads <= 1 {
+            for (i, (previous, bits)) in strips {
+                diff_strip(
+                    data,
+                    stride,
+                    row_bytes,
+                    columns,
+                    words,
+                    i * strip_rows,
+                    previous,
+                    bits,
+                );
+            }
+        } else {
+            thread::scope(|s| {
+                for (i, (previous, bits)) in strips {
+                    s.spawn(move || {
+                        diff_strip(
+                            data,
+                            stride,
+                            row_bytes,
+                            columns,
+                            words,
+                            i * strip_rows,
+                            previous,
+                            bits,
+                        )
+                    });
+                }
+            });
+        }
+        Ok(&self.map)
+    }
+}
+
+/// Diffs the tile rows starting at `first_row` whose packed previous pixels
+/// and bitmap words are `previous` and `bits`, copying changed tiles over.
+#[allow(clippy::too_many_arguments)]
+fn diff_strip(
+    data: &[u8],
+    stride: usize,
+    row_bytes: usize,
+    columns: usize,
+    words: usize,
+    first_row: usize,
+    previous: &mut [u8],
+    bits: &mut [u64],
+) {
+    let differs = differs_fn();
+    let tile_bytes = TILE_SIZE * BPP;
+    let lines = previous.len() / row_bytes;
+    for line in 0..lines {
+        let y = first_row * TILE_SIZE + line;
+        let cur = &data[y * stride..y * stride + row_bytes];
+        let prev = &mut previous[line * row_bytes..(line + 1) * row_bytes];
+        let row_bits = &mut bits[(line / TILE_SIZE) * words..][..words];
+        for c in 0..columns {
+            let (word, bit) = (c / 64, 1u64 << (c % 64));
+            if row_bits[word] & bit != 0 {
+                continue;
+            }
+            let start = c * tile_bytes;
+            let end = (start + tile_bytes).min(row_bytes);
+            if differs(&cur[start..end], &prev[start..end]) {
+                row_bits[word] |= bit;
+            }
+        }
+    }
+    // bring the previous frame up to date, unchanged tiles already are
+    for line in 0..lines {
+        let y = first_row * TILE_SIZE + line;
+        let row_bits = &bits[(line / TILE_SIZE) * words..][..words];
+        let cur = &data[y * stride..y * stride + row_bytes];
+        let prev = &mut previous[line * row_bytes..(line + 1) * row_bytes];
+        for c in 0..columns {
+            if row_bits[c / 64] & (1 << (c % 64)) != 0 {
+                let start = c * tile_bytes;
+                let end = (start + tile_bytes).min(row_bytes);
+                prev[start..end].copy_from_slice(&cur[start..end]);
+            }
+        }
+    }
+}
@@ -1,5 +1,18 @@
+use crate::{
+    cpu,
+    crop::SpsCrop,
+    dirty::{DirtyMap, FrameDiffer},
+    filter::{BitstreamFilter, FilterChain, FilterStats},
+    gop::GopCache,
+    idle::{FrameAction, IdleDetector, IdlePolicy},
+    keyframe::{KeyframeCoalescer, KeyframeRequester, KeyframeStats},
+    parser::{FrameInfo, Parser},
+    scene::{SceneDetector, SceneParams},
+    skip::SkipFrames,
+};
 use gpu_common::{
-    inner::EncodeCalls, AdapterDesc, DynamicContext, EncodeContext, EncodeDriver::*, FeatureContext,
+    inner::EncodeCalls, AdapterDesc, DataFormat, DynamicContext, EncodeContext, EncodeDriver::*,
+    FeatureContext,
 };
 use log::trace;
 use std::{
@@ -8,27 +21,100 @@ use std::{
     slice::from_raw_parts,
     sync::{Arc, Mutex},
     thread,
+    time::{Duration, Instant},
 };
 
+const MAX_POOLED_BUFFERS: usize = 8;
+
+struct EncodeOutput {
+    frames: Vec<EncodeFrame>,
+    pool: Vec<Vec<u8>>,
+    filters: FilterChain,
+    parser: Parser,
+    skip: SkipFrames,
+    crop: Option<SpsCrop>,
+    gop: Option<GopCache>,
+    format: DataFormat,
+}
+
+impl EncodeOutput {
+    /// Recycles the buffers of the previous call that were not taken.
+    fn recycle(&mut self) {
+        for frame in self.frames.drain(..) {
+            if self.pool.len() < MAX_POOLED_BUFFERS && frame.data.capacity() > 0 {
+                let mut data = frame.data;
+                data.clear();
+                self.pool.push(data);
+            }
+        }
+    }
+
+    fn push(&mut self, mut buf: Vec<u8>, key: i32, mut info: FrameInfo) {
+        if let Some(gop) = self.gop.as_mut() {
+            gop.capture(&buf, &info);
+        }
+        if !self.filters.is_empty() {
+            self.filters.run(self.format, &mut buf);
+            if buf.is_empty() {
+                self.pool.push(buf);
+                return;
+            }
+        }
+        info.size = buf.len();
+        if let Some(gop) = self.gop.as_mut() {
+            gop.push(&buf, &info, self.filters.length_prefixed(self.format));
+        }
+        self.frames.push(EncodeFrame {
+            data: buf,
+            pts: 0,
+            key,
+            info,
+        });
+    }
+}
+
 pub struct Encoder {
     calls: EncodeCalls,
     codec: *mut c_void,
-    frames: *mut Vec<EncodeFrame>,
+    output: *mut EncodeOutput,
+    idle: Option<IdleDetector>,
+    dirty: Option<FrameDiffer>,
+    scene: Option<SceneDetector>,
+    keyframes: KeyframeCoalescer,
+    /// Whether the backend runs at the idle framerate.
+    idle_framerate: bool,
     pub ctx: EncodeContext,
 }
 
 unsafe impl Send for Encoder {}
 unsafe impl Sync for Encoder {}
 
+/// Size the backend codes `width` x `height` frames at. 4:2:0 needs even
+/// sizes, so backends pad odd ones by repeating the last column or row.
+fn coded_size(width: i32, height: i32) -> (i32, i32) {
+    ((width + 1) & !1, (height + 1) & !1)
+}
+
+/// Crops H.264 and HEVC streams back from the 16-pixel aligned size the
+/// hardware codes at, in case the backend does not.
+fn sps_crop(format: DataFormat, width: i32, height: i32) -> Option<SpsCrop> {
+    (matches!(format, DataFormat::H264 | DataFormat::H265) && (width % 16 != 0 || height % 16 != 0))
+        .then(|| SpsCrop {
+            width: width as u32,
+            height: height as u32,
+        })
+}
+
 impl Encoder {
+    /// Odd sizes are accepted: frames are padded by one column or row and
+    /// the stream is cropped back as far as its chroma format allows.
     pub fn new(ctx: EncodeContext) -> Result<Self, ()> {
-        if ctx.d.width % 2 == 1 || ctx.d.height % 2 == 1 {
-            return Err(());
-        }
+        let (width, height) = coded_size(ctx.d.width, ctx.d.height);
         let calls = match ctx.f.driver {
             NVENC => nv::encode_calls(),
             AMF => amf::encode_calls(),
             VPL => vpl::encode_calls(),
+            CPU => cpu::encode_calls(),
         };
         unsafe {
             let codec = (calls.new)(
@@ -36,65 +122,337 @@ impl Encoder {
                 ctx.f.luid,
                 ctx.f.api as _,
                 ctx.f.data_format as i32,
-                ctx.d.width,
-                ctx.d.height,
+                width,
+                height,
                 ctx.d.kbitrate,
                 ctx.d.framerate,
                 ctx.d.gop,
+                ctx.d.chroma as i32,
+                ctx.d.range as i32,
             );
             if codec.is_null() {
                 return Err(());
             }
+            let output = EncodeOutput {
+                frames: Vec::new(),
+                pool: Vec::new(),
+                filters: FilterChain::default(),
+                parser: Parser::new(ctx.f.data_format),
+                skip: SkipFrames::new(ctx.f.data_format),
+                crop: sps_crop(ctx.f.data_format, ctx.d.width, ctx.d.height),
+                gop: None,
+                format: ctx.f.data_format,
+            };
             Ok(Self {
                 calls,
                 codec,
-                frames: Box::into_raw(Box::new(Vec::<EncodeFrame>::new())),
+                output: Box::into_raw(Box::new(output)),
+                idle: None,
+                dirty: None,
+                scene: None,
+                keyframes: KeyframeCoalescer::default(),
+                idle_framerate: false,
                 ctx,
             })
         }
     }
 
     pub fn encode(&mut self, tex: *mut c_void) -> Result<&mut Vec<EncodeFrame>, i32> {
+        let now = Instant::now();
+        if self.keyframes.poll(now) {
+            trace!("Forcing a keyframe");
+            if let Err(e) = self.force_keyframe() {
+                trace!("Keyframe request failed: {}", e);
+            }
+        }
         unsafe {
-            (&mut *self.frames).clear();
+            let output = &mut *self.output;
+            output.recycle();
             let result = (self.calls.encode)(
                 self.codec,
                 tex,
                 Some(Self::callback),
-                self.frames as *mut _ as *mut c_void,
+                self.output as *mut c_void,
             );
             if result != 0 {
                 Err(result)
             } else {
-                Ok(&mut *self.frames)
+                let key = output.frames.iter().any(|f| f.is_random_access());
+                self.keyframes.produced(key, now);
+                Ok(&mut output.frames)
             }
         }
     }
 
     extern "C" fn callback(data: *const u8, size: c_int, key: i32, obj: *const c_void) {
         unsafe {
-            let frames = &mut *(obj as *mut Vec<EncodeFrame>);
-            frames.push(EncodeFrame {
-                data: from_raw_parts(data, size as usize).to_vec(),
-                pts: 0,
-                key,
-            });
+            let output = &mut *(obj as *mut EncodeOutput);
+            let mut buf = output.pool.pop().unwrap_or_default();
+            buf.extend_from_slice(from_raw_parts(data, size as usize));
+            if let Some(crop) = output.crop.as_mut() {
+                crop.filter(output.format, &mut buf);
+            }
+            let info = output.parser.parse(&buf);
+            output.skip.follow(&output.parser, &mut buf);
+            output.push(buf, key, info);
+        }
+    }
+
+    /// Like `encode`, for a frame known to be identical to the previous one:
+    /// an all-skip picture is emitted instead of calling the backend when
+    /// the stream allows it, see `skip`.
+    pub fn encode_unchanged(&mut self, tex: *mut c_void) -> Result<&mut Vec<EncodeFrame>, i32> {
+        if self.keyframes.due(Instant::now()) {
+            return self.encode(tex);
+        }
+        let output = unsafe { &mut *self.output };
+        match output.skip.next(&output.parser) {
+            Some(buf) => {
+                output.recycle();
+                let info = output.parser.parse(&buf);
+                output.push(buf, 0, info);
+                Ok(&mut output.frames)
+            }
+            None => self.encode(tex),
+        }
+    }
+
+    /// Enables detection of unchanged frames in `encode_with_pixels`.
+    pub fn set_idle_policy(&mut self, policy: Option<IdlePolicy>) {
+        if self.idle_framerate {
+            self.idle_framerate = false;
+            unsafe { (self.calls.set_framerate)(self.codec, self.ctx.d.framerate) };
         }
+        self.idle = policy.map(IdleDetector::new);
+    }
+
+    pub fn is_idle(&self) -> bool {
+        self.idle.as_ref().map_or(false, |d| d.is_idle())
+    }
+
+    /// Enables the map of changed tiles in `encode_with_pixels`, comparing
+    /// in `threads` row strips, 0 for automatic. `None` disables it.
+    pub fn set_dirty_tracking(&mut self, threads: Option<usize>) {
+        self.dirty = threads.map(FrameDiffer::new);
+    }
+
+    /// The tiles of the frame last passed to `encode_with_pixels` that
+    /// differ from the one before, when tracking is enabled.
+    pub fn dirty_map(&self) -> Option<&DirtyMap> {
+        self.dirty.as_ref().and_then(|d| d.map())
+    }
+
+    /// Enables scene cut detection in `encode_with_pixels`, each cut
+    /// requesting a keyframe. `None` disables it.
+    pub fn set_scene_detection(&mut self, params: Option<SceneParams>) {
+        self.scene = params.map(SceneDetector::new);
+    }
+
+    /// Scene cuts found by `encode_with_pixels` while detection is enabled.
+    pub fn scene_cuts(&self) -> u64 {
+        self.scene.as_ref().map_or(0, |s| s.cuts())
+    }
+
+    /// Asks for a keyframe, an IDR preceded by the parameter sets. Requests
+    /// are coalesced: the next keyframe answers all of them, and keyframes
+    /// are forced at most once per window, see `keyframe`.
+    pub fn request_keyframe(&self) {
+        self.keyframes.request();
+    }
+
+    /// A handle for one receiver to request keyframes from any thread.
+    pub fn keyframe_requester(&self) -> KeyframeRequester {
+        self.keyframes.requester()
+    }
+
+    /// Sets the shortest interval between forced keyframes.
+    pub fn set_keyframe_window(&mut self, window: Duration) {
+        self.keyframes.set_window(window);
+    }
+
+    /// Whether the next `encode` forces a keyframe, for callers deciding
+    /// whether to encode at all.
+    pub fn keyframe_due(&mut self) -> bool {
+        self.keyframes.due(Instant::now())
+    }
+
+    pub fn keyframe_stats(&self) -> KeyframeStats {
+        self.keyframes.stats()
+    }
+
+    /// Keeps the stream since the last keyframe, up to `max_bytes`, for
+    /// `late_join`. `None` disables it.
+    pub fn set_gop_cache(&mut self, max_bytes: Option<usize>) {
+        let format = self.ctx.f.data_format;
+        unsafe { (&mut *self.output).gop = max_bytes.map(|m| GopCache::new(format, m)) }
+    }
+
+    pub fn gop_cache(&self) -> Option<&GopCache> {
+        unsafe { (&*self.output).gop.as_ref() }
+    }
+
+    /// Starts a receiver joining a running stream: passes the cached GOP to
+    /// `send` and returns true, so the receiver decodes from the next packet
+    /// on. Without a complete GOP cached a keyframe is requested instead and
+    /// false is returned.
+    pub fn late_join<F: FnMut(&[u8])>(&self, send: F) -> bool {
+        match self.gop_cache().and_then(|g| g.replay()) {
+            Some(packets) => {
+                packets.for_each(send);
+                true
+            }
+            None => {
+                self.request_keyframe();
+                false
+            }
+        }
+    }
+
+    /// Makes the next frame the backend encodes an IDR, a key frame for AV1,
+    /// preceded by the parameter sets.
+    fn force_keyframe(&mut self) -> Result<(), i32> {
+        unsafe {
+            match (self.calls.request_keyframe)(self.codec) {
+                0 => Ok(()),
+                err => Err(err),
+            }
+        }
+    }
+
+    /// Encodes `tex` under the idle policy. `pixels` is a CPU copy of the
+    /// same frame in BGRA, rows `stride` bytes apart, used to find unchanged
+    /// frames: those are sent as skip pictures or dropped, which returns no
+    /// frames. It also updates `dirty_map` and looks for scene cuts. Without
+    /// a policy the frame is always encoded.
+    pub fn encode_with_pixels(
+        &mut self,
+        tex: *mut c_void,
+        pixels: &[u8],
+        stride: usize,
+    ) -> Result<&mut Vec<EncodeFrame>, i32> {
+        let (width, height) = (self.ctx.d.width as usize, self.ctx.d.height as usize);
+        if let Some(scene) = self.scene.as_mut() {
+            if scene.check(pixels, width, height, stride) {
+                // coalesced with receiver requests, one IDR per window
+                trace!("Scene cut, requesting a keyframe");
+                self.keyframes.request();
+            }
+        }
+        let changed = self.dirty.as_mut().map(|d| {
+            d.diff(pixels, width, height, stride)
+                .map_or(true, |m| !m.is_empty())
+        });
+        let (action, idle, idle_fps) = match self.idle.as_mut() {
+            Some(d) => {
+                let action = match changed {
+                    Some(changed) => d.update(changed),
+                    None => d.check(pixels, width, height, stride),
+                };
+                (action, d.is_idle(), d.policy().idle_framerate)
+            }
+            None => return self.encode(tex),
+        };
+        if let Some(fps) = idle_fps {
+            if idle != self.idle_framerate {
+                let fps = if idle { fps } else { self.ctx.d.framerate };
+                if unsafe { (self.calls.set_framerate)(self.codec, fps) } == 0 {
+                    self.idle_framerate = idle;
+                }
+            }
+        }
+        match action {
+            FrameAction::Encode => self.encode(tex),
+            FrameAction::Repeat => self.encode_unchanged(tex),
+            FrameAction::Drop if self.keyframes.due(Instant::now()) => self.encode(tex),
+            FrameAction::Drop => {
+                let output = unsafe { &mut *self.output };
+                output.recycle();
+                Ok(&mut output.frames)
+            }
+        }
+    }
+
+    /// Appends a filter run on every packet before it is returned by `encode`.
+    pub fn add_filter(&mut self, filter: Box<dyn BitstreamFilter>) {
+        unsafe { (&mut *self.output).filters.push(filter) }
+    }
+
+    pub fn filter_stats(&self) -> Vec<FilterStats> {
+        unsafe { (&*self.output).filters.stats() }
     }
 
     pub fn set_bitrate(&mut self, kbs: i32) -> Result<(), i32> {
         unsafe {
             match (self.calls.set_bitrate)(self.codec, kbs) {
-                0 => Ok(()),
+                0 => {
+                    self.ctx.d.kbitrate = kbs;
+                    Ok(())
+                }
                 err => Err(err),
             }
         }
     }
 
+    /// Recreates the backend for frames of `width` x `height`, keeping the
+    /// bitrate, framerate, filters and policies. What is captured does not
+    /// change, frames are brought to the new size before `encode`, e.g. by
+    /// `scale::Scaler`. The old backend is kept if the new one fails.
+    pub fn set_resolution(&mut self, width: i32, height: i32) -> Result<(), ()> {
+        if width <= 0 || height <= 0 {
+            return Err(());
+        }
+        if width == self.ctx.d.width && height == self.ctx.d.height {
+            return Ok(());
+        }
+        let d = &self.ctx.d;
+        let (coded_width, coded_height) = coded_size(width, height);
+        let codec = unsafe {
+            (self.calls.new)(
+                d.device.unwrap_or(std::ptr::null_mut()),
+                self.ctx.f.luid,
+                self.ctx.f.api as _,
+                self.ctx.f.data_format as i32,
+                coded_width,
+                coded_height,
+                d.kbitrate,
+                d.framerate,
+                d.gop,
+                d.chroma as i32,
+                d.range as i32,
+            )
+        };
+        if codec.is_null() {
+            return Err(());
+        }
+        unsafe { (self.calls.destroy)(self.codec) };
+        self.codec = codec;
+        self.ctx.d.width = width;
+        self.ctx.d.height = height;
+        // created at the normal framerate
+        self.idle_framerate = false;
+        let output = unsafe { &mut *self.output };
+        output.parser = Parser::new(self.ctx.f.data_format);
+        output.skip = SkipFrames::new(self.ctx.f.data_format);
+        output.crop = sps_crop(self.ctx.f.data_format, width, height);
+        if let Some(gop) = output.gop.as_mut() {
+            gop.clear();
+        }
+        trace!("Encoder resized to {}x{}", width, height);
+        Ok(())
+    }
+
     pub fn set_framerate(&mut self, framerate: i32) -> Result<(), i32> {
+        if self.idle_framerate {
+            // applied when the stream leaves idle
+            self.ctx.d.framerate = framerate;
+            return Ok(());
+        }
         unsafe {
             match (self.calls.set_framerate)(self.codec, framerate) {
-                0 => Ok(()),
+                0 => {
+                    self.ctx.d.framerate = framerate;
+                    Ok(())
+                }
                 err => Err(err),
             }
         }
@@ -105,7 +463,7 @@ impl Drop for Encoder {
     fn drop(&mut self) {
         unsafe {
             (self.calls.destroy)(self.codec);
-            let _ = Box::from_raw(self.frames);
+            let _ = Box::from_raw(self.output);
             trace!("Encoder dropped");
         }
     }
@@ -115,11 +473,32 @@ pub struct EncodeFrame {
     pub data: Vec<u8>,
     pub pts: i64,
     pub key: i32,
+    pub info: FrameInfo,
+}
+
+impl EncodeFrame {
+    /// Whether a new decoder can start at this packet. Parsed streams need
+    /// an IDR (an IRAP picture, an AV1 key frame), as backends also flag
+    /// other intra pictures as key; for the others the flag is taken.
+    pub fn is_random_access(&self) -> bool {
+        if self.info.slices.count > 0 {
+            self.info.is_keyframe()
+        } else {
+            self.key != 0
+        }
+    }
 }
 
 impl Display for EncodeFrame {
     fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
-        write!(f, "encode len:{}, key:{}", self.data.len(), self.key)
+        write!(
+            f,
+            "encode len:{}, key:{}, type:{:?}, qp:{:?}",
+            self.data.len(),
+            self.key,
+            self.info.picture_type,
+            self.info.qp
+        )
     }
 }
 
@@ -161,6 +540,7 @@ pub fn available(d: DynamicContext) -> Vec<FeatureContext> {
                 NVENC => nv::encode_calls().test,
                 AMF => amf::encode_calls().test,
                 VPL => vpl::encode_calls().test,
+                CPU => cpu::encode_calls().test,
             };
             let mut descs: Vec<AdapterDesc> = vec![];
             descs.resize(crate::MAX_ADATER_NUM_ONE_VENDER, unsafe {
@@ -179,6 +559,8 @@ pub fn available(d: DynamicContext) -> Vec<FeatureContext> {
                     input.d.kbitrate,
                     input.d.framerate,
                     input.d.gop,
+                    input.d.chroma as i32,
+                    input.d.range as i32,
                 )
             } {
                 if desc_count as usize <= descs.len() {
@@ -198,3 +580,149 @@ pub fn available(d: DynamicContext) -> Vec<FeatureContext> {
     let mut x = outputs.lock().unwrap().clone();
     x.drain(..).map(|e| e.f).collect()
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use gpu_common::{DataFormat::H264, API::API_DX11};
+    use std::ptr::null_mut;
+
+    const WIDTH: usize = 128;
+    const HEIGHT: usize = 64;
+
+    fn encoder() -> Encoder {
+        Encoder::new(EncodeContext {
+            f: FeatureContext {
+                driver: CPU,
+                luid: 0,
+                api: API_DX11,
+                data_format: H264,
+            },
+            d: DynamicContext {
+                device: None,
+                width: WIDTH as i32,
+                height: HEIGHT as i32,
+                kbitrate: 1000,
+                framerate: 30,
+                gop: i32::MAX,
+                chroma: Default::default(),
+                range: Default::default(),
+            },
+        })
+        .unwrap()
+    }
+
+    /// Whether a frame of `value` pixels comes out as an IDR.
+    fn encode_pixels(e: &mut Encoder, value: u8) -> bool {
+        let pixels = vec![value; WIDTH * HEIGHT * 4];
+        let frames = e
+            .encode_with_pixels(null_mut(), &pixels, WIDTH * 4)
+            .unwrap();
+        frames.iter().any(|f| f.is_random_access())
+    }
+
+    #[test]
+    fn scene_cuts_coalesce_with_requests() {
+        let mut e = encoder();
+        e.set_keyframe_window(Duration::from_secs(60));
+        e.set_scene_detection(Some(SceneParams {
+            min_interval: Duration::ZERO,
+            ..Default::default()
+        }));
+        assert!(encode_pixels(&mut e, 0));
+        // a cut within the window of the first IDR waits, with a request
+        assert!(!encode_pixels(&mut e, 0xFF));
+        e.request_keyframe();
+        assert!(!encode_pixels(&mut e, 0));
+        assert_eq!(e.scene_cuts(), 2);
+        let stats = e.keyframe_stats();
+        assert_eq!((stats.requests, stats.forced, stats.keyframes), (3, 0, 1));
+
+        e.set_keyframe_window(Duration::ZERO);
+        assert!(encode_pixels(&mut e, 0xFF));
+        assert!(!encode_pixels(&mut e, 0xFF));
+        let stats = e.keyframe_stats();
+        assert_eq!((stats.requests, stats.forced, stats.keyframes), (4, 1, 2));
+    }
+
+    fn encode(e: &mut Encoder) -> bool {
+        let frames = e.encode(null_mut()).unwrap();
+        frames.iter().any(|f| f.is_random_access())
+    }
+
+    #[test]
+    fn requests_in_window_coalesce() {
+        const WINDOW: Duration = Duration::from_millis(200);
+        let mut e = encoder();
+        e.set_keyframe_window(WINDOW);
+        let requester = e.keyframe_requester();
+        assert!(encode(&mut e));
+        thread::sleep(WINDOW);
+
+        // a burst after the window is answered at once
+        thread::scope(|s| {
+            for _ in 0..5 {
+                let r = requester.clone();
+                s.spawn(move || r.request());
+            }
+        });
+        assert!(encode(&mut e));
+        // one arriving within the window of that IDR waits for its end
+        for _ in 0..5 {
+            e.request_keyframe();
+            assert!(!encode(&mut e));
+        }
+        let stats = e.keyframe_stats();
+        assert_eq!((stats.requests, stats.forced, stats.keyframes), (10, 1, 2));
+
+        thread::sleep(WINDOW);
+        assert!(encode(&mut e));
+        assert!(!encode(&mut e));
+        let stats = e.keyframe_stats();
+        assert_eq!((stats.requests, stats.forced, stats.keyframes), (10, 2, 3));
+    }
+
+    #[test]
+    fn request_after_window_forces_keyframe() {
+        let mut e = encoder();
+        e.set_keyframe_window(Duration::ZERO);
+        assert!(encode(&mut e));
+        for i in 1..=3 {
+            assert!(!e.keyframe_due());
+            e.request_keyframe();
+            assert!(e.keyframe_due());
+            assert!(encode(&mut e));
+            assert!(!encode(&mut e));
+            assert_eq!(e.keyframe_stats().forced, i);
+        }
+    }
+
+    #[test]
+    fn request_overrides_idle_drop() {
+        for min_refresh_interval in [Duration::from_secs(60), Duration::ZERO] {
+            let mut e = encoder();
+            e.set_keyframe_window(Duration::ZERO);
+            e.set_idle_policy(Some(IdlePolicy {
+                min_refresh_interval,
+                ..Default::default()
+            }));
+            assert!(encode_pixels(&mut e, 0x80));
+            let pixels = vec![0x80; WIDTH * HEIGHT * 4];
+            // unchanged frames are dropped or repeated with a skip picture
+            let frames = e
+                .encode_with_pixels(null_mut(), &pixels, WIDTH * 4)
+                .unwrap();
+            assert!(frames.iter().all(|f| !f.is_random_access()));
+            let dropped = frames.is_empty();
+            assert_eq!(dropped, !min_refresh_interval.is_zero());
+
+            e.request_keyframe();
+            assert!(encode_pixels(&mut e, 0x80));
+            let frames = e
+                .encode_with_pixels(null_mut(), &pixels, WIDTH * 4)
+                .unwrap();
+            assert_eq!(frames.is_empty(), dropped);
+            assert_eq!(e.keyframe_stats().forced, 1);
+        }
+    }
+}
@@ -0,0 +1,196 @@
+use crate::{avcc, nal};
+use gpu_common::{DataFormat, DataFormat::*};
+
+/// A packet rewrite applied to encoder output before it is handed out.
+pub trait BitstreamFilter: Send {
+    fn name(&self) -> &'static str;
+
+    /// Rewrites `data` in place and returns the number of bytes saved.
+    fn filter(&mut self, format: DataFormat, data: &mut Vec<u8>) -> usize;
+
+    /// Whether packets of `format` leave the filter length-prefixed rather
+    /// than Annex-B.
+    fn length_prefixed(&self, _format: DataFormat) -> bool {
+        false
+    }
+}
+
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct FilterStats {
+    pub name: &'static str,
+    pub packets: u64,
+    pub bytes_in: u64,
+    pub bytes_saved: u64,
+}
+
+#[derive(Default)]
+pub struct FilterChain {
+    filters: Vec<(Box<dyn BitstreamFilter>, FilterStats)>,
+}
+
+impl FilterChain {
+    pub fn push(&mut self, filter: Box<dyn BitstreamFilter>) {
+        let stats = FilterStats {
+            name: filter.name(),
+            ..Default::default()
+        };
+        self.filters.push((filter, stats));
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.filters.is_empty()
+    }
+
+    pub fn run(&mut self, format: DataFormat, data: &mut Vec<u8>) {
+        for (filter, stats) in self.filters.iter_mut() {
+            stats.packets += 1;
+            stats.bytes_in += data.len() as u64;
+            stats.bytes_saved += filter.filter(format, data) as u64;
+        }
+    }
+
+    /// Whether packets of `format` leave the chain length-prefixed.
+    pub fn length_prefixed(&self, format: DataFormat) -> bool {
+        self.filters.iter().any(|(f, _)| f.length_prefixed(format))
+    }
+
+    pub fn stats(&self) -> Vec<FilterStats> {
+        self.filters.iter().map(|(_, s)| s.clone()).collect()
+    }
+
+    pub fn reset_stats(&mut self) {
+        for (filter, stats) in self.filters.iter_mut() {
+            *stats = FilterStats {
+                name: filter.name(),
+                ..Default::default()
+            };
+        }
+    }
+}
+
+/// Whether `format` is made of NAL units the filters below rewrite; other
+/// packets pass through them unchanged.
+fn is_annexb(format: DataFormat) -> bool {
+    matches!(format, H264 | H265)
+}
+
+/// Drops access unit delimiters.
+pub struct StripAud;
+
+impl BitstreamFilter for StripAud {
+    fn name(&self) -> &'static str {
+        "strip_aud"
+    }
+
+    fn filter(&mut self, format: DataFormat, data: &mut Vec<u8>) -> usize {
+        if !is_annexb(format) {
+            return 0;
+        }
+        nal::rewrite_nals(data, |p| match p.first() {
+            Some(&h) if nal::is_aud(format, nal::nal_type(format, h)) => None,
+            _ => Some(p.len()),
+        })
+    }
+}
+
+/// Drops filler data NAL units and cabac_zero_words trailing slice data.
+pub struct DropFiller;
+
+impl BitstreamFilter for DropFiller {
+    fn name(&self) -> &'static str {
+        "drop_filler"
+    }
+
+    fn filter(&mut self, format: DataFormat, data: &mut Vec<u8>) -> usize {
+        if !is_annexb(format) {
+            return 0;
+        }
+        nal::rewrite_nals(data, |p| {
+            let t = match p.first() {
+                Some(&h) => nal::nal_type(format, h),
+                None => return Some(0),
+            };
+            if nal::is_filler(format, t) {
+                return None;
+            }
+            if !nal::is_slice(format, t) {
+                return Some(p.len());
+            }
+            // cabac_zero_words end up as repeated 00 00 03 triplets, which
+            // the escaped slice data itself can never end with
+            let mut len = p.len();
+            while len >= 4 && p[len - 3..len] == [0, 0, 3] {
+                len -= 3;
+            }
+            Some(len)
+        })
+    }
+}
+
+/// Replaces start codes with 4-byte big-endian NAL lengths.
+pub struct AnnexBToLengthPrefixed;
+
+impl BitstreamFilter for AnnexBToLengthPrefixed {
+    fn name(&self) -> &'static str {
+        "annexb_to_length_prefixed"
+    }
+
+    fn filter(&mut self, format: DataFormat, data: &mut Vec<u8>) -> usize {
+        if !is_annexb(format) {
+            return 0;
+        }
+        let before = data.len();
+        avcc::annexb_to_length_prefixed(data);
+        before.saturating_sub(data.len())
+    }
+
+    fn length_prefixed(&self, format: DataFormat) -> bool {
+        is_annexb(format)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::obu;
+
+    fn chain() -> FilterChain {
+        let mut chain = FilterChain::default();
+        chain.push(Box::new(StripAud));
+        chain.push(Box::new(DropFiller));
+        chain.push(Box::new(AnnexBToLengthPrefixed));
+        chain
+    }
+
+    #[test]
+    fn av1_passes_unchanged() {
+        // a temporal delimiter, then a frame OBU whose payload holds what
+        // would be start codes of an AUD, filler data and cabac_zero_words
+        let payload = [
+            0x10, 0x00, 0x00, 0x01, 0x09, 0xF0, 0x00, 0x00, 0x01, 0x0C, 0xFF, 0x80, 0x00, 0x00,
+            0x03, 0x00, 0x00, 0x03,
+        ];
+        let mut tu = vec![obu::OBU_TEMPORAL_DELIMITER << 3 | 2, 0];
+        tu.push(obu::OBU_FRAME << 3 | 2);
+        obu::write_leb128(payload.len() as u64, &mut tu);
+        tu.extend_from_slice(&payload);
+
+        let mut chain = chain();
+        let mut data = tu.clone();
+        chain.run(AV1, &mut data);
+        assert_eq!(data, tu);
+        assert!(chain.stats().iter().all(|s| s.bytes_saved == 0));
+        assert!(!chain.length_prefixed(AV1));
+        assert!(chain.length_prefixed(H264) && chain.length_prefixed(H265));
+    }
+
+    #[test]
+    fn h264_rewritten() {
+        let mut data = vec![
+            0, 0, 0, 1, 0x09, 0xF0, 0, 0, 0, 1, 0x65, 0x88, 0x80, 0, 0, 3,
+        ];
+        data.extend_from_slice(&[0, 0, 1, 0x0C, 0xFF, 0xFF, 0x80]);
+        chain().run(H264, &mut data);
+        assert_eq!(data, [0, 0, 0, 3, 0x65, 0x88, 0x80]);
+    }
+}
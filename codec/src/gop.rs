@@ -0,0 +1,377 @@
+//! The stream since the last keyframe, kept so a receiver joining late can
+//! start decoding at once instead of every receiver getting a new IDR.
+//!
+//! The first cached packet is the keyframe with the current parameter sets
+//! in front, taken from earlier packets when the keyframe does not carry
+//! them. Parameter sets are read before bitstream filters run, and written
+//! in the layout the filters hand packets out in. Packets are copied into
+//! pooled buffers. Once the GOP outgrows the memory cap nothing is cached
+//! until the next keyframe, and joiners need one, see `Encoder::late_join`.
+
+use crate::{nal, obu, parser::FrameInfo};
+use gpu_common::DataFormat::{self, *};
+
+pub struct GopCache {
+    format: DataFormat,
+    max_bytes: usize,
+    /// Latest parameter sets, Annex-B NAL units or sequence header OBUs.
+    params: Vec<u8>,
+    /// Bytes of `params` with 4-byte lengths instead of start codes.
+    params_length_prefixed: usize,
+    packets: Vec<Vec<u8>>,
+    bytes: usize,
+    /// Whether the current GOP outgrew `max_bytes`.
+    overflowed: bool,
+    pool: Vec<Vec<u8>>,
+    pool_bytes: usize,
+}
+
+impl GopCache {
+    pub fn new(format: DataFormat, max_bytes: usize) -> Self {
+        Self {
+            format,
+            max_bytes,
+            params: Vec::new(),
+            params_length_prefixed: 0,
+            packets: Vec::new(),
+            bytes: 0,
+            overflowed: false,
+            pool: Vec::new(),
+            pool_bytes: 0,
+        }
+    }
+
+    pub fn max_bytes(&self) -> usize {
+        self.max_bytes
+    }
+
+    /// Bytes of the cached packets.
+    pub fn bytes(&self) -> usize {
+        self.bytes
+    }
+
+    /// Cached packets, the keyframe included.
+    pub fn len(&self) -> usize {
+        self.packets.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.packets.is_empty()
+    }
+
+    /// Whether the current GOP outgrew the cap.
+    pub fn overflowed(&self) -> bool {
+        self.overflowed
+    }
+
+    /// The packets a new receiver decodes from, keyframe first, or `None`
+    /// when there is no keyframe cached or the GOP outgrew the cap.
+    pub fn replay(&self) -> Option<impl Iterator<Item = &[u8]>> {
+        (!self.packets.is_empty()).then(|| self.packets.iter().map(|p| p.as_slice()))
+    }
+
+    /// Drops the cached packets, e.g. when the stream restarts.
+    pub fn clear(&mut self) {
+        self.recycle();
+        self.overflowed = false;
+        self.params.clear();
+        self.params_length_prefixed = 0;
+    }
+
+    fn recycle(&mut self) {
+        for mut buf in self.packets.drain(..) {
+            // pooled buffers stay within the cap as well
+            if self.pool_bytes + buf.capacity() <= self.max_bytes {
+                self.pool_bytes += buf.capacity();
+                buf.clear();
+                self.pool.push(buf);
+            }
+        }
+        self.bytes = 0;
+    }
+
+    fn buffer(&mut self) -> Vec<u8> {
+        match self.pool.pop() {
+            Some(buf) => {
+                self.pool_bytes -= buf.capacity();
+                buf
+            }
+            None => Vec::new(),
+        }
+    }
+
+    /// Appends the parameter sets in `data` to `out`, returns whether there
+    /// were any.
+    fn copy_params(format: DataFormat, data: &[u8], out: &mut Vec<u8>) -> bool {
+        let len = out.len();
+        match format {
+            H264 | H265 => {
+                for n in nal::nal_units(data) {
+                    let t = nal::nal_type(format, data[n.header]);
+                    if match format {
+                        H264 => t == nal::H264_NAL_SPS || t == nal::H264_NAL_PPS,
+                        _ => (nal::HEVC_NAL_VPS..=nal::HEVC_NAL_PPS).contains(&t),
+                    } {
+                        out.extend_from_slice(&data[n.start..n.end]);
+                    }
+                }
+            }
+            AV1 => {
+                for o in obu::obus(data) {
+                    if o.obu_type == obu::OBU_SEQUENCE_HEADER {
+                        out.extend_from_slice(&data[o.start..o.end]);
+                    }
+                }
+            }
+            _ => {}
+        }
+        out.len() > len
+    }
+
+    /// Takes the parameter sets of a packet as the encoder returned it,
+    /// before any bitstream filter runs.
+    pub fn capture(&mut self, data: &[u8], info: &FrameInfo) {
+        if info.parameter_sets.count == 0 {
+            return;
+        }
+        let mut params = std::mem::take(&mut self.params);
+        let start = params.len();
+        if Self::copy_params(self.format, data, &mut params) {
+            params.drain(..start);
+            self.params_length_prefixed = nal::nal_units(&params).map(|n| 4 + n.len()).sum();
+        }
+        self.params = params;
+    }
+
+    /// Writes the parameter sets to `out`, H.264 and HEVC ones with 4-byte
+    /// lengths when `length_prefixed`.
+    fn put_params(&self, out: &mut Vec<u8>, length_prefixed: bool) {
+        if !length_prefixed {
+            out.extend_from_slice(&self.params);
+            return;
+        }
+        for n in nal::nal_units(&self.params) {
+            out.extend_from_slice(&(n.len() as u32).to_be_bytes());
+            out.extend_from_slice(n.payload(&self.params));
+        }
+    }
+
+    /// Adds a packet as handed out, after `capture` saw it before the
+    /// filters. `length_prefixed` tells whether the filters made H.264 or
+    /// HEVC packets length-prefixed.
+    pub fn push(&mut self, data: &[u8], info: &FrameInfo, length_prefixed: bool) {
+        let length_prefixed = length_prefixed && matches!(self.format, H264 | H265);
+        if info.is_keyframe() {
+            self.recycle();
+            self.overflowed = false;
+        } else if self.packets.is_empty() {
+            return;
+        }
+        let extra = match info.is_keyframe() && info.parameter_sets.count == 0 {
+            true if length_prefixed => self.params_length_prefixed,
+            true => self.params.len(),
+            false => 0,
+        };
+        if self.bytes + data.len() + extra > self.max_bytes {
+            self.recycle();
+            self.overflowed = true;
+            return;
+        }
+        let mut buf = self.buffer();
+        if extra > 0 {
+            // after the temporal delimiter of an AV1 temporal unit
+            let head = match obu::next_obu(data, 0) {
+                Some(o) if self.format == AV1 && o.obu_type == obu::OBU_TEMPORAL_DELIMITER => o.end,
+                _ => 0,
+            };
+            buf.extend_from_slice(&data[..head]);
+            self.put_params(&mut buf, length_prefixed);
+            buf.extend_from_slice(&data[head..]);
+        } else {
+            buf.extend_from_slice(data);
+        }
+        self.bytes += buf.len();
+        self.packets.push(buf);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{avcc, parser::Parser, skip::SkipFrames};
+
+    /// The embedded H.264 clip, SPS, PPS and an IDR, followed by the IDR
+    /// alone and a skip picture.
+    fn packets() -> Vec<Vec<u8>> {
+        let clip = unsafe {
+            let (mut p, mut len) = (std::ptr::null_mut(), 0);
+            crate::gpu_video_codec_get_bin_file(H264 as _, &mut p, &mut len);
+            std::slice::from_raw_parts(p, len as usize).to_vec()
+        };
+        let mut parser = Parser::new(H264);
+        let mut skip = SkipFrames::new(H264);
+        let mut first = clip.clone();
+        parser.parse(&first);
+        skip.follow(&parser, &mut first);
+        let idr = nal::nal_units(&clip)
+            .find(|n| nal::nal_type(H264, clip[n.header]) == nal::H264_NAL_IDR)
+            .map(|n| clip[n.start..].to_vec())
+            .unwrap();
+        vec![first, idr, skip.next(&parser).unwrap()]
+    }
+
+    fn types(data: &[u8], length_prefixed: bool) -> Vec<u8> {
+        if length_prefixed {
+            avcc::length_prefixed_units(data, 4)
+                .unwrap()
+                .iter()
+                .map(|u| nal::nal_type(H264, u[0]))
+                .collect()
+        } else {
+            nal::nal_units(data)
+                .map(|n| nal::nal_type(H264, data[n.header]))
+                .collect()
+        }
+    }
+
+    #[test]
+    fn keyframe_gets_parameter_sets_in_output_layout() {
+        for length_prefixed in [false, true] {
+            let mut cache = GopCache::new(H264, 1 << 20);
+            let mut parser = Parser::new(H264);
+            for data in packets() {
+                let info = parser.parse(&data);
+                cache.capture(&data, &info);
+                let mut out = data.clone();
+                if length_prefixed {
+                    avcc::annexb_to_length_prefixed(&mut out);
+                }
+                cache.push(&out, &info, length_prefixed);
+            }
+            let replay: Vec<&[u8]> = cache.replay().unwrap().collect();
+            assert_eq!(replay.len(), 2);
+            assert_eq!(
+                types(replay[0], length_prefixed),
+                [nal::H264_NAL_SPS, nal::H264_NAL_PPS, nal::H264_NAL_IDR]
+            );
+            assert_eq!(types(replay[1], length_prefixed), [nal::H264_NAL_SLICE]);
+            assert_eq!(cache.bytes(), replay[0].len() + replay[1].len());
+        }
+    }
+
+    /// Pushes `packets` as the encoder returned them, unfiltered.
+    fn push_all(cache: &mut GopCache, parser: &mut Parser, packets: &[Vec<u8>]) {
+        for data in packets {
+            let info = parser.parse(data);
+            cache.capture(data, &info);
+            cache.push(data, &info, false);
+        }
+    }
+
+    #[test]
+    fn overflow_until_next_keyframe() {
+        let p = packets();
+        let (first, idr, skip) = (&p[0], &p[1], &p[2]);
+        let max_bytes = first.len() + 2 * skip.len();
+        let mut cache = GopCache::new(H264, max_bytes);
+        let mut parser = Parser::new(H264);
+        push_all(
+            &mut cache,
+            &mut parser,
+            &[first.clone(), skip.clone(), skip.clone()],
+        );
+        assert_eq!((cache.len(), cache.bytes()), (3, max_bytes));
+        assert!(!cache.overflowed());
+
+        push_all(&mut cache, &mut parser, &[skip.clone()]);
+        assert!(cache.overflowed());
+        assert!(cache.replay().is_none());
+        assert_eq!((cache.len(), cache.bytes()), (0, 0));
+        push_all(&mut cache, &mut parser, &[skip.clone(), skip.clone()]);
+        assert!(cache.overflowed() && cache.replay().is_none());
+
+        // the next keyframe starts over, with the parameter sets seen before
+        push_all(&mut cache, &mut parser, &[idr.clone(), skip.clone()]);
+        assert!(!cache.overflowed());
+        let replay: Vec<&[u8]> = cache.replay().unwrap().collect();
+        assert_eq!(replay.len(), 2);
+        assert_eq!(
+            types(replay[0], false),
+            [nal::H264_NAL_SPS, nal::H264_NAL_PPS, nal::H264_NAL_IDR]
+        );
+
+        // a keyframe larger than the cap is not cached either
+        let mut cache = GopCache::new(H264, first.len() - 1);
+        push_all(&mut cache, &mut parser, &[first.clone(), skip.clone()]);
+        assert!(cache.overflowed() && cache.replay().is_none());
+    }
+
+    #[test]
+    fn pool_within_cap() {
+        let p = packets();
+        let max_bytes = p[0].len() + 3 * p[2].len();
+        let mut cache = GopCache::new(H264, max_bytes);
+        let mut parser = Parser::new(H264);
+        for gop in 0..20 {
+            let skips = gop % 6;
+            let mut packets = vec![p[gop % 2].clone()];
+            packets.extend(std::iter::repeat(p[2].clone()).take(skips));
+            push_all(&mut cache, &mut parser, &packets);
+            assert_eq!(cache.overflowed(), skips > 3);
+            let pooled: usize = cache.pool.iter().map(|b| b.capacity()).sum();
+            assert_eq!(cache.pool_bytes, pooled);
+            assert!(cache.pool_bytes <= max_bytes);
+            assert!(cache.bytes() <= max_bytes);
+        }
+    }
+
+    #[test]
+    fn clear_drops_packets_and_parameter_sets() {
+        let p = packets();
+        let mut cache = GopCache::new(H264, 1 << 20);
+        let mut parser = Parser::new(H264);
+        push_all(&mut cache, &mut parser, &p);
+        assert_eq!(cache.len(), 2);
+        cache.clear();
+        assert!(cache.replay().is_none() && cache.is_empty());
+        assert_eq!(cache.bytes(), 0);
+        assert!(!cache.overflowed());
+        // nothing to put in front of a keyframe without parameter sets
+        push_all(&mut cache, &mut parser, &p[1..]);
+        let replay: Vec<&[u8]> = cache.replay().unwrap().collect();
+        assert_eq!(types(replay[0], false), [nal::H264_NAL_IDR]);
+    }
+
+    #[test]
+    fn av1_sequence_header_after_temporal_delimiter() {
+        let clip = unsafe {
+            let (mut p, mut len) = (std::ptr::null_mut(), 0);
+            crate::gpu_video_codec_get_bin_file(AV1 as _, &mut p, &mut len);
+            std::slice::from_raw_parts(p, len as usize).to_vec()
+        };
+        let obu_types = |data: &[u8]| -> Vec<u8> { obu::obus(data).map(|o| o.obu_type).collect() };
+        assert_eq!(
+            obu_types(&clip)[..2],
+            [obu::OBU_TEMPORAL_DELIMITER, obu::OBU_SEQUENCE_HEADER]
+        );
+        // the key frame again without its sequence header
+        let mut key = vec![];
+        for o in obu::obus(&clip) {
+            if o.obu_type != obu::OBU_SEQUENCE_HEADER {
+                key.extend_from_slice(&clip[o.start..o.end]);
+            }
+        }
+        let mut cache = GopCache::new(AV1, 1 << 20);
+        let mut parser = Parser::new(AV1);
+        for length_prefixed in [false, true] {
+            for data in [&clip, &key] {
+                let info = parser.parse(data);
+                assert!(info.is_keyframe());
+                cache.capture(data, &info);
+                cache.push(data, &info, length_prefixed);
+                let replay: Vec<&[u8]> = cache.replay().unwrap().collect();
+                assert_eq!(replay, [&clip[..]]);
+            }
+        }
+    }
+}
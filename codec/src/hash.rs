@@ -0,0 +1,142 @@
+//! Tile-wise CRC32C hashes of CPU frames, used to find unchanged content.
+
+/// Tiles are `TILE_SIZE` x `TILE_SIZE` pixels, the last row and column may
+/// be smaller.
+pub const TILE_SIZE: usize = 64;
+
+const POLY: u32 = 0x82F6_3B78;
+
+const fn crc_table() -> [u32; 256] {
+    let mut table = [0u32; 256];
+    let mut i = 0;
+    while i < 256 {
+        let mut crc = i as u32;
+        let mut k = 0;
+        while k < 8 {
+            crc = if crc & 1 != 0 {
+                (crc >> 1) ^ POLY
+            } else {
+                crc >> 1
+            };
+            k += 1;
+        }
+        table[i] = crc;
+        i += 1;
+    }
+    table
+}
+
+static TABLE: [u32; 256] = crc_table();
+
+fn crc32c_sw(mut crc: u32, data: &[u8]) -> u32 {
+    for &b in data {
+        crc = TABLE[((crc ^ b as u32) & 0xFF) as usize] ^ (crc >> 8);
+    }
+    crc
+}
+
+#[cfg(target_arch = "x86_64")]
+#[target_feature(enable = "sse4.2")]
+unsafe fn crc32c_sse42(crc: u32, data: &[u8]) -> u32 {
+    use std::arch::x86_64::{_mm_crc32_u64, _mm_crc32_u8};
+    let mut crc = crc as u64;
+    let mut chunks = data.chunks_exact(8);
+    for c in &mut chunks {
+        crc = _mm_crc32_u64(crc, u64::from_le_bytes(c.try_into().unwrap()));
+    }
+    let mut crc = crc as u32;
+    for &b in chunks.remainder() {
+        crc = _mm_crc32_u8(crc, b);
+    }
+    crc
+}
+
+#[cfg(target_arch = "aarch64")]
+#[target_feature(enable = "crc")]
+unsafe fn crc32c_arm(crc: u32, data: &[u8]) -> u32 {
+    use std::arch::aarch64::{__crc32cb, __crc32cd};
+    let mut crc = crc;
+    let mut chunks = data.chunks_exact(8);
+    for c in &mut chunks {
+        crc = __crc32cd(crc, u64::from_le_bytes(c.try_into().unwrap()));
+    }
+    for &b in chunks.remainder() {
+        crc = __crc32cb(crc, b);
+    }
+    crc
+}
+
+type CrcFn = fn(u32, &[u8]) -> u32;
+
+fn select() -> CrcFn {
+    #[cfg(target_arch = "x86_64")]
+    if is_x86_feature_detected!("sse4.2") {
+        return |crc, data| unsafe { crc32c_sse42(crc, data) };
+    }
+    #[cfg(target_arch = "aarch64")]
+    if std::arch::is_aarch64_feature_detected!("crc") {
+        return |crc, data| unsafe { crc32c_arm(crc, data) };
+    }
+    crc32c_sw
+}
+
+fn crc_fn() -> CrcFn {
+    static CRC: std::sync::OnceLock<CrcFn> = std::sync::OnceLock::new();
+    *CRC.get_or_init(select)
+}
+
+/// Updates a raw (not pre- or post-inverted) CRC32C with `data`, using the
+/// CRC instructions of the CPU when it has them.
+pub fn crc32c(crc: u32, data: &[u8]) -> u32 {
+    crc_fn()(crc, data)
+}
+
+/// One hash per tile of a frame, row by row.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct TileHashes {
+    pub columns: usize,
+    pub rows: usize,
+    pub hashes: Vec<u32>,
+}
+
+impl TileHashes {
+    /// Hashes a frame of `width` x `height` pixels of `bpp` bytes, rows
+    /// `stride` bytes apart.
+    pub fn compute(
+        &mut self,
+        data: &[u8],
+        width: usize,
+        height: usize,
+        bpp: usize,
+        stride: usize,
+    ) -> Result<(), ()> {
+        let row_bytes = width * bpp;
+        if width == 0 || height == 0 || stride < row_bytes {
+            return Err(());
+        }
+        if data.len() < stride * (height - 1) + row_bytes {
+            return Err(());
+        }
+        self.columns = (width + TILE_SIZE - 1) / TILE_SIZE;
+        self.rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+        self.hashes.clear();
+        self.hashes.resize(self.columns * self.rows, !0);
+        let crc = crc_fn();
+        let tile_bytes = TILE_SIZE * bpp;
+        for y in 0..height {
+            let row = &data[y * stride..y * stride + row_bytes];
+            let hashes = &mut self.hashes[(y / TILE_SIZE) * self.columns..][..self.columns];
+            // independent CRC chains per tile keep the CRC unit busy
+            for (h, part) in hashes.iter_mut().zip(row.chunks(tile_bytes)) {
+                *h = crc(*h, part);
+            }
+        }
+        Ok(())
+    }
+
+    /// Whether any tile differs from `other`, frames of another size
+    /// included.
+    pub fn differs(&self, other: &TileHashes) -> bool {
+        self.columns != other.columns || self.rows != other.rows || self.hashes != other.hashes
+    }
+}
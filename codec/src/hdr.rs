@@ -0,0 +1,548 @@
+//! CPU conversion of 10-bit and HDR captures to P010, and the HDR10 static
+//! metadata decoders tone map with: mastering display colour volume and
+//! content light level, as SEI messages for H.264 and HEVC or metadata OBUs
+//! for AV1.
+//!
+//! P010 holds studio range samples in the high 10 bits of each `u16`, its
+//! interleaved chroma halved both ways as in NV12.
+
+use crate::{
+    convert::{band_threads, run_bands},
+    filter::BitstreamFilter,
+    nal, obu,
+};
+use gpu_common::{
+    DataFormat::{self, *},
+    DynamicRange,
+};
+
+/// Packed RGB layouts of 10-bit and HDR captures.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum HdrFormat {
+    /// `DXGI_FORMAT_R10G10B10A2_UNORM`, already encoded with the transfer
+    /// of the target range: BT.2020 PQ or HLG for HDR, BT.709 otherwise.
+    Rgb10a2,
+    /// `DXGI_FORMAT_R16G16B16A16_FLOAT` scRGB, linear BT.709 primaries with
+    /// 1.0 at 80 nits, as an HDR desktop is captured.
+    Rgba16f,
+}
+
+impl HdrFormat {
+    pub fn bytes_per_pixel(self) -> usize {
+        match self {
+            HdrFormat::Rgb10a2 => 4,
+            HdrFormat::Rgba16f => 8,
+        }
+    }
+}
+
+/// Destination of `RgbToP010::convert`, strides in samples.
+pub struct P010Planes<'a> {
+    pub y: &'a mut [u16],
+    pub y_stride: usize,
+    pub uv: &'a mut [u16],
+    pub uv_stride: usize,
+}
+
+const BT709_TO_BT2020: [[f32; 3]; 3] = [
+    [0.627404, 0.329282, 0.0433136],
+    [0.069097, 0.919540, 0.0113612],
+    [0.0163916, 0.0880132, 0.895595],
+];
+const SCRGB_NITS: f32 = 80.0;
+const HLG_PEAK_NITS: f32 = 1000.0;
+const HLG_GAMMA: f32 = 1.2;
+
+/// SMPTE ST 2084 inverse EOTF of `l` in units of 10000 nits.
+pub fn pq(l: f32) -> f32 {
+    let (m1, m2) = (0.1593017578125, 78.84375);
+    let (c1, c2, c3) = (0.8359375, 18.8515625, 18.6875);
+    let p = l.max(0.0).powf(m1);
+    ((c1 + c2 * p) / (1.0 + c3 * p)).powf(m2)
+}
+
+/// ARIB STD-B67 OETF of normalised scene light.
+pub fn hlg(e: f32) -> f32 {
+    let (a, b, c) = (0.17883277, 0.28466892, 0.55991073);
+    if e <= 1.0 / 12.0 {
+        (3.0 * e.max(0.0)).sqrt()
+    } else {
+        a * (12.0 * e - b).ln() + c
+    }
+}
+
+/// A function of [0, 1] sampled at every `f32` whose low 16 bits are 0 and
+/// linear in between, which within one exponent is linear in the value.
+struct Curve(Vec<f32>);
+
+impl Curve {
+    fn new(f: impl Fn(f32) -> f32) -> Self {
+        let last = (1.0f32.to_bits() >> 16) + 1;
+        Curve((0..=last).map(|i| f(f32::from_bits(i << 16))).collect())
+    }
+
+    fn get(&self, x: f32) -> f32 {
+        if !(x > 0.0) {
+            return self.0[0];
+        }
+        let bits = x.min(1.0).to_bits();
+        let (i, frac) = ((bits >> 16) as usize, (bits & 0xFFFF) as f32 / 65536.0);
+        self.0[i] + (self.0[i + 1] - self.0[i]) * frac
+    }
+}
+
+fn f16_to_f32(h: u16) -> f32 {
+    let sign = if h & 0x8000 != 0 { -1.0 } else { 1.0 };
+    let exp = ((h >> 10) & 0x1F) as u32;
+    let man = (h & 0x3FF) as u32;
+    match exp {
+        0 => sign * man as f32 / (1 << 24) as f32,
+        31 if man == 0 => sign * f32::INFINITY,
+        31 => f32::NAN,
+        _ => sign * f32::from_bits(((exp + 112) << 23) | (man << 13)),
+    }
+}
+
+/// Converts 10-bit or HDR RGB to P010 with the matrix and transfer of a
+/// `DynamicRange`: BT.2020 with PQ or HLG for HDR, BT.709 otherwise.
+/// Linear input is encoded by table, HLG after the inverse of the OOTF of a
+/// 1000 nit display.
+pub struct RgbToP010 {
+    format: HdrFormat,
+    range: DynamicRange,
+    threads: usize,
+    kr: f32,
+    kb: f32,
+    half: Vec<f32>,
+    curve: Option<Curve>,
+    ootf: Option<Curve>,
+}
+
+impl RgbToP010 {
+    pub fn new(format: HdrFormat, range: DynamicRange) -> Self {
+        let hdr = matches!(
+            range,
+            DynamicRange::DYNAMIC_RANGE_HDR_PQ | DynamicRange::DYNAMIC_RANGE_HDR_HLG
+        );
+        let (kr, kb) = if hdr {
+            (0.2627, 0.0593)
+        } else {
+            (0.2126, 0.0722)
+        };
+        let linear = format == HdrFormat::Rgba16f;
+        let curve = linear.then(|| match range {
+            DynamicRange::DYNAMIC_RANGE_HDR_PQ => Curve::new(pq),
+            DynamicRange::DYNAMIC_RANGE_HDR_HLG => Curve::new(hlg),
+            // display light, the inverse of BT.1886
+            _ => Curve::new(|l| l.powf(1.0 / 2.4)),
+        });
+        let ootf = (linear && range == DynamicRange::DYNAMIC_RANGE_HDR_HLG)
+            .then(|| Curve::new(|y| y.powf((1.0 - HLG_GAMMA) / HLG_GAMMA)));
+        Self {
+            format,
+            range,
+            threads: 1,
+            kr,
+            kb,
+            half: if linear {
+                (0..=u16::MAX).map(f16_to_f32).collect()
+            } else {
+                vec![]
+            },
+            curve,
+            ootf,
+        }
+    }
+
+    /// Splits frames into `threads` row bands, 0 picks the number of CPUs
+    /// for frames above 4K and 1 below.
+    pub fn with_threads(mut self, threads: usize) -> Self {
+        self.threads = threads;
+        self
+    }
+
+    /// Non-linear R'G'B' of the pixel at the start of `p`.
+    fn pixel(&self, p: &[u8]) -> [f32; 3] {
+        match self.format {
+            HdrFormat::Rgb10a2 => {
+                let v = u32::from_le_bytes([p[0], p[1], p[2], p[3]]);
+                [0, 10, 20].map(|s| ((v >> s) & 0x3FF) as f32 / 1023.0)
+            }
+            HdrFormat::Rgba16f => {
+                let c = |i: usize| self.half[u16::from_le_bytes([p[2 * i], p[2 * i + 1]]) as usize];
+                self.encode([c(0), c(1), c(2)])
+            }
+        }
+    }
+
+    fn encode(&self, rgb: [f32; 3]) -> [f32; 3] {
+        let curve = self.curve.as_ref().unwrap();
+        let to_2020 = |scale: f32| {
+            BT709_TO_BT2020.map(|m| scale * (m[0] * rgb[0] + m[1] * rgb[1] + m[2] * rgb[2]))
+        };
+        match self.range {
+            DynamicRange::DYNAMIC_RANGE_HDR_PQ => {
+                to_2020(SCRGB_NITS / 10000.0).map(|l| curve.get(l))
+            }
+            DynamicRange::DYNAMIC_RANGE_HDR_HLG => {
+                let d = to_2020(SCRGB_NITS / HLG_PEAK_NITS).map(|l| l.clamp(0.0, 1.0));
+                let y = self.kr * d[0] + (1.0 - self.kr - self.kb) * d[1] + self.kb * d[2];
+                if y < 1e-6 {
+                    return [0.0; 3];
+                }
+                let scene = self.ootf.as_ref().unwrap().get(y);
+                d.map(|l| curve.get(l * scene))
+            }
+            _ => rgb.map(|l| curve.get(l)),
+        }
+    }
+
+    fn luma(&self, p: [f32; 3]) -> f32 {
+        self.kr * p[0] + (1.0 - self.kr - self.kb) * p[1] + self.kb * p[2]
+    }
+
+    /// Converts `width` x `height` pixels, rows `stride` bytes apart.
+    pub fn convert(
+        &self,
+        src: &[u8],
+        stride: usize,
+        width: usize,
+        height: usize,
+        dst: P010Planes,
+    ) -> Result<(), ()> {
+        let (cw, ch) = ((width + 1) / 2, (height + 1) / 2);
+        let bpp = self.format.bytes_per_pixel();
+        let fits = |len: usize, stride: usize, rows: usize, row: usize| {
+            stride >= row && len >= stride * (rows - 1) + row
+        };
+        if width == 0
+            || height == 0
+            || !fits(src.len(), stride, height, bpp * width)
+            || !fits(dst.y.len(), dst.y_stride, height, width)
+            || !fits(dst.uv.len(), dst.uv_stride, ch, 2 * cw)
+        {
+            return Err(());
+        }
+        let (ys, uvs) = (dst.y_stride, dst.uv_stride);
+        let threads = band_threads(self.threads, width, height);
+        // bands of whole chroma rows
+        let band = (ch + threads - 1) / threads;
+        let bands = dst
+            .y
+            .chunks_mut(2 * band * ys)
+            .zip(dst.uv.chunks_mut(band * uvs))
+            .enumerate();
+        run_bands(threads, bands, |(i, (y, uv))| {
+            let mut line = vec![[0.0f32; 3]; 2 * width];
+            for r in 0..band.min(ch - i * band) {
+                let row0 = 2 * (i * band + r);
+                let row1 = (row0 + 1).min(height - 1);
+                for x in 0..width {
+                    line[x] = self.pixel(&src[row0 * stride + x * bpp..]);
+                    line[width + x] = self.pixel(&src[row1 * stride + x * bpp..]);
+                }
+                for (k, rgb) in line.chunks(width).enumerate().take(row1 - row0 + 1) {
+                    let out = &mut y[(2 * r + k) * ys..][..width];
+                    for (o, &p) in out.iter_mut().zip(rgb) {
+                        *o = quantize(64.0 + 876.0 * self.luma(p));
+                    }
+                }
+                let out = &mut uv[r * uvs..][..2 * cw];
+                for (c, o) in out.chunks_exact_mut(2).enumerate() {
+                    let (x0, x1) = (2 * c, (2 * c + 1).min(width - 1));
+                    let mut p = [0.0; 3];
+                    for q in [line[x0], line[x1], line[width + x0], line[width + x1]] {
+                        for k in 0..3 {
+                            p[k] += q[k] / 4.0;
+                        }
+                    }
+                    let l = self.luma(p);
+                    o[0] = quantize(512.0 + 896.0 * (p[2] - l) / (2.0 * (1.0 - self.kb)));
+                    o[1] = quantize(512.0 + 896.0 * (p[0] - l) / (2.0 * (1.0 - self.kr)));
+                }
+            }
+        });
+        Ok(())
+    }
+}
+
+fn quantize(v: f32) -> u16 {
+    (v.round().clamp(0.0, 1023.0) as u16) << 6
+}
+
+/// SMPTE ST 2086 colour volume of the display the content was graded on.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct MasteringDisplay {
+    /// CIE 1931 xy of the red, green and blue primaries.
+    pub primaries: [[f32; 2]; 3],
+    pub white_point: [f32; 2],
+    /// In nits.
+    pub max_luminance: f32,
+    pub min_luminance: f32,
+}
+
+impl Default for MasteringDisplay {
+    /// BT.2020 primaries, D65 and 0.0001 to 1000 nits, what most HDR10
+    /// content declares.
+    fn default() -> Self {
+        Self {
+            primaries: [[0.708, 0.292], [0.170, 0.797], [0.131, 0.046]],
+            white_point: [0.3127, 0.3290],
+            max_luminance: 1000.0,
+            min_luminance: 0.0001,
+        }
+    }
+}
+
+/// Content light levels in nits, 0 when unknown.
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct ContentLight {
+    /// Brightest pixel.
+    pub max_cll: u16,
+    /// Brightest frame average.
+    pub max_fall: u16,
+}
+
+#[derive(Debug, Clone, Copy, Default, PartialEq)]
+pub struct HdrMetadata {
+    pub mastering: Option<MasteringDisplay>,
+    pub content_light: Option<ContentLight>,
+}
+
+const SEI_MASTERING_DISPLAY: u8 = 137;
+const SEI_CONTENT_LIGHT: u8 = 144;
+const METADATA_HDR_CLL: u64 = 1;
+const METADATA_HDR_MDCV: u64 = 2;
+
+/// `v` in units of `1 / one`.
+fn fixed(v: f32, one: f32) -> u32 {
+    (v as f64 * one as f64).round().clamp(0.0, u32::MAX as f64) as u32
+}
+
+fn fixed16(v: f32, one: f32) -> [u8; 2] {
+    (fixed(v, one).min(u16::MAX as u32) as u16).to_be_bytes()
+}
+
+fn sei_message(rbsp: &mut Vec<u8>, payload_type: u8, payload: &[u8]) {
+    // both types and sizes stay below 255, one byte each
+    rbsp.push(payload_type);
+    rbsp.push(payload.len() as u8);
+    rbsp.extend_from_slice(payload);
+}
+
+fn metadata_obu(out: &mut Vec<u8>, metadata_type: u64, payload: &[u8]) {
+    let mut body = vec![];
+    obu::write_leb128(metadata_type, &mut body);
+    body.extend_from_slice(payload);
+    body.push(0x80);
+    out.push(obu::OBU_METADATA << 3 | 0x02);
+    obu::write_leb128(body.len() as u64, out);
+    out.extend_from_slice(&body);
+}
+
+impl HdrMetadata {
+    /// A prefix SEI NAL unit, header included and start code excluded,
+    /// `None` for AV1 or without metadata.
+    pub fn sei_nal(&self, format: DataFormat) -> Option<Vec<u8>> {
+        let header: &[u8] = match format {
+            H264 => &[nal::H264_NAL_SEI],
+            H265 => &[nal::HEVC_NAL_SEI_PREFIX << 1, 1],
+            _ => return None,
+        };
+        let mut rbsp = vec![];
+        if let Some(m) = &self.mastering {
+            let mut p = Vec::with_capacity(24);
+            // green, blue, red in units of 0.00002
+            for i in [1, 2, 0] {
+                for c in m.primaries[i] {
+                    p.extend_from_slice(&fixed16(c, 50000.0));
+                }
+            }
+            for c in m.white_point {
+                p.extend_from_slice(&fixed16(c, 50000.0));
+            }
+            p.extend_from_slice(&fixed(m.max_luminance, 10000.0).to_be_bytes());
+            p.extend_from_slice(&fixed(m.min_luminance, 10000.0).to_be_bytes());
+            sei_message(&mut rbsp, SEI_MASTERING_DISPLAY, &p);
+        }
+        if let Some(c) = &self.content_light {
+            let p = [c.max_cll.to_be_bytes(), c.max_fall.to_be_bytes()].concat();
+            sei_message(&mut rbsp, SEI_CONTENT_LIGHT, &p);
+        }
+        if rbsp.is_empty() {
+            return None;
+        }
+        rbsp.push(0x80);
+        let mut out = header.to_vec();
+        nal::escape(&rbsp, &mut out);
+        Some(out)
+    }
+
+    /// Metadata OBUs with `obu_size` fields, `None` without metadata.
+    pub fn av1_obus(&self) -> Option<Vec<u8>> {
+        let mut out = vec![];
+        if let Some(c) = &self.content_light {
+            let p = [c.max_cll.to_be_bytes(), c.max_fall.to_be_bytes()].concat();
+            metadata_obu(&mut out, METADATA_HDR_CLL, &p);
+        }
+        if let Some(m) = &self.mastering {
+            let mut p = Vec::with_capacity(24);
+            // red, green, blue in 0.16 fixed point
+            for c in m.primaries.iter().chain([&m.white_point]).flatten() {
+                p.extend_from_slice(&fixed16(*c, 65536.0));
+            }
+            // 24.8 and 18.14 fixed point
+            p.extend_from_slice(&fixed(m.max_luminance, 256.0).to_be_bytes());
+            p.extend_from_slice(&fixed(m.min_luminance, 16384.0).to_be_bytes());
+            metadata_obu(&mut out, METADATA_HDR_MDCV, &p);
+        }
+        (!out.is_empty()).then_some(out)
+    }
+}
+
+/// Puts the HDR metadata in front of the first picture of every packet that
+/// starts with parameter sets or a sequence header, so each keyframe
+/// carries it. Add it with `Encoder::add_filter` to HDR streams.
+pub struct HdrSei {
+    pub metadata: HdrMetadata,
+}
+
+impl BitstreamFilter for HdrSei {
+    fn name(&self) -> &'static str {
+        "hdr_sei"
+    }
+
+    fn filter(&mut self, format: DataFormat, data: &mut Vec<u8>) -> usize {
+        let (at, insert) = match format {
+            H264 | H265 => {
+                let sps_type = match format {
+                    H264 => nal::H264_NAL_SPS,
+                    _ => nal::HEVC_NAL_SPS,
+                };
+                let mut sps = false;
+                let mut slice = None;
+                for n in nal::nal_units(data) {
+                    let t = match n.payload(data).first() {
+                        Some(&h) => nal::nal_type(format, h),
+                        None => continue,
+                    };
+                    if t == sps_type {
+                        sps = true;
+                    } else if nal::is_slice(format, t) {
+                        slice = Some(n.start);
+                        break;
+                    }
+                }
+                match (sps, slice, self.metadata.sei_nal(format)) {
+                    (true, Some(at), Some(sei)) => (at, [&[0, 0, 0, 1], &sei[..]].concat()),
+                    _ => return 0,
+                }
+            }
+            AV1 => {
+                let seq = obu::obus(data).find(|o| o.obu_type == obu::OBU_SEQUENCE_HEADER);
+                match (seq, self.metadata.av1_obus()) {
+                    (Some(seq), Some(obus)) => (seq.end, obus),
+                    _ => return 0,
+                }
+            }
+            _ => return 0,
+        };
+        data.splice(at..at, insert);
+        0
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn close(a: f32, b: f32) -> bool {
+        (a - b).abs() < 1e-3
+    }
+
+    fn metadata() -> HdrMetadata {
+        HdrMetadata {
+            mastering: Some(MasteringDisplay::default()),
+            content_light: Some(ContentLight {
+                max_cll: 1000,
+                max_fall: 400,
+            }),
+        }
+    }
+
+    #[test]
+    fn pq_known_points() {
+        assert!(pq(0.0) < 1e-6);
+        assert!(close(pq(0.01), 0.5081));
+        assert!(close(pq(0.1), 0.7518));
+        assert!(close(pq(1.0), 1.0));
+        assert!(pq(-1.0) < 1e-6);
+    }
+
+    #[test]
+    fn hlg_known_points() {
+        assert_eq!(hlg(0.0), 0.0);
+        assert!(close(hlg(1.0 / 12.0), 0.5));
+        assert!(close(hlg(0.5), 0.8716));
+        assert!(close(hlg(1.0), 1.0));
+    }
+
+    #[rustfmt::skip]
+    const SEI_RBSP: [u8; 33] = [
+        SEI_MASTERING_DISPLAY, 24,
+        0x21, 0x34, 0x9B, 0xAA, // green
+        0x19, 0x96, 0x08, 0xFC, // blue
+        0x8A, 0x48, 0x39, 0x08, // red
+        0x3D, 0x13, 0x40, 0x42, // white point
+        0x00, 0x98, 0x96, 0x80, // 1000 nits
+        0x00, 0x00, 0x00, 0x01, // 0.0001 nits
+        SEI_CONTENT_LIGHT, 4,
+        0x03, 0xE8, 0x01, 0x90,
+        0x80,
+    ];
+
+    #[test]
+    fn sei_layout() {
+        let sei = metadata().sei_nal(H264).unwrap();
+        assert_eq!(sei[0], nal::H264_NAL_SEI);
+        // the minimum luminance needs an emulation prevention byte
+        assert_eq!(&sei[23..28], &[0x00, 0x00, 0x03, 0x00, 0x01]);
+        assert_eq!(nal::unescape(&sei[1..]), SEI_RBSP);
+        let sei = metadata().sei_nal(H265).unwrap();
+        assert_eq!(&sei[..2], &[nal::HEVC_NAL_SEI_PREFIX << 1, 1]);
+        assert_eq!(nal::unescape(&sei[2..]), SEI_RBSP);
+        let light_only = HdrMetadata {
+            mastering: None,
+            ..metadata()
+        };
+        assert_eq!(
+            light_only.sei_nal(H264).unwrap(),
+            [&[nal::H264_NAL_SEI][..], &SEI_RBSP[26..]].concat()
+        );
+        assert_eq!(HdrMetadata::default().sei_nal(H264), None);
+        assert_eq!(metadata().sei_nal(AV1), None);
+    }
+
+    #[test]
+    fn av1_metadata_obus() {
+        let data = metadata().av1_obus().unwrap();
+        #[rustfmt::skip]
+        let expected = [
+            obu::OBU_METADATA << 3 | 0x02, 6,
+            METADATA_HDR_CLL as u8, 0x03, 0xE8, 0x01, 0x90, 0x80,
+            obu::OBU_METADATA << 3 | 0x02, 26,
+            METADATA_HDR_MDCV as u8,
+            0xB5, 0x3F, 0x4A, 0xC1, // red
+            0x2B, 0x85, 0xCC, 0x08, // green
+            0x21, 0x89, 0x0B, 0xC7, // blue
+            0x50, 0x0D, 0x54, 0x39, // white point
+            0x00, 0x03, 0xE8, 0x00, // 1000 nits
+            0x00, 0x00, 0x00, 0x02, // 0.0001 nits
+            0x80,
+        ];
+        assert_eq!(data, expected);
+        let types: Vec<_> = obu::obus(&data).map(|o| (o.obu_type, o.len())).collect();
+        assert_eq!(types, [(obu::OBU_METADATA, 8), (obu::OBU_METADATA, 28)]);
+        assert_eq!(HdrMetadata::default().av1_obus(), None);
+    }
+}
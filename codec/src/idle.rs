@@ -0,0 +1,120 @@
+//! Detection of unchanged frames and what to send for them.
+
+use crate::hash::TileHashes;
+use std::time::{Duration, Instant};
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct IdlePolicy {
+    /// Unchanged frames closer than this to the previous frame sent are
+    /// dropped.
+    pub min_refresh_interval: Duration,
+    /// Every that many consecutive unchanged frames one is encoded in full,
+    /// letting the encoder refine the static picture. 0 disables it.
+    pub force_refresh_after: u32,
+    /// Consecutive unchanged frames after which the stream counts as idle.
+    pub idle_after: u32,
+    /// Framerate the encoder runs at while idle, `None` to keep it.
+    pub idle_framerate: Option<i32>,
+}
+
+impl Default for IdlePolicy {
+    fn default() -> Self {
+        Self {
+            min_refresh_interval: Duration::from_millis(200),
+            force_refresh_after: 0,
+            idle_after: 30,
+            idle_framerate: None,
+        }
+    }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum FrameAction {
+    /// The frame changed or a refresh is due, encode it.
+    Encode,
+    /// Unchanged, send a picture repeating the previous one.
+    Repeat,
+    /// Unchanged, send nothing.
+    Drop,
+}
+
+pub struct IdleDetector {
+    policy: IdlePolicy,
+    current: TileHashes,
+    previous: TileHashes,
+    has_previous: bool,
+    idle_frames: u32,
+    last_sent: Option<Instant>,
+}
+
+impl IdleDetector {
+    pub fn new(policy: IdlePolicy) -> Self {
+        Self {
+            policy,
+            current: TileHashes::default(),
+            previous: TileHashes::default(),
+            has_previous: false,
+            idle_frames: 0,
+            last_sent: None,
+        }
+    }
+
+    pub fn policy(&self) -> &IdlePolicy {
+        &self.policy
+    }
+
+    /// Consecutive unchanged frames up to the last one checked.
+    pub fn idle_frames(&self) -> u32 {
+        self.idle_frames
+    }
+
+    pub fn is_idle(&self) -> bool {
+        self.idle_frames > 0 && self.idle_frames >= self.policy.idle_after
+    }
+
+    /// Decides what to do with a BGRA frame. Frames that cannot be hashed
+    /// are always encoded.
+    pub fn check(
+        &mut self,
+        data: &[u8],
+        width: usize,
+        height: usize,
+        stride: usize,
+    ) -> FrameAction {
+        if self
+            .current
+            .compute(data, width, height, 4, stride)
+            .is_err()
+        {
+            self.has_previous = false;
+            return self.update(true);
+        }
+        let changed = !self.has_previous || self.current.differs(&self.previous);
+        std::mem::swap(&mut self.current, &mut self.previous);
+        self.has_previous = true;
+        self.update(changed)
+    }
+
+    /// Like `check` for a frame already compared with the previous one by
+    /// other means, such as a `dirty::FrameDiffer`.
+    pub fn update(&mut self, changed: bool) -> FrameAction {
+        if changed {
+            self.idle_frames = 0;
+            return self.sent(FrameAction::Encode);
+        }
+        self.idle_frames = self.idle_frames.saturating_add(1);
+        let refresh = self.policy.force_refresh_after;
+        if refresh > 0 && self.idle_frames % refresh == 0 {
+            return self.sent(FrameAction::Encode);
+        }
+        match self.last_sent {
+            Some(t) if t.elapsed() < self.policy.min_refresh_interval => FrameAction::Drop,
+            _ => self.sent(FrameAction::Repeat),
+        }
+    }
+
+    fn sent(&mut self, action: FrameAction) -> FrameAction {
+        self.last_sent = Some(Instant::now());
+        action
+    }
+}
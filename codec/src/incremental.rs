@@ -0,0 +1,153 @@
+//! NV12 frames kept across captures, reconverting only the changed tiles.
+
+use crate::{
+    convert::{band_threads, run_bands, BandChroma, RgbToYuv},
+    dirty::DirtyMap,
+    hash::TILE_SIZE,
+};
+use std::sync::Arc;
+
+/// A packed NV12 frame, chroma rows of `(width + 1) / 2` pairs.
+#[derive(Debug, Clone, Default)]
+pub struct Nv12Frame {
+    pub width: usize,
+    pub height: usize,
+    pub y: Vec<u8>,
+    pub uv: Vec<u8>,
+}
+
+impl Nv12Frame {
+    fn new(width: usize, height: usize) -> Self {
+        let (cw, ch) = ((width + 1) / 2, (height + 1) / 2);
+        Self {
+            width,
+            height,
+            y: vec![0; width * height],
+            uv: vec![0; 2 * cw * ch],
+        }
+    }
+
+    pub fn y_stride(&self) -> usize {
+        self.width
+    }
+
+    pub fn uv_stride(&self) -> usize {
+        (self.width + 1) / 2 * 2
+    }
+}
+
+struct Slot {
+    frame: Arc<Nv12Frame>,
+    /// Tiles changed since this frame was written.
+    stale: DirtyMap,
+}
+
+/// Converts captured frames into a rotation of NV12 buffers. Each buffer
+/// only gets the tiles changed since it was last written, so with two of
+/// them the encoder can read one frame while the next is converted into the
+/// other. A buffer still shared when its turn comes is replaced and
+/// converted in full.
+pub struct IncrementalNv12 {
+    converter: RgbToYuv,
+    slots: Vec<Slot>,
+    buffers: usize,
+    front: usize,
+}
+
+impl IncrementalNv12 {
+    pub fn new(converter: RgbToYuv, buffers: usize) -> Self {
+        Self {
+            converter,
+            slots: vec![],
+            buffers: buffers.max(1),
+            front: 0,
+        }
+    }
+
+    /// The last frame written.
+    pub fn front(&self) -> Option<Arc<Nv12Frame>> {
+        self.slots.get(self.front).map(|s| s.frame.clone())
+    }
+
+    /// Writes `width` x `height` pixels of `src`, rows `stride` bytes apart,
+    /// into the next buffer and makes it the front. `dirty` holds the tiles
+    /// changed since the previous call, `None` meaning all of them.
+    pub fn update(
+        &mut self,
+        src: &[u8],
+        stride: usize,
+        width: usize,
+        height: usize,
+        dirty: Option<&DirtyMap>,
+    ) -> Result<Arc<Nv12Frame>, ()> {
+        if width == 0 || height == 0 || stride < 4 * width {
+            return Err(());
+        }
+        if src.len() < stride * (height - 1) + 4 * width {
+            return Err(());
+        }
+        if self
+            .slots
+            .first()
+            .map_or(true, |s| s.frame.width != width || s.frame.height != height)
+        {
+            self.slots = (0..self.buffers)
+                .map(|_| Slot {
+                    frame: Arc::new(Nv12Frame::new(width, height)),
+                    stale: DirtyMap::full(width, height),
+                })
+                .collect();
+            self.front = self.buffers - 1;
+        }
+        for slot in self.slots.iter_mut() {
+            match dirty {
+                Some(d) if slot.stale.same_grid(d) => slot.stale.merge(d),
+                _ => slot.stale.set_all(),
+            }
+        }
+        let target = (self.front + 1) % self.buffers;
+        let slot = &mut self.slots[target];
+        if Arc::get_mut(&mut slot.frame).is_none() {
+            slot.frame = Arc::new(Nv12Frame::new(width, height));
+            slot.stale.set_all();
+        }
+        let frame = Arc::get_mut(&mut slot.frame).ok_or(())?;
+        let (y_stride, uv_stride) = (frame.y_stride(), frame.uv_stride());
+        let tile_rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+        let threads = band_threads(self.converter.threads(), width, height).min(tile_rows);
+        let band = (tile_rows + threads - 1) / threads;
+        let bands = frame
+            .y
+            .chunks_mut(band * TILE_SIZE * y_stride)
+            .zip(frame.uv.chunks_mut(band * TILE_SIZE / 2 * uv_stride))
+            .enumerate();
+        let (stale, converter) = (&slot.stale, &self.converter);
+        run_bands(threads, bands, |(i, (y, uv))| {
+            for t in 0..band.min(tile_rows - i * band) {
+                let row = i * band + t;
+                let first = row * TILE_SIZE / 2;
+                let rows = (TILE_SIZE / 2).min((height + 1) / 2 - first);
+                let y = &mut y[t * TILE_SIZE * y_stride..];
+                let uv = &mut uv[t * TILE_SIZE / 2 * uv_stride..];
+                let mut chroma = BandChroma::Nv12(uv, uv_stride);
+                for run in stale.runs(row) {
+                    let columns = run.start * TILE_SIZE..(run.end * TILE_SIZE).min(width);
+                    converter.band(
+                        src,
+                        stride,
+                        height,
+                        first,
+                        rows,
+                        columns,
+                        y,
+                        y_stride,
+                        &mut chroma,
+                    );
+                }
+            }
+        });
+        slot.stale.clear();
+        self.front = target;
+        Ok(slot.frame.clone())
+    }
+}
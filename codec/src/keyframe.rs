@@ -0,0 +1,133 @@
+//! Coalescing of keyframe requests. Every receiver that loses the stream
+//! asks for a keyframe, and with many receivers those requests arrive in
+//! bursts that one IDR can answer.
+//!
+//! A request is answered by the next keyframe the encoder produces, forced
+//! or from the GOP. Keyframes are forced at most once per window: requests
+//! arriving within the window of the last keyframe wait for its end, so a
+//! burst of any size costs at most two.
+
+use std::{
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Arc,
+    },
+    time::{Duration, Instant},
+};
+
+/// Shortest interval between forced keyframes by default.
+pub const DEFAULT_WINDOW: Duration = Duration::from_millis(300);
+
+/// Handle given to each receiver to ask for a keyframe, usable from any
+/// thread.
+#[derive(Debug, Clone, Default)]
+pub struct KeyframeRequester(Arc<AtomicU64>);
+
+impl KeyframeRequester {
+    pub fn request(&self) {
+        self.0.fetch_add(1, Ordering::Relaxed);
+    }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub struct KeyframeStats {
+    /// Requests from all requesters, scene cuts included.
+    pub requests: u64,
+    /// Keyframes asked of the backend.
+    pub forced: u64,
+    /// Keyframes produced, forced or not.
+    pub keyframes: u64,
+}
+
+pub struct KeyframeCoalescer {
+    requests: KeyframeRequester,
+    window: Duration,
+    /// Requests counted so far.
+    seen: u64,
+    /// Whether requests wait for a keyframe.
+    waiting: bool,
+    /// When the last keyframe was forced or produced.
+    last_keyframe: Option<Instant>,
+    stats: KeyframeStats,
+}
+
+impl KeyframeCoalescer {
+    pub fn new(window: Duration) -> Self {
+        Self {
+            requests: KeyframeRequester::default(),
+            window,
+            seen: 0,
+            waiting: false,
+            last_keyframe: None,
+            stats: KeyframeStats::default(),
+        }
+    }
+
+    pub fn window(&self) -> Duration {
+        self.window
+    }
+
+    pub fn set_window(&mut self, window: Duration) {
+        self.window = window;
+    }
+
+    pub fn requester(&self) -> KeyframeRequester {
+        self.requests.clone()
+    }
+
+    pub fn request(&self) {
+        self.requests.request();
+    }
+
+    pub fn stats(&self) -> KeyframeStats {
+        self.stats
+    }
+
+    /// Whether requests wait for a keyframe.
+    pub fn pending(&mut self) -> bool {
+        let total = self.requests.0.load(Ordering::Relaxed);
+        if total != self.seen {
+            self.stats.requests += total - self.seen;
+            self.seen = total;
+            self.waiting = true;
+        }
+        self.waiting
+    }
+
+    /// Whether a keyframe would be forced at `now`.
+    pub fn due(&mut self, now: Instant) -> bool {
+        self.pending()
+            && self
+                .last_keyframe
+                .map_or(true, |t| now.duration_since(t) >= self.window)
+    }
+
+    /// Called before each frame is encoded, whether to force a keyframe
+    /// now. Requests stay pending until a keyframe is produced, so a forced
+    /// one the backend drops is forced again after the window.
+    pub fn poll(&mut self, now: Instant) -> bool {
+        if !self.due(now) {
+            return false;
+        }
+        self.last_keyframe = Some(now);
+        self.stats.forced += 1;
+        true
+    }
+
+    /// Called for each frame produced, answering the pending requests when
+    /// it is a keyframe.
+    pub fn produced(&mut self, keyframe: bool, now: Instant) {
+        if keyframe {
+            self.pending();
+            self.waiting = false;
+            self.last_keyframe = Some(now);
+            self.stats.keyframes += 1;
+        }
+    }
+}
+
+impl Default for KeyframeCoalescer {
+    fn default() -> Self {
+        Self::new(DEFAULT_WINDOW)
+    }
+}
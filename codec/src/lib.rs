@@ -4,8 +4,35 @@
 
 include!(concat!(env!("OUT_DIR"), "/codec_ffi.rs"));
 
+pub mod avcc;
+pub mod bits;
+pub mod broadcast;
+pub mod convert;
+pub mod crop;
+pub mod cpu;
 pub mod decode;
+pub mod denoise;
+pub mod dirty;
 pub mod encode;
+pub mod filter;
+pub mod gop;
+pub mod hash;
+pub mod hdr;
+pub mod idle;
+pub mod incremental;
+pub mod keyframe;
+pub mod nal;
+pub mod obu;
+pub mod params;
+pub mod quality;
+pub mod scene;
+pub mod parser;
+pub mod scale;
+pub mod simulcast;
+pub mod skip;
+pub mod synth;
+pub mod tiled;
+pub mod yuv444;
 pub use gpu_common;
 
 pub(crate) const MAX_ADATER_NUM_ONE_VENDER: usize = 4;
@@ -0,0 +1,297 @@
+use gpu_common::DataFormat::{self, *};
+
+pub const H264_NAL_SLICE: u8 = 1;
+pub const H264_NAL_IDR: u8 = 5;
+pub const H264_NAL_SEI: u8 = 6;
+pub const H264_NAL_SPS: u8 = 7;
+pub const H264_NAL_PPS: u8 = 8;
+pub const H264_NAL_AUD: u8 = 9;
+pub const H264_NAL_FILLER: u8 = 12;
+
+pub const HEVC_NAL_TRAIL_R: u8 = 1;
+pub const HEVC_NAL_BLA_W_LP: u8 = 16;
+pub const HEVC_NAL_IDR_W_RADL: u8 = 19;
+pub const HEVC_NAL_IDR_N_LP: u8 = 20;
+pub const HEVC_NAL_CRA: u8 = 21;
+pub const HEVC_NAL_VPS: u8 = 32;
+pub const HEVC_NAL_SPS: u8 = 33;
+pub const HEVC_NAL_PPS: u8 = 34;
+pub const HEVC_NAL_AUD: u8 = 35;
+pub const HEVC_NAL_FD: u8 = 38;
+pub const HEVC_NAL_SEI_PREFIX: u8 = 39;
+
+/// One NAL unit inside an Annex-B buffer, as byte offsets into that buffer.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct NalUnit {
+    /// First byte of the start code.
+    pub start: usize,
+    /// First byte of the NAL header.
+    pub header: usize,
+    /// One past the last payload byte, trailing zero bytes excluded.
+    pub end: usize,
+}
+
+impl NalUnit {
+    pub fn start_code_len(&self) -> usize {
+        self.header - self.start
+    }
+
+    pub fn len(&self) -> usize {
+        self.end - self.header
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.end == self.header
+    }
+
+    pub fn payload<'a>(&self, data: &'a [u8]) -> &'a [u8] {
+        &data[self.header..self.end]
+    }
+}
+
+/// Returns the position and length (3 or 4) of the first start code at or
+/// after `from`.
+pub fn find_start_code(data: &[u8], from: usize) -> Option<(usize, usize)> {
+    let p = find_prefix(data, from)?;
+    if p > from && data[p - 1] == 0 {
+        Some((p - 1, 4))
+    } else {
+        Some((p, 3))
+    }
+}
+
+/// Position of the first `00 00 01` at or after `from`.
+fn find_prefix(data: &[u8], from: usize) -> Option<usize> {
+    #[allow(unused_mut)]
+    let mut i = from;
+    #[cfg(target_arch = "x86_64")]
+    {
+        i = if is_x86_feature_detected!("avx2") {
+            unsafe { simd::scan_avx2(data, i) }
+        } else {
+            unsafe { simd::scan_sse2(data, i) }
+        };
+    }
+    #[cfg(target_arch = "aarch64")]
+    {
+        i = unsafe { simd::scan_neon(data, i) };
+    }
+    scan_scalar(data, i)
+}
+
+fn scan_scalar(data: &[u8], from: usize) -> Option<usize> {
+    let n = data.len();
+    let mut i = from + 2;
+    while i < n {
+        // the byte at i can only end a prefix if it is 1, and a byte > 1
+        // means no prefix can end in the next two positions either
+        match data[i] {
+            1 => {
+                if data[i - 1] == 0 && data[i - 2] == 0 {
+                    return Some(i - 2);
+                }
+                i += 3;
+            }
+            0 => i += 1,
+            _ => i += 3,
+        }
+    }
+    None
+}
+
+/// The vector scanners compare three shifted loads against `00 00 01` and
+/// return either the first match or the offset the scalar scan should
+/// resume from.
+mod simd {
+    #[cfg(target_arch = "x86_64")]
+    #[target_feature(enable = "avx2")]
+    pub unsafe fn scan_avx2(data: &[u8], mut i: usize) -> usize {
+        use std::arch::x86_64::*;
+        let zero = _mm256_setzero_si256();
+        let one = _mm256_set1_epi8(1);
+        let p = data.as_ptr();
+        while i + 34 <= data.len() {
+            let a = _mm256_loadu_si256(p.add(i) as *const __m256i);
+            let b = _mm256_loadu_si256(p.add(i + 1) as *const __m256i);
+            let c = _mm256_loadu_si256(p.add(i + 2) as *const __m256i);
+            let m = _mm256_and_si256(
+                _mm256_and_si256(_mm256_cmpeq_epi8(a, zero), _mm256_cmpeq_epi8(b, zero)),
+                _mm256_cmpeq_epi8(c, one),
+            );
+            let mask = _mm256_movemask_epi8(m) as u32;
+            if mask != 0 {
+                return i + mask.trailing_zeros() as usize;
+            }
+            i += 32;
+        }
+        i
+    }
+
+    #[cfg(target_arch = "x86_64")]
+    pub unsafe fn scan_sse2(data: &[u8], mut i: usize) -> usize {
+        use std::arch::x86_64::*;
+        let zero = _mm_setzero_si128();
+        let one = _mm_set1_epi8(1);
+        let p = data.as_ptr();
+        while i + 18 <= data.len() {
+            let a = _mm_loadu_si128(p.add(i) as *const __m128i);
+            let b = _mm_loadu_si128(p.add(i + 1) as *const __m128i);
+            let c = _mm_loadu_si128(p.add(i + 2) as *const __m128i);
+            let m = _mm_and_si128(
+                _mm_and_si128(_mm_cmpeq_epi8(a, zero), _mm_cmpeq_epi8(b, zero)),
+                _mm_cmpeq_epi8(c, one),
+            );
+            let mask = _mm_movemask_epi8(m) as u32;
+            if mask != 0 {
+                return i + mask.trailing_zeros() as usize;
+            }
+            i += 16;
+        }
+        i
+    }
+
+    #[cfg(target_arch = "aarch64")]
+    pub unsafe fn scan_neon(data: &[u8], mut i: usize) -> usize {
+        use std::arch::aarch64::*;
+        let zero = vdupq_n_u8(0);
+        let one = vdupq_n_u8(1);
+        let p = data.as_ptr();
+        while i + 18 <= data.len() {
+            let a = vld1q_u8(p.add(i));
+            let b = vld1q_u8(p.add(i + 1));
+            let c = vld1q_u8(p.add(i + 2));
+            let m = vandq_u8(
+                vandq_u8(vceqq_u8(a, zero), vceqq_u8(b, zero)),
+                vceqq_u8(c, one),
+            );
+            if vmaxvq_u8(m) != 0 {
+                // let the scalar scan pinpoint the match
+                return i;
+            }
+            i += 16;
+        }
+        i
+    }
+}
+
+/// Returns the NAL unit whose start code begins at or after `from`.
+pub fn next_nal(data: &[u8], from: usize) -> Option<NalUnit> {
+    let (start, sc_len) = find_start_code(data, from)?;
+    let header = start + sc_len;
+    let mut end = match find_start_code(data, header) {
+        Some((next, _)) => next,
+        None => data.len(),
+    };
+    while end > header && data[end - 1] == 0 {
+        end -= 1;
+    }
+    Some(NalUnit { start, header, end })
+}
+
+pub struct NalIter<'a> {
+    data: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> Iterator for NalIter<'a> {
+    type Item = NalUnit;
+
+    fn next(&mut self) -> Option<NalUnit> {
+        let nal = next_nal(self.data, self.pos)?;
+        self.pos = nal.end;
+        Some(nal)
+    }
+}
+
+pub fn nal_units(data: &[u8]) -> NalIter<'_> {
+    NalIter { data, pos: 0 }
+}
+
+/// `nal_unit_type` of the header starting at `header`.
+pub fn nal_type(format: DataFormat, header: u8) -> u8 {
+    match format {
+        H265 => (header >> 1) & 0x3F,
+        _ => header & 0x1F,
+    }
+}
+
+pub fn is_aud(format: DataFormat, nal_type: u8) -> bool {
+    match format {
+        H264 => nal_type == H264_NAL_AUD,
+        H265 => nal_type == HEVC_NAL_AUD,
+        _ => false,
+    }
+}
+
+pub fn is_filler(format: DataFormat, nal_type: u8) -> bool {
+    match format {
+        H264 => nal_type == H264_NAL_FILLER,
+        H265 => nal_type == HEVC_NAL_FD,
+        _ => false,
+    }
+}
+
+pub fn is_slice(format: DataFormat, nal_type: u8) -> bool {
+    match format {
+        H264 => (H264_NAL_SLICE..=H264_NAL_IDR).contains(&nal_type),
+        H265 => nal_type < HEVC_NAL_VPS,
+        _ => false,
+    }
+}
+
+/// Rewrites the NAL units of `data` in place. `f` gets each NAL payload
+/// (header included) and returns the payload length to keep, or `None` to
+/// drop the unit together with its start code. Returns the bytes removed.
+pub fn rewrite_nals<F>(data: &mut Vec<u8>, mut f: F) -> usize
+where
+    F: FnMut(&[u8]) -> Option<usize>,
+{
+    let before = data.len();
+    let mut write = 0;
+    let mut read = 0;
+    while let Some(nal) = next_nal(data, read) {
+        read = nal.end;
+        if let Some(keep) = f(nal.payload(data)) {
+            let keep = keep.min(nal.len());
+            let len = nal.start_code_len() + keep;
+            if write != nal.start {
+                data.copy_within(nal.start..nal.start + len, write);
+            }
+            write += len;
+        }
+    }
+    if read == 0 {
+        // not annex-b, leave it alone
+        return 0;
+    }
+    data.truncate(write);
+    before - write
+}
+
+/// Strips emulation prevention bytes.
+pub fn unescape(data: &[u8]) -> Vec<u8> {
+    let mut out = Vec::with_capacity(data.len());
+    let mut zeros = 0;
+    for &b in data {
+        if zeros >= 2 && b == 3 {
+            zeros = 0;
+            continue;
+        }
+        zeros = if b == 0 { zeros + 1 } else { 0 };
+        out.push(b);
+    }
+    out
+}
+
+/// Appends `rbsp` to `out` with emulation prevention bytes inserted.
+pub fn escape(rbsp: &[u8], out: &mut Vec<u8>) {
+    let mut zeros = 0;
+    for &b in rbsp {
+        if zeros >= 2 && b <= 3 {
+            out.push(3);
+            zeros = 0;
+        }
+        zeros = if b == 0 { zeros + 1 } else { 0 };
+        out.push(b);
+    }
+}
@@ -0,0 +1,723 @@
+//! AV1 low-overhead bitstream (OBU) parsing: OBU and temporal unit
+//! iteration, sequence headers, and frame headers up to `base_q_idx`.
+
+use crate::bits::BitReader;
+
+pub const OBU_SEQUENCE_HEADER: u8 = 1;
+pub const OBU_TEMPORAL_DELIMITER: u8 = 2;
+pub const OBU_FRAME_HEADER: u8 = 3;
+pub const OBU_TILE_GROUP: u8 = 4;
+pub const OBU_METADATA: u8 = 5;
+pub const OBU_FRAME: u8 = 6;
+pub const OBU_REDUNDANT_FRAME_HEADER: u8 = 7;
+pub const OBU_PADDING: u8 = 15;
+
+pub const FRAME_TYPE_KEY: u8 = 0;
+pub const FRAME_TYPE_INTER: u8 = 1;
+pub const FRAME_TYPE_INTRA_ONLY: u8 = 2;
+pub const FRAME_TYPE_SWITCH: u8 = 3;
+
+const NUM_REF_FRAMES: usize = 8;
+const REFS_PER_FRAME: usize = 7;
+const ALL_FRAMES: u8 = 0xFF;
+const SELECT_SCREEN_CONTENT_TOOLS: u32 = 2;
+const SELECT_INTEGER_MV: u32 = 2;
+
+/// One OBU inside a buffer, as byte offsets into that buffer.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Obu {
+    pub obu_type: u8,
+    pub temporal_id: u8,
+    pub spatial_id: u8,
+    /// First byte of the OBU header.
+    pub start: usize,
+    /// First payload byte.
+    pub payload: usize,
+    /// One past the last payload byte.
+    pub end: usize,
+}
+
+impl Obu {
+    pub fn len(&self) -> usize {
+        self.end - self.start
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.end == self.start
+    }
+
+    pub fn payload<'a>(&self, data: &'a [u8]) -> &'a [u8] {
+        &data[self.payload..self.end]
+    }
+}
+
+/// Reads a leb128() value, returning it and its length in bytes.
+pub fn leb128(data: &[u8]) -> Option<(u64, usize)> {
+    let mut value = 0u64;
+    for (i, &b) in data.iter().take(8).enumerate() {
+        value |= ((b & 0x7F) as u64) << (7 * i);
+        if b & 0x80 == 0 {
+            return Some((value, i + 1));
+        }
+    }
+    None
+}
+
+/// Appends `value` as leb128(), in as few bytes as it takes.
+pub fn write_leb128(mut value: u64, out: &mut Vec<u8>) {
+    loop {
+        let b = (value & 0x7F) as u8;
+        value >>= 7;
+        if value == 0 {
+            out.push(b);
+            return;
+        }
+        out.push(b | 0x80);
+    }
+}
+
+/// Parses the OBU starting at `pos`. An OBU without `obu_size` extends to
+/// the end of the buffer.
+pub fn next_obu(data: &[u8], pos: usize) -> Option<Obu> {
+    let header = *data.get(pos)?;
+    if header & 0x80 != 0 {
+        return None;
+    }
+    let mut obu = Obu {
+        obu_type: (header >> 3) & 0x0F,
+        temporal_id: 0,
+        spatial_id: 0,
+        start: pos,
+        payload: pos + 1,
+        end: data.len(),
+    };
+    if header & 0x04 != 0 {
+        let ext = *data.get(pos + 1)?;
+        obu.temporal_id = ext >> 5;
+        obu.spatial_id = (ext >> 3) & 0x03;
+        obu.payload += 1;
+    }
+    if header & 0x02 != 0 {
+        let (size, len) = leb128(data.get(obu.payload..)?)?;
+        obu.payload += len;
+        obu.end = obu.payload.checked_add(size as usize)?;
+        if obu.end > data.len() {
+            return None;
+        }
+    }
+    Some(obu)
+}
+
+pub struct ObuIter<'a> {
+    data: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> Iterator for ObuIter<'a> {
+    type Item = Obu;
+
+    fn next(&mut self) -> Option<Obu> {
+        let obu = next_obu(self.data, self.pos)?;
+        self.pos = obu.end;
+        Some(obu)
+    }
+}
+
+pub fn obus(data: &[u8]) -> ObuIter<'_> {
+    ObuIter { data, pos: 0 }
+}
+
+/// Splits a buffer of OBUs into temporal units, each starting at a temporal
+/// delimiter. OBUs before the first delimiter form a unit of their own.
+pub fn temporal_units(data: &[u8]) -> Vec<&[u8]> {
+    let mut units = vec![];
+    let mut start = 0;
+    let mut end = 0;
+    for obu in obus(data) {
+        if obu.obu_type == OBU_TEMPORAL_DELIMITER && obu.start > start {
+            units.push(&data[start..obu.start]);
+            start = obu.start;
+        }
+        end = obu.end;
+    }
+    if end > start {
+        units.push(&data[start..end]);
+    }
+    units
+}
+
+fn uvlc(r: &mut BitReader) -> Option<u32> {
+    let mut leading_zeros = 0;
+    while !r.flag()? {
+        leading_zeros += 1;
+        if leading_zeros >= 32 {
+            return Some(u32::MAX);
+        }
+    }
+    Some(r.u(leading_zeros)? + ((1u64 << leading_zeros) - 1) as u32)
+}
+
+fn ns(r: &mut BitReader, n: u32) -> Option<u32> {
+    let w = 32 - n.leading_zeros();
+    let m = (1 << w) - n;
+    let v = r.u(w - 1)?;
+    if v < m {
+        return Some(v);
+    }
+    Some((v << 1) - m + r.u(1)?)
+}
+
+fn tile_log2(blk_size: u32, target: u32) -> u32 {
+    let mut k = 0;
+    while (blk_size << k) < target {
+        k += 1;
+    }
+    k
+}
+
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct Av1OperatingPoint {
+    pub idc: u32,
+    pub seq_level_idx: u8,
+    pub seq_tier: bool,
+    pub decoder_model_present: bool,
+}
+
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct Av1SequenceHeader {
+    pub seq_profile: u8,
+    pub still_picture: bool,
+    pub reduced_still_picture_header: bool,
+    pub decoder_model_info_present: bool,
+    pub equal_picture_interval: bool,
+    pub buffer_removal_time_length: u32,
+    pub frame_presentation_time_length: u32,
+    pub operating_points: Vec<Av1OperatingPoint>,
+    pub frame_width_bits: u32,
+    pub frame_height_bits: u32,
+    pub max_frame_width: u32,
+    pub max_frame_height: u32,
+    pub frame_id_numbers_present: bool,
+    pub delta_frame_id_length: u32,
+    pub frame_id_length: u32,
+    pub use_128x128_superblock: bool,
+    pub enable_order_hint: bool,
+    pub enable_ref_frame_mvs: bool,
+    pub seq_force_screen_content_tools: u32,
+    pub seq_force_integer_mv: u32,
+    pub order_hint_bits: u32,
+    pub enable_superres: bool,
+    pub bit_depth: u32,
+    pub mono_chrome: bool,
+    pub color_primaries: u8,
+    pub transfer_characteristics: u8,
+    pub matrix_coefficients: u8,
+    pub color_range: bool,
+    pub subsampling_x: bool,
+    pub subsampling_y: bool,
+    pub film_grain_params_present: bool,
+}
+
+/// Parses a sequence header OBU payload.
+pub fn parse_sequence_header(payload: &[u8]) -> Option<Av1SequenceHeader> {
+    let mut r = BitReader::new_raw(payload);
+    let mut seq = Av1SequenceHeader {
+        seq_profile: r.u(3)? as u8,
+        still_picture: r.flag()?,
+        reduced_still_picture_header: r.flag()?,
+        ..Default::default()
+    };
+    if seq.reduced_still_picture_header {
+        seq.operating_points.push(Av1OperatingPoint {
+            seq_level_idx: r.u(5)? as u8,
+            ..Default::default()
+        });
+    } else {
+        let mut buffer_delay_length = 0;
+        if r.flag()? {
+            // timing_info()
+            r.skip(64)?;
+            seq.equal_picture_interval = r.flag()?;
+            if seq.equal_picture_interval {
+                uvlc(&mut r)?;
+            }
+            seq.decoder_model_info_present = r.flag()?;
+            if seq.decoder_model_info_present {
+                buffer_delay_length = r.u(5)? + 1;
+                r.skip(32)?; // num_units_in_decoding_tick
+                seq.buffer_removal_time_length = r.u(5)? + 1;
+                seq.frame_presentation_time_length = r.u(5)? + 1;
+            }
+        }
+        let initial_display_delay_present = r.flag()?;
+        for _ in 0..=r.u(5)? {
+            let mut op = Av1OperatingPoint {
+                idc: r.u(12)?,
+                seq_level_idx: r.u(5)? as u8,
+                ..Default::default()
+            };
+            if op.seq_level_idx > 7 {
+                op.seq_tier = r.flag()?;
+            }
+            if seq.decoder_model_info_present {
+                op.decoder_model_present = r.flag()?;
+                if op.decoder_model_present {
+                    r.skip(2 * buffer_delay_length + 1)?;
+                }
+            }
+            if initial_display_delay_present && r.flag()? {
+                r.skip(4)?;
+            }
+            seq.operating_points.push(op);
+        }
+    }
+    seq.frame_width_bits = r.u(4)? + 1;
+    seq.frame_height_bits = r.u(4)? + 1;
+    seq.max_frame_width = r.u(seq.frame_width_bits)? + 1;
+    seq.max_frame_height = r.u(seq.frame_height_bits)? + 1;
+    if !seq.reduced_still_picture_header {
+        seq.frame_id_numbers_present = r.flag()?;
+    }
+    if seq.frame_id_numbers_present {
+        seq.delta_frame_id_length = r.u(4)? + 2;
+        seq.frame_id_length = r.u(3)? + 1 + seq.delta_frame_id_length;
+    }
+    seq.use_128x128_superblock = r.flag()?;
+    r.skip(2)?; // enable_filter_intra, enable_intra_edge_filter
+    seq.seq_force_screen_content_tools = SELECT_SCREEN_CONTENT_TOOLS;
+    seq.seq_force_integer_mv = SELECT_INTEGER_MV;
+    if !seq.reduced_still_picture_header {
+        r.skip(4)?; // interintra, masked, warped motion, dual filter
+        seq.enable_order_hint = r.flag()?;
+        if seq.enable_order_hint {
+            r.skip(1)?; // enable_jnt_comp
+            seq.enable_ref_frame_mvs = r.flag()?;
+        }
+        if !r.flag()? {
+            seq.seq_force_screen_content_tools = r.u(1)?;
+        }
+        if seq.seq_force_screen_content_tools > 0 {
+            if !r.flag()? {
+                seq.seq_force_integer_mv = r.u(1)?;
+            }
+        }
+        if seq.enable_order_hint {
+            seq.order_hint_bits = r.u(3)? + 1;
+        }
+    }
+    seq.enable_superres = r.flag()?;
+    r.skip(2)?; // enable_cdef, enable_restoration
+                // color_config()
+    let high_bitdepth = r.flag()?;
+    seq.bit_depth = if seq.seq_profile == 2 && high_bitdepth {
+        if r.flag()? {
+            12
+        } else {
+            10
+        }
+    } else if high_bitdepth {
+        10
+    } else {
+        8
+    };
+    if seq.seq_profile != 1 {
+        seq.mono_chrome = r.flag()?;
+    }
+    (
+        seq.color_primaries,
+        seq.transfer_characteristics,
+        seq.matrix_coefficients,
+    ) = if r.flag()? {
+        (r.u(8)? as u8, r.u(8)? as u8, r.u(8)? as u8)
+    } else {
+        (2, 2, 2)
+    };
+    if seq.mono_chrome {
+        seq.color_range = r.flag()?;
+        seq.subsampling_x = true;
+        seq.subsampling_y = true;
+    } else if (
+        seq.color_primaries,
+        seq.transfer_characteristics,
+        seq.matrix_coefficients,
+    ) == (1, 13, 0)
+    {
+        seq.color_range = true;
+    } else {
+        seq.color_range = r.flag()?;
+        match seq.seq_profile {
+            0 => (seq.subsampling_x, seq.subsampling_y) = (true, true),
+            1 => {}
+            _ => {
+                if seq.bit_depth == 12 {
+                    seq.subsampling_x = r.flag()?;
+                    if seq.subsampling_x {
+                        seq.subsampling_y = r.flag()?;
+                    }
+                } else {
+                    seq.subsampling_x = true;
+                }
+            }
+        }
+        if seq.subsampling_x && seq.subsampling_y {
+            r.skip(2)?; // chroma_sample_position
+        }
+    }
+    if !seq.mono_chrome {
+        r.skip(1)?; // separate_uv_delta_q
+    }
+    seq.film_grain_params_present = r.flag()?;
+    Some(seq)
+}
+
+/// The state a frame leaves in a reference slot that later frame headers
+/// depend on.
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct Av1RefSlot {
+    pub valid: bool,
+    pub frame_type: u8,
+    pub order_hint: u32,
+    /// Upscaled width, frame height, render width and render height, if
+    /// known.
+    pub size: Option<(u32, u32, u32, u32)>,
+}
+
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct Av1FrameHeader {
+    pub show_existing_frame: bool,
+    pub frame_type: u8,
+    pub show_frame: bool,
+    pub refresh_frame_flags: u8,
+    /// `None` when the header could not be followed up to the quantizer,
+    /// e.g. with short reference signaling.
+    pub base_q_idx: Option<u8>,
+    /// `render_width` and `render_height`, if the frame size was followed.
+    pub render_size: Option<(u32, u32)>,
+}
+
+impl Av1FrameHeader {
+    pub fn is_intra(&self) -> bool {
+        self.frame_type == FRAME_TYPE_KEY || self.frame_type == FRAME_TYPE_INTRA_ONLY
+    }
+}
+
+struct FrameSize {
+    upscaled_width: u32,
+    width: u32,
+    height: u32,
+    render_width: u32,
+    render_height: u32,
+}
+
+fn frame_size(
+    r: &mut BitReader,
+    seq: &Av1SequenceHeader,
+    override_flag: bool,
+) -> Option<FrameSize> {
+    let (width, height) = if override_flag {
+        (
+            r.u(seq.frame_width_bits)? + 1,
+            r.u(seq.frame_height_bits)? + 1,
+        )
+    } else {
+        (seq.max_frame_width, seq.max_frame_height)
+    };
+    let mut size = FrameSize {
+        upscaled_width: width,
+        width,
+        height,
+        render_width: 0,
+        render_height: 0,
+    };
+    superres_params(r, seq, &mut size)?;
+    Some(size)
+}
+
+fn superres_params(r: &mut BitReader, seq: &Av1SequenceHeader, size: &mut FrameSize) -> Option<()> {
+    if seq.enable_superres && r.flag()? {
+        let denom = r.u(3)? + 9;
+        size.width = (size.upscaled_width * 8 + denom / 2) / denom;
+    }
+    Some(())
+}
+
+fn render_size(r: &mut BitReader, size: &mut FrameSize) -> Option<()> {
+    if r.flag()? {
+        size.render_width = r.u(16)? + 1;
+        size.render_height = r.u(16)? + 1;
+    } else {
+        size.render_width = size.upscaled_width;
+        size.render_height = size.height;
+    }
+    Some(())
+}
+
+fn tile_info(r: &mut BitReader, seq: &Av1SequenceHeader, size: &FrameSize) -> Option<()> {
+    let mi_cols = 2 * ((size.width + 7) >> 3);
+    let mi_rows = 2 * ((size.height + 7) >> 3);
+    let sb_shift = if seq.use_128x128_superblock { 5 } else { 4 };
+    let sb_cols = (mi_cols + (1 << sb_shift) - 1) >> sb_shift;
+    let sb_rows = (mi_rows + (1 << sb_shift) - 1) >> sb_shift;
+    let sb_size = sb_shift + 2;
+    let max_tile_width_sb = 4096 >> sb_size;
+    let mut max_tile_area_sb = (4096 * 2304) >> (2 * sb_size);
+    let min_log2_tile_cols = tile_log2(max_tile_width_sb, sb_cols);
+    let max_log2_tile_cols = tile_log2(1, sb_cols.min(64));
+    let max_log2_tile_rows = tile_log2(1, sb_rows.min(64));
+    let min_log2_tiles = min_log2_tile_cols.max(tile_log2(max_tile_area_sb, sb_rows * sb_cols));
+    let (cols_log2, rows_log2);
+    if r.flag()? {
+        let mut log2 = min_log2_tile_cols;
+        while log2 < max_log2_tile_cols && r.flag()? {
+            log2 += 1;
+        }
+        cols_log2 = log2;
+        let mut log2 = min_log2_tiles.saturating_sub(cols_log2);
+        while log2 < max_log2_tile_rows && r.flag()? {
+            log2 += 1;
+        }
+        rows_log2 = log2;
+    } else {
+        let mut widest_tile_sb = 0;
+        let mut start = 0;
+        let mut cols = 0;
+        while start < sb_cols {
+            let width = ns(r, (sb_cols - start).min(max_tile_width_sb))? + 1;
+            widest_tile_sb = widest_tile_sb.max(width);
+            start += width;
+            cols += 1;
+        }
+        cols_log2 = tile_log2(1, cols);
+        max_tile_area_sb = if min_log2_tiles > 0 {
+            (sb_rows * sb_cols) >> (min_log2_tiles + 1)
+        } else {
+            sb_rows * sb_cols
+        };
+        let max_tile_height_sb = (max_tile_area_sb / widest_tile_sb).max(1);
+        start = 0;
+        let mut rows = 0;
+        while start < sb_rows {
+            start += ns(r, (sb_rows - start).min(max_tile_height_sb))? + 1;
+            rows += 1;
+        }
+        rows_log2 = tile_log2(1, rows);
+    }
+    if cols_log2 > 0 || rows_log2 > 0 {
+        r.skip(cols_log2 + rows_log2 + 2)?; // context_update_tile_id, tile_size_bytes_minus_1
+    }
+    Some(())
+}
+
+/// Parses a frame header OBU payload (or the start of a frame OBU) and
+/// updates `refs` with the slots it refreshes.
+pub fn parse_frame_header(
+    payload: &[u8],
+    seq: &Av1SequenceHeader,
+    refs: &mut [Av1RefSlot; NUM_REF_FRAMES],
+    temporal_id: u8,
+    spatial_id: u8,
+) -> Option<Av1FrameHeader> {
+    let mut r = BitReader::new_raw(payload);
+    let mut hdr = Av1FrameHeader {
+        frame_type: FRAME_TYPE_KEY,
+        show_frame: true,
+        ..Default::default()
+    };
+    let temporal_point_info = seq.decoder_model_info_present && !seq.equal_picture_interval;
+    let error_resilient_mode;
+    if seq.reduced_still_picture_header {
+        error_resilient_mode = true;
+    } else {
+        hdr.show_existing_frame = r.flag()?;
+        if hdr.show_existing_frame {
+            let idx = r.u(3)? as usize;
+            if temporal_point_info {
+                r.skip(seq.frame_presentation_time_length)?;
+            }
+            let slot = refs[idx];
+            hdr.frame_type = slot.frame_type;
+            if hdr.frame_type == FRAME_TYPE_KEY {
+                // showing a key frame resets every slot to it
+                hdr.refresh_frame_flags = ALL_FRAMES;
+                refs.iter_mut().for_each(|s| *s = slot);
+            }
+            return Some(hdr);
+        }
+        hdr.frame_type = r.u(2)? as u8;
+        hdr.show_frame = r.flag()?;
+        if hdr.show_frame && temporal_point_info {
+            r.skip(seq.frame_presentation_time_length)?;
+        }
+        if !hdr.show_frame {
+            r.skip(1)?; // showable_frame
+        }
+        error_resilient_mode = hdr.frame_type == FRAME_TYPE_SWITCH
+            || hdr.frame_type == FRAME_TYPE_KEY && hdr.show_frame
+            || r.flag()?;
+    }
+    if hdr.frame_type == FRAME_TYPE_KEY && hdr.show_frame {
+        for slot in refs.iter_mut() {
+            slot.valid = false;
+            slot.order_hint = 0;
+        }
+    }
+    let disable_cdf_update = r.flag()?;
+    let allow_screen_content_tools =
+        if seq.seq_force_screen_content_tools == SELECT_SCREEN_CONTENT_TOOLS {
+            r.u(1)?
+        } else {
+            seq.seq_force_screen_content_tools
+        };
+    let mut force_integer_mv = 0;
+    if allow_screen_content_tools != 0 {
+        force_integer_mv = if seq.seq_force_integer_mv == SELECT_INTEGER_MV {
+            r.u(1)?
+        } else {
+            seq.seq_force_integer_mv
+        };
+    }
+    if hdr.is_intra() {
+        force_integer_mv = 1;
+    }
+    if seq.frame_id_numbers_present {
+        r.skip(seq.frame_id_length)?; // current_frame_id
+    }
+    let frame_size_override = if hdr.frame_type == FRAME_TYPE_SWITCH {
+        true
+    } else if seq.reduced_still_picture_header {
+        false
+    } else {
+        r.flag()?
+    };
+    let order_hint = r.u(seq.order_hint_bits)?;
+    if !hdr.is_intra() && !error_resilient_mode {
+        r.skip(3)?; // primary_ref_frame
+    }
+    if seq.decoder_model_info_present && r.flag()? {
+        for op in seq.operating_points.iter() {
+            if op.decoder_model_present {
+                let in_temporal = (op.idc >> temporal_id) & 1 != 0;
+                let in_spatial = (op.idc >> (spatial_id + 8)) & 1 != 0;
+                if op.idc == 0 || in_temporal && in_spatial {
+                    r.skip(seq.buffer_removal_time_length)?;
+                }
+            }
+        }
+    }
+    hdr.refresh_frame_flags = if hdr.frame_type == FRAME_TYPE_SWITCH
+        || hdr.frame_type == FRAME_TYPE_KEY && hdr.show_frame
+    {
+        ALL_FRAMES
+    } else {
+        r.u(8)? as u8
+    };
+    if (!hdr.is_intra() || hdr.refresh_frame_flags != ALL_FRAMES)
+        && error_resilient_mode
+        && seq.enable_order_hint
+    {
+        for slot in refs.iter_mut() {
+            let hint = r.u(seq.order_hint_bits)?;
+            if !slot.valid || slot.order_hint != hint {
+                *slot = Av1RefSlot {
+                    valid: false,
+                    order_hint: hint,
+                    ..Default::default()
+                };
+            }
+        }
+    }
+    // a failure from here on only loses the frame size and the quantizer
+    let mut frame_size_part = || -> Option<FrameSize> {
+        if hdr.is_intra() {
+            let mut s = frame_size(&mut r, seq, frame_size_override)?;
+            render_size(&mut r, &mut s)?;
+            if allow_screen_content_tools != 0 && s.upscaled_width == s.width {
+                r.skip(1)?; // allow_intrabc
+            }
+            return Some(s);
+        }
+        let mut short_signaling = false;
+        if seq.enable_order_hint {
+            short_signaling = r.flag()?;
+            if short_signaling {
+                r.skip(6)?; // last_frame_idx, gold_frame_idx
+            }
+        }
+        let mut ref_frame_idx = [0usize; REFS_PER_FRAME];
+        for idx in ref_frame_idx.iter_mut() {
+            if !short_signaling {
+                *idx = r.u(3)? as usize;
+            }
+            if seq.frame_id_numbers_present {
+                r.skip(seq.delta_frame_id_length)?;
+            }
+        }
+        let mut size = None;
+        if frame_size_override && !error_resilient_mode {
+            // frame_size_with_refs()
+            for &idx in ref_frame_idx.iter() {
+                if r.flag()? {
+                    // the slots short signaling picks are not derived here
+                    let (upscaled_width, height, render_width, render_height) = if short_signaling {
+                        None
+                    } else {
+                        refs[idx].size
+                    }?;
+                    let mut s = FrameSize {
+                        upscaled_width,
+                        width: upscaled_width,
+                        height,
+                        render_width,
+                        render_height,
+                    };
+                    superres_params(&mut r, seq, &mut s)?;
+                    size = Some(s);
+                    break;
+                }
+            }
+        }
+        let size = match size {
+            Some(s) => s,
+            None => {
+                let mut s = frame_size(&mut r, seq, frame_size_override)?;
+                render_size(&mut r, &mut s)?;
+                s
+            }
+        };
+        if force_integer_mv == 0 {
+            r.skip(1)?; // allow_high_precision_mv
+        }
+        if !r.flag()? {
+            r.skip(2)?; // interpolation_filter
+        }
+        r.skip(1)?; // is_motion_mode_switchable
+        if !error_resilient_mode && seq.enable_ref_frame_mvs {
+            r.skip(1)?; // use_ref_frame_mvs
+        }
+        Some(size)
+    };
+    let size = frame_size_part();
+    hdr.render_size = size.as_ref().map(|s| (s.render_width, s.render_height));
+    for (i, slot) in refs.iter_mut().enumerate() {
+        if hdr.refresh_frame_flags & (1 << i) != 0 {
+            *slot = Av1RefSlot {
+                valid: true,
+                frame_type: hdr.frame_type,
+                order_hint,
+                size: size
+                    .as_ref()
+                    .map(|s| (s.upscaled_width, s.height, s.render_width, s.render_height)),
+            };
+        }
+    }
+    let size = match size {
+        Some(s) => s,
+        None => return Some(hdr),
+    };
+    if !seq.reduced_still_picture_header && !disable_cdf_update {
+        r.skip(1)?; // disable_frame_end_update_cdf
+    }
+    tile_info(&mut r, seq, &size)?;
+    hdr.base_q_idx = Some(r.u(8)? as u8);
+    Some(hdr)
+}
@@ -0,0 +1,573 @@
+use crate::bits::BitReader;
+
+/// The fields of an H.264 sequence parameter set the library cares about.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct H264Sps {
+    pub profile_idc: u8,
+    pub constraint_flags: u8,
+    pub level_idc: u8,
+    pub id: u32,
+    pub chroma_format_idc: u32,
+    pub separate_colour_plane: bool,
+    pub bit_depth_luma: u32,
+    pub bit_depth_chroma: u32,
+    pub log2_max_frame_num: u32,
+    pub pic_order_cnt_type: u32,
+    pub log2_max_poc_lsb: u32,
+    pub delta_pic_order_always_zero: bool,
+    pub max_num_ref_frames: u32,
+    pub width_in_mbs: u32,
+    pub height_in_map_units: u32,
+    pub frame_mbs_only: bool,
+    pub mb_adaptive_frame_field: bool,
+    pub crop: [u32; 4],
+    /// RBSP bit offsets, after the NAL header, of `frame_cropping_flag` and
+    /// of what follows the crop offsets.
+    pub crop_bits: (usize, usize),
+}
+
+impl H264Sps {
+    pub fn height_in_mbs(&self) -> u32 {
+        self.height_in_map_units * if self.frame_mbs_only { 1 } else { 2 }
+    }
+
+    /// Pixels per unit of the crop offsets, horizontally and vertically.
+    pub fn crop_units(&self) -> (u32, u32) {
+        let (sub_w, sub_h) = match self.chroma_format_idc {
+            1 => (2, 2),
+            2 => (2, 1),
+            _ => (1, 1),
+        };
+        if self.chroma_format_idc == 0 || self.separate_colour_plane {
+            (1, if self.frame_mbs_only { 1 } else { 2 })
+        } else {
+            (sub_w, sub_h * if self.frame_mbs_only { 1 } else { 2 })
+        }
+    }
+
+    /// Coded picture size in pixels.
+    pub fn coded_size(&self) -> (u32, u32) {
+        (self.width_in_mbs * 16, self.height_in_mbs() * 16)
+    }
+
+    /// Cropped picture size in pixels.
+    pub fn size(&self) -> (u32, u32) {
+        let (crop_x, crop_y) = self.crop_units();
+        let (w, h) = self.coded_size();
+        (
+            w.saturating_sub(crop_x * (self.crop[0] + self.crop[1])),
+            h.saturating_sub(crop_y * (self.crop[2] + self.crop[3])),
+        )
+    }
+}
+
+/// Whether an H.264 SPS of `profile_idc` carries chroma_format_idc and the
+/// bit depths, as do the `avcC` records of its streams.
+pub fn has_chroma_info(profile_idc: u8) -> bool {
+    matches!(
+        profile_idc,
+        100 | 110 | 122 | 244 | 44 | 83 | 86 | 118 | 128 | 138 | 139 | 134 | 135
+    )
+}
+
+fn skip_scaling_list(r: &mut BitReader, size: u32) -> Option<()> {
+    let mut last = 8i32;
+    let mut next = 8i32;
+    for _ in 0..size {
+        if next != 0 {
+            next = (last + r.se()? + 256) % 256;
+        }
+        if next != 0 {
+            last = next;
+        }
+    }
+    Some(())
+}
+
+/// Parses an H.264 SPS NAL unit, header byte included.
+pub fn parse_h264_sps(nal: &[u8]) -> Option<H264Sps> {
+    let mut r = BitReader::new(nal.get(1..)?);
+    let mut sps = H264Sps {
+        profile_idc: r.u(8)? as u8,
+        constraint_flags: r.u(8)? as u8,
+        level_idc: r.u(8)? as u8,
+        id: r.ue()?,
+        chroma_format_idc: 1,
+        bit_depth_luma: 8,
+        bit_depth_chroma: 8,
+        ..Default::default()
+    };
+    if has_chroma_info(sps.profile_idc) {
+        sps.chroma_format_idc = r.ue()?;
+        if sps.chroma_format_idc == 3 {
+            sps.separate_colour_plane = r.flag()?;
+        }
+        sps.bit_depth_luma = r.ue()? + 8;
+        sps.bit_depth_chroma = r.ue()? + 8;
+        r.skip(1)?; // qpprime_y_zero_transform_bypass_flag
+        if r.flag()? {
+            let count = if sps.chroma_format_idc != 3 { 8 } else { 12 };
+            for i in 0..count {
+                if r.flag()? {
+                    skip_scaling_list(&mut r, if i < 6 { 16 } else { 64 })?;
+                }
+            }
+        }
+    }
+    sps.log2_max_frame_num = r.ue()? + 4;
+    sps.pic_order_cnt_type = r.ue()?;
+    match sps.pic_order_cnt_type {
+        0 => sps.log2_max_poc_lsb = r.ue()? + 4,
+        1 => {
+            sps.delta_pic_order_always_zero = r.flag()?;
+            r.se()?; // offset_for_non_ref_pic
+            r.se()?; // offset_for_top_to_bottom_field
+            for _ in 0..r.ue()? {
+                r.se()?;
+            }
+        }
+        _ => {}
+    }
+    sps.max_num_ref_frames = r.ue()?;
+    r.skip(1)?; // gaps_in_frame_num_value_allowed_flag
+    sps.width_in_mbs = r.ue()? + 1;
+    sps.height_in_map_units = r.ue()? + 1;
+    sps.frame_mbs_only = r.flag()?;
+    if !sps.frame_mbs_only {
+        sps.mb_adaptive_frame_field = r.flag()?;
+    }
+    r.skip(1)?; // direct_8x8_inference_flag
+    sps.crop_bits.0 = r.bits_read();
+    if r.flag()? {
+        for c in sps.crop.iter_mut() {
+            *c = r.ue()?;
+        }
+    }
+    sps.crop_bits.1 = r.bits_read();
+    Some(sps)
+}
+
+/// The fields of an H.264 picture parameter set needed to read and write
+/// slice headers.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct H264Pps {
+    pub id: u32,
+    pub sps_id: u32,
+    pub entropy_coding_mode: bool,
+    pub bottom_field_pic_order_in_frame_present: bool,
+    pub num_ref_idx_l0_default: u32,
+    pub num_ref_idx_l1_default: u32,
+    pub weighted_pred: bool,
+    pub weighted_bipred_idc: u32,
+    pub pic_init_qp: i32,
+    pub deblocking_filter_control_present: bool,
+    pub redundant_pic_cnt_present: bool,
+}
+
+/// Parses an H.264 PPS NAL unit, header byte included. Slice groups (FMO)
+/// are not supported.
+pub fn parse_h264_pps(nal: &[u8]) -> Option<H264Pps> {
+    let mut r = BitReader::new(nal.get(1..)?);
+    let mut pps = H264Pps {
+        id: r.ue()?,
+        sps_id: r.ue()?,
+        entropy_coding_mode: r.flag()?,
+        bottom_field_pic_order_in_frame_present: r.flag()?,
+        ..Default::default()
+    };
+    if r.ue()? != 0 {
+        return None;
+    }
+    pps.num_ref_idx_l0_default = r.ue()? + 1;
+    pps.num_ref_idx_l1_default = r.ue()? + 1;
+    pps.weighted_pred = r.flag()?;
+    pps.weighted_bipred_idc = r.u(2)?;
+    pps.pic_init_qp = 26 + r.se()?;
+    r.se()?; // pic_init_qs_minus26
+    r.se()?; // chroma_qp_index_offset
+    pps.deblocking_filter_control_present = r.flag()?;
+    r.skip(1)?; // constrained_intra_pred_flag
+    pps.redundant_pic_cnt_present = r.flag()?;
+    Some(pps)
+}
+
+/// general_profile_tier_level() of an HEVC VPS/SPS.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct HevcProfileTierLevel {
+    pub profile_space: u8,
+    pub tier: bool,
+    pub profile_idc: u8,
+    pub compatibility_flags: u32,
+    /// The 48 constraint indicator bits, right aligned.
+    pub constraint_flags: u64,
+    pub level_idc: u8,
+}
+
+fn parse_hevc_ptl(r: &mut BitReader, max_sub_layers_minus1: u32) -> Option<HevcProfileTierLevel> {
+    let ptl = HevcProfileTierLevel {
+        profile_space: r.u(2)? as u8,
+        tier: r.flag()?,
+        profile_idc: r.u(5)? as u8,
+        compatibility_flags: r.u(32)?,
+        constraint_flags: ((r.u(16)? as u64) << 32) | r.u(32)? as u64,
+        level_idc: r.u(8)? as u8,
+    };
+    let mut present = [(false, false); 8];
+    for p in present.iter_mut().take(max_sub_layers_minus1 as usize) {
+        *p = (r.flag()?, r.flag()?);
+    }
+    if max_sub_layers_minus1 > 0 {
+        r.skip(2 * (8 - max_sub_layers_minus1))?;
+    }
+    for &(profile, level) in present.iter().take(max_sub_layers_minus1 as usize) {
+        if profile {
+            r.skip(88)?;
+        }
+        if level {
+            r.skip(8)?;
+        }
+    }
+    Some(ptl)
+}
+
+/// The fields of an HEVC sequence parameter set the library cares about.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct HevcSps {
+    pub vps_id: u32,
+    pub max_sub_layers: u32,
+    pub temporal_id_nesting: bool,
+    pub ptl: HevcProfileTierLevel,
+    pub id: u32,
+    pub chroma_format_idc: u32,
+    pub separate_colour_plane: bool,
+    pub width: u32,
+    pub height: u32,
+    /// Conformance window offsets in chroma units: left, right, top, bottom.
+    pub conf_win: [u32; 4],
+    /// RBSP bit offsets, after the NAL header, of
+    /// `conformance_window_flag` and of what follows the offsets.
+    pub conf_win_bits: (usize, usize),
+    pub bit_depth_luma: u32,
+    pub bit_depth_chroma: u32,
+    pub log2_max_poc_lsb: u32,
+    pub log2_min_cb_size: u32,
+    pub log2_ctb_size: u32,
+    pub sample_adaptive_offset: bool,
+    pub short_term_rps: Vec<ShortTermRps>,
+    pub long_term_refs_present: bool,
+    /// used_by_curr_pic_lt_sps_flag of each candidate long-term picture.
+    pub long_term_ref_pics_used: Vec<bool>,
+    pub temporal_mvp: bool,
+}
+
+impl HevcSps {
+    pub fn chroma_array_type(&self) -> u32 {
+        if self.separate_colour_plane {
+            0
+        } else {
+            self.chroma_format_idc
+        }
+    }
+
+    pub fn ctb_count(&self) -> u32 {
+        let ctb = 1 << self.log2_ctb_size;
+        ((self.width + ctb - 1) / ctb) * ((self.height + ctb - 1) / ctb)
+    }
+
+    /// Pixels per unit of the conformance window offsets.
+    pub fn crop_units(&self) -> (u32, u32) {
+        match self.chroma_format_idc {
+            1 if !self.separate_colour_plane => (2, 2),
+            2 if !self.separate_colour_plane => (2, 1),
+            _ => (1, 1),
+        }
+    }
+
+    /// Cropped picture size in pixels.
+    pub fn size(&self) -> (u32, u32) {
+        let (sub_w, sub_h) = self.crop_units();
+        (
+            self.width
+                .saturating_sub(sub_w * (self.conf_win[0] + self.conf_win[1])),
+            self.height
+                .saturating_sub(sub_h * (self.conf_win[2] + self.conf_win[3])),
+        )
+    }
+}
+
+/// Parses an HEVC SPS NAL unit, 2-byte header included.
+pub fn parse_hevc_sps(nal: &[u8]) -> Option<HevcSps> {
+    let mut r = BitReader::new(nal.get(2..)?);
+    let mut sps = HevcSps {
+        vps_id: r.u(4)?,
+        ..Default::default()
+    };
+    let max_sub_layers_minus1 = r.u(3)?;
+    sps.max_sub_layers = max_sub_layers_minus1 + 1;
+    sps.temporal_id_nesting = r.flag()?;
+    sps.ptl = parse_hevc_ptl(&mut r, max_sub_layers_minus1)?;
+    sps.id = r.ue()?;
+    sps.chroma_format_idc = r.ue()?;
+    if sps.chroma_format_idc == 3 {
+        sps.separate_colour_plane = r.flag()?;
+    }
+    sps.width = r.ue()?;
+    sps.height = r.ue()?;
+    sps.conf_win_bits.0 = r.bits_read();
+    if r.flag()? {
+        for c in sps.conf_win.iter_mut() {
+            *c = r.ue()?;
+        }
+    }
+    sps.conf_win_bits.1 = r.bits_read();
+    sps.bit_depth_luma = r.ue()? + 8;
+    sps.bit_depth_chroma = r.ue()? + 8;
+    sps.log2_max_poc_lsb = r.ue()? + 4;
+    let ordering_all = r.flag()?;
+    let first = if ordering_all {
+        0
+    } else {
+        max_sub_layers_minus1
+    };
+    for _ in first..=max_sub_layers_minus1 {
+        r.ue()?; // max_dec_pic_buffering_minus1
+        r.ue()?; // max_num_reorder_pics
+        r.ue()?; // max_latency_increase_plus1
+    }
+    sps.log2_min_cb_size = r.ue()? + 3;
+    sps.log2_ctb_size = sps.log2_min_cb_size + r.ue()?;
+    r.ue()?; // log2_min_luma_transform_block_size_minus2
+    r.ue()?; // log2_diff_max_min_luma_transform_block_size
+    r.ue()?; // max_transform_hierarchy_depth_inter
+    r.ue()?; // max_transform_hierarchy_depth_intra
+    if r.flag()? && r.flag()? {
+        skip_hevc_scaling_list_data(&mut r)?;
+    }
+    r.skip(1)?; // amp_enabled_flag
+    sps.sample_adaptive_offset = r.flag()?;
+    if r.flag()? {
+        r.skip(8)?; // pcm bit depths
+        r.ue()?;
+        r.ue()?;
+        r.skip(1)?;
+    }
+    let num_sets = r.ue()?;
+    if num_sets > 64 {
+        return None;
+    }
+    for i in 0..num_sets {
+        let rps = parse_short_term_rps(&mut r, i, num_sets, &sps.short_term_rps)?;
+        sps.short_term_rps.push(rps);
+    }
+    sps.long_term_refs_present = r.flag()?;
+    if sps.long_term_refs_present {
+        let count = r.ue()?;
+        if count > 32 {
+            return None;
+        }
+        for _ in 0..count {
+            r.skip(sps.log2_max_poc_lsb)?;
+            sps.long_term_ref_pics_used.push(r.flag()?);
+        }
+    }
+    sps.temporal_mvp = r.flag()?;
+    Some(sps)
+}
+
+fn skip_hevc_scaling_list_data(r: &mut BitReader) -> Option<()> {
+    for size_id in 0..4 {
+        let step = if size_id == 3 { 3 } else { 1 };
+        for _ in (0..6).step_by(step) {
+            if !r.flag()? {
+                r.ue()?; // scaling_list_pred_matrix_id_delta
+            } else {
+                let coefs = 64.min(1 << (4 + (size_id << 1)));
+                if size_id > 1 {
+                    r.se()?;
+                }
+                for _ in 0..coefs {
+                    r.se()?;
+                }
+            }
+        }
+    }
+    Some(())
+}
+
+/// st_ref_pic_set() with the delta POCs resolved.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct ShortTermRps {
+    /// (delta POC, used by current picture) before the current picture.
+    pub negative: Vec<(i32, bool)>,
+    /// (delta POC, used by current picture) after the current picture.
+    pub positive: Vec<(i32, bool)>,
+}
+
+impl ShortTermRps {
+    pub fn used_count(&self) -> u32 {
+        self.negative
+            .iter()
+            .chain(self.positive.iter())
+            .filter(|p| p.1)
+            .count() as u32
+    }
+}
+
+/// Parses st_ref_pic_set(idx). `sets` are the sets already parsed from the
+/// SPS, `num_sets` is their total count (idx == num_sets in a slice header).
+pub fn parse_short_term_rps(
+    r: &mut BitReader,
+    idx: u32,
+    num_sets: u32,
+    sets: &[ShortTermRps],
+) -> Option<ShortTermRps> {
+    let mut rps = ShortTermRps::default();
+    if idx != 0 && r.flag()? {
+        let delta_idx = if idx == num_sets { r.ue()? + 1 } else { 1 };
+        let reference = sets.get(idx.checked_sub(delta_idx)? as usize)?;
+        let sign = r.flag()?;
+        let abs = r.ue()? as i32 + 1;
+        let delta_rps = if sign { -abs } else { abs };
+        let num_delta = reference.negative.len() + reference.positive.len();
+        let mut used = Vec::with_capacity(num_delta + 1);
+        for _ in 0..=num_delta {
+            let used_by_curr = r.flag()?;
+            let use_delta = used_by_curr || r.flag()?;
+            used.push((used_by_curr, use_delta));
+        }
+        let neg = reference.negative.len();
+        for (j, &(d, _)) in reference.positive.iter().enumerate().rev() {
+            let poc = d + delta_rps;
+            if poc < 0 && used[neg + j].1 {
+                rps.negative.push((poc, used[neg + j].0));
+            }
+        }
+        if delta_rps < 0 && used[num_delta].1 {
+            rps.negative.push((delta_rps, used[num_delta].0));
+        }
+        for (j, &(d, _)) in reference.negative.iter().enumerate() {
+            let poc = d + delta_rps;
+            if poc < 0 && used[j].1 {
+                rps.negative.push((poc, used[j].0));
+            }
+        }
+        for (j, &(d, _)) in reference.negative.iter().enumerate().rev() {
+            let poc = d + delta_rps;
+            if poc > 0 && used[j].1 {
+                rps.positive.push((poc, used[j].0));
+            }
+        }
+        if delta_rps > 0 && used[num_delta].1 {
+            rps.positive.push((delta_rps, used[num_delta].0));
+        }
+        for (j, &(d, _)) in reference.positive.iter().enumerate() {
+            let poc = d + delta_rps;
+            if poc > 0 && used[neg + j].1 {
+                rps.positive.push((poc, used[neg + j].0));
+            }
+        }
+    } else {
+        let num_negative = r.ue()?;
+        let num_positive = r.ue()?;
+        if num_negative > 16 || num_positive > 16 {
+            return None;
+        }
+        let mut poc = 0;
+        for _ in 0..num_negative {
+            poc -= r.ue()? as i32 + 1;
+            rps.negative.push((poc, r.flag()?));
+        }
+        poc = 0;
+        for _ in 0..num_positive {
+            poc += r.ue()? as i32 + 1;
+            rps.positive.push((poc, r.flag()?));
+        }
+    }
+    Some(rps)
+}
+
+/// The fields of an HEVC picture parameter set needed to read and write
+/// slice headers.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct HevcPps {
+    pub id: u32,
+    pub sps_id: u32,
+    pub dependent_slice_segments: bool,
+    pub output_flag_present: bool,
+    pub num_extra_slice_header_bits: u32,
+    pub cabac_init_present: bool,
+    pub num_ref_idx_l0_default: u32,
+    pub num_ref_idx_l1_default: u32,
+    pub init_qp: i32,
+    pub weighted_pred: bool,
+    pub weighted_bipred: bool,
+    pub slice_chroma_qp_offsets_present: bool,
+    pub transquant_bypass: bool,
+    pub tiles: bool,
+    pub entropy_coding_sync: bool,
+    pub loop_filter_across_slices: bool,
+    pub deblocking_filter_override_enabled: bool,
+    pub deblocking_filter_disabled: bool,
+    pub lists_modification_present: bool,
+    pub slice_header_extension_present: bool,
+    /// Whether any PPS extension is present; range and SCC extensions add
+    /// slice header syntax that is not handled.
+    pub extensions: bool,
+}
+
+/// Parses an HEVC PPS NAL unit, 2-byte header included.
+pub fn parse_hevc_pps(nal: &[u8]) -> Option<HevcPps> {
+    let mut r = BitReader::new(nal.get(2..)?);
+    let mut pps = HevcPps {
+        id: r.ue()?,
+        sps_id: r.ue()?,
+        dependent_slice_segments: r.flag()?,
+        output_flag_present: r.flag()?,
+        num_extra_slice_header_bits: r.u(3)?,
+        ..Default::default()
+    };
+    r.skip(1)?; // sign_data_hiding_enabled_flag
+    pps.cabac_init_present = r.flag()?;
+    pps.num_ref_idx_l0_default = r.ue()? + 1;
+    pps.num_ref_idx_l1_default = r.ue()? + 1;
+    pps.init_qp = 26 + r.se()?;
+    r.skip(2)?; // constrained_intra_pred_flag, transform_skip_enabled_flag
+    if r.flag()? {
+        r.ue()?; // diff_cu_qp_delta_depth
+    }
+    r.se()?; // pps_cb_qp_offset
+    r.se()?; // pps_cr_qp_offset
+    pps.slice_chroma_qp_offsets_present = r.flag()?;
+    pps.weighted_pred = r.flag()?;
+    pps.weighted_bipred = r.flag()?;
+    pps.transquant_bypass = r.flag()?;
+    pps.tiles = r.flag()?;
+    pps.entropy_coding_sync = r.flag()?;
+    if pps.tiles {
+        let columns = r.ue()?;
+        let rows = r.ue()?;
+        if !r.flag()? {
+            for _ in 0..columns + rows {
+                r.ue()?;
+            }
+        }
+        r.skip(1)?;
+    }
+    pps.loop_filter_across_slices = r.flag()?;
+    if r.flag()? {
+        pps.deblocking_filter_override_enabled = r.flag()?;
+        pps.deblocking_filter_disabled = r.flag()?;
+        if !pps.deblocking_filter_disabled {
+            r.se()?;
+            r.se()?;
+        }
+    }
+    if r.flag()? {
+        skip_hevc_scaling_list_data(&mut r)?;
+    }
+    pps.lists_modification_present = r.flag()?;
+    r.ue()?; // log2_parallel_merge_level_minus2
+    pps.slice_header_extension_present = r.flag()?;
+    pps.extensions = r.flag()?;
+    Some(pps)
+}
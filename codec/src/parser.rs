@@ -0,0 +1,603 @@
+//! Per-packet metadata read from the bitstream itself, so it does not
+//! depend on what each backend reports.
+
+use crate::{
+    bits::BitReader,
+    nal,
+    obu::{self, Av1RefSlot, Av1SequenceHeader},
+    params::{self, H264Pps, H264Sps, HevcPps, HevcSps, ShortTermRps},
+};
+use gpu_common::DataFormat::{self, *};
+use std::collections::HashMap;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Hash, Default)]
+pub enum PictureType {
+    #[default]
+    Unknown,
+    /// A random access point: IDR, or an HEVC IRAP picture.
+    Idr,
+    I,
+    P,
+    B,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub struct NalStats {
+    pub count: u32,
+    pub bytes: u32,
+}
+
+impl NalStats {
+    fn add(&mut self, len: usize) {
+        self.count += 1;
+        self.bytes += len as u32;
+    }
+}
+
+/// What a packet contains. Byte counts include start codes, for AV1
+/// `slices` counts frame, frame header and tile group OBUs and
+/// `parameter_sets` sequence headers.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub struct FrameInfo {
+    pub picture_type: PictureType,
+    /// Whether later pictures may reference this one.
+    pub reference: bool,
+    pub temporal_id: u8,
+    /// QP of the first slice (`base_q_idx` of the first frame for AV1),
+    /// `None` if no slice header could be parsed.
+    pub qp: Option<i32>,
+    pub size: usize,
+    /// Picture size after cropping (the render size for AV1), from the
+    /// first slice whose header could be parsed.
+    pub dimensions: Option<(u32, u32)>,
+    pub slices: NalStats,
+    pub parameter_sets: NalStats,
+    pub sei: NalStats,
+    pub other: NalStats,
+}
+
+impl FrameInfo {
+    pub fn is_keyframe(&self) -> bool {
+        self.picture_type == PictureType::Idr
+    }
+}
+
+#[derive(Debug, Clone, Default)]
+pub(crate) struct SliceHeader {
+    pub picture_type: PictureType,
+    pub qp: Option<i32>,
+    pub pps_id: u32,
+    /// `frame_num` of H.264 and its bit offset in the RBSP after the NAL
+    /// header.
+    pub frame_num: Option<(u32, usize)>,
+    /// `pic_order_cnt_lsb` (`slice_pic_order_cnt_lsb` for HEVC) and its bit
+    /// offset, `None` when not coded.
+    pub poc_lsb: Option<(u32, usize)>,
+    /// Active list 0 entries.
+    pub refs: u32,
+    /// Whether the reference list is modified (reordered).
+    pub list_modification: bool,
+    /// Whether the slice touches long-term references or adaptive marking.
+    pub long_term: bool,
+    /// The short-term reference picture set of an HEVC slice.
+    pub rps: Option<ShortTermRps>,
+    /// Cropped picture size of the active SPS, render size for AV1.
+    pub size: Option<(u32, u32)>,
+}
+
+/// Keeps the parameter sets seen so far and parses the slice headers of
+/// each packet up to `slice_qp_delta`.
+pub struct Parser {
+    format: DataFormat,
+    h264_sps: HashMap<u32, H264Sps>,
+    h264_pps: HashMap<u32, H264Pps>,
+    hevc_sps: HashMap<u32, HevcSps>,
+    hevc_pps: HashMap<u32, HevcPps>,
+    av1_seq: Option<Av1SequenceHeader>,
+    av1_refs: [Av1RefSlot; 8],
+}
+
+impl Parser {
+    pub fn new(format: DataFormat) -> Self {
+        Self {
+            format,
+            h264_sps: HashMap::new(),
+            h264_pps: HashMap::new(),
+            hevc_sps: HashMap::new(),
+            hevc_pps: HashMap::new(),
+            av1_seq: None,
+            av1_refs: Default::default(),
+        }
+    }
+
+    pub(crate) fn h264_params(&self, pps_id: u32) -> Option<(&H264Sps, &H264Pps)> {
+        let pps = self.h264_pps.get(&pps_id)?;
+        Some((self.h264_sps.get(&pps.sps_id)?, pps))
+    }
+
+    pub(crate) fn hevc_params(&self, pps_id: u32) -> Option<(&HevcSps, &HevcPps)> {
+        let pps = self.hevc_pps.get(&pps_id)?;
+        Some((self.hevc_sps.get(&pps.sps_id)?, pps))
+    }
+
+    /// Parses the header of a slice NAL unit with the parameter sets seen so
+    /// far.
+    pub(crate) fn slice_header(&self, p: &[u8]) -> Option<SliceHeader> {
+        let t = nal::nal_type(self.format, *p.first()?);
+        match self.format {
+            H264 => self.parse_h264_slice(p, t == nal::H264_NAL_IDR, (p[0] >> 5) & 0x03),
+            H265 => self.parse_hevc_slice(p, t),
+            _ => None,
+        }
+    }
+
+    /// Parses an Annex-B packet holding one access unit.
+    pub fn parse(&mut self, data: &[u8]) -> FrameInfo {
+        let mut info = FrameInfo {
+            size: data.len(),
+            ..Default::default()
+        };
+        if self.format == AV1 {
+            for o in obu::obus(data) {
+                self.parse_av1_obu(data, &o, &mut info);
+            }
+            return info;
+        }
+        for n in nal::nal_units(data) {
+            let p = n.payload(data);
+            if p.is_empty() {
+                continue;
+            }
+            let len = n.end - n.start;
+            match self.format {
+                H264 => self.parse_h264_nal(p, len, &mut info),
+                H265 => self.parse_hevc_nal(p, len, &mut info),
+                _ => info.other.add(len),
+            }
+        }
+        info
+    }
+
+    fn add_slice(info: &mut FrameInfo, header: Option<SliceHeader>) {
+        if let Some(h) = header {
+            if info.qp.is_none() {
+                info.qp = h.qp;
+            }
+            if info.dimensions.is_none() {
+                info.dimensions = h.size;
+            }
+            // a picture is as predicted as its most predicted slice
+            if info.picture_type != PictureType::Idr && h.picture_type > info.picture_type {
+                info.picture_type = h.picture_type;
+            }
+        }
+    }
+
+    fn parse_h264_nal(&mut self, p: &[u8], len: usize, info: &mut FrameInfo) {
+        let t = nal::nal_type(H264, p[0]);
+        let nal_ref_idc = (p[0] >> 5) & 0x03;
+        match t {
+            nal::H264_NAL_SLICE | nal::H264_NAL_IDR => {
+                info.slices.add(len);
+                info.reference |= nal_ref_idc != 0;
+                if t == nal::H264_NAL_IDR {
+                    info.picture_type = PictureType::Idr;
+                }
+                let header = self.parse_h264_slice(p, t == nal::H264_NAL_IDR, nal_ref_idc);
+                Self::add_slice(info, header);
+            }
+            nal::H264_NAL_SPS => {
+                info.parameter_sets.add(len);
+                if let Some(sps) = params::parse_h264_sps(p) {
+                    self.h264_sps.insert(sps.id, sps);
+                }
+            }
+            nal::H264_NAL_PPS => {
+                info.parameter_sets.add(len);
+                if let Some(pps) = params::parse_h264_pps(p) {
+                    self.h264_pps.insert(pps.id, pps);
+                }
+            }
+            nal::H264_NAL_SEI => info.sei.add(len),
+            _ => info.other.add(len),
+        }
+    }
+
+    fn parse_h264_slice(&self, p: &[u8], idr: bool, nal_ref_idc: u8) -> Option<SliceHeader> {
+        let mut r = BitReader::new(p.get(1..)?);
+        r.ue()?; // first_mb_in_slice
+        let slice_type = r.ue()? % 5;
+        let pps_id = r.ue()?;
+        let (sps, pps) = self.h264_params(pps_id)?;
+        let (p_slice, b_slice) = (slice_type == 0 || slice_type == 3, slice_type == 1);
+        if sps.separate_colour_plane {
+            r.skip(2)?;
+        }
+        let pos = r.bits_read();
+        let frame_num = Some((r.u(sps.log2_max_frame_num)?, pos));
+        let mut field_pic = false;
+        if !sps.frame_mbs_only {
+            field_pic = r.flag()?;
+            if field_pic {
+                r.skip(1)?; // bottom_field_flag
+            }
+        }
+        if idr {
+            r.ue()?; // idr_pic_id
+        }
+        let delta_bottom = pps.bottom_field_pic_order_in_frame_present && !field_pic;
+        let mut poc_lsb = None;
+        if sps.pic_order_cnt_type == 0 {
+            let pos = r.bits_read();
+            poc_lsb = Some((r.u(sps.log2_max_poc_lsb)?, pos));
+            if delta_bottom {
+                r.se()?;
+            }
+        } else if sps.pic_order_cnt_type == 1 && !sps.delta_pic_order_always_zero {
+            r.se()?;
+            if delta_bottom {
+                r.se()?;
+            }
+        }
+        if pps.redundant_pic_cnt_present {
+            r.ue()?;
+        }
+        if b_slice {
+            r.skip(1)?; // direct_spatial_mv_pred_flag
+        }
+        let mut num_l0 = pps.num_ref_idx_l0_default;
+        let mut num_l1 = pps.num_ref_idx_l1_default;
+        if p_slice || b_slice {
+            if r.flag()? {
+                num_l0 = r.ue()? + 1;
+                if b_slice {
+                    num_l1 = r.ue()? + 1;
+                }
+            }
+            if num_l0 > 32 || num_l1 > 32 {
+                return None;
+            }
+        }
+        // ref_pic_list_modification()
+        let mut list_modification = false;
+        for list in 0..2 {
+            if (list == 0 && (p_slice || b_slice) || list == 1 && b_slice) && r.flag()? {
+                list_modification = true;
+                loop {
+                    match r.ue()? {
+                        3 => break,
+                        0..=2 => {
+                            r.ue()?;
+                        }
+                        _ => return None,
+                    }
+                }
+            }
+        }
+        let chroma = !sps.separate_colour_plane && sps.chroma_format_idc != 0;
+        if pps.weighted_pred && p_slice || pps.weighted_bipred_idc == 1 && b_slice {
+            r.ue()?; // luma_log2_weight_denom
+            if chroma {
+                r.ue()?;
+            }
+            let lists: &[u32] = if b_slice {
+                &[num_l0, num_l1]
+            } else {
+                &[num_l0]
+            };
+            for &num in lists {
+                for _ in 0..num {
+                    if r.flag()? {
+                        r.se()?;
+                        r.se()?;
+                    }
+                    if chroma && r.flag()? {
+                        for _ in 0..4 {
+                            r.se()?;
+                        }
+                    }
+                }
+            }
+        }
+        // dec_ref_pic_marking()
+        let mut long_term = false;
+        if nal_ref_idc != 0 {
+            if idr {
+                r.skip(1)?; // no_output_of_prior_pics_flag
+                long_term = r.flag()?;
+            } else if r.flag()? {
+                long_term = true;
+                loop {
+                    match r.ue()? {
+                        0 => break,
+                        3 => {
+                            r.ue()?;
+                            r.ue()?;
+                        }
+                        1 | 2 | 4 | 6 => {
+                            r.ue()?;
+                        }
+                        5 => {}
+                        _ => return None,
+                    }
+                }
+            }
+        }
+        if pps.entropy_coding_mode && slice_type != 2 && slice_type != 4 {
+            r.ue()?; // cabac_init_idc
+        }
+        Some(SliceHeader {
+            picture_type: match slice_type {
+                0 | 3 => PictureType::P,
+                1 => PictureType::B,
+                _ => PictureType::I,
+            },
+            qp: Some(pps.pic_init_qp + r.se()?),
+            pps_id,
+            frame_num,
+            poc_lsb,
+            refs: if p_slice || b_slice { num_l0 } else { 0 },
+            list_modification,
+            long_term,
+            rps: None,
+            size: Some(sps.size()),
+        })
+    }
+
+    fn parse_av1_obu(&mut self, data: &[u8], o: &obu::Obu, info: &mut FrameInfo) {
+        let len = o.len();
+        match o.obu_type {
+            obu::OBU_SEQUENCE_HEADER => {
+                info.parameter_sets.add(len);
+                if let Some(seq) = obu::parse_sequence_header(o.payload(data)) {
+                    self.av1_seq = Some(seq);
+                }
+            }
+            obu::OBU_FRAME_HEADER | obu::OBU_FRAME => {
+                info.slices.add(len);
+                info.temporal_id = o.temporal_id;
+                let seq = match self.av1_seq.as_ref() {
+                    Some(seq) => seq,
+                    None => return,
+                };
+                let hdr = match obu::parse_frame_header(
+                    o.payload(data),
+                    seq,
+                    &mut self.av1_refs,
+                    o.temporal_id,
+                    o.spatial_id,
+                ) {
+                    Some(hdr) => hdr,
+                    None => return,
+                };
+                info.reference |= hdr.refresh_frame_flags != 0;
+                let picture_type = match hdr.frame_type {
+                    obu::FRAME_TYPE_KEY if hdr.show_frame => PictureType::Idr,
+                    obu::FRAME_TYPE_KEY | obu::FRAME_TYPE_INTRA_ONLY => PictureType::I,
+                    _ => PictureType::P,
+                };
+                if picture_type == PictureType::Idr {
+                    info.picture_type = PictureType::Idr;
+                }
+                let header = SliceHeader {
+                    picture_type,
+                    qp: hdr.base_q_idx.map(|q| q as i32),
+                    size: hdr.render_size,
+                    ..Default::default()
+                };
+                Self::add_slice(info, Some(header));
+            }
+            obu::OBU_TILE_GROUP | obu::OBU_REDUNDANT_FRAME_HEADER => info.slices.add(len),
+            obu::OBU_METADATA => info.sei.add(len),
+            _ => info.other.add(len),
+        }
+    }
+
+    fn parse_hevc_nal(&mut self, p: &[u8], len: usize, info: &mut FrameInfo) {
+        if p.len() < 2 {
+            info.other.add(len);
+            return;
+        }
+        let t = nal::nal_type(H265, p[0]);
+        match t {
+            0..=31 => {
+                info.slices.add(len);
+                info.temporal_id = (p[1] & 0x07).saturating_sub(1);
+                // sub-layer non-reference pictures have even types below 16
+                info.reference |= t >= nal::HEVC_NAL_BLA_W_LP || t % 2 == 1;
+                if (nal::HEVC_NAL_BLA_W_LP..=23).contains(&t) {
+                    info.picture_type = PictureType::Idr;
+                }
+                let header = self.parse_hevc_slice(p, t);
+                Self::add_slice(info, header);
+            }
+            nal::HEVC_NAL_VPS => info.parameter_sets.add(len),
+            nal::HEVC_NAL_SPS => {
+                info.parameter_sets.add(len);
+                if let Some(sps) = params::parse_hevc_sps(p) {
+                    self.hevc_sps.insert(sps.id, sps);
+                }
+            }
+            nal::HEVC_NAL_PPS => {
+                info.parameter_sets.add(len);
+                if let Some(pps) = params::parse_hevc_pps(p) {
+                    self.hevc_pps.insert(pps.id, pps);
+                }
+            }
+            nal::HEVC_NAL_SEI_PREFIX | 40 => info.sei.add(len),
+            _ => info.other.add(len),
+        }
+    }
+
+    fn parse_hevc_slice(&self, p: &[u8], t: u8) -> Option<SliceHeader> {
+        let mut r = BitReader::new(p.get(2..)?);
+        let first_slice_segment = r.flag()?;
+        if (nal::HEVC_NAL_BLA_W_LP..=23).contains(&t) {
+            r.skip(1)?; // no_output_of_prior_pics_flag
+        }
+        let pps_id = r.ue()?;
+        let (sps, pps) = self.hevc_params(pps_id)?;
+        if !first_slice_segment {
+            // dependent slice segments carry no slice_qp_delta
+            if pps.dependent_slice_segments && r.flag()? {
+                return None;
+            }
+            r.skip(ceil_log2(sps.ctb_count()))?; // slice_segment_address
+        }
+        r.skip(pps.num_extra_slice_header_bits)?;
+        let slice_type = r.ue()?;
+        let (p_slice, b_slice) = (slice_type == 1, slice_type == 0);
+        if pps.output_flag_present {
+            r.skip(1)?;
+        }
+        if sps.separate_colour_plane {
+            r.skip(2)?;
+        }
+        let mut num_pic_total_curr = 0;
+        let mut num_l0 = 0;
+        let mut list_modification = false;
+        let mut temporal_mvp = false;
+        let mut poc_lsb = None;
+        let mut rps = None;
+        let mut long_term = false;
+        if t != nal::HEVC_NAL_IDR_W_RADL && t != nal::HEVC_NAL_IDR_N_LP {
+            let pos = r.bits_read();
+            poc_lsb = Some((r.u(sps.log2_max_poc_lsb)?, pos));
+            let num_sets = sps.short_term_rps.len() as u32;
+            let st = if !r.flag()? {
+                params::parse_short_term_rps(&mut r, num_sets, num_sets, &sps.short_term_rps)?
+            } else {
+                let idx = r.u(ceil_log2(num_sets))?;
+                sps.short_term_rps.get(idx as usize)?.clone()
+            };
+            num_pic_total_curr += st.used_count();
+            rps = Some(st);
+            if sps.long_term_refs_present {
+                let candidates = sps.long_term_ref_pics_used.len() as u32;
+                let num_lt_sps = if candidates > 0 { r.ue()? } else { 0 };
+                let num_lt_pics = r.ue()?;
+                if num_lt_sps > candidates || num_lt_pics > 32 {
+                    return None;
+                }
+                long_term = num_lt_sps + num_lt_pics > 0;
+                for i in 0..num_lt_sps + num_lt_pics {
+                    if i < num_lt_sps {
+                        let idx = r.u(ceil_log2(candidates))?;
+                        if *sps.long_term_ref_pics_used.get(idx as usize)? {
+                            num_pic_total_curr += 1;
+                        }
+                    } else {
+                        r.skip(sps.log2_max_poc_lsb)?;
+                        if r.flag()? {
+                            num_pic_total_curr += 1;
+                        }
+                    }
+                    if r.flag()? {
+                        r.ue()?; // delta_poc_msb_cycle_lt
+                    }
+                }
+            }
+            if sps.temporal_mvp {
+                temporal_mvp = r.flag()?;
+            }
+        }
+        let chroma = sps.chroma_array_type() != 0;
+        if sps.sample_adaptive_offset {
+            r.skip(if chroma { 2 } else { 1 })?;
+        }
+        if p_slice || b_slice {
+            num_l0 = pps.num_ref_idx_l0_default;
+            let mut num_l1 = pps.num_ref_idx_l1_default;
+            if r.flag()? {
+                num_l0 = r.ue()? + 1;
+                if b_slice {
+                    num_l1 = r.ue()? + 1;
+                }
+            }
+            if num_l0 > 16 || num_l1 > 16 {
+                return None;
+            }
+            if pps.lists_modification_present && num_pic_total_curr > 1 {
+                let bits = ceil_log2(num_pic_total_curr);
+                if r.flag()? {
+                    list_modification = true;
+                    r.skip(bits * num_l0)?;
+                }
+                if b_slice && r.flag()? {
+                    r.skip(bits * num_l1)?;
+                }
+            }
+            if b_slice {
+                r.skip(1)?; // mvd_l1_zero_flag
+            }
+            if pps.cabac_init_present {
+                r.skip(1)?;
+            }
+            if temporal_mvp {
+                let from_l0 = !b_slice || r.flag()?;
+                if from_l0 && num_l0 > 1 || !from_l0 && num_l1 > 1 {
+                    r.ue()?; // collocated_ref_idx
+                }
+            }
+            if pps.weighted_pred && p_slice || pps.weighted_bipred && b_slice {
+                r.ue()?; // luma_log2_weight_denom
+                if chroma {
+                    r.se()?;
+                }
+                let lists: &[u32] = if b_slice {
+                    &[num_l0, num_l1]
+                } else {
+                    &[num_l0]
+                };
+                for &num in lists {
+                    let mut luma = 0u32;
+                    let mut chroma_flags = 0u32;
+                    for i in 0..num {
+                        luma |= (r.flag()? as u32) << i;
+                    }
+                    if chroma {
+                        for i in 0..num {
+                            chroma_flags |= (r.flag()? as u32) << i;
+                        }
+                    }
+                    for i in 0..num {
+                        if luma & (1 << i) != 0 {
+                            r.se()?;
+                            r.se()?;
+                        }
+                        if chroma_flags & (1 << i) != 0 {
+                            for _ in 0..4 {
+                                r.se()?;
+                            }
+                        }
+                    }
+                }
+            }
+            r.ue()?; // five_minus_max_num_merge_cand
+        }
+        Some(SliceHeader {
+            picture_type: match slice_type {
+                0 => PictureType::B,
+                1 => PictureType::P,
+                _ => PictureType::I,
+            },
+            qp: Some(pps.init_qp + r.se()?),
+            pps_id,
+            frame_num: None,
+            poc_lsb,
+            refs: num_l0,
+            list_modification,
+            long_term,
+            rps,
+            size: Some(sps.size()),
+        })
+    }
+}
+
+fn ceil_log2(v: u32) -> u32 {
+    if v <= 1 {
+        0
+    } else {
+        32 - (v - 1).leading_zeros()
+    }
+}
@@ -0,0 +1,662 @@
+//! Objective quality of a distorted frame against its reference: PSNR and
+//! SSIM per plane, MS-SSIM on request.
+//!
+//! SSIM follows x264: sums over 4x4 blocks, combined into 8x8 windows on a
+//! 4 pixel grid. Subsampling measures every n-th row of windows and of 4
+//! pixel rows only, cheap enough to run on live sessions.
+
+use crate::convert::{band_threads, run_bands, Simd, YuvSource};
+use std::time::{Duration, Instant};
+
+/// What a PSNR of an exact copy is reported as.
+pub const MAX_PSNR: f64 = 100.0;
+const MS_SSIM_WEIGHTS: [f64; 5] = [0.0448, 0.2856, 0.3001, 0.2363, 0.1333];
+
+#[derive(Clone, Copy)]
+pub enum Frame<'a> {
+    Yuv(YuvSource<'a>),
+    /// Measured on the B, G and R channels.
+    Bgra {
+        data: &'a [u8],
+        stride: usize,
+    },
+}
+
+#[derive(Debug, Clone, Copy, Default, PartialEq)]
+pub struct PlaneQuality {
+    pub psnr: f64,
+    /// 1 for planes smaller than one 8x8 window.
+    pub ssim: f64,
+    pub ms_ssim: Option<f64>,
+    /// Sum of squared differences over `samples` samples.
+    pub sse: u64,
+    pub samples: u64,
+}
+
+/// Planes in Y, U, V or B, G, R order.
+#[derive(Debug, Clone, Copy, Default, PartialEq)]
+pub struct Quality {
+    pub planes: [PlaneQuality; 3],
+}
+
+impl Quality {
+    /// PSNR over the samples of all planes.
+    pub fn psnr(&self) -> f64 {
+        psnr(
+            self.planes.iter().map(|p| p.sse).sum(),
+            self.planes.iter().map(|p| p.samples).sum(),
+        )
+    }
+}
+
+fn psnr(sse: u64, samples: u64) -> f64 {
+    if sse == 0 {
+        return MAX_PSNR;
+    }
+    (10.0 * (255.0 * 255.0 * samples as f64 / sse as f64).log10()).min(MAX_PSNR)
+}
+
+/// Tells when the next frame of a session should be measured, for sampling
+/// production streams at a fixed interval.
+pub struct Sampler {
+    interval: Duration,
+    last: Option<Instant>,
+}
+
+impl Sampler {
+    pub fn new(interval: Duration) -> Self {
+        Self {
+            interval,
+            last: None,
+        }
+    }
+
+    pub fn due(&mut self) -> bool {
+        let now = Instant::now();
+        if self
+            .last
+            .map_or(true, |t| now.duration_since(t) >= self.interval)
+        {
+            self.last = Some(now);
+            return true;
+        }
+        false
+    }
+}
+
+/// One channel of a frame, `step` bytes apart from `offset` in each row.
+#[derive(Clone, Copy)]
+struct Plane<'a> {
+    data: &'a [u8],
+    stride: usize,
+    offset: usize,
+    step: usize,
+}
+
+impl<'a> Plane<'a> {
+    fn fits(&self, width: usize, height: usize) -> bool {
+        self.stride >= self.step * width
+            && self.data.len()
+                >= self.stride * (height - 1) + self.offset + self.step * (width - 1) + 1
+    }
+
+    /// Row `r`, gathered into `buf` if the channel is interleaved.
+    fn row<'b>(&self, r: usize, width: usize, buf: &'b mut Vec<u8>) -> &'b [u8]
+    where
+        'a: 'b,
+    {
+        let start = r * self.stride + self.offset;
+        if self.step == 1 {
+            return &self.data[start..][..width];
+        }
+        buf.clear();
+        buf.extend(self.data[start..].iter().step_by(self.step).take(width));
+        buf
+    }
+}
+
+/// The planes of `f` with their sizes.
+fn planes(f: Frame, width: usize, height: usize) -> [(Plane, usize, usize); 3] {
+    let (cw, ch) = ((width + 1) / 2, (height + 1) / 2);
+    let p = |data, stride, offset, step| Plane {
+        data,
+        stride,
+        offset,
+        step,
+    };
+    match f {
+        Frame::Yuv(YuvSource::Nv12 {
+            y,
+            y_stride,
+            uv,
+            uv_stride,
+        }) => [
+            (p(y, y_stride, 0, 1), width, height),
+            (p(uv, uv_stride, 0, 2), cw, ch),
+            (p(uv, uv_stride, 1, 2), cw, ch),
+        ],
+        Frame::Yuv(YuvSource::I420 {
+            y,
+            y_stride,
+            u,
+            u_stride,
+            v,
+            v_stride,
+        }) => [
+            (p(y, y_stride, 0, 1), width, height),
+            (p(u, u_stride, 0, 1), cw, ch),
+            (p(v, v_stride, 0, 1), cw, ch),
+        ],
+        Frame::Bgra { data, stride } => [
+            (p(data, stride, 0, 4), width, height),
+            (p(data, stride, 1, 4), width, height),
+            (p(data, stride, 2, 4), width, height),
+        ],
+    }
+}
+
+fn sse_scalar(a: &[u8], b: &[u8], from: usize) -> u64 {
+    a.iter()
+        .zip(b)
+        .skip(from)
+        .map(|(&x, &y)| (x as i32 - y as i32).pow(2) as u64)
+        .sum()
+}
+
+/// Sum of a, sum of b, sum of a² + b² and sum of ab over each 4x4 block of
+/// the four rows, from block `from` on.
+fn blocks_scalar(a: [&[u8]; 4], b: [&[u8]; 4], out: &mut [[u32; 4]], from: usize) {
+    for (g, o) in out.iter_mut().enumerate().skip(from) {
+        *o = [0; 4];
+        for r in 0..4 {
+            for i in 4 * g..4 * g + 4 {
+                let (x, y) = (a[r][i] as u32, b[r][i] as u32);
+                o[0] += x;
+                o[1] += y;
+                o[2] += x * x + y * y;
+                o[3] += x * y;
+            }
+        }
+    }
+}
+
+#[cfg(target_arch = "x86_64")]
+mod x86 {
+    use std::arch::x86_64::*;
+
+    /// Iterations after which the 32 bit lanes of the SSE sums could
+    /// overflow.
+    const FLUSH: usize = 4096;
+
+    #[target_feature(enable = "sse4.1")]
+    pub unsafe fn sse_sse41(a: &[u8], b: &[u8]) -> (u64, usize) {
+        let n = a.len().min(b.len()) / 16 * 16;
+        let zero = _mm_setzero_si128();
+        let mut total = 0;
+        for chunk in (0..n).step_by(16 * FLUSH) {
+            let mut acc = zero;
+            for i in (chunk..n.min(chunk + 16 * FLUSH)).step_by(16) {
+                let x = _mm_loadu_si128(a.as_ptr().add(i) as *const __m128i);
+                let y = _mm_loadu_si128(b.as_ptr().add(i) as *const __m128i);
+                let lo = _mm_sub_epi16(_mm_unpacklo_epi8(x, zero), _mm_unpacklo_epi8(y, zero));
+                let hi = _mm_sub_epi16(_mm_unpackhi_epi8(x, zero), _mm_unpackhi_epi8(y, zero));
+                acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, lo));
+                acc = _mm_add_epi32(acc, _mm_madd_epi16(hi, hi));
+            }
+            let mut lanes = [0u32; 4];
+            _mm_storeu_si128(lanes.as_mut_ptr() as *mut __m128i, acc);
+            total += lanes.iter().map(|&l| l as u64).sum::<u64>();
+        }
+        (total, n)
+    }
+
+    #[target_feature(enable = "sse4.1")]
+    pub unsafe fn blocks_sse41(a: [&[u8]; 4], b: [&[u8]; 4], out: &mut [[u32; 4]]) -> usize {
+        let n = out.len() / 2 * 2;
+        let one = _mm_set1_epi16(1);
+        for g in (0..n).step_by(2) {
+            let (mut sums, mut products) = (_mm_setzero_si128(), _mm_setzero_si128());
+            for r in 0..4 {
+                let x =
+                    _mm_cvtepu8_epi16(_mm_loadl_epi64(a[r].as_ptr().add(4 * g) as *const __m128i));
+                let y =
+                    _mm_cvtepu8_epi16(_mm_loadl_epi64(b[r].as_ptr().add(4 * g) as *const __m128i));
+                let (sx, sy) = (_mm_madd_epi16(x, one), _mm_madd_epi16(y, one));
+                let ss = _mm_add_epi32(_mm_madd_epi16(x, x), _mm_madd_epi16(y, y));
+                // [a0, a1, b0, b1] for blocks 0 and 1
+                sums = _mm_add_epi32(sums, _mm_hadd_epi32(sx, sy));
+                products = _mm_add_epi32(products, _mm_hadd_epi32(ss, _mm_madd_epi16(x, y)));
+            }
+            let (mut s, mut p) = ([0u32; 4], [0u32; 4]);
+            _mm_storeu_si128(s.as_mut_ptr() as *mut __m128i, sums);
+            _mm_storeu_si128(p.as_mut_ptr() as *mut __m128i, products);
+            for j in 0..2 {
+                out[g + j] = [s[j], s[2 + j], p[j], p[2 + j]];
+            }
+        }
+        n
+    }
+
+    #[target_feature(enable = "avx2")]
+    pub unsafe fn sse_avx2(a: &[u8], b: &[u8]) -> (u64, usize) {
+        let n = a.len().min(b.len()) / 32 * 32;
+        let zero = _mm256_setzero_si256();
+        let mut total = 0;
+        for chunk in (0..n).step_by(32 * FLUSH) {
+            let mut acc = zero;
+            for i in (chunk..n.min(chunk + 32 * FLUSH)).step_by(32) {
+                let x = _mm256_loadu_si256(a.as_ptr().add(i) as *const __m256i);
+                let y = _mm256_loadu_si256(b.as_ptr().add(i) as *const __m256i);
+                let lo =
+                    _mm256_sub_epi16(_mm256_unpacklo_epi8(x, zero), _mm256_unpacklo_epi8(y, zero));
+                let hi =
+                    _mm256_sub_epi16(_mm256_unpackhi_epi8(x, zero), _mm256_unpackhi_epi8(y, zero));
+                acc = _mm256_add_epi32(acc, _mm256_madd_epi16(lo, lo));
+                acc = _mm256_add_epi32(acc, _mm256_madd_epi16(hi, hi));
+            }
+            let mut lanes = [0u32; 8];
+            _mm256_storeu_si256(lanes.as_mut_ptr() as *mut __m256i, acc);
+            total += lanes.iter().map(|&l| l as u64).sum::<u64>();
+        }
+        (total, n)
+    }
+
+    #[target_feature(enable = "avx2")]
+    pub unsafe fn blocks_avx2(a: [&[u8]; 4], b: [&[u8]; 4], out: &mut [[u32; 4]]) -> usize {
+        let n = out.len() / 4 * 4;
+        let one = _mm256_set1_epi16(1);
+        for g in (0..n).step_by(4) {
+            let (mut sums, mut products) = (_mm256_setzero_si256(), _mm256_setzero_si256());
+            for r in 0..4 {
+                let x = _mm256_cvtepu8_epi16(_mm_loadu_si128(
+                    a[r].as_ptr().add(4 * g) as *const __m128i
+                ));
+                let y = _mm256_cvtepu8_epi16(_mm_loadu_si128(
+                    b[r].as_ptr().add(4 * g) as *const __m128i
+                ));
+                let (sx, sy) = (_mm256_madd_epi16(x, one), _mm256_madd_epi16(y, one));
+                let ss = _mm256_add_epi32(_mm256_madd_epi16(x, x), _mm256_madd_epi16(y, y));
+                // [a0, a1, b0, b1 | a2, a3, b2, b3]
+                sums = _mm256_add_epi32(sums, _mm256_hadd_epi32(sx, sy));
+                products =
+                    _mm256_add_epi32(products, _mm256_hadd_epi32(ss, _mm256_madd_epi16(x, y)));
+            }
+            let (mut s, mut p) = ([0u32; 8], [0u32; 8]);
+            _mm256_storeu_si256(s.as_mut_ptr() as *mut __m256i, sums);
+            _mm256_storeu_si256(p.as_mut_ptr() as *mut __m256i, products);
+            for j in 0..4 {
+                let l = j / 2 * 4 + j % 2;
+                out[g + j] = [s[l], s[l + 2], p[l], p[l + 2]];
+            }
+        }
+        n
+    }
+}
+
+#[cfg(target_arch = "aarch64")]
+mod arm {
+    use std::arch::aarch64::*;
+
+    const FLUSH: usize = 4096;
+
+    #[target_feature(enable = "neon")]
+    pub unsafe fn sse_neon(a: &[u8], b: &[u8]) -> (u64, usize) {
+        let n = a.len().min(b.len()) / 16 * 16;
+        let mut total = 0;
+        for chunk in (0..n).step_by(16 * FLUSH) {
+            let mut acc = vdupq_n_u32(0);
+            for i in (chunk..n.min(chunk + 16 * FLUSH)).step_by(16) {
+                let d = vabdq_u8(vld1q_u8(a.as_ptr().add(i)), vld1q_u8(b.as_ptr().add(i)));
+                acc = vpadalq_u16(acc, vmull_u8(vget_low_u8(d), vget_low_u8(d)));
+                acc = vpadalq_u16(acc, vmull_u8(vget_high_u8(d), vget_high_u8(d)));
+            }
+            total += vaddlvq_u32(acc);
+        }
+        (total, n)
+    }
+
+    /// Per 4 byte group sums of the products of `x` and `y`.
+    #[inline(always)]
+    unsafe fn dot4(x: uint8x16_t, y: uint8x16_t) -> uint32x4_t {
+        let lo = vpaddlq_u16(vmull_u8(vget_low_u8(x), vget_low_u8(y)));
+        let hi = vpaddlq_u16(vmull_u8(vget_high_u8(x), vget_high_u8(y)));
+        vpaddq_u32(lo, hi)
+    }
+
+    #[target_feature(enable = "neon")]
+    pub unsafe fn blocks_neon(a: [&[u8]; 4], b: [&[u8]; 4], out: &mut [[u32; 4]]) -> usize {
+        let n = out.len() / 4 * 4;
+        for g in (0..n).step_by(4) {
+            let mut acc = [vdupq_n_u32(0); 4];
+            for r in 0..4 {
+                let x = vld1q_u8(a[r].as_ptr().add(4 * g));
+                let y = vld1q_u8(b[r].as_ptr().add(4 * g));
+                acc[0] = vaddq_u32(acc[0], vpaddlq_u16(vpaddlq_u8(x)));
+                acc[1] = vaddq_u32(acc[1], vpaddlq_u16(vpaddlq_u8(y)));
+                acc[2] = vaddq_u32(acc[2], vaddq_u32(dot4(x, x), dot4(y, y)));
+                acc[3] = vaddq_u32(acc[3], dot4(x, y));
+            }
+            let mut t = [[0u32; 4]; 4];
+            for k in 0..4 {
+                vst1q_u32(t[k].as_mut_ptr(), acc[k]);
+            }
+            for j in 0..4 {
+                out[g + j] = [t[0][j], t[1][j], t[2][j], t[3][j]];
+            }
+        }
+        n
+    }
+}
+
+/// SSIM and its contrast-structure term of an 8x8 window from its sums.
+fn window(s: [u32; 4]) -> (f64, f64) {
+    const C1: f64 = 0.01 * 0.01 * 255.0 * 255.0 * 64.0;
+    const C2: f64 = 0.03 * 0.03 * 255.0 * 255.0 * 64.0 * 63.0;
+    let [s1, s2, ss, s12] = s.map(|v| v as f64);
+    let vars = ss * 64.0 - s1 * s1 - s2 * s2;
+    let covar = s12 * 64.0 - s1 * s2;
+    let cs = (2.0 * covar + C2) / (vars + C2);
+    (cs * (2.0 * s1 * s2 + C1) / (s1 * s1 + s2 * s2 + C1), cs)
+}
+
+#[derive(Debug, Clone, Copy, Default)]
+struct Sums {
+    sse: u64,
+    samples: u64,
+    ssim: f64,
+    cs: f64,
+    windows: u64,
+}
+
+pub struct QualityMeter {
+    simd: Simd,
+    threads: usize,
+    subsample: usize,
+    ms_ssim: bool,
+}
+
+impl Default for QualityMeter {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl QualityMeter {
+    pub fn new() -> Self {
+        Self {
+            simd: Simd::detect(),
+            threads: 0,
+            subsample: 1,
+            ms_ssim: false,
+        }
+    }
+
+    /// Uses `simd` instead of the detected instruction set, if supported.
+    pub fn with_simd(mut self, simd: Simd) -> Self {
+        if simd.supported() {
+            self.simd = simd;
+        }
+        self
+    }
+
+    /// Measures in `threads` bands, 0 picks the number of CPUs for frames
+    /// above 4K and 1 below.
+    pub fn with_threads(mut self, threads: usize) -> Self {
+        self.threads = threads;
+        self
+    }
+
+    /// Measures every `n`-th row of windows only.
+    pub fn with_subsample(mut self, n: usize) -> Self {
+        self.subsample = n.max(1);
+        self
+    }
+
+    /// Also computes MS-SSIM, over the whole frame regardless of
+    /// subsampling.
+    pub fn with_ms_ssim(mut self, enable: bool) -> Self {
+        self.ms_ssim = enable;
+        self
+    }
+
+    pub fn simd(&self) -> Simd {
+        self.simd
+    }
+
+    fn sse(&self, a: &[u8], b: &[u8]) -> u64 {
+        let (sum, done) = unsafe {
+            match self.simd {
+                #[cfg(target_arch = "x86_64")]
+                Simd::Avx2 => x86::sse_avx2(a, b),
+                #[cfg(target_arch = "x86_64")]
+                Simd::Sse41 => x86::sse_sse41(a, b),
+                #[cfg(target_arch = "aarch64")]
+                Simd::Neon => arm::sse_neon(a, b),
+                _ => (0, 0),
+            }
+        };
+        sum + sse_scalar(a, b, done)
+    }
+
+    fn blocks(&self, a: [&[u8]; 4], b: [&[u8]; 4], out: &mut [[u32; 4]]) {
+        let done = unsafe {
+            match self.simd {
+                #[cfg(target_arch = "x86_64")]
+                Simd::Avx2 => x86::blocks_avx2(a, b, out),
+                #[cfg(target_arch = "x86_64")]
+                Simd::Sse41 => x86::blocks_sse41(a, b, out),
+                #[cfg(target_arch = "aarch64")]
+                Simd::Neon => arm::blocks_neon(a, b, out),
+                _ => 0,
+            }
+        };
+        blocks_scalar(a, b, out, done);
+    }
+
+    /// Block sums of block row `br`.
+    fn block_row(
+        &self,
+        a: Plane,
+        b: Plane,
+        br: usize,
+        width: usize,
+        bufs: &mut [Vec<u8>; 8],
+        out: &mut [[u32; 4]],
+    ) {
+        let [a0, a1, a2, a3, b0, b1, b2, b3] = bufs;
+        let r = 4 * br;
+        let ra = [
+            a.row(r, width, a0),
+            a.row(r + 1, width, a1),
+            a.row(r + 2, width, a2),
+            a.row(r + 3, width, a3),
+        ];
+        let rb = [
+            b.row(r, width, b0),
+            b.row(r + 1, width, b1),
+            b.row(r + 2, width, b2),
+            b.row(r + 3, width, b3),
+        ];
+        self.blocks(ra, rb, out);
+    }
+
+    fn plane(&self, a: Plane, b: Plane, width: usize, height: usize, every: usize) -> Sums {
+        let (bw, bh) = (width / 4, height / 4);
+        let block_rows = (height + 3) / 4;
+        let threads = band_threads(self.threads, width, height).min(block_rows);
+        let band = (block_rows + threads - 1) / threads;
+        let mut sums = vec![Sums::default(); threads];
+        run_bands(threads, sums.iter_mut().enumerate(), |(i, s)| {
+            let (b0, b1) = (i * band, ((i + 1) * band).min(block_rows));
+            let mut bufs: [Vec<u8>; 8] = Default::default();
+            let (mut ba, mut bb) = (vec![], vec![]);
+            for r in 4 * b0..(4 * b1).min(height) {
+                if (r / 4) % every == 0 {
+                    s.sse += self.sse(a.row(r, width, &mut ba), b.row(r, width, &mut bb));
+                    s.samples += width as u64;
+                }
+            }
+            let (mut top, mut bottom) = (vec![[0; 4]; bw], vec![[0; 4]; bw]);
+            let mut cached = None;
+            // windows span two blocks each way, narrower planes get PSNR only
+            let window_rows = if bw < 2 { 0 } else { bh.saturating_sub(1) };
+            for wr in (b0..b1.min(window_rows)).filter(|wr| wr % every == 0) {
+                if cached == Some(wr) {
+                    std::mem::swap(&mut top, &mut bottom);
+                } else {
+                    self.block_row(a, b, wr, width, &mut bufs, &mut top);
+                }
+                self.block_row(a, b, wr + 1, width, &mut bufs, &mut bottom);
+                cached = Some(wr + 1);
+                for c in 0..bw - 1 {
+                    let w = [top[c], top[c + 1], bottom[c], bottom[c + 1]];
+                    let (ssim, cs) = window(std::array::from_fn(|k| w.iter().map(|v| v[k]).sum()));
+                    s.ssim += ssim;
+                    s.cs += cs;
+                    s.windows += 1;
+                }
+            }
+        });
+        sums.iter().fold(Sums::default(), |t, s| Sums {
+            sse: t.sse + s.sse,
+            samples: t.samples + s.samples,
+            ssim: t.ssim + s.ssim,
+            cs: t.cs + s.cs,
+            windows: t.windows + s.windows,
+        })
+    }
+
+    fn ms_ssim(&self, a: Plane, b: Plane, mut width: usize, mut height: usize) -> Option<f64> {
+        let copy = |p: Plane| {
+            let mut buf = vec![];
+            (0..height)
+                .flat_map(|r| p.row(r, width, &mut buf).to_vec())
+                .collect::<Vec<u8>>()
+        };
+        let (mut pa, mut pb) = (copy(a), copy(b));
+        let mut terms = vec![];
+        for _ in 0..MS_SSIM_WEIGHTS.len() {
+            let plane = |data| Plane {
+                data,
+                stride: width,
+                offset: 0,
+                step: 1,
+            };
+            let s = self.plane(plane(&pa), plane(&pb), width, height, 1);
+            if s.windows == 0 {
+                break;
+            }
+            terms.push((s.ssim / s.windows as f64, s.cs / s.windows as f64));
+            let half = |p: &[u8]| -> Vec<u8> {
+                (0..height / 2)
+                    .flat_map(|r| {
+                        (0..width / 2).map(move |c| {
+                            let i = 2 * r * width + 2 * c;
+                            ((p[i] as u32
+                                + p[i + 1] as u32
+                                + p[i + width] as u32
+                                + p[i + width + 1] as u32
+                                + 2)
+                                / 4) as u8
+                        })
+                    })
+                    .collect()
+            };
+            (pa, pb) = (half(&pa), half(&pb));
+            (width, height) = (width / 2, height / 2);
+        }
+        let total: f64 = MS_SSIM_WEIGHTS[..terms.len()].iter().sum();
+        let last = terms.len().checked_sub(1)?;
+        Some(
+            terms
+                .iter()
+                .zip(MS_SSIM_WEIGHTS)
+                .enumerate()
+                .map(|(i, (&(ssim, cs), w))| {
+                    let v = if i == last { ssim } else { cs };
+                    v.max(0.0).powf(w / total)
+                })
+                .product(),
+        )
+    }
+
+    /// Measures `distorted` against `reference`, both `width` x `height`.
+    /// YUV frames may mix NV12 and I420.
+    pub fn measure(
+        &self,
+        reference: Frame,
+        distorted: Frame,
+        width: usize,
+        height: usize,
+    ) -> Result<Quality, ()> {
+        if width == 0
+            || height == 0
+            || matches!(reference, Frame::Yuv(_)) != matches!(distorted, Frame::Yuv(_))
+        {
+            return Err(());
+        }
+        let (pa, pb) = (
+            planes(reference, width, height),
+            planes(distorted, width, height),
+        );
+        if pa.iter().chain(&pb).any(|(p, w, h)| !p.fits(*w, *h)) {
+            return Err(());
+        }
+        let mut q = Quality::default();
+        for ((&(a, w, h), &(b, ..)), out) in pa.iter().zip(&pb).zip(&mut q.planes) {
+            let s = self.plane(a, b, w, h, self.subsample);
+            *out = PlaneQuality {
+                psnr: psnr(s.sse, s.samples),
+                ssim: if s.windows > 0 {
+                    s.ssim / s.windows as f64
+                } else {
+                    1.0
+                },
+                ms_ssim: if self.ms_ssim {
+                    self.ms_ssim(a, b, w, h)
+                } else {
+                    None
+                },
+                sse: s.sse,
+                samples: s.samples,
+            };
+        }
+        Ok(q)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn narrow_planes_measure_psnr_only() {
+        for (width, height) in [(2, 40), (3, 16), (6, 16), (7, 7), (8, 8)] {
+            let a = vec![100u8; width * height * 4];
+            let mut b = a.clone();
+            b[0] = 110;
+            let bgra = |data| Frame::Bgra {
+                data,
+                stride: width * 4,
+            };
+            let nv12 = |data| {
+                Frame::Yuv(YuvSource::Nv12 {
+                    y: data,
+                    y_stride: width,
+                    uv: &data[width * height..],
+                    uv_stride: 2 * ((width + 1) / 2),
+                })
+            };
+            let meter = QualityMeter::new().with_ms_ssim(true);
+            for q in [
+                meter.measure(bgra(&a), bgra(&b), width, height).unwrap(),
+                meter.measure(nv12(&a), nv12(&b), width, height).unwrap(),
+            ] {
+                assert!(q.planes[0].psnr < MAX_PSNR);
+                assert_eq!(q.planes[1].psnr, MAX_PSNR);
+                let windows = width >= 8 && height >= 8;
+                assert_eq!(q.planes[0].ssim < 1.0, windows, "{}x{}", width, height);
+            }
+        }
+    }
+}
@@ -0,0 +1,594 @@
+//! CPU resizing of packed BGRA frames and YUV planes, used to encode at
+//! another size than captured.
+//!
+//! Separable polyphase filtering, vertical pass first. Both passes use
+//! 14-bit fixed point weights with rounding, and the SIMD paths compute
+//! exactly the scalar result.
+
+use crate::convert::{band_threads, run_bands, Simd, YuvPlanes, YuvSource};
+use std::{
+    collections::HashMap,
+    f64::consts::PI,
+    sync::{Arc, Mutex},
+};
+
+const SHIFT: u32 = 14;
+const ONE: i32 = 1 << SHIFT;
+const ROUND: i32 = 1 << (SHIFT - 1);
+/// Zeroed bytes after the vertical pass output, read by the horizontal
+/// pass with weight 0.
+const SLACK: usize = 16;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum ScaleFilter {
+    Bilinear,
+    /// Mean of the covered source area; an exact 2:1 reduction takes a
+    /// dedicated path.
+    Area,
+    Lanczos3,
+}
+
+impl ScaleFilter {
+    fn support(self) -> f64 {
+        match self {
+            ScaleFilter::Bilinear => 1.0,
+            ScaleFilter::Area => 0.5,
+            ScaleFilter::Lanczos3 => 3.0,
+        }
+    }
+
+    fn weight(self, x: f64) -> f64 {
+        let x = x.abs();
+        match self {
+            ScaleFilter::Bilinear => (1.0 - x).max(0.0),
+            ScaleFilter::Area => unreachable!(),
+            ScaleFilter::Lanczos3 if x < 1e-9 => 1.0,
+            ScaleFilter::Lanczos3 if x < 3.0 => {
+                let px = PI * x;
+                3.0 * px.sin() * (px / 3.0).sin() / (px * px)
+            }
+            ScaleFilter::Lanczos3 => 0.0,
+        }
+    }
+}
+
+/// Weights of every destination position along one axis, `len` of them
+/// from source index `starts[i]`, all windows within the source.
+#[derive(Debug)]
+struct Taps {
+    starts: Vec<usize>,
+    len: usize,
+    weights: Vec<i16>,
+    /// Horizontal weights for `bpp` byte pixels in groups of 8 source
+    /// bytes, `groups` per destination, each weight next to the one of the
+    /// same channel in the following pixel: as laid out by `group_mask`.
+    lanes: Vec<[i16; 8]>,
+    groups: usize,
+}
+
+impl Taps {
+    fn new(filter: ScaleFilter, src: usize, dst: usize, bpp: usize) -> Self {
+        let scale = src as f64 / dst as f64;
+        let fscale = scale.max(1.0);
+        let support = filter.support() * fscale;
+        let mut windows = Vec::with_capacity(dst);
+        for i in 0..dst {
+            let center = (i as f64 + 0.5) * scale;
+            let lo = ((center - support).floor().max(0.0) as usize).min(src - 1);
+            let hi = ((center + support).ceil() as usize).clamp(lo + 1, src);
+            let mut w: Vec<f64> = (lo..hi)
+                .map(|j| match filter {
+                    ScaleFilter::Area => {
+                        let (a, b) = (center - fscale / 2.0, center + fscale / 2.0);
+                        (b.min(j as f64 + 1.0) - a.max(j as f64)).max(0.0)
+                    }
+                    _ => filter.weight((j as f64 + 0.5 - center) / fscale),
+                })
+                .collect();
+            let sum: f64 = w.iter().sum();
+            if sum.abs() < 1e-9 {
+                w.iter_mut().for_each(|x| *x = 0.0);
+                let nearest = ((center as usize).clamp(lo, hi - 1)) - lo;
+                w[nearest] = 1.0;
+            } else {
+                w.iter_mut().for_each(|x| *x /= sum);
+            }
+            let mut q: Vec<i32> = w.iter().map(|x| (x * ONE as f64).round() as i32).collect();
+            // the largest weight takes the rounding error so each sums to 1
+            let error = ONE - q.iter().sum::<i32>();
+            let largest = (0..q.len()).max_by_key(|&k| q[k]).unwrap_or(0);
+            q[largest] += error;
+            let (mut first, mut last) = (0, q.len());
+            while last - first > 1 && q[first] == 0 {
+                first += 1;
+            }
+            while last - first > 1 && q[last - 1] == 0 {
+                last -= 1;
+            }
+            windows.push((lo + first, q[first..last].to_vec()));
+        }
+        let len = windows.iter().map(|w| w.1.len()).max().unwrap_or(1);
+        let mut starts = Vec::with_capacity(dst);
+        let mut weights = vec![0i16; dst * len];
+        for (i, (start, w)) in windows.iter().enumerate() {
+            // shifted left at the far edge so that `len` taps fit
+            let s = (*start).min(src - len);
+            starts.push(s);
+            for (k, &x) in w.iter().enumerate() {
+                weights[i * len + start - s + k] = x as i16;
+            }
+        }
+        let per_group = 8 / bpp;
+        let groups = (len + per_group - 1) / per_group;
+        let mut lanes = vec![[0i16; 8]; dst * groups];
+        for i in 0..dst {
+            for g in 0..groups {
+                for (j, lane) in lanes[i * groups + g].iter_mut().enumerate() {
+                    let k = g * per_group + group_lane(bpp, j).0;
+                    if k < len {
+                        *lane = weights[i * len + k];
+                    }
+                }
+            }
+        }
+        Self {
+            starts,
+            len,
+            weights,
+            lanes,
+            groups,
+        }
+    }
+}
+
+/// Pixel and channel of word `j` when 8 bytes of `bpp` byte pixels are
+/// widened so that each channel sits next to its value in the next pixel.
+fn group_lane(bpp: usize, j: usize) -> (usize, usize) {
+    match bpp {
+        4 => (j % 2, j / 2),
+        2 => (j / 4 * 2 + j % 2, j % 4 / 2),
+        _ => (j, 0),
+    }
+}
+
+fn clamp(x: i32) -> u8 {
+    x.clamp(0, 255) as u8
+}
+
+fn vertical_scalar(rows: &[&[u8]], weights: &[i16], dst: &mut [u8], from: usize) {
+    for (x, d) in dst.iter_mut().enumerate().skip(from) {
+        let sum: i32 = rows
+            .iter()
+            .zip(weights)
+            .map(|(r, &w)| r[x] as i32 * w as i32)
+            .sum();
+        *d = clamp((sum + ROUND) >> SHIFT);
+    }
+}
+
+fn horizontal_scalar(taps: &Taps, bpp: usize, src: &[u8], dst: &mut [u8]) {
+    for (i, d) in dst.chunks_exact_mut(bpp).enumerate() {
+        let w = &taps.weights[i * taps.len..][..taps.len];
+        let s = &src[taps.starts[i] * bpp..];
+        for (c, d) in d.iter_mut().enumerate() {
+            let sum: i32 = w
+                .iter()
+                .enumerate()
+                .map(|(k, &w)| s[k * bpp + c] as i32 * w as i32)
+                .sum();
+            *d = clamp((sum + ROUND) >> SHIFT);
+        }
+    }
+}
+
+fn box2_scalar(s0: &[u8], s1: &[u8], bpp: usize, dst: &mut [u8], from: usize) {
+    for o in from..dst.len() {
+        let x = o / bpp * 2 * bpp + o % bpp;
+        let sum = s0[x] as u32 + s0[x + bpp] as u32 + s1[x] as u32 + s1[x + bpp] as u32;
+        dst[o] = ((sum + 2) >> 2) as u8;
+    }
+}
+
+#[cfg(target_arch = "x86_64")]
+mod x86 {
+    use super::{ROUND, SHIFT};
+    use std::arch::x86_64::*;
+
+    #[target_feature(enable = "sse4.1")]
+    pub unsafe fn vertical_sse41(rows: &[&[u8]], weights: &[i16], dst: &mut [u8]) -> usize {
+        let n = dst.len() / 16 * 16;
+        let zero = _mm_setzero_si128();
+        for x in (0..n).step_by(16) {
+            let mut acc = [_mm_set1_epi32(ROUND); 4];
+            for k in (0..rows.len()).step_by(2) {
+                let (b, wb) = match rows.get(k + 1) {
+                    Some(r) => (*r, weights[k + 1]),
+                    None => (rows[k], 0),
+                };
+                let w = _mm_set1_epi32(weights[k] as u16 as i32 | (wb as i32) << 16);
+                let a = _mm_loadu_si128(rows[k].as_ptr().add(x) as *const __m128i);
+                let b = _mm_loadu_si128(b.as_ptr().add(x) as *const __m128i);
+                let (a0, a1) = (_mm_unpacklo_epi8(a, zero), _mm_unpackhi_epi8(a, zero));
+                let (b0, b1) = (_mm_unpacklo_epi8(b, zero), _mm_unpackhi_epi8(b, zero));
+                let p = [
+                    _mm_unpacklo_epi16(a0, b0),
+                    _mm_unpackhi_epi16(a0, b0),
+                    _mm_unpacklo_epi16(a1, b1),
+                    _mm_unpackhi_epi16(a1, b1),
+                ];
+                for (acc, p) in acc.iter_mut().zip(p) {
+                    *acc = _mm_add_epi32(*acc, _mm_madd_epi16(p, w));
+                }
+            }
+            let r = acc.map(|a| _mm_srai_epi32::<{ SHIFT as i32 }>(a));
+            let lo = _mm_packs_epi32(r[0], r[1]);
+            let hi = _mm_packs_epi32(r[2], r[3]);
+            _mm_storeu_si128(
+                dst.as_mut_ptr().add(x) as *mut __m128i,
+                _mm_packus_epi16(lo, hi),
+            );
+        }
+        n
+    }
+
+    #[target_feature(enable = "avx2")]
+    pub unsafe fn vertical_avx2(rows: &[&[u8]], weights: &[i16], dst: &mut [u8]) -> usize {
+        let n = dst.len() / 32 * 32;
+        let zero = _mm256_setzero_si256();
+        for x in (0..n).step_by(32) {
+            let mut acc = [_mm256_set1_epi32(ROUND); 4];
+            for k in (0..rows.len()).step_by(2) {
+                let (b, wb) = match rows.get(k + 1) {
+                    Some(r) => (*r, weights[k + 1]),
+                    None => (rows[k], 0),
+                };
+                let w = _mm256_set1_epi32(weights[k] as u16 as i32 | (wb as i32) << 16);
+                let a = _mm256_loadu_si256(rows[k].as_ptr().add(x) as *const __m256i);
+                let b = _mm256_loadu_si256(b.as_ptr().add(x) as *const __m256i);
+                let (a0, a1) = (_mm256_unpacklo_epi8(a, zero), _mm256_unpackhi_epi8(a, zero));
+                let (b0, b1) = (_mm256_unpacklo_epi8(b, zero), _mm256_unpackhi_epi8(b, zero));
+                let p = [
+                    _mm256_unpacklo_epi16(a0, b0),
+                    _mm256_unpackhi_epi16(a0, b0),
+                    _mm256_unpacklo_epi16(a1, b1),
+                    _mm256_unpackhi_epi16(a1, b1),
+                ];
+                for (acc, p) in acc.iter_mut().zip(p) {
+                    *acc = _mm256_add_epi32(*acc, _mm256_madd_epi16(p, w));
+                }
+            }
+            let r = acc.map(|a| _mm256_srai_epi32::<{ SHIFT as i32 }>(a));
+            // in-lane packing undoes the in-lane unpacking
+            let lo = _mm256_packs_epi32(r[0], r[1]);
+            let hi = _mm256_packs_epi32(r[2], r[3]);
+            let p = dst.as_mut_ptr().add(x) as *mut __m256i;
+            _mm256_storeu_si256(p, _mm256_packus_epi16(lo, hi));
+        }
+        n
+    }
+
+    /// Destination pixels of `bpp` bytes, 8 source bytes at a time.
+    #[target_feature(enable = "sse4.1")]
+    pub unsafe fn horizontal_sse41<const BPP: usize>(
+        taps: &super::Taps,
+        src: &[u8],
+        dst: &mut [u8],
+    ) {
+        let mut mask = [-1i8; 16];
+        for j in 0..8 {
+            let (pixel, channel) = super::group_lane(BPP, j);
+            mask[2 * j] = (pixel * BPP + channel) as i8;
+        }
+        let mask = _mm_loadu_si128(mask.as_ptr() as *const __m128i);
+        let n = dst.len() / BPP;
+        assert!(taps.starts.len() >= n && taps.lanes.len() >= n * taps.groups);
+        for i in 0..n {
+            let lanes = taps.lanes.as_ptr().add(i * taps.groups);
+            let s = src.as_ptr().add(*taps.starts.get_unchecked(i) * BPP);
+            let mut acc = _mm_set1_epi32(0);
+            for g in 0..taps.groups {
+                let v = _mm_loadl_epi64(s.add(8 * g) as *const __m128i);
+                let w = _mm_loadu_si128(lanes.add(g) as *const __m128i);
+                acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_shuffle_epi8(v, mask), w));
+            }
+            if BPP <= 2 {
+                acc = _mm_add_epi32(acc, _mm_shuffle_epi32::<0b01_00_11_10>(acc));
+            }
+            if BPP == 1 {
+                acc = _mm_add_epi32(acc, _mm_shuffle_epi32::<0b10_11_00_01>(acc));
+            }
+            let r = _mm_srai_epi32::<{ SHIFT as i32 }>(_mm_add_epi32(acc, _mm_set1_epi32(ROUND)));
+            let r = _mm_packus_epi16(_mm_packs_epi32(r, r), _mm_setzero_si128());
+            let r = (_mm_cvtsi128_si32(r) as u32).to_le_bytes();
+            std::ptr::copy_nonoverlapping(r.as_ptr(), dst.as_mut_ptr().add(i * BPP), BPP);
+        }
+    }
+
+    fn box2_mask(bpp: usize) -> [i8; 16] {
+        let mut m = [0i8; 16];
+        for o in 0..8 {
+            let (p, c) = (o / bpp, o % bpp);
+            m[2 * o] = (2 * bpp * p + c) as i8;
+            m[2 * o + 1] = (2 * bpp * p + c + bpp) as i8;
+        }
+        m
+    }
+
+    /// Rounded means of 2x2 pixels from 16 bytes of each row, as i16.
+    #[inline]
+    #[target_feature(enable = "sse4.1")]
+    unsafe fn box2_means(a: *const u8, b: *const u8, mask: __m128i) -> __m128i {
+        let ones = _mm_set1_epi8(1);
+        let a = _mm_maddubs_epi16(
+            _mm_shuffle_epi8(_mm_loadu_si128(a as *const __m128i), mask),
+            ones,
+        );
+        let b = _mm_maddubs_epi16(
+            _mm_shuffle_epi8(_mm_loadu_si128(b as *const __m128i), mask),
+            ones,
+        );
+        _mm_srli_epi16::<2>(_mm_add_epi16(_mm_add_epi16(a, b), _mm_set1_epi16(2)))
+    }
+
+    #[target_feature(enable = "sse4.1")]
+    pub unsafe fn box2_sse41(s0: &[u8], s1: &[u8], bpp: usize, dst: &mut [u8]) -> usize {
+        let mask = _mm_loadu_si128(box2_mask(bpp).as_ptr() as *const __m128i);
+        let n = dst.len() / 16 * 16;
+        let (a, b) = (s0.as_ptr(), s1.as_ptr());
+        for o in (0..n).step_by(16) {
+            let lo = box2_means(a.add(2 * o), b.add(2 * o), mask);
+            let hi = box2_means(a.add(2 * o + 16), b.add(2 * o + 16), mask);
+            let r = _mm_packus_epi16(lo, hi);
+            _mm_storeu_si128(dst.as_mut_ptr().add(o) as *mut __m128i, r);
+        }
+        n
+    }
+
+    #[inline]
+    #[target_feature(enable = "avx2")]
+    unsafe fn box2_means256(a: *const u8, b: *const u8, mask: __m256i) -> __m256i {
+        let ones = _mm256_set1_epi8(1);
+        let a = _mm256_loadu_si256(a as *const __m256i);
+        let b = _mm256_loadu_si256(b as *const __m256i);
+        let a = _mm256_maddubs_epi16(_mm256_shuffle_epi8(a, mask), ones);
+        let b = _mm256_maddubs_epi16(_mm256_shuffle_epi8(b, mask), ones);
+        _mm256_srli_epi16::<2>(_mm256_add_epi16(
+            _mm256_add_epi16(a, b),
+            _mm256_set1_epi16(2),
+        ))
+    }
+
+    #[target_feature(enable = "avx2")]
+    pub unsafe fn box2_avx2(s0: &[u8], s1: &[u8], bpp: usize, dst: &mut [u8]) -> usize {
+        let mask = _mm_loadu_si128(box2_mask(bpp).as_ptr() as *const __m128i);
+        let mask = _mm256_broadcastsi128_si256(mask);
+        let n = dst.len() / 32 * 32;
+        let (a, b) = (s0.as_ptr(), s1.as_ptr());
+        for o in (0..n).step_by(32) {
+            let lo = box2_means256(a.add(2 * o), b.add(2 * o), mask);
+            let hi = box2_means256(a.add(2 * o + 32), b.add(2 * o + 32), mask);
+            let r = _mm256_packus_epi16(lo, hi);
+            let r = _mm256_permute4x64_epi64::<0b11_01_10_00>(r);
+            _mm256_storeu_si256(dst.as_mut_ptr().add(o) as *mut __m256i, r);
+        }
+        n
+    }
+}
+
+/// Resizes frames with one filter, keeping the weights of every size pair
+/// it has seen.
+pub struct Scaler {
+    filter: ScaleFilter,
+    simd: Simd,
+    threads: usize,
+    cache: Mutex<HashMap<(usize, usize, usize), Arc<Taps>>>,
+}
+
+impl Scaler {
+    pub fn new(filter: ScaleFilter) -> Self {
+        Self {
+            filter,
+            simd: Simd::detect(),
+            threads: 0,
+            cache: Mutex::new(HashMap::new()),
+        }
+    }
+
+    /// As `RgbToYuv::with_simd`; NEON runs the scalar code.
+    pub fn with_simd(mut self, simd: Simd) -> Self {
+        if simd.supported() {
+            self.simd = simd;
+        }
+        self
+    }
+
+    /// As `RgbToYuv::with_threads`.
+    pub fn with_threads(mut self, threads: usize) -> Self {
+        self.threads = threads;
+        self
+    }
+
+    pub fn filter(&self) -> ScaleFilter {
+        self.filter
+    }
+
+    fn taps(&self, src: usize, dst: usize, bpp: usize) -> Arc<Taps> {
+        let mut cache = self.cache.lock().unwrap();
+        cache
+            .entry((src, dst, bpp))
+            .or_insert_with(|| Arc::new(Taps::new(self.filter, src, dst, bpp)))
+            .clone()
+    }
+
+    /// Resizes a plane of `bpp` (1, 2 or 4) byte pixels.
+    #[allow(clippy::too_many_arguments)]
+    pub fn scale(
+        &self,
+        src: &[u8],
+        src_stride: usize,
+        src_width: usize,
+        src_height: usize,
+        bpp: usize,
+        dst: &mut [u8],
+        dst_stride: usize,
+        dst_width: usize,
+        dst_height: usize,
+    ) -> Result<(), ()> {
+        let fits = |len: usize, stride: usize, width: usize, height: usize| {
+            width > 0
+                && height > 0
+                && stride >= width * bpp
+                && len >= stride * (height - 1) + width * bpp
+        };
+        if !matches!(bpp, 1 | 2 | 4)
+            || !fits(src.len(), src_stride, src_width, src_height)
+            || !fits(dst.len(), dst_stride, dst_width, dst_height)
+        {
+            return Err(());
+        }
+        let threads = band_threads(self.threads, src_width, src_height).min(dst_height);
+        let band = (dst_height + threads - 1) / threads;
+        let bands = dst.chunks_mut(band * dst_stride).enumerate();
+        let row_bytes = dst_width * bpp;
+        if self.filter == ScaleFilter::Area
+            && src_width == 2 * dst_width
+            && src_height == 2 * dst_height
+        {
+            run_bands(threads, bands, |(i, dst)| {
+                for r in 0..band.min(dst_height - i * band) {
+                    let y = 2 * (i * band + r);
+                    let s0 = &src[y * src_stride..][..2 * row_bytes];
+                    let s1 = &src[(y + 1) * src_stride..][..2 * row_bytes];
+                    self.box2(s0, s1, bpp, &mut dst[r * dst_stride..][..row_bytes]);
+                }
+            });
+            return Ok(());
+        }
+        let vertical = self.taps(src_height, dst_height, bpp);
+        let horizontal = self.taps(src_width, dst_width, bpp);
+        run_bands(threads, bands, |(i, dst)| {
+            let mut tmp = vec![0u8; src_width * bpp + SLACK];
+            let mut rows: Vec<&[u8]> = Vec::with_capacity(vertical.len);
+            for r in 0..band.min(dst_height - i * band) {
+                let y = i * band + r;
+                let start = vertical.starts[y];
+                rows.clear();
+                rows.extend(
+                    (start..start + vertical.len)
+                        .map(|k| &src[k * src_stride..][..src_width * bpp]),
+                );
+                let weights = &vertical.weights[y * vertical.len..][..vertical.len];
+                let out = &mut dst[r * dst_stride..][..row_bytes];
+                if src_width == dst_width {
+                    self.vertical(&rows, weights, out);
+                } else {
+                    self.vertical(&rows, weights, &mut tmp[..src_width * bpp]);
+                    self.horizontal(&horizontal, bpp, &tmp, out);
+                }
+            }
+        });
+        Ok(())
+    }
+
+    /// Resizes the planes of an NV12 or I420 frame, chroma planes of
+    /// `(width + 1) / 2` x `(height + 1) / 2` samples. `dst` is of the same
+    /// kind as `src`.
+    pub fn scale_yuv(
+        &self,
+        src: YuvSource,
+        width: usize,
+        height: usize,
+        dst: YuvPlanes,
+        dst_width: usize,
+        dst_height: usize,
+    ) -> Result<(), ()> {
+        let (cw, ch) = ((width + 1) / 2, (height + 1) / 2);
+        let (dcw, dch) = ((dst_width + 1) / 2, (dst_height + 1) / 2);
+        match (src, dst) {
+            (
+                YuvSource::Nv12 {
+                    y,
+                    y_stride,
+                    uv,
+                    uv_stride,
+                },
+                YuvPlanes::Nv12 {
+                    y: dy,
+                    y_stride: dy_stride,
+                    uv: duv,
+                    uv_stride: duv_stride,
+                },
+            ) => {
+                self.scale(
+                    y, y_stride, width, height, 1, dy, dy_stride, dst_width, dst_height,
+                )?;
+                self.scale(uv, uv_stride, cw, ch, 2, duv, duv_stride, dcw, dch)
+            }
+            (
+                YuvSource::I420 {
+                    y,
+                    y_stride,
+                    u,
+                    u_stride,
+                    v,
+                    v_stride,
+                },
+                YuvPlanes::I420 {
+                    y: dy,
+                    y_stride: dy_stride,
+                    u: du,
+                    u_stride: du_stride,
+                    v: dv,
+                    v_stride: dv_stride,
+                },
+            ) => {
+                self.scale(
+                    y, y_stride, width, height, 1, dy, dy_stride, dst_width, dst_height,
+                )?;
+                self.scale(u, u_stride, cw, ch, 1, du, du_stride, dcw, dch)?;
+                self.scale(v, v_stride, cw, ch, 1, dv, dv_stride, dcw, dch)
+            }
+            _ => Err(()),
+        }
+    }
+
+    fn vertical(&self, rows: &[&[u8]], weights: &[i16], dst: &mut [u8]) {
+        let done = unsafe {
+            match self.simd {
+                #[cfg(target_arch = "x86_64")]
+                Simd::Avx2 => x86::vertical_avx2(rows, weights, dst),
+                #[cfg(target_arch = "x86_64")]
+                Simd::Sse41 => x86::vertical_sse41(rows, weights, dst),
+                _ => 0,
+            }
+        };
+        vertical_scalar(rows, weights, dst, done);
+    }
+
+    fn horizontal(&self, taps: &Taps, bpp: usize, src: &[u8], dst: &mut [u8]) {
+        match self.simd {
+            #[cfg(target_arch = "x86_64")]
+            Simd::Avx2 | Simd::Sse41 => unsafe {
+                match bpp {
+                    1 => x86::horizontal_sse41::<1>(taps, src, dst),
+                    2 => x86::horizontal_sse41::<2>(taps, src, dst),
+                    _ => x86::horizontal_sse41::<4>(taps, src, dst),
+                }
+            },
+            _ => horizontal_scalar(taps, bpp, src, dst),
+        }
+    }
+
+    fn box2(&self, s0: &[u8], s1: &[u8], bpp: usize, dst: &mut [u8]) {
+        let done = unsafe {
+            match self.simd {
+                #[cfg(target_arch = "x86_64")]
+                Simd::Avx2 => x86::box2_avx2(s0, s1, bpp, dst),
+                #[cfg(target_arch = "x86_64")]
+                Simd::Sse41 => x86::box2_sse41(s0, s1, bpp, dst),
+                _ => 0,
+            }
+        };
+        box2_scalar(s0, s1, bpp, dst, done);
+    }
+}
@@ -0,0 +1,202 @@
+//! Detection of hard scene changes in BGRA frames, to start a new GOP at a
+//! cut instead of converging over many P-frames.
+//!
+//! Each frame is reduced to a luma thumbnail of sampled pixels. A cut needs
+//! both a large thumbnail SAD, well above its recent average so steady
+//! motion does not trigger, and a different luma histogram, which scrolling
+//! and moving windows keep.
+
+use std::time::{Duration, Instant};
+
+const THUMB_WIDTH: usize = 64;
+const THUMB_HEIGHT: usize = 36;
+/// Pixels sampled per thumbnail cell in each direction.
+const SAMPLES: usize = 4;
+const BINS: usize = 32;
+const BPP: usize = 4;
+
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct SceneParams {
+    /// Mean absolute thumbnail difference, in levels, a cut reaches.
+    pub sad_threshold: u32,
+    /// How many times the recent average SAD a cut exceeds.
+    pub sad_ratio: u32,
+    /// Share of the histogram, 0 to 1, that moves at a cut.
+    pub histogram_threshold: f32,
+    /// Cuts closer than this to the previous one are ignored.
+    pub min_interval: Duration,
+}
+
+impl Default for SceneParams {
+    fn default() -> Self {
+        Self {
+            sad_threshold: 24,
+            sad_ratio: 3,
+            histogram_threshold: 0.12,
+            min_interval: Duration::from_secs(1),
+        }
+    }
+}
+
+pub struct SceneDetector {
+    params: SceneParams,
+    thumb: Vec<u8>,
+    previous: Vec<u8>,
+    histogram: [u32; BINS],
+    previous_histogram: [u32; BINS],
+    /// Recent SAD, in 1/16 levels.
+    average: u32,
+    size: (usize, usize),
+    last_cut: Option<Instant>,
+    cuts: u64,
+}
+
+impl SceneDetector {
+    pub fn new(params: SceneParams) -> Self {
+        Self {
+            params,
+            thumb: vec![0; THUMB_WIDTH * THUMB_HEIGHT],
+            previous: vec![0; THUMB_WIDTH * THUMB_HEIGHT],
+            histogram: [0; BINS],
+            previous_histogram: [0; BINS],
+            average: 0,
+            size: (0, 0),
+            last_cut: None,
+            cuts: 0,
+        }
+    }
+
+    pub fn params(&self) -> &SceneParams {
+        &self.params
+    }
+
+    /// Cuts detected so far.
+    pub fn cuts(&self) -> u64 {
+        self.cuts
+    }
+
+    /// Samples the thumbnail and histogram of a frame.
+    fn sample(&mut self, data: &[u8], width: usize, height: usize, stride: usize) {
+        self.histogram = [0; BINS];
+        for ty in 0..THUMB_HEIGHT {
+            for tx in 0..THUMB_WIDTH {
+                let mut sum = 0;
+                for sy in 0..SAMPLES {
+                    let y = ((ty * SAMPLES + sy) * 2 + 1) * height / (2 * THUMB_HEIGHT * SAMPLES);
+                    let row = &data[y * stride..];
+                    for sx in 0..SAMPLES {
+                        let x = ((tx * SAMPLES + sx) * 2 + 1) * width / (2 * THUMB_WIDTH * SAMPLES);
+                        let p = &row[x * BPP..][..3];
+                        sum += (p[0] as u32 * 29 + p[1] as u32 * 150 + p[2] as u32 * 77) >> 8;
+                    }
+                }
+                let luma = (sum / (SAMPLES * SAMPLES) as u32) as u8;
+                self.thumb[ty * THUMB_WIDTH + tx] = luma;
+                self.histogram[luma as usize * BINS / 256] += 1;
+            }
+        }
+    }
+
+    /// Whether a BGRA frame starts a new scene. The first frame, and any
+    /// frame after a size change, does not.
+    pub fn check(&mut self, data: &[u8], width: usize, height: usize, stride: usize) -> bool {
+        if width == 0
+            || height == 0
+            || stride < width * BPP
+            || data.len() < stride * (height - 1) + width * BPP
+        {
+            return false;
+        }
+        self.sample(data, width, height, stride);
+        let cut = self.size == (width, height) && self.compare();
+        std::mem::swap(&mut self.thumb, &mut self.previous);
+        std::mem::swap(&mut self.histogram, &mut self.previous_histogram);
+        if self.size != (width, height) {
+            self.size = (width, height);
+            self.average = 0;
+        }
+        if !cut {
+            return false;
+        }
+        let now = Instant::now();
+        if self
+            .last_cut
+            .map_or(false, |t| now.duration_since(t) < self.params.min_interval)
+        {
+            return false;
+        }
+        self.last_cut = Some(now);
+        self.cuts += 1;
+        true
+    }
+
+    /// Whether the sampled frame differs from the previous one like a cut.
+    fn compare(&mut self) -> bool {
+        let n = (THUMB_WIDTH * THUMB_HEIGHT) as u32;
+        let sad = self
+            .thumb
+            .iter()
+            .zip(&self.previous)
+            .map(|(&a, &b)| a.abs_diff(b) as u32)
+            .sum::<u32>()
+            * 16
+            / n;
+        let moved: u32 = self
+            .histogram
+            .iter()
+            .zip(&self.previous_histogram)
+            .map(|(&a, &b)| a.abs_diff(b))
+            .sum();
+        let average = self.average;
+        self.average = (self.average * 7 + sad) / 8;
+        sad >= self.params.sad_threshold * 16
+            && sad > average * self.params.sad_ratio
+            && moved as f32 / (2 * n) as f32 >= self.params.histogram_threshold
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::synth::{Scenario, ScreenContent};
+
+    #[test]
+    fn cuts_at_scenario_switches_only() {
+        const WIDTH: usize = 640;
+        const HEIGHT: usize = 360;
+        const FRAMES: u64 = 20;
+        let mut d = SceneDetector::new(SceneParams {
+            min_interval: Duration::ZERO,
+            ..Default::default()
+        });
+        // every scenario follows every other one once
+        let order = Scenario::ALL
+            .iter()
+            .chain(&Scenario::ALL)
+            .chain(&Scenario::ALL[..1]);
+        for (i, &scenario) in order.enumerate() {
+            let mut content = ScreenContent::new(scenario, WIDTH, HEIGHT, 30);
+            for n in 0..FRAMES {
+                let cut = d.check(content.frame(n), WIDTH, HEIGHT, WIDTH * BPP);
+                assert_eq!(cut, i > 0 && n == 0, "{:?} frame {}", scenario, n);
+            }
+        }
+        assert_eq!(d.cuts(), 10);
+    }
+
+    #[test]
+    fn min_interval_between_cuts() {
+        let mut d = SceneDetector::new(SceneParams {
+            min_interval: Duration::from_secs(60),
+            ..Default::default()
+        });
+        let black = vec![0; 64 * 64 * BPP];
+        let white = vec![0xFF; 64 * 64 * BPP];
+        assert!(!d.check(&black, 64, 64, 64 * BPP));
+        assert!(d.check(&white, 64, 64, 64 * BPP));
+        assert!(!d.check(&black, 64, 64, 64 * BPP));
+        assert_eq!(d.cuts(), 1);
+        // a new size starts over without a cut
+        assert!(!d.check(&white, 32, 64, 32 * BPP));
+    }
+}
@@ -0,0 +1,399 @@
+//! One capture encoded at several resolutions and bitrates, so receivers
+//! with different bandwidth each get a stream without encoding per
+//! receiver.
+//!
+//! Each layer is an `Encoder` session of its own. Frames are scaled on the
+//! CPU once per layer size, layers of the same size share the result and
+//! layers at the capture size use it as is. Layers are encoded smallest
+//! first and handed out as soon as each is done; a larger layer whose
+//! recent cost would push the frame past its interval skips the frame
+//! instead of delaying the next one of the smaller layers, up to a few
+//! frames in a row.
+
+use crate::{
+    encode::{EncodeFrame, Encoder},
+    keyframe::KeyframeRequester,
+    scale::{ScaleFilter, Scaler},
+};
+use gpu_common::EncodeContext;
+use std::{
+    os::raw::c_void,
+    time::{Duration, Instant},
+};
+
+const BPP: usize = 4;
+/// Consecutive frames a layer may skip, so it slows down but never stops.
+const MAX_SKIPPED: u32 = 3;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct SimulcastLayer {
+    pub width: i32,
+    pub height: i32,
+    pub kbitrate: i32,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub struct LayerStats {
+    pub encoded: u64,
+    /// Frames skipped to keep the smaller layers on time.
+    pub skipped: u64,
+    /// Recent time to scale and encode a frame.
+    pub cost: Duration,
+}
+
+struct Layer {
+    config: SimulcastLayer,
+    encoder: Encoder,
+    /// Index of the scaled frame, `None` at the capture size.
+    frame: Option<usize>,
+    /// Frames skipped in a row.
+    skipped: u32,
+    stats: LayerStats,
+}
+
+struct ScaledFrame {
+    width: usize,
+    height: usize,
+    data: Vec<u8>,
+    /// Whether `data` holds the current capture.
+    ready: bool,
+}
+
+pub struct SimulcastEncoder {
+    layers: Vec<Layer>,
+    frames: Vec<ScaledFrame>,
+    scaler: Scaler,
+    width: usize,
+    height: usize,
+    framerate: i32,
+}
+
+impl SimulcastEncoder {
+    /// `ctx` gives the capture size and framerate and the settings every
+    /// layer shares. Layers may not be larger than the capture; they are
+    /// sorted by size and indexed smallest first.
+    pub fn new(ctx: EncodeContext, layers: &[SimulcastLayer]) -> Result<Self, ()> {
+        let (width, height) = (ctx.d.width, ctx.d.height);
+        if layers.is_empty()
+            || layers
+                .iter()
+                .any(|l| l.width <= 0 || l.height <= 0 || l.width > width || l.height > height)
+        {
+            return Err(());
+        }
+        let mut configs = layers.to_vec();
+        configs.sort_by_key(|l| (l.width as i64 * l.height as i64, l.kbitrate));
+        let mut frames: Vec<ScaledFrame> = vec![];
+        let mut out = Vec::with_capacity(configs.len());
+        for config in configs {
+            let mut ctx = ctx.clone();
+            ctx.d.width = config.width;
+            ctx.d.height = config.height;
+            ctx.d.kbitrate = config.kbitrate;
+            let encoder = Encoder::new(ctx)?;
+            let (w, h) = (config.width as usize, config.height as usize);
+            let frame = if (config.width, config.height) == (width, height) {
+                None
+            } else {
+                match frames.iter().position(|f| (f.width, f.height) == (w, h)) {
+                    Some(i) => Some(i),
+                    None => {
+                        frames.push(ScaledFrame {
+                            width: w,
+                            height: h,
+                            data: vec![0; w * h * BPP],
+                            ready: false,
+                        });
+                        Some(frames.len() - 1)
+                    }
+                }
+            };
+            out.push(Layer {
+                config,
+                encoder,
+                frame,
+                skipped: 0,
+                stats: LayerStats::default(),
+            });
+        }
+        Ok(Self {
+            layers: out,
+            frames,
+            scaler: Scaler::new(ScaleFilter::Area),
+            width: width as usize,
+            height: height as usize,
+            framerate: ctx.d.framerate,
+        })
+    }
+
+    pub fn with_scaler(mut self, scaler: Scaler) -> Self {
+        self.scaler = scaler;
+        self
+    }
+
+    pub fn layer_count(&self) -> usize {
+        self.layers.len()
+    }
+
+    pub fn layer(&self, layer: usize) -> &SimulcastLayer {
+        &self.layers[layer].config
+    }
+
+    /// The session of a layer, for the settings not mirrored here.
+    pub fn encoder(&mut self, layer: usize) -> &mut Encoder {
+        &mut self.layers[layer].encoder
+    }
+
+    pub fn stats(&self, layer: usize) -> LayerStats {
+        self.layers[layer].stats
+    }
+
+    pub fn set_bitrate(&mut self, layer: usize, kbs: i32) -> Result<(), i32> {
+        let l = &mut self.layers[layer];
+        l.encoder.set_bitrate(kbs)?;
+        l.config.kbitrate = kbs;
+        Ok(())
+    }
+
+    pub fn request_keyframe(&self, layer: usize) {
+        self.layers[layer].encoder.request_keyframe();
+    }
+
+    pub fn keyframe_requester(&self, layer: usize) -> KeyframeRequester {
+        self.layers[layer].encoder.keyframe_requester()
+    }
+
+    /// The largest layer whose bitrate fits in `kbs`, the smallest if none
+    /// does.
+    pub fn select_layer(&self, kbs: i32) -> usize {
+        self.layers
+            .iter()
+            .rposition(|l| l.config.kbitrate <= kbs)
+            .unwrap_or(0)
+    }
+
+    /// Encodes a BGRA capture, rows `stride` bytes apart, in every layer
+    /// that is on time. `upload` makes the texture a layer encodes from its
+    /// pixels: (layer, pixels, stride, width, height). `sink` gets the
+    /// packets of each layer as soon as it is done. All layers are tried,
+    /// the first error is returned.
+    pub fn encode<U, S>(
+        &mut self,
+        pixels: &[u8],
+        stride: usize,
+        mut upload: U,
+        mut sink: S,
+    ) -> Result<(), i32>
+    where
+        U: FnMut(usize, &[u8], usize, usize, usize) -> *mut c_void,
+        S: FnMut(usize, &mut Vec<EncodeFrame>),
+    {
+        if stride < self.width * BPP || pixels.len() < stride * (self.height - 1) + self.width * BPP
+        {
+            return Err(-1);
+        }
+        let Self {
+            layers,
+            frames,
+            scaler,
+            ..
+        } = self;
+        for f in frames.iter_mut() {
+            f.ready = false;
+        }
+        let start = Instant::now();
+        let interval = Duration::from_secs(1) / self.framerate.max(1) as u32;
+        let mut result = Ok(());
+        for (i, layer) in layers.iter_mut().enumerate() {
+            if i > 0 && layer.skipped < MAX_SKIPPED && start.elapsed() + layer.stats.cost > interval
+            {
+                layer.skipped += 1;
+                layer.stats.skipped += 1;
+                continue;
+            }
+            layer.skipped = 0;
+            let t = Instant::now();
+            let (data, data_stride) = match layer.frame {
+                None => (pixels, stride),
+                Some(f) => {
+                    let f = &mut frames[f];
+                    if !f.ready {
+                        let dst_stride = f.width * BPP;
+                        if scaler
+                            .scale(
+                                pixels,
+                                stride,
+                                self.width,
+                                self.height,
+                                BPP,
+                                &mut f.data,
+                                dst_stride,
+                                f.width,
+                                f.height,
+                            )
+                            .is_err()
+                        {
+                            result = result.and(Err(-1));
+                            continue;
+                        }
+                        f.ready = true;
+                    }
+                    (&f.data[..], f.width * BPP)
+                }
+            };
+            let (w, h) = (layer.config.width as usize, layer.config.height as usize);
+            let tex = upload(i, data, data_stride, w, h);
+            match layer.encoder.encode_with_pixels(tex, data, data_stride) {
+                Ok(packets) => sink(i, packets),
+                Err(e) => result = result.and(Err(e)),
+            }
+            layer.stats.encoded += 1;
+            layer.stats.cost = (layer.stats.cost * 3 + t.elapsed()) / 4;
+        }
+        result
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use gpu_common::{
+        DataFormat::H264, DynamicContext, EncodeDriver::CPU, FeatureContext, API::API_DX11,
+    };
+
+    const WIDTH: usize = 320;
+    const HEIGHT: usize = 180;
+
+    fn layer(width: i32, height: i32, kbitrate: i32) -> SimulcastLayer {
+        SimulcastLayer {
+            width,
+            height,
+            kbitrate,
+        }
+    }
+
+    fn context() -> EncodeContext {
+        EncodeContext {
+            f: FeatureContext {
+                driver: CPU,
+                luid: 0,
+                api: API_DX11,
+                data_format: H264,
+            },
+            d: DynamicContext {
+                device: None,
+                width: WIDTH as i32,
+                height: HEIGHT as i32,
+                kbitrate: 1000,
+                framerate: 30,
+                gop: i32::MAX,
+                chroma: Default::default(),
+                range: Default::default(),
+            },
+        }
+    }
+
+    fn simulcast(layers: &[SimulcastLayer]) -> SimulcastEncoder {
+        let mut s = SimulcastEncoder::new(context(), layers).unwrap();
+        for i in 0..s.layer_count() {
+            s.encoder(i).set_keyframe_window(Duration::ZERO);
+        }
+        s
+    }
+
+    /// Encodes a frame, returns per layer whether it was encoded and
+    /// whether as a keyframe.
+    fn encode(s: &mut SimulcastEncoder, slow: Option<usize>) -> Vec<Option<bool>> {
+        let pixels = vec![0x80; WIDTH * HEIGHT * BPP];
+        let mut out = vec![None; s.layer_count()];
+        s.encode(
+            &pixels,
+            WIDTH * BPP,
+            |i, data, stride, w, h| {
+                assert!(data.len() >= stride * (h - 1) + w * BPP);
+                if slow == Some(i) {
+                    std::thread::sleep(Duration::from_millis(100));
+                }
+                std::ptr::null_mut()
+            },
+            |i, frames| out[i] = Some(frames.iter().any(|f| f.is_random_access())),
+        )
+        .unwrap();
+        out
+    }
+
+    #[test]
+    fn layers_sorted_and_scaled_frames_shared() {
+        let s = simulcast(&[
+            layer(320, 180, 1500),
+            layer(160, 90, 300),
+            layer(240, 136, 800),
+            layer(160, 90, 200),
+        ]);
+        let configs: Vec<_> = (0..s.layer_count()).map(|i| *s.layer(i)).collect();
+        assert_eq!(
+            configs,
+            [
+                layer(160, 90, 200),
+                layer(160, 90, 300),
+                layer(240, 136, 800),
+                layer(320, 180, 1500),
+            ]
+        );
+        let frames: Vec<_> = s.layers.iter().map(|l| l.frame).collect();
+        assert_eq!(frames, [Some(0), Some(0), Some(1), None]);
+        assert_eq!(s.frames.len(), 2);
+    }
+
+    #[test]
+    fn rejects_layers_larger_than_capture() {
+        assert!(SimulcastEncoder::new(context(), &[layer(640, 360, 1000)]).is_err());
+        assert!(SimulcastEncoder::new(context(), &[layer(0, 90, 300)]).is_err());
+        assert!(SimulcastEncoder::new(context(), &[]).is_err());
+    }
+
+    #[test]
+    fn per_layer_bitrate_and_keyframes() {
+        let mut s = simulcast(&[layer(160, 90, 300), layer(320, 180, 1500)]);
+        assert_eq!(encode(&mut s, None), [Some(true), Some(true)]);
+        assert_eq!(encode(&mut s, None), [Some(false), Some(false)]);
+        s.request_keyframe(1);
+        assert_eq!(encode(&mut s, None), [Some(false), Some(true)]);
+        s.keyframe_requester(0).request();
+        assert_eq!(encode(&mut s, None), [Some(true), Some(false)]);
+        s.set_bitrate(0, 250).unwrap();
+        assert_eq!(s.layer(0).kbitrate, 250);
+        assert_eq!(s.layer(1).kbitrate, 1500);
+    }
+
+    #[test]
+    fn select_layer_by_bandwidth() {
+        let s = simulcast(&[
+            layer(160, 90, 300),
+            layer(240, 136, 800),
+            layer(320, 180, 1500),
+        ]);
+        assert_eq!(s.select_layer(100), 0);
+        assert_eq!(s.select_layer(300), 0);
+        assert_eq!(s.select_layer(799), 0);
+        assert_eq!(s.select_layer(800), 1);
+        assert_eq!(s.select_layer(10000), 2);
+    }
+
+    #[test]
+    fn slow_layer_skips_at_most_max_skipped_in_a_row() {
+        let mut s = simulcast(&[layer(160, 90, 300), layer(320, 180, 1500)]);
+        let mut run = 0;
+        for _ in 0..12 {
+            let out = encode(&mut s, Some(1));
+            assert!(out[0].is_some());
+            run = if out[1].is_some() { 0 } else { run + 1 };
+            assert!(run <= MAX_SKIPPED);
+        }
+        let (small, slow) = (s.stats(0), s.stats(1));
+        assert_eq!((small.encoded, small.skipped), (12, 0));
+        assert!(slow.skipped >= MAX_SKIPPED as u64);
+        assert_eq!(slow.encoded + slow.skipped, 12);
+        assert!(slow.cost > Duration::from_secs(1) / 30);
+    }
+}
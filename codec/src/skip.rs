@@ -0,0 +1,649 @@
+//! All-skip P pictures built on the CPU, so static content costs a few
+//! bytes per frame and no backend call.
+//!
+//! A skip picture repeats the last reference picture exactly: every
+//! macroblock or coding unit is skipped with a zero motion vector, so there
+//! is no residual and nothing for the loop filters to do. Skip pictures are
+//! reference pictures; the encoder packets that follow are renumbered
+//! (`frame_num` and the POC LSBs) to continue after them. As the encoder
+//! keeps predicting from the picture it coded last while the decoder holds
+//! copies of it in front, this only matches for streams predicting from a
+//! single reference picture. HEVC streams with temporal motion vector
+//! prediction, tiles or wavefronts are not handled either.
+
+use crate::{
+    bits::{self, BitWriter},
+    nal,
+    params::{H264Pps, H264Sps, HevcPps, HevcSps, ShortTermRps},
+    parser::{Parser, PictureType, SliceHeader},
+};
+use gpu_common::DataFormat::{self, *};
+
+#[rustfmt::skip]
+const RANGE_TAB_LPS: [[u8; 4]; 64] = [
+    [128, 176, 208, 240], [128, 167, 197, 227], [128, 158, 187, 216], [123, 150, 178, 205],
+    [116, 142, 169, 195], [111, 135, 160, 185], [105, 128, 152, 175], [100, 122, 144, 166],
+    [95, 116, 137, 158], [90, 110, 130, 150], [85, 104, 123, 142], [81, 99, 117, 135],
+    [77, 94, 111, 128], [73, 89, 105, 122], [69, 85, 100, 116], [66, 80, 95, 110],
+    [62, 76, 90, 104], [59, 72, 86, 99], [56, 69, 81, 94], [53, 65, 77, 89],
+    [51, 62, 73, 85], [48, 59, 69, 80], [46, 56, 66, 76], [43, 53, 63, 72],
+    [41, 50, 59, 69], [39, 48, 56, 65], [37, 45, 54, 62], [35, 43, 51, 59],
+    [33, 41, 48, 56], [32, 39, 46, 53], [30, 37, 43, 50], [29, 35, 41, 48],
+    [27, 33, 39, 45], [26, 31, 37, 43], [24, 30, 35, 41], [23, 28, 33, 39],
+    [22, 27, 32, 37], [21, 26, 30, 35], [20, 24, 29, 33], [19, 23, 27, 31],
+    [18, 22, 26, 30], [17, 21, 25, 28], [16, 20, 23, 27], [15, 19, 22, 25],
+    [14, 18, 21, 24], [14, 17, 20, 23], [13, 16, 19, 22], [12, 15, 18, 21],
+    [12, 14, 17, 20], [11, 14, 16, 19], [11, 13, 15, 18], [10, 12, 15, 17],
+    [10, 12, 14, 16], [9, 11, 13, 15], [9, 11, 12, 14], [8, 10, 12, 14],
+    [8, 9, 11, 13], [7, 9, 11, 12], [7, 9, 10, 12], [7, 8, 10, 11],
+    [6, 8, 9, 11], [6, 7, 9, 10], [6, 7, 8, 9], [2, 2, 2, 2],
+];
+
+#[rustfmt::skip]
+const TRANS_IDX_LPS: [u8; 64] = [
+    0, 0, 1, 2, 2, 4, 4, 5, 6, 7, 8, 9, 9, 11, 11, 12,
+    13, 13, 15, 15, 16, 16, 18, 18, 19, 19, 21, 21, 22, 22, 23, 24,
+    24, 25, 26, 26, 27, 27, 28, 29, 29, 30, 30, 30, 31, 32, 32, 33,
+    33, 33, 34, 34, 35, 35, 35, 36, 36, 36, 37, 37, 37, 38, 38, 63,
+];
+
+/// H.264 (m, n) of mb_skip_flag with ctxIdxInc 0, cabac_init_idc 0.
+const H264_MB_SKIP_INIT: (i32, i32) = (23, 33);
+/// HEVC initValues for initType 1 (P slices without cabac_init_flag).
+const HEVC_SPLIT_CU_INIT: [u8; 3] = [107, 139, 126];
+const HEVC_CU_SKIP_INIT: [u8; 3] = [197, 185, 201];
+
+#[derive(Clone, Copy)]
+struct Context {
+    state: u8,
+    mps: u8,
+}
+
+impl Context {
+    fn new(m: i32, n: i32, qp: i32) -> Self {
+        let pre = (((m * qp.clamp(0, 51)) >> 4) + n).clamp(1, 126);
+        if pre <= 63 {
+            Self {
+                state: (63 - pre) as u8,
+                mps: 0,
+            }
+        } else {
+            Self {
+                state: (pre - 64) as u8,
+                mps: 1,
+            }
+        }
+    }
+
+    fn hevc(init_value: u8, qp: i32) -> Self {
+        let (slope, offset) = ((init_value >> 4) as i32, (init_value & 15) as i32);
+        Self::new(slope * 5 - 45, (offset << 3) - 16, qp)
+    }
+}
+
+/// The CABAC arithmetic encoder shared by H.264 and HEVC.
+struct Cabac<'a> {
+    w: &'a mut BitWriter,
+    low: u32,
+    range: u32,
+    outstanding: u32,
+    first: bool,
+}
+
+impl<'a> Cabac<'a> {
+    fn new(w: &'a mut BitWriter) -> Self {
+        Self {
+            w,
+            low: 0,
+            range: 510,
+            outstanding: 0,
+            first: true,
+        }
+    }
+
+    fn put_bit(&mut self, b: u32) {
+        if self.first {
+            self.first = false;
+        } else {
+            self.w.u(1, b);
+        }
+        while self.outstanding > 0 {
+            self.w.u(1, 1 - b);
+            self.outstanding -= 1;
+        }
+    }
+
+    fn renorm(&mut self) {
+        while self.range < 256 {
+            if self.low < 256 {
+                self.put_bit(0);
+            } else if self.low >= 512 {
+                self.low -= 512;
+                self.put_bit(1);
+            } else {
+                self.low -= 256;
+                self.outstanding += 1;
+            }
+            self.range <<= 1;
+            self.low <<= 1;
+        }
+    }
+
+    fn decision(&mut self, ctx: &mut Context, bin: u8) {
+        let lps = RANGE_TAB_LPS[ctx.state as usize][((self.range >> 6) & 3) as usize] as u32;
+        self.range -= lps;
+        if bin != ctx.mps {
+            self.low += self.range;
+            self.range = lps;
+            if ctx.state == 0 {
+                ctx.mps = 1 - ctx.mps;
+            }
+            ctx.state = TRANS_IDX_LPS[ctx.state as usize];
+        } else {
+            ctx.state = (ctx.state + 1).min(62);
+        }
+        self.renorm();
+    }
+
+    /// Codes end_of_slice_flag; the final flush also writes the stop bit.
+    fn terminate(&mut self, last: bool) {
+        self.range -= 2;
+        if last {
+            self.low += self.range;
+            self.range = 2;
+            self.renorm();
+            self.put_bit((self.low >> 9) & 1);
+            self.w.u(2, ((self.low >> 7) & 3) | 1);
+        } else {
+            self.renorm();
+        }
+    }
+}
+
+struct LastPicture {
+    header: SliceHeader,
+    /// nal_ref_idc of H.264, 0 for non-reference pictures of both formats.
+    nal_ref_idc: u8,
+}
+
+/// Tracks the encoder output and builds skip pictures continuing it.
+pub struct SkipFrames {
+    format: DataFormat,
+    /// First slice of the last picture, with the numbering as sent.
+    last: Option<LastPicture>,
+    frame_num_offset: u32,
+    poc_offset: u32,
+    /// POC LSB distance between consecutive encoder pictures.
+    poc_step: u32,
+    last_encoder_poc_lsb: Option<u32>,
+    /// Set once the encoder uses several or long-term references.
+    unsupported: bool,
+}
+
+impl SkipFrames {
+    pub fn new(format: DataFormat) -> Self {
+        Self {
+            format,
+            last: None,
+            frame_num_offset: 0,
+            poc_offset: 0,
+            poc_step: if format == H264 { 2 } else { 1 },
+            last_encoder_poc_lsb: None,
+            unsupported: !matches!(format, H264 | H265),
+        }
+    }
+
+    /// Follows an encoder packet already run through `parser`, renumbering
+    /// its slices after the skip pictures sent since its predecessor.
+    pub fn follow(&mut self, parser: &Parser, data: &mut Vec<u8>) {
+        if self.unsupported {
+            return;
+        }
+        let hdr_len = if self.format == H264 { 1 } else { 2 };
+        let mut out: Option<Vec<u8>> = None;
+        let mut copied = 0;
+        let mut first: Option<LastPicture> = None;
+        let mut pos = 0;
+        while let Some(n) = nal::next_nal(data, pos) {
+            pos = n.end;
+            let p = n.payload(data);
+            if p.len() <= hdr_len || !nal::is_slice(self.format, nal::nal_type(self.format, p[0])) {
+                continue;
+            }
+            let mut header = match parser.slice_header(p) {
+                Some(h) => h,
+                None => {
+                    // the numbering of this picture is unknown
+                    self.last = None;
+                    return;
+                }
+            };
+            let t = nal::nal_type(self.format, p[0]);
+            let nal_ref_idc = match self.format {
+                H264 => (p[0] >> 5) & 0x03,
+                _ => (t >= nal::HEVC_NAL_BLA_W_LP || t % 2 == 1) as u8,
+            };
+            if first.is_none() {
+                let idr = match self.format {
+                    H264 => t == nal::H264_NAL_IDR,
+                    _ => (nal::HEVC_NAL_BLA_W_LP..=nal::HEVC_NAL_IDR_N_LP).contains(&t),
+                };
+                if idr {
+                    self.frame_num_offset = 0;
+                    self.poc_offset = 0;
+                }
+                if let (Some((lsb, _)), Some(last)) = (header.poc_lsb, self.last_encoder_poc_lsb) {
+                    if !idr && lsb != last {
+                        self.poc_step = lsb.wrapping_sub(last) & self.poc_mask(parser, &header);
+                    }
+                }
+                self.last_encoder_poc_lsb = Some(header.poc_lsb.map_or(0, |p| p.0));
+            }
+            self.unsupported |= header.long_term
+                || header.refs > 1
+                || header.list_modification
+                || header.picture_type == PictureType::B;
+            if self.frame_num_offset != 0 || self.poc_offset != 0 {
+                let mut rbsp = nal::unescape(&p[hdr_len..]);
+                if self.renumber(parser, &mut header, &mut rbsp).is_none() {
+                    self.unsupported = true;
+                    return;
+                }
+                let buf = out.get_or_insert_with(|| Vec::with_capacity(data.len() + 16));
+                buf.extend_from_slice(&data[copied..n.header + hdr_len]);
+                nal::escape(&rbsp, buf);
+                copied = n.end;
+            }
+            if first.is_none() {
+                first = Some(LastPicture {
+                    header,
+                    nal_ref_idc,
+                });
+            }
+        }
+        if let Some(mut buf) = out {
+            buf.extend_from_slice(&data[copied..]);
+            *data = buf;
+        }
+        if first.is_some() {
+            self.last = first;
+        }
+    }
+
+    fn poc_mask(&self, parser: &Parser, header: &SliceHeader) -> u32 {
+        let bits = match self.format {
+            H264 => parser
+                .h264_params(header.pps_id)
+                .map(|p| p.0.log2_max_poc_lsb),
+            _ => parser
+                .hevc_params(header.pps_id)
+                .map(|p| p.0.log2_max_poc_lsb),
+        };
+        (1u32 << bits.unwrap_or(16).min(16)) - 1
+    }
+
+    fn renumber(&self, parser: &Parser, header: &mut SliceHeader, rbsp: &mut [u8]) -> Option<()> {
+        let (frame_num_bits, poc_bits) = match self.format {
+            H264 => {
+                let (sps, _) = parser.h264_params(header.pps_id)?;
+                (sps.log2_max_frame_num, sps.log2_max_poc_lsb)
+            }
+            _ => (0, parser.hevc_params(header.pps_id)?.0.log2_max_poc_lsb),
+        };
+        if let Some((v, pos)) = header.frame_num.as_mut() {
+            *v = (*v + self.frame_num_offset) & ((1 << frame_num_bits) - 1);
+            bits::put_bits_at(rbsp, *pos, frame_num_bits, *v)?;
+        }
+        if let Some((v, pos)) = header.poc_lsb.as_mut() {
+            *v = (*v + self.poc_offset) & ((1 << poc_bits) - 1);
+            bits::put_bits_at(rbsp, *pos, poc_bits, *v)?;
+        }
+        Some(())
+    }
+
+    /// Builds an Annex-B skip picture repeating the last picture, or `None`
+    /// when the stream does not allow one. The next encoder packets passed
+    /// to `follow` are renumbered accordingly.
+    pub fn next(&mut self, parser: &Parser) -> Option<Vec<u8>> {
+        if self.unsupported {
+            return None;
+        }
+        let last = self.last.as_ref()?;
+        if last.nal_ref_idc == 0 || last.header.picture_type == PictureType::B {
+            return None;
+        }
+        let h = &last.header;
+        let (data, frame_num, poc_lsb) = match self.format {
+            H264 => {
+                let (sps, pps) = parser.h264_params(h.pps_id)?;
+                let frame_num = (h.frame_num?.0 + 1) & ((1 << sps.log2_max_frame_num) - 1);
+                let poc_lsb = h
+                    .poc_lsb
+                    .map(|(v, _)| (v + self.poc_step) & ((1 << sps.log2_max_poc_lsb) - 1));
+                let data = h264_skip(sps, pps, last.nal_ref_idc, frame_num, poc_lsb)?;
+                (data, Some(frame_num), poc_lsb)
+            }
+            _ => {
+                let (sps, pps) = parser.hevc_params(h.pps_id)?;
+                let poc_lsb = (h.poc_lsb.map_or(0, |p| p.0) + self.poc_step)
+                    & ((1 << sps.log2_max_poc_lsb) - 1);
+                let rps = match h.rps.as_ref() {
+                    Some(rps) if !rps.negative.is_empty() => rps.clone(),
+                    _ => ShortTermRps {
+                        negative: vec![(-(self.poc_step as i32), true)],
+                        positive: vec![],
+                    },
+                };
+                // the picture repeated must be the one predicted from
+                if rps.negative[0] != (-(self.poc_step as i32), true) {
+                    return None;
+                }
+                let data = hevc_skip(sps, pps, poc_lsb, &rps)?;
+                self.last.as_mut()?.header.rps = Some(rps);
+                (data, None, Some(poc_lsb))
+            }
+        };
+        let last = self.last.as_mut()?;
+        if let Some(v) = frame_num {
+            last.header.frame_num = Some((v, 0));
+            self.frame_num_offset += 1;
+        }
+        if let Some(v) = poc_lsb {
+            last.header.poc_lsb = Some((v, 0));
+            self.poc_offset += self.poc_step;
+        }
+        // keep the offsets small, only their value modulo the field size matters
+        self.frame_num_offset &= 0xFFFF;
+        self.poc_offset &= 0xFFFF;
+        Some(data)
+    }
+}
+
+fn annexb(header: &[u8], rbsp: &[u8]) -> Vec<u8> {
+    let mut data = vec![0, 0, 0, 1];
+    data.extend_from_slice(header);
+    nal::escape(rbsp, &mut data);
+    data
+}
+
+fn h264_skip(
+    sps: &H264Sps,
+    pps: &H264Pps,
+    nal_ref_idc: u8,
+    frame_num: u32,
+    poc_lsb: Option<u32>,
+) -> Option<Vec<u8>> {
+    if !sps.frame_mbs_only || sps.separate_colour_plane || sps.pic_order_cnt_type == 1 {
+        return None;
+    }
+    let mut w = BitWriter::new();
+    w.ue(0); // first_mb_in_slice
+    w.ue(5); // slice_type, P for the whole picture
+    w.ue(pps.id);
+    w.u(sps.log2_max_frame_num, frame_num);
+    if sps.pic_order_cnt_type == 0 {
+        w.u(sps.log2_max_poc_lsb, poc_lsb?);
+        if pps.bottom_field_pic_order_in_frame_present {
+            w.se(0);
+        }
+    }
+    if pps.redundant_pic_cnt_present {
+        w.ue(0);
+    }
+    // num_ref_idx_active_override_flag
+    w.flag(pps.num_ref_idx_l0_default != 1);
+    if pps.num_ref_idx_l0_default != 1 {
+        w.ue(0);
+    }
+    w.flag(false); // ref_pic_list_modification_flag_l0
+    if pps.weighted_pred {
+        let chroma = sps.chroma_format_idc != 0;
+        w.ue(0); // luma_log2_weight_denom
+        if chroma {
+            w.ue(0);
+        }
+        w.flag(false);
+        if chroma {
+            w.flag(false);
+        }
+    }
+    w.flag(false); // adaptive_ref_pic_marking_mode_flag
+    if pps.entropy_coding_mode {
+        w.ue(0); // cabac_init_idc
+    }
+    w.se(0); // slice_qp_delta
+    if pps.deblocking_filter_control_present {
+        w.ue(1); // disable_deblocking_filter_idc
+    }
+    let mbs = sps.width_in_mbs * sps.height_in_mbs();
+    if pps.entropy_coding_mode {
+        while !w.byte_aligned() {
+            w.u(1, 1); // cabac_alignment_one_bit
+        }
+        let (m, n) = H264_MB_SKIP_INIT;
+        // neighbours are skipped or unavailable, so ctxIdxInc is always 0
+        let mut ctx = Context::new(m, n, pps.pic_init_qp);
+        let mut c = Cabac::new(&mut w);
+        for i in 0..mbs {
+            c.decision(&mut ctx, 1);
+            c.terminate(i + 1 == mbs);
+        }
+        while !w.byte_aligned() {
+            w.u(1, 0);
+        }
+    } else {
+        w.ue(mbs); // mb_skip_run
+        w.trailing_bits();
+    }
+    Some(annexb(
+        &[(nal_ref_idc << 5) | nal::H264_NAL_SLICE],
+        &w.into_bytes(),
+    ))
+}
+
+struct CodingTree<'a> {
+    cabac: Cabac<'a>,
+    width: u32,
+    height: u32,
+    log2_min_cb: u32,
+    /// CtDepth per minimum coding block.
+    depth: Vec<u8>,
+    split: [Context; 3],
+    skip: [Context; 3],
+}
+
+impl CodingTree<'_> {
+    fn depth_at(&self, x: u32, y: u32) -> u8 {
+        let stride = self.width >> self.log2_min_cb;
+        self.depth[((y >> self.log2_min_cb) * stride + (x >> self.log2_min_cb)) as usize]
+    }
+
+    fn quadtree(&mut self, x0: u32, y0: u32, log2: u32, depth: u8) {
+        let size = 1 << log2;
+        let split =
+            if x0 + size <= self.width && y0 + size <= self.height && log2 > self.log2_min_cb {
+                let inc = (x0 > 0 && self.depth_at(x0 - 1, y0) > depth) as usize
+                    + (y0 > 0 && self.depth_at(x0, y0 - 1) > depth) as usize;
+                self.cabac.decision(&mut self.split[inc], 0);
+                false
+            } else {
+                log2 > self.log2_min_cb
+            };
+        if split {
+            let half = size / 2;
+            for (dx, dy) in [(0, 0), (half, 0), (0, half), (half, half)] {
+                if x0 + dx < self.width && y0 + dy < self.height {
+                    self.quadtree(x0 + dx, y0 + dy, log2 - 1, depth + 1);
+                }
+            }
+            return;
+        }
+        // every coded neighbour is skipped
+        let inc = (x0 > 0) as usize + (y0 > 0) as usize;
+        self.cabac.decision(&mut self.skip[inc], 1);
+        let stride = self.width >> self.log2_min_cb;
+        let (x1, y1) = ((x0 + size).min(self.width), (y0 + size).min(self.height));
+        for y in (y0..y1).step_by(1 << self.log2_min_cb) {
+            for x in (x0..x1).step_by(1 << self.log2_min_cb) {
+                self.depth[((y >> self.log2_min_cb) * stride + (x >> self.log2_min_cb)) as usize] =
+                    depth;
+            }
+        }
+    }
+}
+
+fn hevc_skip(sps: &HevcSps, pps: &HevcPps, poc_lsb: u32, rps: &ShortTermRps) -> Option<Vec<u8>> {
+    if sps.separate_colour_plane
+        || sps.temporal_mvp
+        || pps.transquant_bypass
+        || pps.tiles
+        || pps.entropy_coding_sync
+        || pps.extensions
+        // ref_pic_lists_modification() is not written
+        || (pps.lists_modification_present && rps.used_count() > 1)
+    {
+        return None;
+    }
+    let chroma = sps.chroma_array_type() != 0;
+    let mut w = BitWriter::new();
+    w.flag(true); // first_slice_segment_in_pic_flag
+    w.ue(pps.id);
+    w.u(pps.num_extra_slice_header_bits, 0);
+    w.ue(1); // slice_type P
+    if pps.output_flag_present {
+        w.flag(true);
+    }
+    w.u(sps.log2_max_poc_lsb, poc_lsb);
+    w.flag(false); // short_term_ref_pic_set_sps_flag
+    if !sps.short_term_rps.is_empty() {
+        w.flag(false); // inter_ref_pic_set_prediction_flag
+    }
+    w.ue(rps.negative.len() as u32);
+    w.ue(rps.positive.len() as u32);
+    let mut prev = 0;
+    for &(delta, used) in rps.negative.iter() {
+        w.ue((prev - delta - 1) as u32);
+        w.flag(used);
+        prev = delta;
+    }
+    prev = 0;
+    for &(delta, used) in rps.positive.iter() {
+        w.ue((delta - prev - 1) as u32);
+        w.flag(used);
+        prev = delta;
+    }
+    if sps.long_term_refs_present {
+        if !sps.long_term_ref_pics_used.is_empty() {
+            w.ue(0); // num_long_term_sps
+        }
+        w.ue(0); // num_long_term_pics
+    }
+    if sps.sample_adaptive_offset {
+        w.flag(false);
+        if chroma {
+            w.flag(false);
+        }
+    }
+    // num_ref_idx_active_override_flag
+    w.flag(pps.num_ref_idx_l0_default != 1);
+    if pps.num_ref_idx_l0_default != 1 {
+        w.ue(0);
+    }
+    if pps.cabac_init_present {
+        w.flag(false);
+    }
+    if pps.weighted_pred {
+        w.ue(0); // luma_log2_weight_denom
+        if chroma {
+            w.se(0);
+        }
+        w.flag(false);
+        if chroma {
+            w.flag(false);
+        }
+    }
+    w.ue(4); // five_minus_max_num_merge_cand, so no merge_idx
+    w.se(0); // slice_qp_delta
+    if pps.slice_chroma_qp_offsets_present {
+        w.se(0);
+        w.se(0);
+    }
+    if pps.deblocking_filter_override_enabled {
+        w.flag(false);
+    }
+    if pps.loop_filter_across_slices && !pps.deblocking_filter_disabled {
+        w.flag(false);
+    }
+    if pps.slice_header_extension_present {
+        w.ue(0);
+    }
+    w.trailing_bits(); // byte_alignment()
+
+    let log2_ctb = sps.log2_ctb_size;
+    let ctb = 1 << log2_ctb;
+    let (width, height) = (sps.width, sps.height);
+    let min_cbs = (width >> sps.log2_min_cb_size) * (height >> sps.log2_min_cb_size);
+    let mut tree = CodingTree {
+        cabac: Cabac::new(&mut w),
+        width,
+        height,
+        log2_min_cb: sps.log2_min_cb_size,
+        depth: vec![0; min_cbs as usize],
+        split: HEVC_SPLIT_CU_INIT.map(|v| Context::hevc(v, pps.init_qp)),
+        skip: HEVC_CU_SKIP_INIT.map(|v| Context::hevc(v, pps.init_qp)),
+    };
+    let ctbs = sps.ctb_count();
+    let columns = (width + ctb - 1) / ctb;
+    for i in 0..ctbs {
+        tree.quadtree((i % columns) * ctb, (i / columns) * ctb, log2_ctb, 0);
+        tree.cabac.terminate(i + 1 == ctbs);
+    }
+    while !w.byte_aligned() {
+        w.u(1, 0);
+    }
+    let header = [nal::HEVC_NAL_TRAIL_R << 1, 1];
+    Some(annexb(&header, &w.into_bytes()))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::params::{parse_hevc_pps, parse_hevc_sps};
+
+    fn hevc_params() -> (HevcSps, HevcPps) {
+        let clip = unsafe {
+            let (mut p, mut len) = (std::ptr::null_mut(), 0);
+            crate::gpu_video_codec_get_bin_file(H265 as _, &mut p, &mut len);
+            std::slice::from_raw_parts(p, len as usize).to_vec()
+        };
+        let unit = |t: u8| {
+            nal::nal_units(&clip)
+                .map(|n| n.payload(&clip))
+                .find(|p| nal::nal_type(H265, p[0]) == t)
+                .unwrap()
+        };
+        (
+            parse_hevc_sps(unit(nal::HEVC_NAL_SPS)).unwrap(),
+            parse_hevc_pps(unit(nal::HEVC_NAL_PPS)).unwrap(),
+        )
+    }
+
+    #[test]
+    fn hevc_skip_needs_no_list_modification() {
+        let (sps, mut pps) = hevc_params();
+        let one = ShortTermRps {
+            negative: vec![(-1, true), (-2, false)],
+            ..Default::default()
+        };
+        let two = ShortTermRps {
+            negative: vec![(-1, true), (-2, true)],
+            ..Default::default()
+        };
+        pps.lists_modification_present = false;
+        assert!(hevc_skip(&sps, &pps, 1, &one).is_some());
+        assert!(hevc_skip(&sps, &pps, 1, &two).is_some());
+        pps.lists_modification_present = true;
+        assert!(hevc_skip(&sps, &pps, 1, &one).is_some());
+        assert!(hevc_skip(&sps, &pps, 1, &two).is_none());
+    }
+}
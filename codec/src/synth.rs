@@ -0,0 +1,392 @@
+//! Synthetic remote desktop content for benchmarks: BGRA sequences of text
+//! scrolling, a window dragged over the desktop, video playing in a window,
+//! an idle editor with a blinking caret and full screen game-like motion.
+//!
+//! Frame `n` depends only on the scenario, size, frame rate, seed and `n`,
+//! and is drawn with integer arithmetic, so results on different machines
+//! are comparable.
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Scenario {
+    /// A full screen text window scrolling 240 pixels a second.
+    ScrollingText,
+    /// A text window moving over the desktop.
+    WindowDrag,
+    /// A window playing video in part of its area, every frame changes.
+    Video,
+    /// An editor with a blinking caret, the only change.
+    IdleCaret,
+    /// Everything moves: a panning textured scene with sprites and grain.
+    Gaming,
+}
+
+impl Scenario {
+    pub const ALL: [Scenario; 5] = [
+        Scenario::ScrollingText,
+        Scenario::WindowDrag,
+        Scenario::Video,
+        Scenario::IdleCaret,
+        Scenario::Gaming,
+    ];
+}
+
+const BPP: usize = 4;
+const CELL_WIDTH: i64 = 8;
+const CELL_HEIGHT: i64 = 16;
+const TITLE_HEIGHT: i64 = 24;
+const SCROLL_SPEED: i64 = 240;
+const CARET_PERIOD_MS: i64 = 530;
+
+const WHITE: [u8; 4] = [0xff, 0xff, 0xff, 0xff];
+const TEXT: [u8; 4] = [0x20, 0x20, 0x20, 0xff];
+const BORDER: [u8; 4] = [0x80, 0x80, 0x80, 0xff];
+const TITLE: [u8; 4] = [0xd7, 0x78, 0x00, 0xff];
+const ICON: [u8; 4] = [0x40, 0xb0, 0xe0, 0xff];
+
+fn hash(mut x: u64) -> u64 {
+    x = (x ^ (x >> 30)).wrapping_mul(0xbf58476d1ce4e5b9);
+    x = (x ^ (x >> 27)).wrapping_mul(0x94d049bb133111eb);
+    x ^ (x >> 31)
+}
+
+fn hash3(a: u64, b: u64, c: u64) -> u64 {
+    hash(a.wrapping_mul(0x9e3779b97f4a7c15) ^ hash(b.wrapping_add(hash(c))))
+}
+
+/// Smooth periodic wave of period 256, 0 to 255.
+fn wave(phase: i64) -> i64 {
+    let p = phase.rem_euclid(256);
+    let half = p % 128;
+    let bump = half * (128 - half) * 127 / 4096;
+    if p < 128 {
+        128 + bump
+    } else {
+        128 - bump
+    }
+}
+
+/// Triangle wave of `period`, 0 to `amplitude` and back.
+fn triangle(t: i64, period: i64, amplitude: i64) -> i64 {
+    let p = t.rem_euclid(period);
+    let up = if 2 * p < period { p } else { period - p };
+    2 * up * amplitude / period
+}
+
+#[derive(Debug, Clone, Copy)]
+struct Rect {
+    x: i64,
+    y: i64,
+    w: i64,
+    h: i64,
+}
+
+impl Rect {
+    fn inset(self, left: i64, top: i64, right: i64, bottom: i64) -> Rect {
+        Rect {
+            x: self.x + left,
+            y: self.y + top,
+            w: (self.w - left - right).max(0),
+            h: (self.h - top - bottom).max(0),
+        }
+    }
+}
+
+struct Canvas<'a> {
+    buf: &'a mut [u8],
+    width: i64,
+    height: i64,
+}
+
+impl Canvas<'_> {
+    /// The on-screen part of `r` as column and row ranges.
+    fn clip(&self, r: Rect) -> (std::ops::Range<i64>, std::ops::Range<i64>) {
+        let x = r.x.clamp(0, self.width)..(r.x + r.w).clamp(0, self.width);
+        let y = r.y.clamp(0, self.height)..(r.y + r.h).clamp(0, self.height);
+        (x, y)
+    }
+
+    fn row(&mut self, y: i64, x: std::ops::Range<i64>) -> &mut [u8] {
+        let start = (y * self.width + x.start) as usize * BPP;
+        &mut self.buf[start..][..(x.end - x.start) as usize * BPP]
+    }
+
+    fn fill(&mut self, r: Rect, color: [u8; 4]) {
+        let (xs, ys) = self.clip(r);
+        for y in ys {
+            for p in self.row(y, xs.clone()).chunks_exact_mut(BPP) {
+                p.copy_from_slice(&color);
+            }
+        }
+    }
+
+    /// Vertical blue gradient.
+    fn desktop(&mut self) {
+        for y in 0..self.height {
+            let v = (y * 96 / self.height.max(1)) as u8;
+            let color = [0xa0 - v / 2, 0x60 - v / 2, 0x20, 0xff];
+            self.fill(
+                Rect {
+                    x: 0,
+                    y,
+                    w: self.width,
+                    h: 1,
+                },
+                color,
+            );
+        }
+        for i in 0..6 {
+            let icon = Rect {
+                x: 24,
+                y: 24 + i * 96,
+                w: 48,
+                h: 48,
+            };
+            self.fill(icon, ICON);
+        }
+    }
+
+    /// A window with a title bar, returning its client area.
+    fn window(&mut self, r: Rect) -> Rect {
+        self.fill(r, BORDER);
+        self.fill(r.inset(1, 1, 1, 1), TITLE);
+        let client = r.inset(1, 1 + TITLE_HEIGHT, 1, 1);
+        self.fill(client, WHITE);
+        client
+    }
+
+    /// Text filling `r`, its first line `scroll` pixels above the top.
+    fn text(&mut self, r: Rect, scroll: i64, seed: u64) {
+        let (xs, ys) = self.clip(r);
+        let columns = (r.w - 8).max(0) / CELL_WIDTH;
+        for y in ys {
+            let ly = y - r.y + scroll;
+            let (line, gy) = (ly.div_euclid(CELL_HEIGHT), ly.rem_euclid(CELL_HEIGHT));
+            let x0 = xs.start;
+            let row = self.row(y, xs.clone());
+            for (i, p) in row.chunks_exact_mut(BPP).enumerate() {
+                let lx = x0 + i as i64 - r.x - 4;
+                if lx < 0 {
+                    continue;
+                }
+                let bits = glyph_row(char_at(seed, line, lx / CELL_WIDTH, columns), gy);
+                if bits >> (lx % CELL_WIDTH) & 1 != 0 {
+                    p.copy_from_slice(&TEXT);
+                }
+            }
+        }
+    }
+
+    /// Moving waves with grain, a stand-in for camera video.
+    fn video(&mut self, r: Rect, n: u64, t: i64) {
+        let (xs, ys) = self.clip(r);
+        for y in ys {
+            let x0 = xs.start;
+            let row = self.row(y, xs.clone());
+            let vy = y - r.y;
+            for (i, p) in row.chunks_exact_mut(BPP).enumerate() {
+                let vx = x0 + i as i64 - r.x;
+                let a = wave(vx / 3 + t / 12);
+                let b = wave(vy / 2 - t / 20 + vx / 7);
+                let grain = (hash3(n, vx as u64, vy as u64) & 15) as i64 - 8;
+                let c = |v: i64| (v + grain).clamp(0, 255) as u8;
+                p.copy_from_slice(&[c((a + b) / 2), c(b * 3 / 4), c(a * 3 / 4 + 32), 0xff]);
+            }
+        }
+    }
+
+    /// A panning scene of textured cells under a sky, sprites, grain.
+    fn game(&mut self, n: u64, t: i64) {
+        let (w, h) = (self.width, self.height);
+        let (cam_x, cam_y) = (t * 400 / 1000, triangle(t, 5000, h / 8));
+        let horizon = h / 3;
+        for y in 0..h {
+            let row = self.row(y, 0..w);
+            for (x, p) in row.chunks_exact_mut(BPP).enumerate() {
+                let x = x as i64;
+                let grain = (hash3(n, x as u64, y as u64) & 7) as i64 - 4;
+                let c = if y < horizon {
+                    let v = y * 128 / horizon.max(1);
+                    [0xff - v / 2, 0xc0 - v / 2, 0x80 + v / 4]
+                } else {
+                    let (wx, wy) = (x + cam_x, (y - horizon) * 2 + cam_y);
+                    let cell = hash3(7, (wx >> 5) as u64, (wy >> 5) as u64);
+                    let shade = (wx & 31) + (wy & 31);
+                    [
+                        0x30 + (cell & 63) as i64 + shade,
+                        0x60 + (cell >> 8 & 63) as i64 + shade,
+                        0x30 + (cell >> 16 & 31) as i64,
+                    ]
+                };
+                let g = |v: i64| (v + grain).clamp(0, 255) as u8;
+                p.copy_from_slice(&[g(c[0]), g(c[1]), g(c[2]), 0xff]);
+            }
+        }
+        for i in 0..8 {
+            let size = h / 12 + i * 4;
+            let sprite = Rect {
+                x: triangle(t + i * 700, 3000 + i * 400, (w - size).max(0)),
+                y: horizon + triangle(t + i * 300, 2000 + i * 250, (h - horizon - size).max(0)),
+                w: size,
+                h: size,
+            };
+            let color = hash(i as u64) as u32 | 0xff00_0000;
+            self.fill(sprite, color.to_le_bytes());
+        }
+    }
+}
+
+/// Glyph of the character at `column` of `line`, 0 for a blank. Lines have
+/// indents, words and lengths up to `columns`.
+fn char_at(seed: u64, line: i64, column: i64, columns: i64) -> u64 {
+    let l = hash3(seed, line as u64, u64::MAX);
+    let indent = (l >> 8 & 3) as i64 * 4;
+    if column < indent || column >= (l % (columns as u64 + 1)) as i64 {
+        return 0;
+    }
+    let c = hash3(seed, line as u64, column as u64);
+    if c % 6 == 0 {
+        0
+    } else {
+        1 + (c >> 8) % 94
+    }
+}
+
+/// Pixels of row `y` of a glyph, bit `x` for column `x`.
+fn glyph_row(glyph: u64, y: i64) -> u8 {
+    if glyph == 0 || !(3..13).contains(&y) {
+        return 0;
+    }
+    hash3(glyph, y as u64, 0) as u8 & 0x7e
+}
+
+/// Generates the frames of one scenario.
+pub struct ScreenContent {
+    scenario: Scenario,
+    width: usize,
+    height: usize,
+    fps: u32,
+    seed: u64,
+    next: u64,
+    buf: Vec<u8>,
+}
+
+impl ScreenContent {
+    pub fn new(scenario: Scenario, width: usize, height: usize, fps: u32) -> Self {
+        Self {
+            scenario,
+            width,
+            height,
+            fps: fps.max(1),
+            seed: 0,
+            next: 0,
+            buf: vec![0; width * height * BPP],
+        }
+    }
+
+    /// Varies the text and textures, 0 by default.
+    pub fn with_seed(mut self, seed: u64) -> Self {
+        self.seed = seed;
+        self
+    }
+
+    pub fn scenario(&self) -> Scenario {
+        self.scenario
+    }
+
+    pub fn width(&self) -> usize {
+        self.width
+    }
+
+    pub fn height(&self) -> usize {
+        self.height
+    }
+
+    /// Rows of the frames are packed.
+    pub fn stride(&self) -> usize {
+        self.width * BPP
+    }
+
+    /// The frame after the last one returned by `next_frame`, the first
+    /// frame at the start.
+    pub fn next_frame(&mut self) -> &[u8] {
+        let n = self.next;
+        self.next += 1;
+        self.frame(n)
+    }
+
+    /// Frames `n..n + count`, for benchmarks that must not time drawing.
+    pub fn frames(&mut self, n: u64, count: usize) -> Vec<Vec<u8>> {
+        (n..n + count as u64)
+            .map(|i| self.frame(i).to_vec())
+            .collect()
+    }
+
+    /// Frame `n`, shown at `n / fps` seconds.
+    pub fn frame(&mut self, n: u64) -> &[u8] {
+        let t = (n * 1000 / self.fps as u64) as i64;
+        let seed = self.seed;
+        let (w, h) = (self.width as i64, self.height as i64);
+        let mut c = Canvas {
+            buf: &mut self.buf,
+            width: w,
+            height: h,
+        };
+        let screen = Rect { x: 0, y: 0, w, h };
+        match self.scenario {
+            Scenario::ScrollingText => {
+                let client = c.window(screen);
+                c.text(client, t * SCROLL_SPEED / 1000, seed);
+            }
+            Scenario::WindowDrag => {
+                c.desktop();
+                let (ww, wh) = (w / 2, h / 2);
+                let window = Rect {
+                    x: triangle(t, 4000, w - ww) - ww / 8,
+                    y: triangle(t, 2600, h - wh),
+                    w: ww,
+                    h: wh,
+                };
+                let client = c.window(window);
+                c.text(client, 0, seed);
+            }
+            Scenario::Video => {
+                c.desktop();
+                let window = Rect {
+                    x: w / 8,
+                    y: h / 8,
+                    w: w * 3 / 4,
+                    h: h * 3 / 4,
+                };
+                let client = c.window(window);
+                c.text(client.inset(0, 0, 0, client.h * 3 / 5), 0, seed);
+                c.video(
+                    client.inset(client.w / 8, client.h * 2 / 5, client.w / 8, 8),
+                    n,
+                    t,
+                );
+            }
+            Scenario::IdleCaret => {
+                c.desktop();
+                let window = Rect {
+                    x: w / 6,
+                    y: h / 8,
+                    w: w * 2 / 3,
+                    h: h * 3 / 4,
+                };
+                let client = c.window(window);
+                c.text(client, 0, seed);
+                if (t / CARET_PERIOD_MS) % 2 == 0 {
+                    let caret = Rect {
+                        x: client.x + 4 + 12 * CELL_WIDTH,
+                        y: client.y + 5 * CELL_HEIGHT + 1,
+                        w: 2,
+                        h: CELL_HEIGHT - 2,
+                    };
+                    c.fill(caret, TEXT);
+                }
+            }
+            Scenario::Gaming => c.game(n, t),
+        }
+        &self.buf
+    }
+}
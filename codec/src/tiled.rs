@@ -0,0 +1,815 @@
+//! Desktops larger than one encoder session takes, split into a grid of
+//! regions each encoded by its own `Encoder`, possibly on different
+//! adapters, and put back together on the decode side.
+//!
+//! Region edges fall on the 64-pixel tiles of `dirty`, so one comparison of
+//! the whole capture tells which regions changed; static regions are not
+//! encoded at all and keep their last picture on the decode side. Every
+//! packet is tagged with a `TileHeader` giving its region and how many
+//! regions were coded in its frame, which is when the decoder considers the
+//! frame complete.
+
+use crate::{
+    decode::Decoder,
+    dirty::{DirtyMap, FrameDiffer},
+    encode::{EncodeFrame, Encoder},
+    hash::TILE_SIZE,
+};
+use gpu_common::{DecodeContext, EncodeContext, FeatureContext};
+use std::{os::raw::c_void, sync::Mutex, thread};
+
+const BPP: usize = 4;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct TileGrid {
+    pub columns: usize,
+    pub rows: usize,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct TileRegion {
+    pub index: usize,
+    pub x: usize,
+    pub y: usize,
+    pub width: usize,
+    pub height: usize,
+}
+
+impl TileGrid {
+    /// Region edges along `size` pixels split in `count`, on tile edges but
+    /// for the last, which is `size`.
+    fn edges(size: usize, count: usize) -> Vec<usize> {
+        (0..=count)
+            .map(|i| match i {
+                i if i == count => size,
+                i => ((size * i / count + TILE_SIZE / 2) / TILE_SIZE * TILE_SIZE).min(size),
+            })
+            .collect()
+    }
+
+    /// Regions of a `width` x `height` frame in raster order, `None` if the
+    /// grid has more columns or rows than the frame has tiles.
+    pub fn regions(&self, width: usize, height: usize) -> Option<Vec<TileRegion>> {
+        if self.columns == 0
+            || self.rows == 0
+            || self.columns > (width + TILE_SIZE - 1) / TILE_SIZE
+            || self.rows > (height + TILE_SIZE - 1) / TILE_SIZE
+        {
+            return None;
+        }
+        let xs = Self::edges(width, self.columns);
+        let ys = Self::edges(height, self.rows);
+        if xs.windows(2).any(|w| w[0] >= w[1]) || ys.windows(2).any(|w| w[0] >= w[1]) {
+            return None;
+        }
+        let mut regions = Vec::with_capacity(self.columns * self.rows);
+        for r in 0..self.rows {
+            for c in 0..self.columns {
+                regions.push(TileRegion {
+                    index: regions.len(),
+                    x: xs[c],
+                    y: ys[r],
+                    width: xs[c + 1] - xs[c],
+                    height: ys[r + 1] - ys[r],
+                });
+            }
+        }
+        Some(regions)
+    }
+
+    /// The smallest grid whose regions fit `max_width` x `max_height`.
+    pub fn fit(width: usize, height: usize, max_width: usize, max_height: usize) -> Option<Self> {
+        let count = |size: usize, max: usize| {
+            (1..=(size + TILE_SIZE - 1) / TILE_SIZE).find(|&n| {
+                Self::edges(size, n)
+                    .windows(2)
+                    .all(|w| w[0] < w[1] && w[1] - w[0] <= max)
+            })
+        };
+        Some(Self {
+            columns: count(width, max_width)?,
+            rows: count(height, max_height)?,
+        })
+    }
+}
+
+/// Tag sent in front of every region packet, see `write` and `read`.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub struct TileHeader {
+    pub frame: u64,
+    pub region: u16,
+    /// Regions in the grid.
+    pub regions: u16,
+    /// Regions coded in this frame.
+    pub coded: u16,
+    pub x: u32,
+    pub y: u32,
+    pub width: u32,
+    pub height: u32,
+    pub frame_width: u32,
+    pub frame_height: u32,
+}
+
+impl TileHeader {
+    pub const SIZE: usize = 38;
+
+    pub fn write(&self, out: &mut Vec<u8>) {
+        out.extend_from_slice(&self.frame.to_le_bytes());
+        for v in [self.region, self.regions, self.coded] {
+            out.extend_from_slice(&v.to_le_bytes());
+        }
+        for v in [
+            self.x,
+            self.y,
+            self.width,
+            self.height,
+            self.frame_width,
+            self.frame_height,
+        ] {
+            out.extend_from_slice(&v.to_le_bytes());
+        }
+    }
+
+    /// Splits a tagged packet into its header and payload.
+    pub fn read(data: &[u8]) -> Option<(Self, &[u8])> {
+        if data.len() < Self::SIZE {
+            return None;
+        }
+        let u16_at = |i: usize| u16::from_le_bytes([data[i], data[i + 1]]);
+        let u32_at = |i: usize| u32::from_le_bytes(data[i..i + 4].try_into().unwrap());
+        let header = Self {
+            frame: u64::from_le_bytes(data[..8].try_into().unwrap()),
+            region: u16_at(8),
+            regions: u16_at(10),
+            coded: u16_at(12),
+            x: u32_at(14),
+            y: u32_at(18),
+            width: u32_at(22),
+            height: u32_at(26),
+            frame_width: u32_at(30),
+            frame_height: u32_at(34),
+        };
+        (header.region < header.regions
+            && header.coded <= header.regions
+            && header
+                .x
+                .checked_add(header.width)
+                .map_or(false, |r| r <= header.frame_width)
+            && header
+                .y
+                .checked_add(header.height)
+                .map_or(false, |b| b <= header.frame_height))
+        .then_some((header, &data[Self::SIZE..]))
+    }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub struct RegionStats {
+    pub encoded: u64,
+    /// Frames the region was static in and not encoded.
+    pub skipped: u64,
+}
+
+struct Region {
+    rect: TileRegion,
+    encoder: Encoder,
+    coded: bool,
+    stats: RegionStats,
+}
+
+type Upload<'a> = dyn FnMut(&TileRegion, &[u8], usize) -> *mut c_void + 'a;
+type Sink<'a> = dyn FnMut(&TileHeader, &mut Vec<EncodeFrame>) + 'a;
+
+impl Region {
+    fn changed(&self, map: &DirtyMap) -> bool {
+        let r = &self.rect;
+        (r.y / TILE_SIZE..(r.y + r.height + TILE_SIZE - 1) / TILE_SIZE).any(|row| {
+            (r.x / TILE_SIZE..(r.x + r.width + TILE_SIZE - 1) / TILE_SIZE)
+                .any(|column| map.is_dirty(column, row))
+        })
+    }
+
+    fn encode(
+        &mut self,
+        header: TileHeader,
+        pixels: &[u8],
+        stride: usize,
+        upload: &mut Upload,
+        sink: &mut Sink,
+    ) -> Result<(), i32> {
+        let view = &pixels[self.rect.y * stride + self.rect.x * BPP..];
+        let tex = upload(&self.rect, view, stride);
+        let frames = self.encoder.encode(tex)?;
+        sink(
+            &TileHeader {
+                region: self.rect.index as u16,
+                x: self.rect.x as u32,
+                y: self.rect.y as u32,
+                width: self.rect.width as u32,
+                height: self.rect.height as u32,
+                ..header
+            },
+            frames,
+        );
+        self.stats.encoded += 1;
+        Ok(())
+    }
+}
+
+pub struct TiledEncoder {
+    regions: Vec<Region>,
+    differ: FrameDiffer,
+    width: usize,
+    height: usize,
+    frame: u64,
+    threads: usize,
+}
+
+impl TiledEncoder {
+    /// Opens one session per region of `grid` with the settings of `ctx`,
+    /// sized to the region and given its share of the bitrate by area.
+    /// Regions are spread over `adapters` in turn, all on `ctx.f` if empty.
+    pub fn new(
+        ctx: EncodeContext,
+        grid: TileGrid,
+        adapters: &[FeatureContext],
+    ) -> Result<Self, ()> {
+        let (width, height) = (ctx.d.width as usize, ctx.d.height as usize);
+        let rects = grid.regions(width, height).ok_or(())?;
+        let mut regions = Vec::with_capacity(rects.len());
+        for rect in rects {
+            let mut ctx = ctx.clone();
+            if !adapters.is_empty() {
+                ctx.f = adapters[rect.index % adapters.len()].clone();
+            }
+            ctx.d.width = rect.width as i32;
+            ctx.d.height = rect.height as i32;
+            ctx.d.kbitrate = Self::share(ctx.d.kbitrate, &rect, width, height);
+            regions.push(Region {
+                rect,
+                encoder: Encoder::new(ctx)?,
+                coded: false,
+                stats: RegionStats::default(),
+            });
+        }
+        Ok(Self {
+            regions,
+            differ: FrameDiffer::new(0),
+            width,
+            height,
+            frame: 0,
+            threads: 1,
+        })
+    }
+
+    /// Encodes up to `threads` regions at once, 0 for one per region. The
+    /// default of 1 suits sessions sharing a device; `upload` and `sink`
+    /// are never called concurrently.
+    pub fn with_threads(mut self, threads: usize) -> Self {
+        self.threads = threads;
+        self
+    }
+
+    fn share(kbs: i32, rect: &TileRegion, width: usize, height: usize) -> i32 {
+        ((kbs as i64 * (rect.width * rect.height) as i64 / (width * height) as i64) as i32).max(1)
+    }
+
+    pub fn region_count(&self) -> usize {
+        self.regions.len()
+    }
+
+    pub fn region(&self, region: usize) -> &TileRegion {
+        &self.regions[region].rect
+    }
+
+    /// The session of a region.
+    pub fn encoder(&mut self, region: usize) -> &mut Encoder {
+        &mut self.regions[region].encoder
+    }
+
+    pub fn stats(&self, region: usize) -> RegionStats {
+        self.regions[region].stats
+    }
+
+    /// Splits `kbs` over the regions by area.
+    pub fn set_bitrate(&mut self, kbs: i32) -> Result<(), i32> {
+        let (width, height) = (self.width, self.height);
+        let mut result = Ok(());
+        for r in self.regions.iter_mut() {
+            let share = Self::share(kbs, &r.rect, width, height);
+            result = result.and(r.encoder.set_bitrate(share));
+        }
+        result
+    }
+
+    /// Requests a keyframe in every region, so a new receiver can decode
+    /// all of the desktop.
+    pub fn request_keyframe(&self) {
+        for r in self.regions.iter() {
+            r.encoder.request_keyframe();
+        }
+    }
+
+    /// Encodes the regions of a BGRA capture, rows `stride` bytes apart,
+    /// that changed or owe a keyframe. `upload` makes the texture a region
+    /// encodes from its pixels, which start at the given slice with the
+    /// capture's stride. `sink` gets the packets of each region with their
+    /// tag. All regions are tried, the first error is returned.
+    pub fn encode<U, S>(
+        &mut self,
+        pixels: &[u8],
+        stride: usize,
+        upload: U,
+        sink: S,
+    ) -> Result<(), i32>
+    where
+        U: FnMut(&TileRegion, &[u8], usize) -> *mut c_void + Send,
+        S: FnMut(&TileHeader, &mut Vec<EncodeFrame>) + Send,
+    {
+        let (width, height) = (self.width, self.height);
+        if stride < width * BPP || pixels.len() < stride * (height - 1) + width * BPP {
+            return Err(-1);
+        }
+        let map = self.differ.diff(pixels, width, height, stride).ok();
+        let mut coded = 0;
+        for r in self.regions.iter_mut() {
+            r.coded = map.map_or(true, |m| r.changed(m)) || r.encoder.keyframe_due();
+            if r.coded {
+                coded += 1;
+            } else {
+                r.stats.skipped += 1;
+            }
+        }
+        let header = TileHeader {
+            frame: self.frame,
+            regions: self.regions.len() as u16,
+            coded,
+            frame_width: width as u32,
+            frame_height: height as u32,
+            ..Default::default()
+        };
+        self.frame += 1;
+        let threads = match self.threads {
+            0 => self.regions.len(),
+            n => n,
+        }
+        .min(coded as usize)
+        .max(1);
+        if threads == 1 {
+            let (mut upload, mut sink) = (upload, sink);
+            let mut result = Ok(());
+            for r in self.regions.iter_mut().filter(|r| r.coded) {
+                result = result.and(r.encode(header, pixels, stride, &mut upload, &mut sink));
+            }
+            return result;
+        }
+        let upload = Mutex::new(upload);
+        let sink = Mutex::new(sink);
+        let result = Mutex::new(Ok(()));
+        let per_thread = (self.regions.len() + threads - 1) / threads;
+        thread::scope(|s| {
+            for chunk in self.regions.chunks_mut(per_thread) {
+                let (upload, sink, result) = (&upload, &sink, &result);
+                s.spawn(move || {
+                    let mut upload =
+                        |r: &TileRegion, p: &[u8], s: usize| (upload.lock().unwrap())(r, p, s);
+                    let mut sink =
+                        |h: &TileHeader, f: &mut Vec<EncodeFrame>| (sink.lock().unwrap())(h, f);
+                    for r in chunk.iter_mut().filter(|r| r.coded) {
+                        let e = r.encode(header, pixels, stride, &mut upload, &mut sink);
+                        let mut result = result.lock().unwrap();
+                        *result = result.and(e);
+                    }
+                });
+            }
+        });
+        result.into_inner().unwrap()
+    }
+}
+
+/// The latest picture of a region.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct DecodedTile {
+    pub x: u32,
+    pub y: u32,
+    pub width: u32,
+    pub height: u32,
+    /// Texture of the region's decoder, null before its first picture.
+    pub texture: *mut c_void,
+    /// Whether the region was coded in this frame.
+    pub updated: bool,
+}
+
+/// A reassembled frame: each tile is drawn at its position.
+#[derive(Debug, Clone, Default)]
+pub struct TiledFrame {
+    pub frame: u64,
+    pub width: u32,
+    pub height: u32,
+    pub tiles: Vec<DecodedTile>,
+}
+
+/// Decodes tagged region packets, one `Decoder` per region.
+pub struct TiledDecoder {
+    ctx: DecodeContext,
+    decoders: Vec<Option<Decoder>>,
+    current: TiledFrame,
+    /// Whether `current` waits for regions.
+    pending: bool,
+    received: usize,
+    coded: usize,
+}
+
+impl TiledDecoder {
+    pub fn new(ctx: DecodeContext) -> Self {
+        Self {
+            ctx,
+            decoders: vec![],
+            current: TiledFrame::default(),
+            pending: false,
+            received: 0,
+            coded: 0,
+        }
+    }
+
+    /// The decoder of a region, once a packet of it arrived.
+    pub fn decoder(&mut self, region: usize) -> Option<&mut Decoder> {
+        self.decoders.get_mut(region).and_then(|d| d.as_mut())
+    }
+
+    /// Decodes one tagged packet. `on_frame` gets each frame completed:
+    /// once every region coded in it arrived, or, if some never do, when a
+    /// packet of another frame arrives.
+    pub fn decode<F: FnMut(&TiledFrame)>(
+        &mut self,
+        data: &[u8],
+        mut on_frame: F,
+    ) -> Result<(), i32> {
+        let (h, payload) = TileHeader::read(data).ok_or(-1)?;
+        let c = &mut self.current;
+        if self.pending && c.frame != h.frame {
+            on_frame(c);
+            self.pending = false;
+        }
+        if (c.width, c.height, c.tiles.len()) != (h.frame_width, h.frame_height, h.regions as usize)
+        {
+            // a new grid, the old decoders do not continue
+            c.width = h.frame_width;
+            c.height = h.frame_height;
+            c.tiles.clear();
+            c.tiles.resize(
+                h.regions as usize,
+                DecodedTile {
+                    x: 0,
+                    y: 0,
+                    width: 0,
+                    height: 0,
+                    texture: std::ptr::null_mut(),
+                    updated: false,
+                },
+            );
+            self.decoders.clear();
+            self.decoders.resize_with(h.regions as usize, || None);
+        }
+        if !self.pending {
+            c.frame = h.frame;
+            c.tiles.iter_mut().for_each(|t| t.updated = false);
+            self.pending = true;
+            self.received = 0;
+            self.coded = h.coded as usize;
+        }
+        let decoder = match self.decoders[h.region as usize].as_mut() {
+            Some(d) => d,
+            None => self.decoders[h.region as usize]
+                .insert(Decoder::new(self.ctx.clone()).map_err(|_| -1)?),
+        };
+        let result = decoder
+            .decode(payload)
+            .map(|frames| frames.last().map(|f| f.texture));
+        let tile = &mut c.tiles[h.region as usize];
+        tile.x = h.x;
+        tile.y = h.y;
+        tile.width = h.width;
+        tile.height = h.height;
+        if let Ok(Some(texture)) = result {
+            tile.texture = texture;
+        }
+        if !tile.updated {
+            tile.updated = true;
+            self.received += 1;
+        }
+        if self.received >= self.coded {
+            on_frame(c);
+            self.pending = false;
+        }
+        result.map(|_| ())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use gpu_common::{
+        DataFormat::H264, DecodeDriver, DynamicContext, EncodeDriver, FeatureContext, API::API_DX11,
+    };
+    use std::time::Duration;
+
+    const WIDTH: usize = 512;
+    const HEIGHT: usize = 256;
+
+    fn grid(columns: usize, rows: usize) -> TileGrid {
+        TileGrid { columns, rows }
+    }
+
+    fn header() -> TileHeader {
+        TileHeader {
+            frame: 0x0102030405060708,
+            region: 2,
+            regions: 4,
+            coded: 3,
+            x: 640,
+            y: 512,
+            width: 640,
+            height: 568,
+            frame_width: 1280,
+            frame_height: 1080,
+        }
+    }
+
+    fn encoder(grid: TileGrid) -> TiledEncoder {
+        let ctx = EncodeContext {
+            f: FeatureContext {
+                driver: EncodeDriver::CPU,
+                luid: 0,
+                api: API_DX11,
+                data_format: H264,
+            },
+            d: DynamicContext {
+                device: None,
+                width: WIDTH as i32,
+                height: HEIGHT as i32,
+                kbitrate: 1000,
+                framerate: 30,
+                gop: i32::MAX,
+                chroma: Default::default(),
+                range: Default::default(),
+            },
+        };
+        let mut e = TiledEncoder::new(ctx, grid, &[]).unwrap();
+        for i in 0..e.region_count() {
+            e.encoder(i).set_keyframe_window(Duration::ZERO);
+        }
+        e
+    }
+
+    fn decoder() -> TiledDecoder {
+        TiledDecoder::new(DecodeContext {
+            device: None,
+            driver: DecodeDriver::CPU,
+            luid: 0,
+            api: API_DX11,
+            data_format: H264,
+            output_shared_handle: false,
+        })
+    }
+
+    /// Encodes a capture, returns the tagged packets and whether each was a
+    /// keyframe.
+    fn encode(e: &mut TiledEncoder, pixels: &[u8]) -> Vec<(TileHeader, Vec<u8>, bool)> {
+        let mut out = vec![];
+        e.encode(
+            pixels,
+            WIDTH * BPP,
+            |r, data, stride| {
+                assert_eq!(stride, WIDTH * BPP);
+                assert!(data.len() >= stride * (r.height - 1) + r.width * BPP);
+                std::ptr::null_mut()
+            },
+            |h, frames| {
+                let mut packet = vec![];
+                h.write(&mut packet);
+                frames
+                    .iter()
+                    .for_each(|f| packet.extend_from_slice(&f.data));
+                let key = frames.iter().any(|f| f.is_random_access());
+                out.push((*h, packet, key));
+            },
+        )
+        .unwrap();
+        out.sort_by_key(|(h, _, _)| h.region);
+        out
+    }
+
+    #[test]
+    fn regions_on_tile_edges() {
+        let regions = grid(3, 2).regions(1920, 1080).unwrap();
+        assert_eq!(regions.len(), 6);
+        for (i, r) in regions.iter().enumerate() {
+            assert_eq!(r.index, i);
+            assert_eq!((r.x % TILE_SIZE, r.y % TILE_SIZE), (0, 0));
+        }
+        let xs: Vec<_> = regions[..3].iter().map(|r| (r.x, r.width)).collect();
+        assert_eq!(xs, [(0, 640), (640, 640), (1280, 640)]);
+        let ys: Vec<_> = [0, 3]
+            .iter()
+            .map(|&i| (regions[i].y, regions[i].height))
+            .collect();
+        assert_eq!(ys, [(0, 512), (512, 568)]);
+        let area: usize = regions.iter().map(|r| r.width * r.height).sum();
+        assert_eq!(area, 1920 * 1080);
+
+        assert_eq!(grid(1, 1).regions(1, 1).unwrap()[0].width, 1);
+        // the last region reaches the frame edge off the tile grid
+        assert_eq!(grid(1, 1).regions(1950, 64).unwrap()[0].width, 1950);
+        let last = grid(2, 1).regions(1950, 64).unwrap()[1];
+        assert_eq!((last.x, last.width), (960, 990));
+        assert_eq!(grid(0, 1).regions(1920, 1080), None);
+        assert_eq!(grid(1, 0).regions(1920, 1080), None);
+        // more columns than tiles
+        assert_eq!(grid(3, 1).regions(100, 64), None);
+        // three tiles, the last two pixels wide, do not split in three
+        assert_eq!(grid(3, 1).regions(130, 64), None);
+        assert!(grid(2, 1).regions(130, 64).is_some());
+    }
+
+    #[test]
+    fn fit_smallest_grid() {
+        assert_eq!(TileGrid::fit(1920, 1080, 1920, 1080), Some(grid(1, 1)));
+        assert_eq!(TileGrid::fit(3840, 2160, 1920, 1088), Some(grid(2, 2)));
+        assert_eq!(TileGrid::fit(3840, 2160, 4096, 1088), Some(grid(1, 2)));
+        let g = TileGrid::fit(7680, 4320, 4096, 2304).unwrap();
+        for r in g.regions(7680, 4320).unwrap() {
+            assert!(r.width <= 4096 && r.height <= 2304);
+        }
+        // no region is narrower than a tile
+        assert_eq!(TileGrid::fit(1920, 1080, 32, 1080), None);
+        assert_eq!(TileGrid::fit(1920, 1080, 1920, 0), None);
+    }
+
+    #[test]
+    fn header_round_trip() {
+        let h = header();
+        let mut data = vec![];
+        h.write(&mut data);
+        assert_eq!(data.len(), TileHeader::SIZE);
+        data.extend_from_slice(&[1, 2, 3]);
+        assert_eq!(TileHeader::read(&data), Some((h, &[1u8, 2, 3][..])));
+        assert_eq!(
+            TileHeader::read(&data[..TileHeader::SIZE]),
+            Some((h, &[][..]))
+        );
+    }
+
+    #[test]
+    fn header_rejects_invalid() {
+        let read = |h: TileHeader| {
+            let mut data = vec![];
+            h.write(&mut data);
+            TileHeader::read(&data).map(|(h, _)| h)
+        };
+        let mut data = vec![];
+        header().write(&mut data);
+        assert_eq!(TileHeader::read(&data[..TileHeader::SIZE - 1]), None);
+        assert_eq!(TileHeader::read(&[]), None);
+        let h = header();
+        assert_eq!(read(TileHeader { region: 4, ..h }), None);
+        assert_eq!(read(TileHeader { coded: 5, ..h }), None);
+        assert_eq!(read(TileHeader { x: 641, ..h }), None);
+        assert_eq!(read(TileHeader { y: 513, ..h }), None);
+        assert_eq!(
+            read(TileHeader {
+                frame_width: 1279,
+                ..h
+            }),
+            None
+        );
+        assert_eq!(
+            read(TileHeader {
+                x: u32::MAX,
+                width: 1,
+                frame_width: u32::MAX,
+                ..h
+            }),
+            None
+        );
+        assert_eq!(
+            read(TileHeader {
+                y: u32::MAX,
+                height: 2,
+                frame_height: u32::MAX,
+                ..h
+            }),
+            None
+        );
+        assert_eq!(
+            read(TileHeader { coded: 0, ..h }),
+            Some(TileHeader { coded: 0, ..h })
+        );
+    }
+
+    #[test]
+    fn static_regions_skipped_unless_keyframe_due() {
+        for threads in [1, 0] {
+            let mut e = encoder(grid(2, 1)).with_threads(threads);
+            let mut pixels = vec![0x80; WIDTH * HEIGHT * BPP];
+            let first = encode(&mut e, &pixels);
+            assert_eq!(first.len(), 2);
+            for (i, (h, _, key)) in first.iter().enumerate() {
+                assert_eq!((h.frame, h.region, h.regions, h.coded), (0, i as u16, 2, 2));
+                assert_eq!((h.x, h.width, h.height), (256 * i as u32, 256, 256));
+                assert!(key);
+            }
+
+            assert!(encode(&mut e, &pixels).is_empty());
+            assert_eq!(
+                e.stats(0),
+                RegionStats {
+                    encoded: 1,
+                    skipped: 1
+                }
+            );
+
+            pixels[(10 * WIDTH + 300) * BPP] ^= 0xFF;
+            let changed = encode(&mut e, &pixels);
+            assert_eq!(changed.len(), 1);
+            let (h, _, key) = &changed[0];
+            assert_eq!((h.frame, h.region, h.coded), (2, 1, 1));
+            assert!(!key);
+
+            e.request_keyframe();
+            let keyframe = encode(&mut e, &pixels);
+            assert_eq!(keyframe.len(), 2);
+            assert!(keyframe.iter().all(|(h, _, key)| h.coded == 2 && *key));
+            assert_eq!(
+                e.stats(0),
+                RegionStats {
+                    encoded: 2,
+                    skipped: 2
+                }
+            );
+            assert_eq!(
+                e.stats(1),
+                RegionStats {
+                    encoded: 3,
+                    skipped: 1
+                }
+            );
+
+            assert!(encode(&mut e, &pixels).is_empty());
+        }
+    }
+
+    #[test]
+    fn decoder_completes_frames() {
+        let mut e = encoder(grid(2, 1));
+        let mut d = decoder();
+        let mut pixels = vec![0x80; WIDTH * HEIGHT * BPP];
+        let mut frames = vec![];
+        let mut decode = |d: &mut TiledDecoder, packet: &[u8]| {
+            let mut done = vec![];
+            d.decode(packet, |f| {
+                let updated: Vec<_> = f.tiles.iter().map(|t| t.updated).collect();
+                done.push((f.frame, updated));
+            })
+            .unwrap();
+            frames.extend(done.iter().cloned());
+            done
+        };
+
+        let first = encode(&mut e, &pixels);
+        assert!(decode(&mut d, &first[0].1).is_empty());
+        assert_eq!(decode(&mut d, &first[1].1), [(0, vec![true, true])]);
+        assert!(d.decoder(0).is_some() && d.decoder(1).is_some());
+
+        pixels[(10 * WIDTH + 300) * BPP] ^= 0xFF;
+        let changed = encode(&mut e, &pixels);
+        assert_eq!(decode(&mut d, &changed[0].1), [(1, vec![false, true])]);
+
+        assert_eq!(d.decode(&[0; TileHeader::SIZE - 1], |_| {}), Err(-1));
+        assert_eq!(frames.len(), 2);
+    }
+
+    #[test]
+    fn decoder_completes_frame_with_missing_region() {
+        let mut e = encoder(grid(2, 1));
+        let mut d = decoder();
+        let mut pixels = vec![0x80; WIDTH * HEIGHT * BPP];
+        let mut frames = vec![];
+        let mut decode = |d: &mut TiledDecoder, packet: &[u8]| {
+            d.decode(packet, |f| {
+                let updated: Vec<_> = f.tiles.iter().map(|t| t.updated).collect();
+                frames.push((f.frame, updated));
+            })
+        };
+
+        // region 0 of the first frame is lost
+        let first = encode(&mut e, &pixels);
+        decode(&mut d, &first[1].1).unwrap();
+        assert!(d.decoder(0).is_none());
+
+        pixels[(10 * WIDTH + 300) * BPP] ^= 0xFF;
+        let changed = encode(&mut e, &pixels);
+        decode(&mut d, &changed[0].1).unwrap();
+        assert_eq!(frames, [(0, vec![false, true]), (1, vec![false, true])]);
+    }
+}
@@ -1,15 +1,30 @@
 #include "incbin.h"
+#include <stddef.h>
 #include <stdint.h>
 
 INCBIN_EXTERN(BinFile264);
 INCBIN_EXTERN(BinFile265);
+INCBIN_EXTERN(BinFileAV1);
 
-void gpu_video_codec_get_bin_file(int32_t is265, uint8_t **p, int32_t *len) {
-  if (is265 == 0) {
+// dataFormat: H264 = 0, H265 = 1, AV1 = 4
+void gpu_video_codec_get_bin_file(int32_t dataFormat, uint8_t **p,
+                                  int32_t *len) {
+  switch (dataFormat) {
+  case 0:
     *p = (uint8_t *)gBinFile264Data;
     *len = gBinFile264Size;
-  } else {
+    break;
+  case 1:
     *p = (uint8_t *)gBinFile265Data;
     *len = gBinFile265Size;
+    break;
+  case 4:
+    *p = (uint8_t *)gBinFileAV1Data;
+    *len = gBinFileAV1Size;
+    break;
+  default:
+    *p = NULL;
+    *len = 0;
+    break;
   }
-}
\ No newline at end of file
+}
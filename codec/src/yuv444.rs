@@ -0,0 +1,392 @@
+//! 4:4:4 pictures carried as two 4:2:0 frames of the same size, for
+//! encoders without native 4:4:4. The main frame is a plain 4:2:0 picture
+//! any decoder shows correctly, the auxiliary one holds the chroma 4:2:0
+//! drops:
+//!
+//! - main luma is Y, main chroma is U and V at even rows and columns;
+//! - auxiliary luma rows `0..h / 2` are the odd rows of U, rows
+//!   `h / 2..h` the odd rows of V;
+//! - auxiliary chroma is U and V at even rows and odd columns.
+//!
+//! Every sample lands in exactly one place, so `unpack` restores what
+//! `pack` was given. Both sizes must be even.
+
+use crate::convert::{Yuv444Planes, Yuv444Source, YuvPlanes, YuvSource};
+
+fn fits(len: usize, stride: usize, rows: usize, row: usize) -> bool {
+    stride >= row && len >= stride * (rows - 1) + row
+}
+
+fn planes_fit(p: &YuvPlanes, width: usize, height: usize) -> bool {
+    let (cw, ch) = (width / 2, height / 2);
+    match p {
+        YuvPlanes::Nv12 {
+            y,
+            y_stride,
+            uv,
+            uv_stride,
+        } => fits(y.len(), *y_stride, height, width) && fits(uv.len(), *uv_stride, ch, 2 * cw),
+        YuvPlanes::I420 {
+            y,
+            y_stride,
+            u,
+            u_stride,
+            v,
+            v_stride,
+        } => {
+            fits(y.len(), *y_stride, height, width)
+                && fits(u.len(), *u_stride, ch, cw)
+                && fits(v.len(), *v_stride, ch, cw)
+        }
+    }
+}
+
+fn source_fits(s: &YuvSource, width: usize, height: usize) -> bool {
+    let (cw, ch) = (width / 2, height / 2);
+    match s {
+        YuvSource::Nv12 {
+            y,
+            y_stride,
+            uv,
+            uv_stride,
+        } => fits(y.len(), *y_stride, height, width) && fits(uv.len(), *uv_stride, ch, 2 * cw),
+        YuvSource::I420 {
+            y,
+            y_stride,
+            u,
+            u_stride,
+            v,
+            v_stride,
+        } => {
+            fits(y.len(), *y_stride, height, width)
+                && fits(u.len(), *u_stride, ch, cw)
+                && fits(v.len(), *v_stride, ch, cw)
+        }
+    }
+}
+
+fn luma_mut<'b>(p: &'b mut YuvPlanes, row: usize, width: usize) -> &'b mut [u8] {
+    match p {
+        YuvPlanes::Nv12 { y, y_stride, .. } | YuvPlanes::I420 { y, y_stride, .. } => {
+            &mut y[row * *y_stride..][..width]
+        }
+    }
+}
+
+fn luma<'b>(s: &YuvSource<'b>, row: usize, width: usize) -> &'b [u8] {
+    match *s {
+        YuvSource::Nv12 { y, y_stride, .. } | YuvSource::I420 { y, y_stride, .. } => {
+            &y[row * y_stride..][..width]
+        }
+    }
+}
+
+fn put_chroma(p: &mut YuvPlanes, row: usize, u: &[u8], v: &[u8]) {
+    match p {
+        YuvPlanes::Nv12 { uv, uv_stride, .. } => {
+            let dst = &mut uv[row * *uv_stride..][..2 * u.len()];
+            for ((d, &u), &v) in dst.chunks_exact_mut(2).zip(u).zip(v) {
+                d.copy_from_slice(&[u, v]);
+            }
+        }
+        YuvPlanes::I420 {
+            u: pu,
+            u_stride,
+            v: pv,
+            v_stride,
+            ..
+        } => {
+            pu[row * *u_stride..][..u.len()].copy_from_slice(u);
+            pv[row * *v_stride..][..v.len()].copy_from_slice(v);
+        }
+    }
+}
+
+fn get_chroma(s: &YuvSource, row: usize, u: &mut [u8], v: &mut [u8]) {
+    match *s {
+        YuvSource::Nv12 { uv, uv_stride, .. } => {
+            let src = &uv[row * uv_stride..][..2 * u.len()];
+            for ((s, u), v) in src.chunks_exact(2).zip(u.iter_mut()).zip(v.iter_mut()) {
+                (*u, *v) = (s[0], s[1]);
+            }
+        }
+        YuvSource::I420 {
+            u: su,
+            u_stride,
+            v: sv,
+            v_stride,
+            ..
+        } => {
+            u.copy_from_slice(&su[row * u_stride..][..u.len()]);
+            v.copy_from_slice(&sv[row * v_stride..][..v.len()]);
+        }
+    }
+}
+
+/// Splits a 4:4:4 picture into `main` and `aux`, both `width` x `height`.
+pub fn pack(
+    src: Yuv444Source,
+    width: usize,
+    height: usize,
+    mut main: YuvPlanes,
+    mut aux: YuvPlanes,
+) -> Result<(), ()> {
+    let s = src.stride;
+    if width == 0
+        || height == 0
+        || width % 2 != 0
+        || height % 2 != 0
+        || [src.y.len(), src.u.len(), src.v.len()]
+            .iter()
+            .any(|&len| !fits(len, s, height, width))
+        || !planes_fit(&main, width, height)
+        || !planes_fit(&aux, width, height)
+    {
+        return Err(());
+    }
+    let half = height / 2;
+    let mut rows = [
+        vec![0; width / 2],
+        vec![0; width / 2],
+        vec![0; width / 2],
+        vec![0; width / 2],
+    ];
+    for r in 0..height {
+        luma_mut(&mut main, r, width).copy_from_slice(&src.y[r * s..][..width]);
+    }
+    for j in 0..half {
+        let (even, odd) = (2 * j * s, (2 * j + 1) * s);
+        luma_mut(&mut aux, j, width).copy_from_slice(&src.u[odd..][..width]);
+        luma_mut(&mut aux, half + j, width).copy_from_slice(&src.v[odd..][..width]);
+        let (u, v) = (&src.u[even..][..width], &src.v[even..][..width]);
+        let [mu, mv, au, av] = &mut rows;
+        for i in 0..width / 2 {
+            (mu[i], au[i]) = (u[2 * i], u[2 * i + 1]);
+            (mv[i], av[i]) = (v[2 * i], v[2 * i + 1]);
+        }
+        put_chroma(&mut main, j, mu, mv);
+        put_chroma(&mut aux, j, au, av);
+    }
+    Ok(())
+}
+
+/// Merges the frames `pack` made back into a 4:4:4 picture.
+pub fn unpack(
+    main: YuvSource,
+    aux: YuvSource,
+    width: usize,
+    height: usize,
+    dst: Yuv444Planes,
+) -> Result<(), ()> {
+    let s = dst.stride;
+    if width == 0
+        || height == 0
+        || width % 2 != 0
+        || height % 2 != 0
+        || [dst.y.len(), dst.u.len(), dst.v.len()]
+            .iter()
+            .any(|&len| !fits(len, s, height, width))
+        || !source_fits(&main, width, height)
+        || !source_fits(&aux, width, height)
+    {
+        return Err(());
+    }
+    let half = height / 2;
+    let mut rows = [
+        vec![0; width / 2],
+        vec![0; width / 2],
+        vec![0; width / 2],
+        vec![0; width / 2],
+    ];
+    for r in 0..height {
+        dst.y[r * s..][..width].copy_from_slice(luma(&main, r, width));
+    }
+    for j in 0..half {
+        let (even, odd) = (2 * j * s, (2 * j + 1) * s);
+        dst.u[odd..][..width].copy_from_slice(luma(&aux, j, width));
+        dst.v[odd..][..width].copy_from_slice(luma(&aux, half + j, width));
+        let [mu, mv, au, av] = &mut rows;
+        get_chroma(&main, j, mu, mv);
+        get_chroma(&aux, j, au, av);
+        let (u, v) = (&mut dst.u[even..][..width], &mut dst.v[even..][..width]);
+        for i in 0..width / 2 {
+            (u[2 * i], u[2 * i + 1]) = (mu[i], au[i]);
+            (v[2 * i], v[2 * i + 1]) = (mv[i], av[i]);
+        }
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Even sizes whose halves are odd too, and padded strides.
+    const SIZES: [(usize, usize); 4] = [(2, 2), (6, 10), (38, 18), (102, 34)];
+
+    fn noise(len: usize, seed: u32) -> Vec<u8> {
+        let mut x = seed | 1;
+        (0..len)
+            .map(|_| {
+                x = x.wrapping_mul(1664525).wrapping_add(1013904223);
+                (x >> 24) as u8
+            })
+            .collect()
+    }
+
+    /// `main` and `aux` as NV12 or I420 over one buffer each.
+    struct Frame {
+        y: Vec<u8>,
+        chroma: Vec<u8>,
+        y_stride: usize,
+        c_stride: usize,
+        rows: usize,
+        nv12: bool,
+    }
+
+    impl Frame {
+        fn new(width: usize, height: usize, nv12: bool) -> Self {
+            let (y_stride, c_stride) = (width + 3, width / 2 + 5);
+            Self {
+                y: vec![0xAA; y_stride * height],
+                chroma: vec![0xAA; 2 * c_stride * height / 2],
+                y_stride,
+                c_stride,
+                rows: height / 2,
+                nv12,
+            }
+        }
+
+        fn planes(&mut self) -> YuvPlanes<'_> {
+            let (y, y_stride, c_stride) = (&mut self.y[..], self.y_stride, self.c_stride);
+            if self.nv12 {
+                return YuvPlanes::Nv12 {
+                    y,
+                    y_stride,
+                    uv: &mut self.chroma,
+                    uv_stride: 2 * c_stride,
+                };
+            }
+            let (u, v) = self.chroma.split_at_mut(c_stride * self.rows);
+            YuvPlanes::I420 {
+                y,
+                y_stride,
+                u,
+                u_stride: c_stride,
+                v,
+                v_stride: c_stride,
+            }
+        }
+
+        fn source(&self) -> YuvSource<'_> {
+            let (y, y_stride, c_stride) = (&self.y[..], self.y_stride, self.c_stride);
+            if self.nv12 {
+                return YuvSource::Nv12 {
+                    y,
+                    y_stride,
+                    uv: &self.chroma,
+                    uv_stride: 2 * c_stride,
+                };
+            }
+            let (u, v) = self.chroma.split_at(c_stride * self.rows);
+            YuvSource::I420 {
+                y,
+                y_stride,
+                u,
+                u_stride: c_stride,
+                v,
+                v_stride: c_stride,
+            }
+        }
+
+        /// U and V of the 4:2:0 picture at chroma row `row`.
+        fn chroma(&self, row: usize, width: usize) -> (Vec<u8>, Vec<u8>) {
+            let (mut u, mut v) = (vec![0; width / 2], vec![0; width / 2]);
+            get_chroma(&self.source(), row, &mut u, &mut v);
+            (u, v)
+        }
+    }
+
+    #[test]
+    fn pack_unpack_round_trip() {
+        for (width, height) in SIZES {
+            let stride = width + 7;
+            let src = noise(3 * stride * height, (width * height) as u32);
+            let (y, uv) = src.split_at(stride * height);
+            let (u, v) = uv.split_at(stride * height);
+            for (main_nv12, aux_nv12) in [(true, true), (false, false), (true, false)] {
+                let mut main = Frame::new(width, height, main_nv12);
+                let mut aux = Frame::new(width, height, aux_nv12);
+                let source = Yuv444Source { y, u, v, stride };
+                pack(source, width, height, main.planes(), aux.planes()).unwrap();
+
+                // the main frame is the 4:2:0 picture of even samples
+                for r in 0..height / 2 {
+                    let (mu, mv) = main.chroma(r, width);
+                    let even = |p: &[u8]| -> Vec<u8> {
+                        p[2 * r * stride..][..width]
+                            .iter()
+                            .step_by(2)
+                            .copied()
+                            .collect()
+                    };
+                    assert_eq!((mu, mv), (even(u), even(v)), "{}x{}", width, height);
+                }
+
+                let mut out = vec![0xAA; 3 * stride * height];
+                let (oy, ouv) = out.split_at_mut(stride * height);
+                let (ou, ov) = ouv.split_at_mut(stride * height);
+                let dst = Yuv444Planes {
+                    y: oy,
+                    u: ou,
+                    v: ov,
+                    stride,
+                };
+                unpack(main.source(), aux.source(), width, height, dst).unwrap();
+                for (r, (a, b)) in src.chunks(stride).zip(out.chunks(stride)).enumerate() {
+                    assert_eq!(
+                        a[..width],
+                        b[..width],
+                        "{}x{} row {} main nv12 {} aux nv12 {}",
+                        width,
+                        height,
+                        r,
+                        main_nv12,
+                        aux_nv12
+                    );
+                    assert!(b[width..].iter().all(|&x| x == 0xAA));
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn rejects_odd_and_short() {
+        let planes = noise(3 * 8 * 8, 1);
+        let source = Yuv444Source {
+            y: &planes[..64],
+            u: &planes[64..128],
+            v: &planes[128..],
+            stride: 8,
+        };
+        for (width, height) in [(3, 4), (4, 3), (1, 1), (0, 2), (10, 2)] {
+            let mut main = Frame::new(8, 8, true);
+            let mut aux = Frame::new(8, 8, false);
+            assert_eq!(
+                pack(source, width, height, main.planes(), aux.planes()),
+                Err(()),
+                "{}x{}",
+                width,
+                height
+            );
+            let mut out = vec![0; 3 * 64];
+            let (y, uv) = out.split_at_mut(64);
+            let (u, v) = uv.split_at_mut(64);
+            let dst = Yuv444Planes { y, u, v, stride: 8 };
+            assert_eq!(
+                unpack(main.source(), aux.source(), width, height, dst),
+                Err(())
+            );
+        }
+    }
+}
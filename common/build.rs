@@ -52,7 +52,7 @@ fn main() {
 struct MyCallbacks;
 impl ParseCallbacks for MyCallbacks {
     fn add_derives(&self, name: &DeriveInfo) -> Vec<String> {
-        let names = vec!["DataFormat", "SurfaceFormat", "API"];
+        let names = vec!["DataFormat", "SurfaceFormat", "ChromaFormat", "DynamicRange", "API"];
         if name.kind == TypeKind::Enum && names.contains(&name.name) {
             vec!["Serialize", "Deserialize"]
                 .drain(..)
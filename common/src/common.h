@@ -27,6 +27,19 @@ enum API {
   API_VULKAN,
 };
 
+enum ChromaFormat {
+  CHROMA_420,
+  CHROMA_444,
+};
+
+// 10-bit ranges take R10G10B10A2 textures, HDR ones BT.2020 encoded
+enum DynamicRange {
+  DYNAMIC_RANGE_SDR,
+  DYNAMIC_RANGE_SDR_10BIT,
+  DYNAMIC_RANGE_HDR_PQ,
+  DYNAMIC_RANGE_HDR_HLG,
+};
+
 enum SurfaceFormat {
   SURFACE_FORMAT_BGRA,
   SURFACE_FORMAT_RGBA,
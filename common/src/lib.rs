@@ -15,6 +15,8 @@ pub enum EncodeDriver {
     NVENC,
     AMF,
     VPL,
+    /// Software H.264 backend coding flat pictures, used for testing.
+    CPU,
 }
 
 #[derive(Debug, Clone, PartialEq, Eq, Deserialize, Serialize)]
@@ -22,6 +24,8 @@ pub enum DecodeDriver {
     CUVID,
     AMF,
     VPL,
+    /// Software backend without pixel output, used for testing.
+    CPU,
 }
 
 #[derive(Debug, Clone, PartialEq, Eq, Deserialize, Serialize)]
@@ -41,6 +45,26 @@ pub struct DynamicContext {
     pub kbitrate: i32,
     pub framerate: i32,
     pub gop: i32,
+    /// Chroma subsampling of the stream, 4:4:4 only where the backend
+    /// supports it, see `codec::yuv444` otherwise.
+    #[serde(default)]
+    pub chroma: ChromaFormat,
+    /// Bit depth and transfer of the stream, 10-bit only where the backend
+    /// supports it, see `codec::hdr` for CPU input.
+    #[serde(default)]
+    pub range: DynamicRange,
+}
+
+impl Default for ChromaFormat {
+    fn default() -> Self {
+        ChromaFormat::CHROMA_420
+    }
+}
+
+impl Default for DynamicRange {
+    fn default() -> Self {
+        DynamicRange::DYNAMIC_RANGE_SDR
+    }
 }
 
 unsafe impl Send for DynamicContext {}
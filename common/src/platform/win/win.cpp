@@ -121,13 +121,13 @@ bool NativeDevice::InitVideoDevice() {
   return true;
 }
 
-bool NativeDevice::EnsureTexture(int width, int height) {
+bool NativeDevice::EnsureTexture(int width, int height, DXGI_FORMAT format) {
   D3D11_TEXTURE2D_DESC desc;
   ZeroMemory(&desc, sizeof(desc));
   if (texture_[0]) {
     texture_[0]->GetDesc(&desc);
     if ((int)desc.Width == width && (int)desc.Height == height &&
-        desc.Format == DXGI_FORMAT_B8G8R8A8_UNORM &&
+        desc.Format == format &&
         desc.MiscFlags == D3D11_RESOURCE_MISC_SHARED &&
         desc.Usage == D3D11_USAGE_DEFAULT) {
       return true;
@@ -137,7 +137,7 @@ bool NativeDevice::EnsureTexture(int width, int height) {
   desc.Height = height;
   desc.MipLevels = 1;
   desc.ArraySize = 1;
-  desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+  desc.Format = format;
   desc.SampleDesc.Count = 1;
   desc.SampleDesc.Quality = 0;
   desc.MiscFlags = D3D11_RESOURCE_MISC_SHARED;
@@ -306,6 +306,51 @@ bool NativeDevice::ToNV12(ID3D11Texture2D *texture, int width, int height,
   return Process(texture, nv12_texture_.Get(), contentDesc, colorSpace_in,
                  colorSpace_out);
 }
+
+ID3D11Texture2D *PadTexture(ID3D11Texture2D *texture, int width, int height,
+                            ComPtr<ID3D11Texture2D> &padded) {
+  D3D11_TEXTURE2D_DESC desc;
+  ZeroMemory(&desc, sizeof(desc));
+  texture->GetDesc(&desc);
+  UINT w = desc.Width;
+  UINT h = desc.Height;
+  if (w >= (UINT)width && h >= (UINT)height) {
+    return texture;
+  }
+  ComPtr<ID3D11Device> device = nullptr;
+  ComPtr<ID3D11DeviceContext> context = nullptr;
+  texture->GetDevice(device.ReleaseAndGetAddressOf());
+  device->GetImmediateContext(context.ReleaseAndGetAddressOf());
+  D3D11_TEXTURE2D_DESC paddedDesc;
+  ZeroMemory(&paddedDesc, sizeof(paddedDesc));
+  if (padded) {
+    padded->GetDesc(&paddedDesc);
+  }
+  if (!padded || paddedDesc.Width != (UINT)width ||
+      paddedDesc.Height != (UINT)height || paddedDesc.Format != desc.Format) {
+    desc.Width = width;
+    desc.Height = height;
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.MiscFlags &= ~D3D11_RESOURCE_MISC_SHARED_KEYEDMUTEX;
+    HRP(device->CreateTexture2D(&desc, nullptr,
+                                padded.ReleaseAndGetAddressOf()));
+  }
+  D3D11_BOX box = {0, 0, 0, w, h, 1};
+  context->CopySubresourceRegion(padded.Get(), 0, 0, 0, 0, texture, 0, &box);
+  // padding repeats the edge, so it costs next to nothing to encode
+  D3D11_BOX column = {w - 1, 0, 0, w, h, 1};
+  for (UINT x = w; x < (UINT)width; x++) {
+    context->CopySubresourceRegion(padded.Get(), 0, x, 0, 0, texture, 0,
+                                   &column);
+  }
+  D3D11_BOX row = {0, h - 1, 0, (UINT)width, h, 1};
+  for (UINT y = h; y < (UINT)height; y++) {
+    context->CopySubresourceRegion(padded.Get(), 0, 0, y, 0, padded.Get(), 0,
+                                   &row);
+  }
+  return padded.Get();
+}
 bool Adapter::Init(IDXGIAdapter1 *adapter1) {
   HRESULT hr = S_OK;
 
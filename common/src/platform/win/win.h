@@ -50,7 +50,8 @@ using namespace std;
 class NativeDevice {
 public:
   bool Init(int64_t luid, ID3D11Device *device, int pool_size = 1);
-  bool EnsureTexture(int width, int height);
+  bool EnsureTexture(int width, int height,
+                     DXGI_FORMAT format = DXGI_FORMAT_B8G8R8A8_UNORM);
   bool SetTexture(ID3D11Texture2D *texture);
   HANDLE GetSharedHandle();
   ID3D11Texture2D *GetCurrentTexture();
@@ -96,6 +97,12 @@ private:
   std::vector<ComPtr<ID3D11Texture2D>> texture_;
 };
 
+// Returns `texture` when it is `width` x `height` (or larger), otherwise
+// copies it to the top-left of `padded`, created as needed, repeating its
+// last column and row over the rest. nullptr on failure.
+ID3D11Texture2D *PadTexture(ID3D11Texture2D *texture, int width, int height,
+                            ComPtr<ID3D11Texture2D> &padded);
+
 class Adapter {
 public:
   bool Init(IDXGIAdapter1 *adapter1);
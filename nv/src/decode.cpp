@@ -585,6 +585,9 @@ private:
     case H265:
       cuda = cudaVideoCodec_HEVC;
       break;
+    case AV1:
+      cuda = cudaVideoCodec_AV1;
+      break;
     default:
       return false;
     }
@@ -73,11 +73,15 @@ public:
   int32_t gop_;
   bool full_range_ = false;
   bool bt709_ = false;
+  ChromaFormat chroma_ = CHROMA_420;
+  DynamicRange range_ = DYNAMIC_RANGE_SDR;
+  bool force_idr_ = false;
   NV_ENC_CONFIG encodeConfig_ = {0};
+  ComPtr<ID3D11Texture2D> padded_ = nullptr;
 
   NvencEncoder(void *handle, int64_t luid, API api, DataFormat dataFormat,
                int32_t width, int32_t height, int32_t kbs, int32_t framerate,
-               int32_t gop) {
+               int32_t gop, ChromaFormat chroma, DynamicRange range) {
     handle_ = handle;
     luid_ = luid;
     api_ = api;
@@ -87,6 +91,8 @@ public:
     kbs_ = kbs;
     framerate_ = framerate;
     gop_ = gop;
+    chroma_ = chroma;
+    range_ = range;
 
     load_driver(&cuda_dl_, &nvenc_dl_);
   }
@@ -105,6 +111,10 @@ public:
                 std::to_string(dataFormat_));
       return false;
     }
+    if (range_ != DYNAMIC_RANGE_SDR && dataFormat_ != H265) {
+      LOG_TRACE("10-bit is only supported with HEVC");
+      return false;
+    }
     if (!ck(cuda_dl_->cuInit(0))) {
       LOG_TRACE("cuInit failed");
       return false;
@@ -133,8 +143,21 @@ public:
 
     int nExtraOutputDelay = 0;
     pEnc_ = new NvEncoderD3D11(cuda_dl_, nvenc_dl_, native_->device_.Get(),
-                               width_, height_, NV_ENC_BUFFER_FORMAT_ARGB,
+                               width_, height_, BufferFormat(),
                                nExtraOutputDelay, false, false); // no delay
+    // ARGB input is converted to 4:4:4 by the encoder itself
+    if (chroma_ == CHROMA_444 &&
+        !pEnc_->GetCapabilityValue(guidCodec,
+                                   NV_ENC_CAPS_SUPPORT_YUV444_ENCODE)) {
+      LOG_TRACE("4:4:4 encoding not supported");
+      return false;
+    }
+    if (range_ != DYNAMIC_RANGE_SDR &&
+        !pEnc_->GetCapabilityValue(guidCodec,
+                                   NV_ENC_CAPS_SUPPORT_10BIT_ENCODE)) {
+      LOG_TRACE("10-bit encoding not supported");
+      return false;
+    }
     NV_ENC_INITIALIZE_PARAMS initializeParams = {0};
     ZeroMemory(&initializeParams, sizeof(initializeParams));
     ZeroMemory(&encodeConfig_, sizeof(encodeConfig_));
@@ -182,14 +205,27 @@ public:
     // height_ ?
     ID3D11Texture2D *pBgraTextyure =
         reinterpret_cast<ID3D11Texture2D *>(pEncInput->inputPtr);
+    // odd sized frames are coded one column or row larger
+    ID3D11Texture2D *input = PadTexture(
+        reinterpret_cast<ID3D11Texture2D *>(texture), width_, height_, padded_);
+    if (!input) {
+      LOG_ERROR("PadTexture failed");
+      return -1;
+    }
 #ifdef CONFIG_NV_OPTIMUS_FOR_DEV
-    copy_texture(texture, pBgraTextyure);
+    copy_texture(input, pBgraTextyure);
 #else
-    native_->context_->CopyResource(
-        pBgraTextyure, reinterpret_cast<ID3D11Texture2D *>(texture));
+    native_->context_->CopyResource(pBgraTextyure, input);
 #endif
 
-    pEnc_->EncodeFrame(vPacket);
+    NV_ENC_PIC_PARAMS picParams = {0};
+    picParams.version = NV_ENC_PIC_PARAMS_VER;
+    if (force_idr_) {
+      picParams.encodePicFlags =
+          NV_ENC_PIC_FLAG_FORCEIDR | NV_ENC_PIC_FLAG_OUTPUT_SPSPPS;
+      force_idr_ = false;
+    }
+    pEnc_->EncodeFrame(vPacket, &picParams);
     for (NvPacket &packet : vPacket) {
       int32_t key = (packet.pictureType == NV_ENC_PIC_TYPE_IDR ||
                      packet.pictureType == NV_ENC_PIC_TYPE_I)
@@ -216,52 +252,72 @@ public:
     free_driver(&cuda_dl_, &nvenc_dl_);
   }
 
-  void setup_h264(NV_ENC_CONFIG *encodeConfig) {
-    NV_ENC_CODEC_CONFIG *encodeCodecConfig = &encodeConfig->encodeCodecConfig;
-    NV_ENC_CONFIG_H264 *h264 = &encodeCodecConfig->h264Config;
-    NV_ENC_CONFIG_H264_VUI_PARAMETERS *vui = &h264->h264VUIParameters;
+  // R10G10B10A2 textures for 10-bit
+  NV_ENC_BUFFER_FORMAT BufferFormat() {
+    return range_ == DYNAMIC_RANGE_SDR ? NV_ENC_BUFFER_FORMAT_ARGB
+                                       : NV_ENC_BUFFER_FORMAT_ABGR10;
+  }
+
+  void setup_vui(NV_ENC_CONFIG_H264_VUI_PARAMETERS *vui) {
+    bool hdr =
+        range_ == DYNAMIC_RANGE_HDR_PQ || range_ == DYNAMIC_RANGE_HDR_HLG;
     vui->videoFullRangeFlag = !!full_range_;
-    vui->colourMatrix = bt709_ ? AVCOL_SPC_BT709 : AVCOL_SPC_SMPTE170M;
-    vui->colourPrimaries = bt709_ ? AVCOL_PRI_BT709 : AVCOL_PRI_SMPTE170M;
-    vui->transferCharacteristics =
-        bt709_ ? AVCOL_TRC_BT709 : AVCOL_TRC_SMPTE170M;
+    if (hdr) {
+      vui->colourMatrix = AVCOL_SPC_BT2020_NCL;
+      vui->colourPrimaries = AVCOL_PRI_BT2020;
+      vui->transferCharacteristics = range_ == DYNAMIC_RANGE_HDR_PQ
+                                         ? AVCOL_TRC_SMPTE2084
+                                         : AVCOL_TRC_ARIB_STD_B67;
+    } else {
+      vui->colourMatrix = bt709_ ? AVCOL_SPC_BT709 : AVCOL_SPC_SMPTE170M;
+      vui->colourPrimaries = bt709_ ? AVCOL_PRI_BT709 : AVCOL_PRI_SMPTE170M;
+      vui->transferCharacteristics =
+          bt709_ ? AVCOL_TRC_BT709 : AVCOL_TRC_SMPTE170M;
+    }
     vui->colourDescriptionPresentFlag = 1;
     vui->videoSignalTypePresentFlag = 1;
+  }
+
+  void setup_h264(NV_ENC_CONFIG *encodeConfig) {
+    NV_ENC_CODEC_CONFIG *encodeCodecConfig = &encodeConfig->encodeCodecConfig;
+    NV_ENC_CONFIG_H264 *h264 = &encodeCodecConfig->h264Config;
+    setup_vui(&h264->h264VUIParameters);
 
     h264->sliceMode = 3;
     h264->sliceModeData = 1;
     h264->repeatSPSPPS = 1;
     // Specifies the chroma format. Should be set to 1 for yuv420 input, 3 for
     // yuv444 input
-    h264->chromaFormatIDC = 1;
+    h264->chromaFormatIDC = chroma_ == CHROMA_444 ? 3 : 1;
     h264->level = NV_ENC_LEVEL_AUTOSELECT;
 
-    encodeConfig->profileGUID = NV_ENC_H264_PROFILE_MAIN_GUID;
+    encodeConfig->profileGUID = chroma_ == CHROMA_444
+                                    ? NV_ENC_H264_PROFILE_HIGH_444_GUID
+                                    : NV_ENC_H264_PROFILE_MAIN_GUID;
   }
 
   void setup_hevc(NV_ENC_CONFIG *encodeConfig) {
     NV_ENC_CODEC_CONFIG *encodeCodecConfig = &encodeConfig->encodeCodecConfig;
     NV_ENC_CONFIG_HEVC *hevc = &encodeCodecConfig->hevcConfig;
-    NV_ENC_CONFIG_H264_VUI_PARAMETERS *vui = &hevc->hevcVUIParameters;
-    vui->videoFullRangeFlag = !!full_range_;
-    vui->colourMatrix = bt709_ ? AVCOL_SPC_BT709 : AVCOL_SPC_SMPTE170M;
-    vui->colourPrimaries = bt709_ ? AVCOL_PRI_BT709 : AVCOL_PRI_SMPTE170M;
-    vui->transferCharacteristics =
-        bt709_ ? AVCOL_TRC_BT709 : AVCOL_TRC_SMPTE170M;
-    vui->colourDescriptionPresentFlag = 1;
-    vui->videoSignalTypePresentFlag = 1;
+    setup_vui(&hevc->hevcVUIParameters);
 
     hevc->sliceMode = 3;
     hevc->sliceModeData = 1;
     hevc->repeatSPSPPS = 1;
     // Specifies the chroma format. Should be set to 1 for yuv420 input, 3 for
     // yuv444 input
-    hevc->chromaFormatIDC = 1;
+    hevc->chromaFormatIDC = chroma_ == CHROMA_444 ? 3 : 1;
+    // Should be set to 0 for 8 bit input, 2 for 10 bit input
+    hevc->pixelBitDepthMinus8 = range_ == DYNAMIC_RANGE_SDR ? 0 : 2;
     hevc->level = NV_ENC_LEVEL_AUTOSELECT;
     hevc->outputPictureTimingSEI = 1;
     hevc->tier = NV_ENC_TIER_HEVC_MAIN;
 
-    encodeConfig->profileGUID = NV_ENC_HEVC_PROFILE_MAIN_GUID;
+    encodeConfig->profileGUID = chroma_ == CHROMA_444
+                                    ? NV_ENC_HEVC_PROFILE_FREXT_GUID
+                                : range_ != DYNAMIC_RANGE_SDR
+                                    ? NV_ENC_HEVC_PROFILE_MAIN10_GUID
+                                    : NV_ENC_HEVC_PROFILE_MAIN_GUID;
   }
 
 private:
@@ -343,11 +399,12 @@ int nv_destroy_encoder(void *encoder) {
 
 void *nv_new_encoder(void *handle, int64_t luid, API api, DataFormat dataFormat,
                      int32_t width, int32_t height, int32_t kbs,
-                     int32_t framerate, int32_t gop) {
+                     int32_t framerate, int32_t gop, ChromaFormat chroma,
+                     DynamicRange range) {
   NvencEncoder *e = NULL;
   try {
     e = new NvencEncoder(handle, luid, api, dataFormat, width, height, kbs,
-                         framerate, gop);
+                         framerate, gop, chroma, range);
     if (!e->init()) {
       goto _exit;
     }
@@ -396,7 +453,7 @@ int nv_encode(void *encoder, void *texture, EncodeCallback callback,
 int nv_test_encode(void *outDescs, int32_t maxDescNum, int32_t *outDescNum,
                    API api, DataFormat dataFormat, int32_t width,
                    int32_t height, int32_t kbs, int32_t framerate,
-                   int32_t gop) {
+                   int32_t gop, ChromaFormat chroma, DynamicRange range) {
   try {
     AdapterDesc *descs = (AdapterDesc *)outDescs;
     Adapters adapters;
@@ -406,10 +463,13 @@ int nv_test_encode(void *outDescs, int32_t maxDescNum, int32_t *outDescNum,
     for (auto &adapter : adapters.adapters_) {
       NvencEncoder *e = (NvencEncoder *)nv_new_encoder(
           (void *)adapter.get()->device_.Get(), LUID(adapter.get()->desc1_),
-          api, dataFormat, width, height, kbs, framerate, gop);
+          api, dataFormat, width, height, kbs, framerate, gop, chroma, range);
       if (!e)
         continue;
-      if (e->native_->EnsureTexture(e->width_, e->height_)) {
+      DXGI_FORMAT format = range == DYNAMIC_RANGE_SDR
+                               ? DXGI_FORMAT_B8G8R8A8_UNORM
+                               : DXGI_FORMAT_R10G10B10A2_UNORM;
+      if (e->native_->EnsureTexture(e->width_, e->height_, format)) {
         e->native_->next();
         if (nv_encode(e, e->native_->GetCurrentTexture(), nullptr, nullptr) ==
             0) {
@@ -445,6 +505,12 @@ int nv_set_bitrate(void *e, int32_t kbs) {
   return -1;
 }
 
+int nv_request_keyframe(void *e) {
+  NvencEncoder *enc = (NvencEncoder *)e;
+  enc->force_idr_ = true;
+  return 0;
+}
+
 int nv_set_framerate(void *e, int32_t framerate) {
   try {
     RECONFIGURE_HEAD
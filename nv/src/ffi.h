@@ -10,7 +10,8 @@ int nv_decode_driver_support();
 
 void *nv_new_encoder(void *handle, int64_t luid, int32_t api,
                      int32_t dataFormat, int32_t width, int32_t height,
-                     int32_t bitrate, int32_t framerate, int32_t gop);
+                     int32_t bitrate, int32_t framerate, int32_t gop,
+                     int32_t chroma, int32_t range);
 
 int nv_encode(void *encoder, void *tex, EncodeCallback callback, void *obj);
 
@@ -26,7 +27,8 @@ int nv_destroy_decoder(void *decoder);
 
 int nv_test_encode(void *outDescs, int32_t maxDescNum, int32_t *outDescNum,
                    int32_t api, int32_t dataFormat, int32_t width,
-                   int32_t height, int32_t kbs, int32_t framerate, int32_t gop);
+                   int32_t height, int32_t kbs, int32_t framerate, int32_t gop,
+                   int32_t chroma, int32_t range);
 
 int nv_test_decode(void *outDescs, int32_t maxDescNum, int32_t *outDescNum,
                    int32_t api, int32_t dataFormat, bool outputSharedHandle,
@@ -36,4 +38,6 @@ int nv_set_bitrate(void *encoder, int32_t kbs);
 
 int nv_set_framerate(void *encoder, int32_t framerate);
 
+int nv_request_keyframe(void *encoder);
+
 #endif // AMF_FFI_H
\ No newline at end of file
@@ -244,6 +244,9 @@ private:
     case H265:
       CodecId = MFX_CODEC_HEVC;
       return true;
+    case AV1:
+      CodecId = MFX_CODEC_AV1;
+      return true;
     }
     return false;
   }
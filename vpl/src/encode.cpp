@@ -71,6 +71,8 @@ public:
   mfxVideoParam mfxEncParams_;
   mfxExtBuffer *extbuffers_[1] = {NULL};
   mfxExtVideoSignalInfo signal_info_;
+  mfxExtBuffer *resetbuffers_[2] = {NULL, NULL};
+  mfxExtEncoderResetOption reset_option_;
 
 // vpp
 #ifdef CONFIG_USE_VPP
@@ -94,6 +96,8 @@ public:
 
   bool full_range_ = false;
   bool bt709_ = false;
+  bool force_idr_ = false;
+  ComPtr<ID3D11Texture2D> padded_ = nullptr;
 
   VplEncoder(void *handle, int64_t luid, API api, DataFormat dataFormat,
              int32_t width, int32_t height, int32_t kbs, int32_t framerate,
@@ -133,6 +137,13 @@ public:
   int encode(ID3D11Texture2D *tex, EncodeCallback callback, void *obj) {
     mfxStatus sts = MFX_ERR_NONE;
 
+    // odd sized frames are coded one column or row larger
+    tex = PadTexture(tex, width_, height_, padded_);
+    if (!tex) {
+      LOG_ERROR("PadTexture failed");
+      return -1;
+    }
+
     int nEncSurfIdx =
         GetFreeSurfaceIndex(encSurfaces_.data(), encSurfaces_.size());
     if (nEncSurfIdx >= encSurfaces_.size()) {
@@ -336,6 +347,9 @@ private:
     } else if (H265 == dataFormat_) {
       mfxEncParams_.mfx.CodecLevel = MFX_LEVEL_HEVC_51;
       mfxEncParams_.mfx.CodecProfile = MFX_PROFILE_HEVC_MAIN;
+    } else if (AV1 == dataFormat_) {
+      mfxEncParams_.mfx.CodecLevel = MFX_LEVEL_AV1_51;
+      mfxEncParams_.mfx.CodecProfile = MFX_PROFILE_AV1_MAIN;
     }
 
     resetEncExtParams();
@@ -393,6 +407,36 @@ private:
     return MFX_ERR_NONE;
   }
 
+  // Changes the bitrate of the running encoder. Unlike Reset(), which
+  // recreates the session, this keeps the current GOP going.
+  mfxStatus SetBitrate(int32_t kbs) {
+    mfxVideoParam param = mfxEncParams_;
+    set_bitrate(&param, kbs);
+    memset(&reset_option_, 0, sizeof(reset_option_));
+    reset_option_.Header.BufferId = MFX_EXTBUFF_ENCODER_RESET_OPTION;
+    reset_option_.Header.BufferSz = sizeof(reset_option_);
+    reset_option_.StartNewSequence = MFX_CODINGOPTION_OFF;
+    resetbuffers_[0] = (mfxExtBuffer *)&signal_info_;
+    resetbuffers_[1] = (mfxExtBuffer *)&reset_option_;
+    param.ExtParam = resetbuffers_;
+    param.NumExtParam = 2;
+    mfxStatus sts = mfxENC_->Reset(&param);
+    MSDK_IGNORE_MFX_STS(sts, MFX_WRN_INCOMPATIBLE_VIDEO_PARAM);
+    CHECK_STATUS(sts, "Reset");
+    kbs_ = kbs;
+
+    // a higher bitrate may need a larger bitstream buffer
+    sts = mfxENC_->GetVideoParam(&mfxEncParams_);
+    CHECK_STATUS(sts, "GetVideoParam");
+    mfxU32 size = mfxEncParams_.mfx.BufferSizeInKB * 1024;
+    if (size > mfxBS_.MaxLength) {
+      bstData_.resize(size);
+      mfxBS_.MaxLength = size;
+      mfxBS_.Data = bstData_.data();
+    }
+    return MFX_ERR_NONE;
+  }
+
 #ifdef CONFIG_USE_VPP
   mfxStatus vppOneFrame(void *texture, mfxFrameSurface1 *out,
                         mfxSyncPoint syncp) {
@@ -438,6 +482,14 @@ private:
     mfxStatus sts = MFX_ERR_NONE;
     mfxSyncPoint syncp;
     bool encoded = false;
+    mfxEncodeCtrl ctrl;
+    mfxEncodeCtrl *pCtrl = NULL;
+    if (force_idr_) {
+      memset(&ctrl, 0, sizeof(ctrl));
+      ctrl.FrameType = MFX_FRAMETYPE_I | MFX_FRAMETYPE_IDR | MFX_FRAMETYPE_REF;
+      pCtrl = &ctrl;
+      force_idr_ = false;
+    }
 
     int loop_counter = 0;
     do {
@@ -447,7 +499,7 @@ private:
       }
       mfxBS_.DataLength = 0;
       mfxBS_.DataOffset = 0;
-      sts = mfxENC_->EncodeFrameAsync(NULL, in, &mfxBS_, &syncp);
+      sts = mfxENC_->EncodeFrameAsync(pCtrl, in, &mfxBS_, &syncp);
       if (MFX_ERR_NONE == sts) {
         if (!syncp) {
           LOG_ERROR("should not happen, error is none while syncp is null");
@@ -527,6 +579,9 @@ private:
     case H265:
       CodecId = MFX_CODEC_HEVC;
       return true;
+    case AV1:
+      CodecId = MFX_CODEC_AV1;
+      return true;
     }
     return false;
   }
@@ -553,9 +608,20 @@ int vpl_destroy_encoder(void *encoder) {
 
 void *vpl_new_encoder(void *handle, int64_t luid, API api,
                       DataFormat dataFormat, int32_t w, int32_t h, int32_t kbs,
-                      int32_t framerate, int32_t gop) {
+                      int32_t framerate, int32_t gop, ChromaFormat chroma,
+                      DynamicRange range) {
   VplEncoder *p = NULL;
   try {
+    if (chroma != CHROMA_420) {
+      // 4:4:4 needs AYUV surfaces the NV12 conversion does not produce
+      LOG_TRACE("VPL encoder only takes 4:2:0");
+      return NULL;
+    }
+    if (range != DYNAMIC_RANGE_SDR) {
+      // P010 surfaces would need their own BGRA conversion
+      LOG_TRACE("VPL encoder is 8-bit only");
+      return NULL;
+    }
     p = new VplEncoder(handle, luid, api, dataFormat, w, h, kbs, framerate,
                        gop);
     if (!p) {
@@ -591,7 +657,7 @@ int vpl_encode(void *encoder, ID3D11Texture2D *tex, EncodeCallback callback,
 int vpl_test_encode(void *outDescs, int32_t maxDescNum, int32_t *outDescNum,
                     API api, DataFormat dataFormat, int32_t width,
                     int32_t height, int32_t kbs, int32_t framerate,
-                    int32_t gop) {
+                    int32_t gop, ChromaFormat chroma, DynamicRange range) {
   try {
     AdapterDesc *descs = (AdapterDesc *)outDescs;
     Adapters adapters;
@@ -601,7 +667,7 @@ int vpl_test_encode(void *outDescs, int32_t maxDescNum, int32_t *outDescNum,
     for (auto &adapter : adapters.adapters_) {
       VplEncoder *e = (VplEncoder *)vpl_new_encoder(
           (void *)adapter.get()->device_.Get(), LUID(adapter.get()->desc1_),
-          api, dataFormat, width, height, kbs, framerate, gop);
+          api, dataFormat, width, height, kbs, framerate, gop, chroma, range);
       if (!e)
         continue;
       if (e->native_->EnsureTexture(e->width_, e->height_)) {
@@ -634,7 +700,12 @@ int vpl_set_bitrate(void *encoder, int32_t kbs) {
   try {
     VplEncoder *p = (VplEncoder *)encoder;
     mfxStatus sts = MFX_ERR_NONE;
+    sts = p->SetBitrate(kbs);
+    if (sts == MFX_ERR_NONE) {
+      return 0;
+    }
     // https://github.com/GStreamer/gstreamer/blob/e19428a802c2f4ee9773818aeb0833f93509a1c0/subprojects/gst-plugins-bad/sys/qsv/gstqsvencoder.cpp#L1312
+    LOG_WARN("bitrate change failed, recreating the encoder");
     p->kbs_ = kbs;
     sts = p->Reset();
     if (sts != MFX_ERR_NONE) {
@@ -652,4 +723,10 @@ int vpl_set_framerate(void *encoder, int32_t framerate) {
   LOG_WARN("not support change framerate");
   return -1;
 }
+
+int vpl_request_keyframe(void *encoder) {
+  VplEncoder *p = (VplEncoder *)encoder;
+  p->force_idr_ = true;
+  return 0;
+}
 }
@@ -8,7 +8,8 @@ int vpl_driver_support();
 
 void *vpl_new_encoder(void *handle, int64_t luid, int32_t api,
                       int32_t dataFormat, int32_t width, int32_t height,
-                      int32_t kbs, int32_t framerate, int32_t gop);
+                      int32_t kbs, int32_t framerate, int32_t gop,
+                      int32_t chroma, int32_t range);
 
 int vpl_encode(void *encoder, void *tex, EncodeCallback callback, void *obj);
 
@@ -25,7 +26,7 @@ int vpl_destroy_decoder(void *decoder);
 int vpl_test_encode(void *outDescs, int32_t maxDescNum, int32_t *outDescNum,
                     int32_t api, int32_t dataFormat, int32_t width,
                     int32_t height, int32_t kbs, int32_t framerate,
-                    int32_t gop);
+                    int32_t gop, int32_t chroma, int32_t range);
 
 int vpl_test_decode(void *outDescs, int32_t maxDescNum, int32_t *outDescNum,
                     int32_t api, int32_t dataFormat, bool outputSharedHandle,
@@ -35,4 +36,6 @@ int vpl_set_bitrate(void *encoder, int32_t kbs);
 
 int vpl_set_framerate(void *encoder, int32_t framerate);
 
+int vpl_request_keyframe(void *encoder);
+
 #endif // AMF_FFI_H
\ No newline at end of file
@@ -18,6 +18,7 @@ pub fn encode_calls() -> EncodeCalls {
         test: vpl_test_encode,
         set_bitrate: vpl_set_bitrate,
         set_framerate: vpl_set_framerate,
+        request_keyframe: vpl_request_keyframe,
     }
 }
 
@@ -35,7 +36,7 @@ pub fn possible_support_encoders() -> Vec<InnerEncodeContext> {
         return vec![];
     }
     let devices = vec![API_DX11];
-    let dataFormats = vec![H264, H265];
+    let dataFormats = vec![H264, H265, AV1];
     let mut v = vec![];
     for device in devices.iter() {
         for dataFormat in dataFormats.iter() {
@@ -53,7 +54,7 @@ pub fn possible_support_decoders() -> Vec<InnerDecodeContext> {
         return vec![];
     }
     let devices = vec![API_DX11];
-    let dataFormats = vec![H264, H265];
+    let dataFormats = vec![H264, H265, AV1];
     let mut v = vec![];
     for device in devices.iter() {
         for dataFormat in dataFormats.iter() {